@@ -0,0 +1,64 @@
+# EmbedFiles.cmake - Generate the embedded file bundle for tftpd.
+#
+# Run in script mode with:
+#   cmake -DEMBED_DIR=<dir> -DOUTPUT=<file.cpp> -P EmbedFiles.cmake
+#
+# Every regular file below EMBED_DIR is written to OUTPUT as a constexpr
+# string literal together with a sorted index of (path, contents) entries
+# that tftp::storage::embedded::bundle() returns. Paths are relative to
+# EMBED_DIR.
+if(NOT EMBED_DIR OR NOT OUTPUT)
+  message(FATAL_ERROR "EmbedFiles.cmake requires EMBED_DIR and OUTPUT.")
+endif()
+
+file(GLOB_RECURSE EMBED_FILES LIST_DIRECTORIES false RELATIVE "${EMBED_DIR}" "${EMBED_DIR}/*")
+list(SORT EMBED_FILES)
+
+string(REPEAT "[0-9a-f]" 64 EMBED_LINE)
+set(EMBED_DATA "")
+set(EMBED_INDEX "")
+set(EMBED_COUNT 0)
+foreach(EMBED_FILE IN LISTS EMBED_FILES)
+  file(READ "${EMBED_DIR}/${EMBED_FILE}" EMBED_HEX HEX)
+  file(SIZE "${EMBED_DIR}/${EMBED_FILE}" EMBED_SIZE)
+
+  # Emit one string literal line per 32 bytes of the file.
+  string(REGEX REPLACE "(${EMBED_LINE})" "\\1\n" EMBED_HEX "${EMBED_HEX}")
+  string(REGEX REPLACE "([0-9a-f][0-9a-f])" "\\\\x\\1" EMBED_HEX "${EMBED_HEX}")
+  string(REGEX REPLACE "([^\n]+)" "\n    \"\\1\"" EMBED_HEX "${EMBED_HEX}")
+  string(REPLACE "\n\n" "\n" EMBED_HEX "${EMBED_HEX}")
+  string(REGEX REPLACE "\n$" "" EMBED_HEX "${EMBED_HEX}")
+  if(EMBED_HEX STREQUAL "")
+    set(EMBED_HEX "\n    \"\"")
+  endif()
+
+  string(APPEND EMBED_DATA
+    "/** @brief ${EMBED_FILE} */\n"
+    "constexpr char file_${EMBED_COUNT}[] =${EMBED_HEX};\n\n")
+  string(APPEND EMBED_INDEX
+    "    {\"${EMBED_FILE}\", std::string_view(file_${EMBED_COUNT}, ${EMBED_SIZE})},\n")
+  math(EXPR EMBED_COUNT "${EMBED_COUNT} + 1")
+endforeach()
+
+set(EMBED_SOURCE
+"// Generated by EmbedFiles.cmake from ${EMBED_DIR}. Do not edit.
+#include \"tftp/storage/embedded.hpp\"
+
+#include <array>
+namespace tftp::storage {
+namespace {
+${EMBED_DATA}constexpr auto files = std::array<embedded::entry, ${EMBED_COUNT}>{{
+${EMBED_INDEX}}};
+} // namespace
+
+auto embedded::bundle() noexcept -> std::span<const entry> { return files; }
+} // namespace tftp::storage
+")
+
+# Only touch the output when it changes to avoid needless rebuilds.
+if(EXISTS "${OUTPUT}")
+  file(READ "${OUTPUT}" EMBED_PREVIOUS)
+endif()
+if(NOT EMBED_PREVIOUS STREQUAL EMBED_SOURCE)
+  file(WRITE "${OUTPUT}" "${EMBED_SOURCE}")
+endif()
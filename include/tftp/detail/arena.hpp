@@ -0,0 +1,106 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file arena.hpp
+ * @brief This file defines a per-event scratch memory arena.
+ */
+#pragma once
+#ifndef TFTP_ARENA_HPP
+#define TFTP_ARENA_HPP
+#include <array>
+#include <cstddef>
+#include <memory_resource>
+/** @brief For internal tftp server implementation details. */
+namespace tftp::detail {
+/**
+ * @brief A monotonic arena for objects that only live while an event is
+ * handled.
+ * @details Allocations are carved out of an inline buffer and spill over to
+ * the heap once it is used up. Nothing is freed until the arena is
+ * released, which rewinds it to the start of the buffer. Each thread has
+ * its own arena, which the server releases after dispatching every event,
+ * so anything that outlives the event must be copied out of it.
+ */
+class arena {
+public:
+  /** @brief The size of the inline buffer. */
+  static constexpr std::size_t SIZE = 4096;
+
+  /** @brief Constructs an empty arena. */
+  arena() = default;
+  /** @brief Deleted copy constructor. */
+  arena(const arena &) = delete;
+  /** @brief Deleted move constructor. */
+  arena(arena &&) = delete;
+  /** @brief Deleted copy assignment. */
+  auto operator=(const arena &) -> arena & = delete;
+  /** @brief Deleted move assignment. */
+  auto operator=(arena &&) -> arena & = delete;
+  /** @brief Destructor. */
+  ~arena() = default;
+
+  /** @brief Gets the arena of the calling thread. */
+  static auto current() noexcept -> arena &
+  {
+    thread_local auto instance = arena();
+    return instance;
+  }
+
+  /** @brief Gets the memory resource to allocate from. */
+  [[nodiscard]] auto resource() noexcept -> std::pmr::memory_resource *
+  {
+    return &resource_;
+  }
+
+  /** @brief Frees everything allocated from the arena. */
+  auto release() noexcept -> void { resource_.release(); }
+
+  /**
+   * @brief Checks if memory was allocated from the inline buffer.
+   * @param ptr The memory to check.
+   */
+  [[nodiscard]] auto owns(const void *ptr) const noexcept -> bool
+  {
+    const auto *byte = static_cast<const std::byte *>(ptr);
+    return byte >= buffer_.data() && byte < buffer_.data() + buffer_.size();
+  }
+
+  /** @brief Releases the current arena when an event has been handled. */
+  class scope {
+  public:
+    /** @brief Enters an event. */
+    scope() = default;
+    /** @brief Deleted copy constructor. */
+    scope(const scope &) = delete;
+    /** @brief Deleted move constructor. */
+    scope(scope &&) = delete;
+    /** @brief Deleted copy assignment. */
+    auto operator=(const scope &) -> scope & = delete;
+    /** @brief Deleted move assignment. */
+    auto operator=(scope &&) -> scope & = delete;
+    /** @brief Releases the arena. */
+    ~scope() { current().release(); }
+  };
+
+private:
+  /** @brief The inline buffer. */
+  alignas(std::max_align_t) std::array<std::byte, SIZE> buffer_{};
+  /** @brief Hands out memory from the buffer, then the heap. */
+  std::pmr::monotonic_buffer_resource resource_{buffer_.data(),
+                                                buffer_.size()};
+};
+} // namespace tftp::detail
+#endif // TFTP_ARENA_HPP
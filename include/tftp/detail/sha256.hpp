@@ -0,0 +1,182 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file sha256.hpp
+ * @brief This file defines an incremental SHA-256 digest.
+ */
+#pragma once
+#ifndef TFTP_SHA256_HPP
+#define TFTP_SHA256_HPP
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <span>
+/** @brief For internal tftp server implementation details. */
+namespace tftp::detail {
+// NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers)
+
+/** @brief The SHA-256 round constants. */
+inline constexpr std::array<std::uint32_t, 64> SHA256_ROUNDS = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+/**
+ * @brief Computes a SHA-256 digest incrementally.
+ * @details Unlike a checksum, two different inputs with the same digest are
+ * not expected to be found, so a matching digest can stand in for comparing
+ * the inputs.
+ */
+class sha256 {
+public:
+  /** @brief The size of a digest in bytes. */
+  static constexpr std::size_t DIGEST_SIZE = 32;
+  /** @brief A digest. */
+  using value_type = std::array<std::uint8_t, DIGEST_SIZE>;
+
+  /**
+   * @brief Adds bytes to the digest.
+   * @param buf The bytes to add.
+   */
+  auto update(std::span<const char> buf) noexcept -> void
+  {
+    const auto *ptr = buf.data();
+    auto len = buf.size();
+    length_ += len;
+    while (len > 0)
+    {
+      auto take = std::min(len, BLOCK_SIZE - fill_);
+      std::memcpy(block_.data() + fill_, ptr, take);
+      fill_ += take;
+      ptr += take;
+      len -= take;
+      if (fill_ == BLOCK_SIZE)
+      {
+        compress();
+        fill_ = 0;
+      }
+    }
+  }
+
+  /** @brief Gets the digest of the bytes added so far. */
+  [[nodiscard]] auto value() const noexcept -> value_type
+  {
+    // Pad a copy, so more bytes can still be added.
+    auto last = *this;
+    auto bits = length_ * 8;
+    last.block_[last.fill_++] = 0x80;
+    if (last.fill_ > BLOCK_SIZE - sizeof(bits))
+    {
+      std::fill(last.block_.begin() + static_cast<long>(last.fill_),
+                last.block_.end(), 0);
+      last.compress();
+      last.fill_ = 0;
+    }
+    std::fill(last.block_.begin() + static_cast<long>(last.fill_),
+              last.block_.end() - sizeof(bits), 0);
+    for (std::size_t i = 0; i < sizeof(bits); ++i)
+    {
+      last.block_[BLOCK_SIZE - 1 - i] =
+          static_cast<std::uint8_t>(bits >> (8 * i));
+    }
+    last.compress();
+
+    auto digest = value_type{};
+    for (std::size_t i = 0; i < digest.size(); ++i)
+    {
+      digest[i] =
+          static_cast<std::uint8_t>(last.state_[i / 4] >> (24 - (8 * (i % 4))));
+    }
+    return digest;
+  }
+
+private:
+  /** @brief The size of a message block in bytes. */
+  static constexpr std::size_t BLOCK_SIZE = 64;
+
+  /** @brief Mixes the buffered block into the state. */
+  auto compress() noexcept -> void
+  {
+    auto words = std::array<std::uint32_t, SHA256_ROUNDS.size()>{};
+    for (std::size_t i = 0; i < 16; ++i)
+    {
+      words[i] = (std::uint32_t{block_[4 * i]} << 24U) |
+                 (std::uint32_t{block_[(4 * i) + 1]} << 16U) |
+                 (std::uint32_t{block_[(4 * i) + 2]} << 8U) |
+                 std::uint32_t{block_[(4 * i) + 3]};
+    }
+    for (std::size_t i = 16; i < words.size(); ++i)
+    {
+      auto low = words[i - 15];
+      auto high = words[i - 2];
+      auto sigma0 = std::rotr(low, 7) ^ std::rotr(low, 18) ^ (low >> 3U);
+      auto sigma1 = std::rotr(high, 17) ^ std::rotr(high, 19) ^ (high >> 10U);
+      words[i] = words[i - 16] + sigma0 + words[i - 7] + sigma1;
+    }
+
+    auto [a, b, c, d, e, f, g, h] = state_;
+    for (std::size_t i = 0; i < words.size(); ++i)
+    {
+      auto sum1 = std::rotr(e, 6) ^ std::rotr(e, 11) ^ std::rotr(e, 25);
+      auto choose = (e & f) ^ (~e & g);
+      auto temp1 = h + sum1 + choose + SHA256_ROUNDS[i] + words[i];
+      auto sum0 = std::rotr(a, 2) ^ std::rotr(a, 13) ^ std::rotr(a, 22);
+      auto majority = (a & b) ^ (a & c) ^ (b & c);
+      h = g;
+      g = f;
+      f = e;
+      e = d + temp1;
+      d = c;
+      c = b;
+      b = a;
+      a = temp1 + sum0 + majority;
+    }
+
+    state_[0] += a;
+    state_[1] += b;
+    state_[2] += c;
+    state_[3] += d;
+    state_[4] += e;
+    state_[5] += f;
+    state_[6] += g;
+    state_[7] += h;
+  }
+
+  /** @brief The running hash. */
+  std::array<std::uint32_t, 8> state_{0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                      0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                      0x1f83d9ab, 0x5be0cd19};
+  /** @brief The block being filled. */
+  std::array<std::uint8_t, BLOCK_SIZE> block_{};
+  /** @brief The number of bytes in the block. */
+  std::size_t fill_{0};
+  /** @brief The number of bytes added. */
+  std::uint64_t length_{0};
+};
+
+// NOLINTEND(cppcoreguidelines-avoid-magic-numbers)
+} // namespace tftp::detail
+#endif // TFTP_SHA256_HPP
@@ -0,0 +1,113 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file single_flight.hpp
+ * @brief This file defines a utility for coalescing concurrent calls.
+ */
+#pragma once
+#ifndef TFTP_SINGLE_FLIGHT_HPP
+#define TFTP_SINGLE_FLIGHT_HPP
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <type_traits>
+/** @brief For internal tftp server implementation details. */
+namespace tftp::detail {
+/**
+ * @brief Coalesces concurrent calls that share the same key.
+ * @details The first caller for a key (the leader) runs the operation. Any
+ * caller that arrives with the same key while the leader is still running
+ * waits for, and receives a copy of, the leader's result instead of
+ * repeating the operation. Once the leader completes the key is released,
+ * so the next call starts a new flight.
+ * @tparam Key The key type. Must be less-than comparable.
+ * @tparam T The result type. Must be copy constructible.
+ */
+template <typename Key, typename T> class single_flight {
+public:
+  /** @brief The key type. */
+  using key_type = Key;
+  /** @brief The result type. */
+  using value_type = T;
+
+  /**
+   * @brief Runs `func` unless a call for `key` is already in flight.
+   * @details Exceptions thrown by the leader are rethrown in every waiting
+   * caller.
+   * @param key The key to coalesce calls on.
+   * @param func The operation to run if this caller becomes the leader.
+   * @returns The result of the (possibly shared) operation.
+   */
+  template <typename Fn>
+    requires std::is_invocable_r_v<T, Fn &>
+  auto operator()(const Key &key, Fn &&func) -> T
+  {
+    auto lock = std::unique_lock{mtx_};
+    if (auto it = calls_.find(key); it != calls_.end())
+    {
+      auto future = it->second;
+      lock.unlock();
+      return future.get();
+    }
+
+    auto promise = std::promise<T>();
+    auto call = calls_.emplace(key, promise.get_future().share()).first;
+    lock.unlock();
+
+    try
+    {
+      auto value = std::invoke(func);
+      promise.set_value(value);
+      release(call);
+      return value;
+    }
+    catch (...)
+    {
+      promise.set_exception(std::current_exception());
+      release(call);
+      throw;
+    }
+  }
+
+  /**
+   * @brief Gets the number of calls currently in flight.
+   * @returns The number of distinct keys with a running leader.
+   */
+  [[nodiscard]] auto in_flight() const -> std::size_t
+  {
+    auto lock = std::lock_guard{mtx_};
+    return calls_.size();
+  }
+
+private:
+  /** @brief The container of in-flight calls. */
+  using calls_t = std::map<Key, std::shared_future<T>>;
+
+  /** @brief Releases a completed call so that its key can fly again. */
+  auto release(typename calls_t::iterator call) -> void
+  {
+    auto lock = std::lock_guard{mtx_};
+    calls_.erase(call);
+  }
+
+  /** @brief Protects calls_. */
+  mutable std::mutex mtx_;
+  /** @brief The in-flight calls. */
+  calls_t calls_;
+};
+} // namespace tftp::detail
+#endif // TFTP_SINGLE_FLIGHT_HPP
@@ -0,0 +1,169 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file fec.hpp
+ * @brief This file declares forward error correction for RRQ transfers.
+ */
+#pragma once
+#ifndef TFTP_FEC_HPP
+#define TFTP_FEC_HPP
+#include "tftp/protocol/tftp_protocol.hpp"
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+/** @brief For forward error correction of DATA blocks. */
+namespace tftp::fec {
+/** @brief The nonstandard opcode of a repair packet. */
+inline constexpr std::uint16_t REPAIR = 16;
+/** @brief The largest number of DATA blocks covered by one repair packet. */
+inline constexpr std::size_t MAX_GROUP = 16;
+
+/**
+ * @brief The header of a repair packet.
+ * @details The header is followed by the XOR of the payloads of the blocks
+ * it covers, each zero-padded to DATALEN bytes. All fields are in network
+ * byte order.
+ */
+struct repair_header {
+  /** @brief Operation code (REPAIR). */
+  std::uint16_t opc;
+  /** @brief The number of the first covered block. */
+  std::uint16_t first_block;
+  /** @brief The number of covered blocks. */
+  std::uint16_t count;
+  /** @brief The XOR of the payload lengths of the covered blocks. */
+  std::uint16_t length;
+};
+
+/** @brief The size of a repair packet. */
+inline constexpr std::size_t REPAIR_MSGLEN =
+    sizeof(repair_header) + messages::DATALEN;
+
+/**
+ * @brief Builds the repair packet for a group of DATA blocks.
+ * @details The repair packet is the XOR parity of the group, so a receiver
+ * that is missing any one block of the group can rebuild it from the others
+ * without a retransmission.
+ */
+class encoder {
+public:
+  /**
+   * @brief Starts a new group.
+   * @param first_block The number of the first block of the group.
+   */
+  auto reset(std::uint16_t first_block) noexcept -> void;
+
+  /**
+   * @brief Adds the next block of the group.
+   * @param payload The block payload.
+   */
+  auto add(std::span<const char> payload) noexcept -> void;
+
+  /** @brief Gets the number of blocks in the group. */
+  [[nodiscard]] auto size() const noexcept -> std::size_t;
+
+  /** @brief Gets the repair packet of the blocks added so far. */
+  [[nodiscard]] auto packet() noexcept -> std::span<const char>;
+
+private:
+  /** @brief The parity of the group. */
+  std::array<char, messages::DATALEN> parity_{};
+  /** @brief The repair packet. */
+  std::array<char, REPAIR_MSGLEN> packet_{};
+  /** @brief The number of the first block of the group. */
+  std::uint16_t first_block_{0};
+  /** @brief The number of blocks in the group. */
+  std::uint16_t count_{0};
+  /** @brief The XOR of the payload lengths. */
+  std::uint16_t length_{0};
+};
+
+/**
+ * @brief Rebuilds lost DATA blocks from repair packets.
+ * @details This is the receiver side of the scheme, for client tooling. It
+ * keeps the payloads of a window of received blocks, and a repair packet
+ * rebuilds the one block of its group that is missing, if there is exactly
+ * one.
+ */
+class decoder {
+public:
+  /**
+   * @brief Records a received DATA block.
+   * @param block The block number.
+   * @param payload The block payload.
+   */
+  auto data(std::uint16_t block, std::span<const char> payload) -> void;
+
+  /**
+   * @brief Applies a received repair packet.
+   * @param packet The repair packet.
+   * @returns The number and payload of the rebuilt block, or std::nullopt if
+   * no block of the group could be rebuilt.
+   */
+  auto repair(std::span<const char> packet)
+      -> std::optional<std::pair<std::uint16_t, std::string>>;
+
+  /**
+   * @brief Looks up a received or rebuilt block.
+   * @param block The block number.
+   * @returns The block payload, or nullptr if the block is missing.
+   */
+  [[nodiscard]] auto find(std::uint16_t block) const -> const std::string *;
+
+  /**
+   * @brief Forgets every block up to and including a block.
+   * @param block The last block that is no longer needed.
+   */
+  auto release(std::uint16_t block) -> void;
+
+private:
+  /** @brief Received payloads keyed by block number. */
+  std::map<std::uint16_t, std::string> blocks_;
+};
+
+/**
+ * @brief The send window of an RRQ with forward error correction.
+ * @details Each window is a group of DATA blocks followed by its repair
+ * packet, which are sent back to back. The client acknowledges the last
+ * block it holds in order, and the next window starts after it.
+ */
+struct window {
+  /** @brief The number of DATA blocks per window. */
+  std::size_t group{0};
+  /** @brief The packets of the window, back to back. */
+  std::vector<char> packets;
+  /** @brief The end offset of each packet in packets. */
+  std::vector<std::size_t> ends;
+  /** @brief Builds the repair packet. */
+  encoder parity;
+  /** @brief The stream offset of the first block of the window. */
+  std::uint64_t start{0};
+  /** @brief The number of the first block of the window. */
+  std::uint16_t first_block{0};
+  /** @brief The number of DATA blocks in the window. */
+  std::uint16_t count{0};
+  /** @brief The number of windows sent, including resends after a loss. */
+  std::uint64_t sequence{0};
+  /** @brief Set if the window holds the last block of the file. */
+  bool last{false};
+};
+} // namespace tftp::fec
+#endif // TFTP_FEC_HPP
@@ -21,13 +21,168 @@
 #ifndef TFTP_FILESYSTEM_HPP
 #define TFTP_FILESYSTEM_HPP
 #include <atomic>
+#include <cstdint>
 #include <filesystem>
-#include <fstream>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include <sys/stat.h>
 /** @brief For TFTP filesystem management. */
 namespace tftp::filesystem {
 /** @brief The temporary file prefix used for generating temporary filenames. */
 constexpr auto prefix = "tftp.";
 
+/**
+ * @brief An owning POSIX file descriptor.
+ * @details Regular files that occupy fewer blocks than their size are
+ * sparse. Their data ranges are mapped with SEEK_DATA and SEEK_HOLE when
+ * the descriptor is opened, so that reads of the holes between them can be
+ * zero-filled without touching the disk.
+ */
+class descriptor {
+public:
+  /** @brief The invalid descriptor value. */
+  static constexpr int INVALID_FD = -1;
+  /** @brief The most data ranges that are mapped in a sparse file. */
+  static constexpr std::size_t MAX_EXTENTS = 4096;
+
+  /** @brief A range of a sparse file that holds data. */
+  struct extent {
+    /** @brief The offset of the range. */
+    std::uint64_t offset{0};
+    /** @brief The length of the range. */
+    std::uint64_t length{0};
+  };
+
+  /**
+   * @brief Takes ownership of an open file descriptor.
+   * @param fd The file descriptor. Its status is sampled, and the data
+   * ranges of a sparse file are mapped, on construction.
+   */
+  explicit descriptor(int fd) noexcept;
+  /** @brief Deleted copy constructor. */
+  descriptor(const descriptor &) = delete;
+  /** @brief Deleted move constructor. */
+  descriptor(descriptor &&) = delete;
+  /** @brief Deleted copy assignment. */
+  auto operator=(const descriptor &) -> descriptor & = delete;
+  /** @brief Deleted move assignment. */
+  auto operator=(descriptor &&) -> descriptor & = delete;
+  /** @brief Closes the file descriptor. */
+  ~descriptor();
+
+  /** @brief Gets the native file descriptor. */
+  [[nodiscard]] auto native_handle() const noexcept -> int { return fd_; }
+  /** @brief Gets the file status sampled when the descriptor was opened. */
+  [[nodiscard]] auto status() const noexcept -> const struct stat &
+  {
+    return status_;
+  }
+  /**
+   * @brief Checks that `file` still names the file behind this descriptor.
+   * @param file The path the descriptor was opened from.
+   * @returns true if the path resolves to the same, unmodified, file.
+   */
+  [[nodiscard]] auto current(const std::filesystem::path &file) const noexcept
+      -> bool;
+
+  /** @brief Checks if the data ranges of the file are mapped. */
+  [[nodiscard]] auto sparse() const noexcept -> bool { return sparse_; }
+
+  /** @brief Gets the data ranges of a sparse file, in offset order. */
+  [[nodiscard]] auto extents() const noexcept -> std::span<const extent>
+  {
+    return extents_;
+  }
+
+private:
+  /** @brief Maps the data ranges of a sparse file. */
+  auto map_extents() noexcept -> void;
+
+  /** @brief The file descriptor. */
+  int fd_{INVALID_FD};
+  /** @brief The file status at open. */
+  struct stat status_ {};
+  /** @brief Set if extents_ maps the data ranges of the file. */
+  bool sparse_{false};
+  /** @brief The data ranges of a sparse file. */
+  std::vector<extent> extents_;
+};
+
+/**
+ * @brief A session's handle to an open file.
+ * @details Read handles share a descriptor with every other session reading
+ * the same file and keep their own read offset, so reads are positional and
+ * never disturb each other. Write handles own their descriptor.
+ */
+class file_handle {
+public:
+  /**
+   * @brief Constructs a file handle over a descriptor.
+   * @param desc The (possibly shared) descriptor.
+   */
+  explicit file_handle(std::shared_ptr<const descriptor> desc) noexcept
+      : desc_(std::move(desc))
+  {}
+
+  /**
+   * @brief Reads bytes from an offset into the file.
+   * @details Does not move the offset of the handle. The holes of a sparse
+   * file are zero-filled instead of read.
+   * @param offset The offset to read from.
+   * @param buf The buffer to read into.
+   * @param[out] err An error code that is cleared on success and set on error.
+   * @returns The number of bytes read. Short reads only happen at EOF.
+   */
+  auto read_at(std::uint64_t offset, std::span<char> buf,
+               std::error_code &err) const noexcept -> std::size_t;
+
+  /**
+   * @brief Reads the next bytes of the file into buf.
+   * @param buf The buffer to read into.
+   * @param[out] err An error code that is cleared on success and set on error.
+   * @returns The number of bytes read. Short reads only happen at EOF.
+   */
+  auto read(std::span<char> buf, std::error_code &err) noexcept -> std::size_t;
+
+  /**
+   * @brief Writes all of buf to the end of the file.
+   * @param buf The bytes to write.
+   * @param[out] err An error code that is cleared on success and set on error.
+   */
+  auto write(std::span<const char> buf, std::error_code &err) noexcept -> void;
+
+  /** @brief Closes the handle. */
+  auto close() noexcept -> void { desc_.reset(); }
+
+  /** @brief Checks if the handle is open. */
+  [[nodiscard]] auto is_open() const noexcept -> bool
+  {
+    return static_cast<bool>(desc_);
+  }
+
+  /** @brief Gets the size of the file when it was opened. */
+  [[nodiscard]] auto size() const noexcept -> std::uint64_t
+  {
+    return desc_ ? static_cast<std::uint64_t>(desc_->status().st_size) : 0;
+  }
+
+  /** @brief Gets the current offset into the file. */
+  [[nodiscard]] auto offset() const noexcept -> std::uint64_t
+  {
+    return offset_;
+  }
+
+private:
+  /** @brief The underlying descriptor. */
+  std::shared_ptr<const descriptor> desc_;
+  /** @brief The current offset into the file. */
+  std::uint64_t offset_{0};
+};
+
 /**
  * @brief Returns a reference to the atomic counter for temporary file
  * generation.
@@ -64,14 +219,66 @@ auto tmpname() -> std::filesystem::path;
  */
 auto touch(const std::filesystem::path &file) -> std::error_code;
 
+/** @brief A path shared by every holder of the same name. */
+using interned_path = std::shared_ptr<const std::filesystem::path>;
+
+/**
+ * @brief Interns a path in the process-wide path table.
+ * @details Every live handle to the same name points at one copy of the
+ * path, so sessions transferring the same file share its storage. A path
+ * leaves the table when its last handle is released.
+ * @param name The path to intern.
+ * @returns A handle to the interned path.
+ */
+auto intern(std::string_view name) -> interned_path;
+
+/** @brief Gets the number of paths in the path table. */
+auto interned() -> std::size_t;
+
+class watcher;
+
+/**
+ * @brief Checks if a path is a directory or lies below it.
+ * @details The comparison is lexical; both paths should be normalized.
+ * @param dir The directory.
+ * @param path The path to check.
+ * @returns true if `path` is `dir` or below it.
+ */
+auto contains(const std::filesystem::path &dir,
+              const std::filesystem::path &path) -> bool;
+
+/**
+ * @brief Drops the shared read descriptors of a path and everything below it.
+ * @details Sessions that already have the files open keep reading them; the
+ * next open_read() of each path reopens it.
+ * @param path The changed path.
+ * @returns The number of descriptors dropped.
+ */
+auto invalidate(const std::filesystem::path &path) -> std::size_t;
+
+/**
+ * @brief Installs the watcher that open_read() relies on to learn of changes.
+ * @details The watcher is subscribed to invalidate(). Shared descriptors for
+ * paths that it covers are then reused without checking that the path still
+ * names the same file.
+ * @param next The watcher to install, or nullptr to remove it.
+ * @returns The previously installed watcher.
+ */
+auto watch(std::shared_ptr<watcher> next) -> std::shared_ptr<watcher>;
+
 /**
  * @brief Opens a file for reading.
+ * @details Concurrent opens of the same path are coalesced so that only one
+ * of them reaches the disk, and the resulting descriptor is shared with every
+ * later request for the same path while any session still has it open.
+ * Before it is shared, a descriptor is checked against the path with a
+ * stat(), unless an installed watcher covers the path.
  * @param file The file to open.
  * @param[out] err An error code that is cleared on success and set on error.
- * @returns A shared pointer to an open file stream.
+ * @returns A shared pointer to an open file handle.
  */
 auto open_read(const std::filesystem::path &file,
-               std::error_code &err) -> std::shared_ptr<std::fstream>;
+               std::error_code &err) -> std::shared_ptr<file_handle>;
 
 /**
  * @brief Opens a file for writing.
@@ -80,9 +287,9 @@ auto open_read(const std::filesystem::path &file,
  * @param file The file to open.
  * @param[in,out] tmp The path of the temporary file.
  * @param[out] err An error code that is cleared on success and set on error.
- * @returns A shared pointer to an open file stream.
+ * @returns A shared pointer to an open file handle.
  */
 auto open_write(const std::filesystem::path &file, std::filesystem::path &tmp,
-                std::error_code &err) -> std::shared_ptr<std::fstream>;
+                std::error_code &err) -> std::shared_ptr<file_handle>;
 } // namespace tftp::filesystem
 #endif // TFTP_FILESYSTEM_HPP
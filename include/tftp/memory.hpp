@@ -0,0 +1,253 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file memory.hpp
+ * @brief This file declares the process-wide memory governor.
+ */
+#pragma once
+#ifndef TFTP_MEMORY_HPP
+#define TFTP_MEMORY_HPP
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+/** @brief For accounting and limiting memory use. */
+namespace tftp::memory {
+/** @brief What memory is used for. */
+enum category : std::uint8_t {
+  /** @brief Session state. */
+  SESSIONS,
+  /** @brief Packet buffers, FEC windows and read contexts. */
+  BUFFERS,
+  /** @brief The file content cache. */
+  CACHE,
+  /** @brief The compressed frame cache. */
+  COMPRESSION,
+  /** @brief The rendered virtual file memo. */
+  TEMPLATES,
+  /** @brief Upload payloads queued for in-process consumers. */
+  UPLOADS,
+  /** @brief Relay downloads in progress. */
+  DOWNLOADS,
+  /** @brief The number of categories. */
+  CATEGORIES
+};
+
+/**
+ * @brief Accounts memory by category and keeps it below a ceiling.
+ * @details Sessions, upload queues and downloads charge what they hold
+ * through a reservation, which gives the memory back when it is destroyed.
+ * Caches are not charged; they are registered with a function that reports
+ * their size and one that shrinks them, and are polled when the total is
+ * needed.
+ *
+ * Every new session must be admitted first, and a cache must make room
+ * before it grows. If either would take the total past the ceiling, the
+ * caches are shrunk in the order they were registered. Only if that does
+ * not free enough memory is the session refused or the cache left as it is.
+ */
+class governor {
+public:
+  /** @brief Reports the size of a cache in bytes. */
+  using usage_fn = std::function<std::size_t()>;
+  /** @brief Frees at least the given number of bytes if it can. */
+  using shrink_fn = std::function<std::size_t(std::size_t)>;
+
+  /** @brief Governor counters. */
+  struct counters {
+    /** @brief The number of times the caches were shrunk. */
+    std::atomic<std::uint64_t> shrinks{0};
+    /** @brief The number of bytes freed by shrinking the caches. */
+    std::atomic<std::uint64_t> reclaimed{0};
+    /** @brief The number of sessions admitted. */
+    std::atomic<std::uint64_t> admitted{0};
+    /** @brief The number of sessions refused. */
+    std::atomic<std::uint64_t> refused{0};
+    /** @brief The number of times a cache was not allowed to grow. */
+    std::atomic<std::uint64_t> declined{0};
+  };
+
+  /** @brief The memory in use. */
+  struct breakdown {
+    /** @brief The bytes used by each category. */
+    std::array<std::size_t, CATEGORIES> bytes{};
+    /** @brief The total of every category. */
+    std::size_t total{0};
+    /** @brief The configured ceiling. */
+    std::size_t ceiling{0};
+  };
+
+  /**
+   * @brief Constructs a governor.
+   * @param ceiling The most bytes to use.
+   */
+  explicit governor(std::size_t ceiling) noexcept;
+
+  /**
+   * @brief Registers a cache that can be shrunk under pressure.
+   * @param cat The category of the cache.
+   * @param usage Reports the size of the cache.
+   * @param shrink Shrinks the cache.
+   */
+  auto reclaimable(category cat, usage_fn usage, shrink_fn shrink) -> void;
+
+  /**
+   * @brief Admits a new session.
+   * @details Shrinks the caches if the session does not fit below the
+   * ceiling.
+   * @param bytes The memory the session is expected to use.
+   * @returns true if the session fits, false if it must be refused.
+   */
+  auto admit(std::size_t bytes) -> bool;
+
+  /**
+   * @brief Makes room for a cache to grow.
+   * @details Shrinks the caches if the bytes do not fit below the ceiling.
+   * The caller must not hold a lock that its own shrink function takes.
+   * @param bytes The number of bytes the cache is about to add.
+   * @returns true if the cache may grow, false if it must not.
+   */
+  auto make_room(std::size_t bytes) -> bool;
+
+  /**
+   * @brief Charges memory to a category.
+   * @param cat The category.
+   * @param bytes The number of bytes.
+   */
+  auto charge(category cat, std::size_t bytes) noexcept -> void;
+
+  /**
+   * @brief Gives memory back to a category.
+   * @param cat The category.
+   * @param bytes The number of bytes.
+   */
+  auto discharge(category cat, std::size_t bytes) noexcept -> void;
+
+  /** @brief Gets the memory used by every category. */
+  [[nodiscard]] auto usage() const -> breakdown;
+
+  /** @brief Gets the configured ceiling. */
+  [[nodiscard]] auto ceiling() const noexcept -> std::size_t;
+
+  /** @brief Gets the governor counters. */
+  [[nodiscard]] auto stats() noexcept -> counters &;
+
+private:
+  /**
+   * @brief Shrinks the caches until bytes more fit below the ceiling.
+   * @details Requires mtx_ to be held.
+   */
+  auto fit(std::size_t bytes) -> bool;
+
+  /** @brief A registered cache. */
+  struct cache {
+    /** @brief The category of the cache. */
+    category cat;
+    /** @brief Reports the size of the cache. */
+    usage_fn usage;
+    /** @brief Shrinks the cache. */
+    shrink_fn shrink;
+  };
+
+  /** @brief The configured ceiling. */
+  std::size_t ceiling_;
+  /** @brief The bytes charged to each category. */
+  std::array<std::atomic<std::size_t>, CATEGORIES> charged_{};
+  /** @brief Protects caches_. */
+  mutable std::mutex mtx_;
+  /** @brief The registered caches. */
+  std::vector<cache> caches_;
+  /** @brief The governor counters. */
+  counters stats_;
+};
+
+/**
+ * @brief Memory charged to a governor on behalf of one owner.
+ * @details Everything added to a reservation is discharged when it is
+ * destroyed. A reservation without a governor accounts nothing.
+ */
+class reservation {
+public:
+  /** @brief Constructs an empty reservation. */
+  reservation() = default;
+  /**
+   * @brief Constructs a reservation against a governor.
+   * @param owner The governor to charge.
+   */
+  explicit reservation(std::shared_ptr<governor> owner) noexcept;
+  /** @brief Deleted copy constructor. */
+  reservation(const reservation &) = delete;
+  /** @brief Move constructor. */
+  reservation(reservation &&other) noexcept;
+  /** @brief Deleted copy assignment. */
+  auto operator=(const reservation &) -> reservation & = delete;
+  /** @brief Move assignment. */
+  auto operator=(reservation &&other) noexcept -> reservation &;
+  /** @brief Discharges everything that was added. */
+  ~reservation();
+
+  /**
+   * @brief Charges more memory.
+   * @param cat The category.
+   * @param bytes The number of bytes.
+   */
+  auto add(category cat, std::size_t bytes) noexcept -> void;
+
+  /**
+   * @brief Gives back memory that was added.
+   * @param cat The category.
+   * @param bytes The number of bytes, at most what was added to cat.
+   */
+  auto remove(category cat, std::size_t bytes) noexcept -> void;
+
+  /** @brief Gets the number of bytes charged. */
+  [[nodiscard]] auto bytes() const noexcept -> std::size_t;
+
+private:
+  /** @brief Discharges everything that was added. */
+  auto release() noexcept -> void;
+
+  /** @brief The governor to charge. */
+  std::shared_ptr<governor> owner_;
+  /** @brief The bytes charged to each category. */
+  std::array<std::size_t, CATEGORIES> bytes_{};
+};
+
+/**
+ * @brief Gets the governor that new sessions are admitted by.
+ * @returns The current governor, or nullptr if memory is not limited.
+ */
+auto current() -> std::shared_ptr<governor>;
+
+/**
+ * @brief Makes room for a cache to grow with the current governor.
+ * @param bytes The number of bytes the cache is about to add.
+ * @returns true if the cache may grow, or if memory is not limited.
+ */
+auto make_room(std::size_t bytes) -> bool;
+
+/**
+ * @brief Installs the governor that new sessions are admitted by.
+ * @param next The governor to install, or nullptr to stop limiting memory.
+ * @returns The previously installed governor.
+ */
+auto install(std::shared_ptr<governor> next) -> std::shared_ptr<governor>;
+} // namespace tftp::memory
+#endif // TFTP_MEMORY_HPP
@@ -0,0 +1,168 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file prefetch.hpp
+ * @brief This file declares the boot chain prefetch predictor.
+ */
+#pragma once
+#ifndef TFTP_PREFETCH_HPP
+#define TFTP_PREFETCH_HPP
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+/** @brief For predictive prefetching of boot chains. */
+namespace tftp::prefetch {
+/**
+ * @brief Learns which files clients request next and prefetches them.
+ * @details Boot chains are predictable: a client that fetches `pxelinux.0`
+ * almost always asks for `ldlinux.c32`, its config, a kernel and an initrd
+ * next. The predictor counts first-order transitions between the files each
+ * client requests, and as soon as a client starts a transfer it prefetches
+ * the files that most often followed it.
+ *
+ * Transitions are counted per client class, where the class is the first
+ * file of the client's current chain (e.g. BIOS and UEFI loaders learn
+ * separate sequences). A chain ends when a client is idle for longer than
+ * the chain gap.
+ */
+class predictor {
+public:
+  /** @brief Prefetches a file. */
+  using callback = std::function<void(const std::filesystem::path &)>;
+  /** @brief The clock used to expire chains. */
+  using clock = std::chrono::steady_clock;
+
+  /** @brief The default idle time that ends a chain. */
+  static constexpr auto DEFAULT_CHAIN_GAP = std::chrono::seconds(30);
+  /** @brief The default most files prefetched per request. */
+  static constexpr std::size_t DEFAULT_FANOUT = 2;
+  /** @brief The fewest observations before a transition is predicted. */
+  static constexpr std::uint32_t MIN_COUNT = 2;
+  /**
+   * @brief The most transitions and clients that are tracked.
+   * @details Once this many clients are tracked, the least recently seen
+   * client is forgotten to make room for a new one.
+   */
+  static constexpr std::size_t MAX_TRACKED = 16384;
+
+  /** @brief Predictor counters. */
+  struct counters {
+    /** @brief The number of requests observed. */
+    std::atomic<std::uint64_t> observed{0};
+    /** @brief The number of prefetches started. */
+    std::atomic<std::uint64_t> predicted{0};
+    /** @brief The number of requests that had been prefetched. */
+    std::atomic<std::uint64_t> hits{0};
+  };
+
+  /**
+   * @brief Constructs a predictor.
+   * @param func Called with each file to prefetch.
+   * @param fanout The most files prefetched per request.
+   * @param gap The idle time that ends a chain.
+   */
+  explicit predictor(callback func, std::size_t fanout = DEFAULT_FANOUT,
+                     clock::duration gap = DEFAULT_CHAIN_GAP);
+
+  /**
+   * @brief Records a request and prefetches the likely next files.
+   * @param client Identifies the client, e.g. its address without the port.
+   * @param file The requested file.
+   * @param now The time of the request.
+   * @returns The files that were prefetched, most likely first.
+   */
+  auto observe(std::string_view client, const std::filesystem::path &file,
+               clock::time_point now = clock::now())
+      -> std::vector<std::string>;
+
+  /**
+   * @brief Predicts the files that follow a file.
+   * @param cls The client class, i.e. the first file of the chain.
+   * @param file The file to predict from.
+   * @returns At most fanout files, most likely first.
+   */
+  [[nodiscard]] auto predict(std::string_view cls, std::string_view file) const
+      -> std::vector<std::string>;
+
+  /** @brief Gets the predictor counters. */
+  [[nodiscard]] auto stats() noexcept -> counters &;
+
+private:
+  /** @brief A client's position in its chain. */
+  struct chain {
+    /** @brief The first file of the chain. */
+    std::string cls;
+    /** @brief The last file requested. */
+    std::string last;
+    /** @brief The files prefetched for the next request. */
+    std::vector<std::string> pending;
+    /** @brief The time of the last request. */
+    clock::time_point seen;
+    /** @brief The client's position in lru_. */
+    std::list<std::string>::iterator lru;
+  };
+
+  /** @brief Requires mtx_ to be held. */
+  [[nodiscard]] auto predict_locked(const std::string &from) const
+      -> std::vector<std::string>;
+  /** @brief Halves every count. Requires mtx_ to be held. */
+  auto age() -> void;
+
+  /** @brief The prefetch callback. */
+  callback prefetch_;
+  /** @brief The most files prefetched per request. */
+  std::size_t fanout_;
+  /** @brief The idle time that ends a chain. */
+  clock::duration gap_;
+  /** @brief Protects the members below. */
+  mutable std::mutex mtx_;
+  /** @brief Successor counts keyed by class and file. */
+  std::unordered_map<std::string,
+                     std::unordered_map<std::string, std::uint32_t>>
+      transitions_;
+  /** @brief The number of successor counts in transitions_. */
+  std::size_t tracked_{0};
+  /** @brief Chains keyed by client. */
+  std::unordered_map<std::string, chain> clients_;
+  /** @brief Clients, most recently seen first. */
+  std::list<std::string> lru_;
+  /** @brief The predictor counters. */
+  counters stats_;
+};
+
+/**
+ * @brief Gets the predictor that new requests are reported to.
+ * @returns The current predictor, or nullptr if prediction is disabled.
+ */
+auto current() -> std::shared_ptr<predictor>;
+
+/**
+ * @brief Installs the predictor that new requests are reported to.
+ * @param next The predictor to install, or nullptr to disable prediction.
+ * @returns The previously installed predictor.
+ */
+auto install(std::shared_ptr<predictor> next) -> std::shared_ptr<predictor>;
+} // namespace tftp::prefetch
+#endif // TFTP_PREFETCH_HPP
@@ -26,6 +26,7 @@
 #include <cassert>
 #include <cstdint>
 #include <cstring>
+#include <optional>
 #include <string_view>
 /** @brief TFTP related utilities. */
 namespace tftp {
@@ -35,9 +36,10 @@ namespace tftp {
 struct messages {
   /**
    * @brief Protocol defined operations (opcodes).
-   * These are the valid TFTP operation codes as defined in RFC 1350.
+   * These are the valid TFTP operation codes as defined in RFC 1350, and
+   * the option acknowledgment defined in RFC 2347.
    */
-  enum opcode_t : std::uint16_t { RRQ = 1, WRQ, DATA, ACK, ERROR };
+  enum opcode_t : std::uint16_t { RRQ = 1, WRQ, DATA, ACK, ERROR, OACK };
 
   /**
    * @brief Protocol defined transfer modes.
@@ -59,7 +61,8 @@ struct messages {
     FILE_ALREADY_EXISTS,
     NO_SUCH_USER,
     // Errors below this point are all ALIASES to NOT_DEFINED.
-    TIMED_OUT
+    TIMED_OUT,
+    BUSY
   };
 
   /**
@@ -73,6 +76,21 @@ struct messages {
     uint16_t mode;
     /** @brief Null-terminated filename. */
     const char *filename;
+    /**
+     * @brief The block to resume an RRQ after, if the client sent the
+     * (nonstandard) `offset` option.
+     */
+    std::optional<std::uint64_t> offset;
+    /**
+     * @brief Set if the client asked for a zstd compressed RRQ with the
+     * (nonstandard) `compress` option.
+     */
+    bool compress{false};
+    /**
+     * @brief The number of DATA blocks per repair packet if the client asked
+     * for forward error correction with the (nonstandard) `fec` option.
+     */
+    std::uint16_t fec{0};
   };
 
   /**
@@ -108,6 +126,14 @@ struct messages {
   static constexpr auto DATALEN = 512UL;
   /** @brief The maximum total size of a DATA message (header + payload). */
   static constexpr auto DATAMSG_MAXLEN = sizeof(data) + DATALEN;
+  /** @brief The name of the option that resumes an RRQ at a block offset. */
+  static constexpr auto OFFSET_OPTION = std::string_view("offset");
+  /** @brief The name of the option that asks for a compressed RRQ. */
+  static constexpr auto COMPRESS_OPTION = std::string_view("compress");
+  /** @brief The value of the compress option for zstd compression. */
+  static constexpr auto ZSTD_COMPRESSION = std::string_view("zstd");
+  /** @brief The name of the option that asks for forward error correction. */
+  static constexpr auto FEC_OPTION = std::string_view("fec");
 };
 // NOLINTEND(performance-enum-size)
 
@@ -183,6 +209,9 @@ struct errors {
       case TIMED_OUT:
         return "Timed out.";
 
+      case BUSY:
+        return "Server busy.";
+
       default:
         return "Not defined.";
     }
@@ -220,6 +249,22 @@ struct errors {
     return static_cast<const decltype(buf) &>(buf);
   }
 
+  /**
+   * @brief Creates a "Server busy" error packet.
+   *
+   * Returns a pre-formatted TFTP error packet with error code NOT_DEFINED
+   * and the message "Server busy." This is used when a new session is
+   * refused because the server is out of memory.
+   *
+   * @return Const reference to a static buffer containing the error packet.
+   */
+  static auto busy() noexcept -> decltype(auto)
+  {
+    using enum messages::error_t;
+    static constexpr auto buf = msg(NOT_DEFINED, "Server busy.");
+    return static_cast<const decltype(buf) &>(buf);
+  }
+
   /**
    * @brief Creates an "Access violation" error packet.
    *
@@ -20,11 +20,17 @@
 #pragma once
 #ifndef TFTP_SESSION_HPP
 #define TFTP_SESSION_HPP
+#include "tftp/fec.hpp"
+#include "tftp/filesystem.hpp"
+#include "tftp/memory.hpp"
+#include "tftp/storage/storage.hpp"
+#include "tftp/transform.hpp"
+
 #include <net/timers/timers.hpp>
 
+#include <cstddef>
 #include <cstdint>
-#include <filesystem>
-#include <fstream>
+#include <memory>
 #include <vector>
 /** @brief TFTP related utilities. */
 namespace tftp {
@@ -52,16 +58,32 @@ struct session {
   /** @brief Timeout max value. */
   static constexpr auto TIMEOUT_MAX = std::chrono::milliseconds(200);
 
-  /** @brief The session state. */
-  struct state_t {
-    /** @brief The requested filepath. */
-    std::filesystem::path target;
-    /** @brief The temporary filepath. */
-    std::filesystem::path tmp;
+  /** @brief The size of a cache line. */
+  static constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+  /** @brief The session state that moves the file contents. */
+  struct transfer_t {
+    /** @brief The requested filepath, shared with other sessions. */
+    filesystem::interned_path target;
     /** @brief A write buffer. */
     std::vector<char> buffer;
-    /** @brief The fstream associated with the operation. */
-    std::shared_ptr<std::fstream> file;
+    /** @brief The file associated with the operation. */
+    std::shared_ptr<storage::file> file;
+    /** @brief Produces the contents of each DATA block of an RRQ. */
+    std::unique_ptr<transform::pipeline> pipeline;
+    /** @brief The send window of an RRQ with forward error correction. */
+    std::unique_ptr<fec::window> fec;
+    /** @brief The memory charged for the session. */
+    tftp::memory::reservation memory;
+  };
+
+  /**
+   * @brief The session state.
+   * @details The fields used to demultiplex packets and to time
+   * retransmissions fit in one cache line, so scanning sessions does not
+   * touch the transfer state, which is allocated separately.
+   */
+  struct alignas(CACHE_LINE_SIZE) state_t {
     /** @brief RTT statistics aggregate type. */
     struct statistics_t {
       /** @brief Used to mark the start time of an interval. */
@@ -73,6 +95,8 @@ struct session {
     statistics_t statistics;
     /** @brief A timer id associated to the TFTP session. */
     timer_id timer{INVALID_TIMER};
+    /** @brief The timeout the session timer enforces, 0 if not periodic. */
+    duration timeout{0};
     /** @brief The local socket that the session is keyed on. */
     socket_type socket{INVALID_SOCKET};
     /** @brief The current protocol block number. */
@@ -81,7 +105,12 @@ struct session {
     std::uint16_t opc = 0;
     /** @brief The operating mode. */
     std::uint8_t mode = 0;
+    /** @brief The number of retransmissions of the current block. */
+    std::uint8_t retries = 0;
+    /** @brief The transfer state. */
+    std::unique_ptr<transfer_t> transfer = std::make_unique<transfer_t>();
   };
+  static_assert(sizeof(state_t) == CACHE_LINE_SIZE);
 
   /** @brief The session state. */
   state_t state;
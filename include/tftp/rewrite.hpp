@@ -0,0 +1,238 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file rewrite.hpp
+ * @brief This file declares the filename rewrite rules engine.
+ */
+#pragma once
+#ifndef TFTP_REWRITE_HPP
+#define TFTP_REWRITE_HPP
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+/** @brief For rewriting requested filenames. */
+namespace tftp::rewrite {
+/**
+ * @brief The client a filename is rewritten for.
+ * @details The addresses may live in scratch memory. Copies allocate from
+ * the default resource, so a copy can outlive the scratch memory.
+ */
+struct client {
+  /** @brief The client IP address, e.g. `192.0.2.10`. */
+  std::pmr::string ip;
+  /** @brief The client MAC address, e.g. `01-aa-bb-cc-dd-ee-ff`. */
+  std::pmr::string mac;
+};
+
+/**
+ * @brief Narrows a list of regex patterns down to the ones that can match a
+ * filename.
+ * @details Each pattern is filed in a trie under the literal text it starts
+ * with. Patterns that start with no literal text are filed in an
+ * Aho-Corasick automaton under the longest literal that every match must
+ * contain, so a lookup walks the filename once through each automaton.
+ *
+ * The candidates still have to be run with std::regex, a backtracking
+ * matcher. Patterns that contain no required literal at all, such as
+ * `(.*)`, are candidates for every filename.
+ */
+class pattern_filter {
+public:
+  /**
+   * @brief Files the next pattern.
+   * @details link() must be called after the last add() and before the
+   * next candidates().
+   * @param pattern An ECMAScript regex that must match the whole filename.
+   * @returns The index of the pattern.
+   */
+  auto add(std::string_view pattern) -> std::uint32_t;
+
+  /** @brief Links the automaton after patterns are added. */
+  auto link() -> void;
+
+  /**
+   * @brief Gets the patterns that can match a filename.
+   * @param name The filename.
+   * @param[out] found Cleared, then set to the indices of the patterns that
+   * can match, in the order they were added.
+   */
+  auto candidates(std::string_view name,
+                  std::pmr::vector<std::uint32_t> &found) const -> void;
+
+private:
+  /** @brief A node of the trie or the automaton. */
+  struct node {
+    /** @brief The child nodes, sorted by byte. */
+    std::vector<std::pair<char, std::uint32_t>> children;
+    /** @brief The node of the longest proper suffix of this node's text. */
+    std::uint32_t fail{0};
+    /** @brief The nearest node along fail links that has patterns. */
+    std::uint32_t output{0};
+    /** @brief The patterns filed under this node. */
+    std::vector<std::uint32_t> patterns;
+  };
+
+  /** @brief The number of patterns added. */
+  std::uint32_t size_{0};
+  /** @brief The literal prefix trie. The root is node 0. */
+  std::vector<node> prefixes_{1};
+  /** @brief The required literal automaton. The root is node 0. */
+  std::vector<node> literals_{1};
+  /** @brief The patterns that have no required literal. */
+  std::vector<std::uint32_t> unfiltered_;
+};
+
+/**
+ * @brief A compiled set of filename rewrite rules.
+ * @details Rules are read one per line. Blank lines and lines starting with
+ * `#` are ignored.
+ *
+ *     slashes                    # convert '\' to '/'
+ *     lowercase                  # fold the filename to lowercase
+ *     prefix <from> <to>         # replace a leading <from> with <to>
+ *     regex <pattern> <to>       # replace a full match of <pattern> with <to>
+ *
+ * A `-` as <to> stands for the empty string. In <to>, `{ip}` and `{mac}`
+ * expand to the client's addresses, and `$1`-`$9` to the captures of a
+ * regex.
+ *
+ * The rules are applied in stages: the `slashes` and `lowercase` folds,
+ * then the longest matching `prefix` rule, then the first matching `regex`
+ * rule in file order. Prefix rules are compiled into a trie, and regex
+ * rules are narrowed down by a pattern_filter, so a lookup only runs the
+ * patterns that can match. Each pattern that does run costs what std::regex
+ * makes it cost.
+ */
+class rules {
+public:
+  /**
+   * @brief Compiles rules.
+   * @param text The rules, one per line.
+   * @param[out] err An error code that is cleared on success and set to
+   * `invalid_argument` if a rule is malformed.
+   * @param[out] line If not null, set to the line number of a malformed rule.
+   * @returns The compiled rules, or nullptr on error.
+   */
+  static auto compile(std::string_view text, std::error_code &err,
+                      std::size_t *line = nullptr) -> std::shared_ptr<rules>;
+
+  /**
+   * @brief Compiles the rules in a file.
+   * @param file The rules file.
+   * @param[out] err An error code that is cleared on success and set on error.
+   * @param[out] line If not null, set to the line number of a malformed rule.
+   * @returns The compiled rules, or nullptr on error.
+   */
+  static auto load(const std::filesystem::path &file, std::error_code &err,
+                   std::size_t *line = nullptr) -> std::shared_ptr<rules>;
+
+  /**
+   * @brief Rewrites a filename.
+   * @param filename The requested filename.
+   * @param who The requesting client.
+   * @param resource The memory resource the result and the intermediate
+   * strings are allocated from.
+   * @returns The rewritten filename.
+   */
+  [[nodiscard]] auto apply(std::string_view filename, const client &who,
+                           std::pmr::memory_resource *resource =
+                               std::pmr::get_default_resource()) const
+      -> std::pmr::string;
+
+  /** @brief Checks if any rule expands `{mac}`. */
+  [[nodiscard]] auto needs_mac() const noexcept -> bool { return needs_mac_; }
+
+  /** @brief Gets the number of compiled rules. */
+  [[nodiscard]] auto size() const noexcept -> std::size_t;
+
+private:
+  /** @brief A trie node. */
+  struct node {
+    /** @brief The child nodes, sorted by byte. */
+    std::vector<std::pair<char, std::uint32_t>> children;
+    /** @brief The prefix rule that ends here, if any. */
+    std::optional<std::uint32_t> prefix;
+  };
+
+  /** @brief A prefix rule. */
+  struct prefix_rule {
+    /** @brief The length of the matched prefix. */
+    std::size_t length;
+    /** @brief The replacement. */
+    std::string to;
+  };
+
+  /** @brief A regex rule. */
+  struct pattern_rule {
+    /** @brief The compiled pattern. */
+    std::regex pattern;
+    /** @brief The replacement. */
+    std::string to;
+  };
+
+  /** @brief Finds or adds the trie node for a key. */
+  auto insert(std::string_view key) -> std::uint32_t;
+
+  /** @brief Set by the `slashes` rule. */
+  bool slashes_{false};
+  /** @brief Set by the `lowercase` rule. */
+  bool lowercase_{false};
+  /** @brief Set if any replacement expands `{mac}`. */
+  bool needs_mac_{false};
+  /** @brief The trie. The root is node 0. */
+  std::vector<node> nodes_{1};
+  /** @brief The prefix rules. */
+  std::vector<prefix_rule> prefixes_;
+  /** @brief The regex rules in file order. */
+  std::vector<pattern_rule> patterns_;
+  /** @brief Narrows down the regex rules. */
+  pattern_filter filter_;
+};
+
+/**
+ * @brief Looks up the MAC address of a directly connected client.
+ * @details Reads the kernel's IPv4 neighbour table.
+ * @param ip The client IP address.
+ * @param resource The memory resource the result and each line of the table
+ * are allocated from.
+ * @returns The MAC address in pxelinux form (`01-aa-bb-cc-dd-ee-ff`), or an
+ * empty string if it is unknown.
+ */
+auto lookup_mac(std::string_view ip,
+                std::pmr::memory_resource *resource =
+                    std::pmr::get_default_resource()) -> std::pmr::string;
+
+/**
+ * @brief Gets the rules that requested filenames are rewritten with.
+ * @returns The current rules, or nullptr if filenames are used verbatim.
+ */
+auto current() -> std::shared_ptr<const rules>;
+
+/**
+ * @brief Installs the rules that requested filenames are rewritten with.
+ * @param next The rules to install, or nullptr to use filenames verbatim.
+ * @returns The previously installed rules.
+ */
+auto install(std::shared_ptr<const rules> next) -> std::shared_ptr<const rules>;
+} // namespace tftp::rewrite
+#endif // TFTP_REWRITE_HPP
@@ -0,0 +1,187 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file sink.hpp
+ * @brief This file declares in-process consumers of uploaded files.
+ */
+#pragma once
+#ifndef TFTP_SINK_HPP
+#define TFTP_SINK_HPP
+#include "storage/storage.hpp"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+/** @brief For uploads that are streamed to in-process consumers. */
+namespace tftp::sink {
+/**
+ * @brief Consumes one uploaded file.
+ * @details A consumer is called from one of its registry's worker threads,
+ * never from the server's event loop, and receives the DATA payloads of
+ * the upload in order. It is never called from two threads at once.
+ */
+class consumer {
+public:
+  /** @brief Default constructor. */
+  consumer() = default;
+  /** @brief Deleted copy constructor. */
+  consumer(const consumer &) = delete;
+  /** @brief Deleted move constructor. */
+  consumer(consumer &&) = delete;
+  /** @brief Deleted copy assignment. */
+  auto operator=(const consumer &) -> consumer & = delete;
+  /** @brief Deleted move assignment. */
+  auto operator=(consumer &&) -> consumer & = delete;
+  /** @brief Virtual destructor. */
+  virtual ~consumer() = default;
+
+  /**
+   * @brief Consumes the next bytes of the upload.
+   * @param buf The bytes.
+   * @param[out] err An error code that is cleared on success and set on
+   * error. An error fails the upload.
+   */
+  virtual auto write(std::span<const char> buf,
+                     std::error_code &err) -> void = 0;
+
+  /**
+   * @brief Completes the upload.
+   * @param[out] err An error code that is cleared on success and set on error.
+   */
+  virtual auto commit(std::error_code &err) -> void = 0;
+
+  /** @brief Abandons an upload that did not complete. */
+  virtual auto abort() noexcept -> void {}
+};
+
+/** @brief Creates the consumer of an upload to a path. */
+using factory =
+    std::function<std::unique_ptr<consumer>(const std::filesystem::path &)>;
+
+/**
+ * @brief Routes uploads to in-process consumers by path prefix.
+ * @details An upload to a registered prefix never touches storage: each
+ * DATA payload is queued for the consumer as it arrives. Once more than the
+ * sink's window is queued the upload reports itself busy and the server
+ * holds back its ACKs, so a slow consumer throttles the client instead of
+ * buffering the whole file.
+ *
+ * Consumers run on a fixed number of worker threads owned by the registry,
+ * which take turns handing one payload at a time to each upload with work.
+ * Destroying the registry finishes committed uploads, cancels the rest and
+ * joins the threads.
+ */
+class registry {
+public:
+  /** @brief The default number of bytes queued before ACKs are delayed. */
+  static constexpr std::size_t DEFAULT_WINDOW = 64UL * 1024;
+  /** @brief The default number of worker threads. */
+  static constexpr std::size_t DEFAULT_THREADS = 4;
+
+  /** @brief Registry counters. */
+  struct counters {
+    /** @brief The number of uploads routed to a consumer. */
+    std::atomic<std::uint64_t> uploads{0};
+    /** @brief The number of bytes handed to consumers. */
+    std::atomic<std::uint64_t> bytes{0};
+    /** @brief The number of times an upload went over its window. */
+    std::atomic<std::uint64_t> stalls{0};
+    /** @brief The number of uploads that a consumer failed. */
+    std::atomic<std::uint64_t> failures{0};
+  };
+
+  /**
+   * @brief Constructs an empty registry.
+   * @param threads The number of worker threads that run consumers.
+   */
+  explicit registry(std::size_t threads = DEFAULT_THREADS);
+  /** @brief Deleted copy constructor. */
+  registry(const registry &) = delete;
+  /** @brief Deleted move constructor. */
+  registry(registry &&) = delete;
+  /** @brief Deleted copy assignment. */
+  auto operator=(const registry &) -> registry & = delete;
+  /** @brief Deleted move assignment. */
+  auto operator=(registry &&) -> registry & = delete;
+  /** @brief Finishes committed uploads and joins the worker threads. */
+  ~registry();
+
+  /**
+   * @brief Registers a consumer.
+   * @details The longest matching prefix wins. A prefix matches a path if
+   * it names the path or a directory above it.
+   * @param prefix The path prefix.
+   * @param make Creates the consumer of each upload.
+   * @param window The number of bytes queued before ACKs are delayed.
+   */
+  auto add(std::filesystem::path prefix, factory make,
+           std::size_t window = DEFAULT_WINDOW) -> void;
+
+  /**
+   * @brief Opens an upload to a path.
+   * @param path The upload target.
+   * @param[out] err An error code that is cleared on success and set to
+   * `permission_denied` if the consumer refused the upload.
+   * @returns The upload, or nullptr if no consumer is registered for the
+   * path or it refused the upload.
+   */
+  auto open(const std::filesystem::path &path,
+            std::error_code &err) -> std::shared_ptr<storage::file>;
+
+  /** @brief Gets the number of registered consumers. */
+  [[nodiscard]] auto size() const noexcept -> std::size_t;
+
+  /** @brief Gets the registry counters. */
+  [[nodiscard]] auto stats() noexcept -> counters &;
+
+  /** @brief The worker threads. */
+  struct workers;
+
+private:
+  /** @brief A registered consumer. */
+  struct route {
+    /** @brief The generic form of the path prefix. */
+    std::string prefix;
+    /** @brief Creates the consumer of each upload. */
+    factory make;
+    /** @brief The number of bytes queued before ACKs are delayed. */
+    std::size_t window;
+  };
+
+  /** @brief The registered consumers. */
+  std::vector<route> routes_;
+  /** @brief The registry counters, shared with open uploads. */
+  std::shared_ptr<counters> stats_;
+  /** @brief The worker threads, shared with open uploads. */
+  std::shared_ptr<workers> workers_;
+};
+
+/**
+ * @brief Gets the consumers that uploads are routed to.
+ * @returns The current registry, or nullptr if there are no consumers.
+ */
+auto current() -> std::shared_ptr<registry>;
+
+/**
+ * @brief Installs the consumers that uploads are routed to.
+ * @param next The registry to install, or nullptr to remove it.
+ * @returns The previously installed registry.
+ */
+auto install(std::shared_ptr<registry> next) -> std::shared_ptr<registry>;
+} // namespace tftp::sink
+#endif // TFTP_SINK_HPP
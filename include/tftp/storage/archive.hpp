@@ -0,0 +1,112 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file archive.hpp
+ * @brief This file declares the tar archive storage backend.
+ */
+#pragma once
+#ifndef TFTP_STORAGE_ARCHIVE_HPP
+#define TFTP_STORAGE_ARCHIVE_HPP
+#include "storage.hpp"
+
+#include <optional>
+#include <string>
+#include <unordered_map>
+/** @brief For TFTP storage backends. */
+namespace tftp::storage {
+/**
+ * @brief Serves files directly out of a tar archive.
+ * @details The archive is indexed once when it is opened, mapping the path
+ * of every regular file to the offset of its data in the archive, so files
+ * are served without being extracted. Archives may also be compressed with
+ * zstd in the seekable format (when built with `TFTP_ENABLE_ZSTD`); frames
+ * are then decompressed on demand and the most recently used frames are
+ * cached. The backend is read-only.
+ */
+class archive : public backend {
+public:
+  /** @brief The location of a file inside the archive. */
+  struct member {
+    /** @brief The offset of the file data in the (decompressed) archive. */
+    std::uint64_t offset{0};
+    /** @brief The file size in bytes. */
+    std::uint64_t size{0};
+    /** @brief The last modification time. */
+    std::filesystem::file_time_type last_write;
+  };
+
+  /** @brief The default number of decompressed frames to cache. */
+  static constexpr std::size_t DEFAULT_CACHED_FRAMES = 32;
+
+  /** @brief The underlying (possibly compressed) archive data. */
+  class source;
+
+  /**
+   * @brief Opens and indexes an archive.
+   * @param path The archive to open.
+   * @param[out] err An error code that is cleared on success and set on error.
+   * `invalid_argument` is reported for archives that can not be parsed and
+   * `not_supported` for compressed archives that can not be decoded.
+   * @param cached_frames The number of decompressed frames to cache.
+   * @returns A shared pointer to the backend, or nullptr on error.
+   */
+  static auto open(const std::filesystem::path &path, std::error_code &err,
+                   std::size_t cached_frames = DEFAULT_CACHED_FRAMES)
+      -> std::shared_ptr<archive>;
+
+  /**
+   * @brief Looks up a file in the index.
+   * @param path The path of the file.
+   * @returns The member, or std::nullopt if there is no such file.
+   */
+  [[nodiscard]] auto find(const std::filesystem::path &path) const
+      -> std::optional<member>;
+
+  /** @brief Gets the number of files in the archive. */
+  [[nodiscard]] auto size() const noexcept -> std::size_t;
+
+  /** @copydoc backend::open_read */
+  auto open_read(const std::filesystem::path &path,
+                 std::error_code &err) -> std::shared_ptr<file> override;
+
+  /**
+   * @brief Archives are read-only.
+   * @param path The file to write.
+   * @param[out] err Always set to `permission_denied`.
+   * @returns nullptr.
+   */
+  auto open_write(const std::filesystem::path &path,
+                  std::error_code &err) -> std::shared_ptr<file> override;
+
+  /** @copydoc backend::stat */
+  auto stat(const std::filesystem::path &path,
+            std::error_code &err) -> file_status override;
+
+  /**
+   * @brief Constructs an archive backend from an indexed source.
+   * @details Use open() instead.
+   */
+  archive(std::shared_ptr<source> data,
+          std::unordered_map<std::string, member> index) noexcept;
+
+private:
+  /** @brief The archive data. */
+  std::shared_ptr<source> source_;
+  /** @brief The archive index. */
+  std::unordered_map<std::string, member> index_;
+};
+} // namespace tftp::storage
+#endif // TFTP_STORAGE_ARCHIVE_HPP
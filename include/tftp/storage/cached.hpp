@@ -0,0 +1,242 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file cached.hpp
+ * @brief This file declares the content caching storage backend.
+ */
+#pragma once
+#ifndef TFTP_STORAGE_CACHED_HPP
+#define TFTP_STORAGE_CACHED_HPP
+#include "memory.hpp"
+
+#include <atomic>
+#include <string>
+#include <utility>
+#include <vector>
+/** @brief For TFTP filesystem management. */
+namespace tftp::filesystem {
+class watcher;
+} // namespace tftp::filesystem
+
+/** @brief For TFTP storage backends. */
+namespace tftp::storage {
+/**
+ * @brief Caches the contents of files read from another backend.
+ * @details Files up to a size limit are read once into memory and served
+ * from there, with the least recently used files evicted once the cache
+ * holds more than its capacity. Concurrent misses on the same file are
+ * coalesced into one load.
+ *
+ * Cached files are split into fixed-size blocks that are stored once by
+ * content, so files and versions of a file that share blocks share their
+ * memory. Capacity is counted in these physical bytes.
+ *
+ * Cached files are validated against the wrapped backend with stat() on
+ * every open unless a watcher covers their path, in which case the watcher
+ * invalidates them when they change.
+ *
+ * With write-through enabled, uploads are kept in memory as they are
+ * written and installed as the cache entry for their path on commit, so
+ * the first reader after an upload is already served from memory.
+ *
+ * The cache also counts how often each path is opened, so that the hot set
+ * can be saved on shutdown and prefetched in the background on the next
+ * start.
+ */
+class cached : public backend {
+public:
+  /** @brief Cached file contents. */
+  using contents = memory::contents;
+  /** @brief A path and how often it was opened. */
+  using hot_entry = std::pair<std::string, std::uint64_t>;
+
+  /** @brief The default capacity in bytes. */
+  static constexpr std::size_t DEFAULT_CAPACITY = 64UL * 1024 * 1024;
+  /** @brief The default size of the largest file that is cached. */
+  static constexpr std::size_t DEFAULT_MAX_FILE_SIZE = 16UL * 1024 * 1024;
+  /** @brief The size of a cached block. */
+  static constexpr std::size_t BLOCK_SIZE = 4096;
+  /** @brief The default number of entries saved in a hot-set snapshot. */
+  static constexpr std::size_t DEFAULT_SNAPSHOT_SIZE = 1024;
+
+  /** @brief Cache counters. */
+  struct counters {
+    /** @brief The number of opens served from the cache. */
+    std::atomic<std::uint64_t> hits{0};
+    /** @brief The number of opens that had to load the file. */
+    std::atomic<std::uint64_t> misses{0};
+    /** @brief The number of files loaded by prefetching. */
+    std::atomic<std::uint64_t> prefetched{0};
+    /** @brief The number of files evicted to make room. */
+    std::atomic<std::uint64_t> evictions{0};
+    /** @brief The number of files dropped because they changed. */
+    std::atomic<std::uint64_t> invalidations{0};
+    /** @brief The number of uploads installed by write-through. */
+    std::atomic<std::uint64_t> written{0};
+  };
+
+  /** @brief The memory used by the cache. */
+  struct usage {
+    /** @brief The number of cached files. */
+    std::size_t files{0};
+    /** @brief The number of distinct cached blocks. */
+    std::size_t blocks{0};
+    /** @brief The total size of the cached files. */
+    std::size_t logical{0};
+    /** @brief The total size of the distinct cached blocks. */
+    std::size_t physical{0};
+  };
+
+  /**
+   * @brief Constructs a cache in front of a backend.
+   * @param inner The backend to cache.
+   * @param capacity The maximum number of physical bytes to cache.
+   * @param max_file_size Files larger than this are never cached.
+   */
+  explicit cached(std::shared_ptr<backend> inner,
+                  std::size_t capacity = DEFAULT_CAPACITY,
+                  std::size_t max_file_size = DEFAULT_MAX_FILE_SIZE);
+  /** @brief Deleted copy constructor. */
+  cached(const cached &) = delete;
+  /** @brief Deleted move constructor. */
+  cached(cached &&) = delete;
+  /** @brief Deleted copy assignment. */
+  auto operator=(const cached &) -> cached & = delete;
+  /** @brief Deleted move assignment. */
+  auto operator=(cached &&) -> cached & = delete;
+  /** @brief Stops background prefetching. */
+  ~cached() override;
+
+  /**
+   * @brief Relies on a watcher to invalidate changed files.
+   * @param watcher The watcher to subscribe to.
+   */
+  auto watch(std::shared_ptr<filesystem::watcher> watcher) -> void;
+
+  /**
+   * @brief Installs committed uploads in the cache.
+   * @details Uploads that fit are retained as they are written and become
+   * the cache entry for their path when they are committed. Entries
+   * installed this way are validated with stat() instead of being dropped
+   * when the watcher reports the upload itself.
+   * @param enable Set to enable write-through.
+   */
+  auto write_through(bool enable) noexcept -> void;
+
+  /**
+   * @brief Drops cached files at or below a path.
+   * @param path The changed path.
+   * @returns The number of files dropped.
+   */
+  auto invalidate(const std::filesystem::path &path) -> std::size_t;
+
+  /**
+   * @brief Loads a file into the cache now.
+   * @param path The file to load.
+   * @param[out] err An error code that is cleared on success and set on error.
+   * @returns true if the file is cached.
+   */
+  auto warm(const std::filesystem::path &path, std::error_code &err) -> bool;
+
+  /**
+   * @brief Loads a file into the cache in the background.
+   * @param path The file to load.
+   */
+  auto prefetch(const std::filesystem::path &path) -> void;
+
+  /**
+   * @brief Warms every file listed in a manifest.
+   * @details The manifest lists one path per line. Blank lines and lines
+   * starting with `#` are ignored. Files that can not be loaded are skipped.
+   * @param manifest The manifest to read.
+   * @param[out] err An error code that is cleared on success and set if the
+   * manifest can not be read.
+   * @returns The number of files loaded.
+   */
+  auto preload(const std::filesystem::path &manifest,
+               std::error_code &err) -> std::size_t;
+
+  /**
+   * @brief Gets the most frequently opened paths.
+   * @param limit The maximum number of paths to return.
+   * @returns Paths and open counts, most frequently opened first.
+   */
+  [[nodiscard]] auto hot_set(std::size_t limit = DEFAULT_SNAPSHOT_SIZE) const
+      -> std::vector<hot_entry>;
+
+  /**
+   * @brief Saves the hot set to a snapshot file.
+   * @details Each line holds an open count and a path separated by a tab.
+   * @param snapshot The file to write.
+   * @param[out] err An error code that is cleared on success and set on error.
+   * @param limit The maximum number of paths to save.
+   */
+  auto save_snapshot(const std::filesystem::path &snapshot,
+                     std::error_code &err,
+                     std::size_t limit = DEFAULT_SNAPSHOT_SIZE) const -> void;
+
+  /**
+   * @brief Restores the hot set from a snapshot and prefetches it.
+   * @details Open counts are restored so the hot set carries over restarts,
+   * and the files are prefetched in the background, hottest first.
+   * @param snapshot The file to read.
+   * @param[out] err An error code that is cleared on success and set on error.
+   * @returns The number of paths queued for prefetching.
+   */
+  auto load_snapshot(const std::filesystem::path &snapshot,
+                     std::error_code &err) -> std::size_t;
+
+  /** @brief Gets the number of bytes held by cached blocks. */
+  [[nodiscard]] auto bytes() const -> std::size_t;
+
+  /**
+   * @brief Reports the logical and physical size of the cache.
+   * @details The ratio of logical to physical bytes is the memory saved by
+   * sharing blocks between files.
+   */
+  [[nodiscard]] auto memory_usage() const -> usage;
+
+  /**
+   * @brief Evicts the least recently used files to free memory.
+   * @param bytes The number of physical bytes to free.
+   * @returns The number of physical bytes freed.
+   */
+  auto shrink(std::size_t bytes) -> std::size_t;
+
+  /** @brief Gets the cache counters. */
+  [[nodiscard]] auto stats() noexcept -> counters &;
+
+  /** @copydoc backend::open_read */
+  auto open_read(const std::filesystem::path &path,
+                 std::error_code &err) -> std::shared_ptr<file> override;
+
+  /** @copydoc backend::open_write */
+  auto open_write(const std::filesystem::path &path,
+                  std::error_code &err) -> std::shared_ptr<file> override;
+
+  /** @copydoc backend::stat */
+  auto stat(const std::filesystem::path &path,
+            std::error_code &err) -> file_status override;
+
+  /** @brief The shared state of the cache. */
+  struct state;
+
+private:
+  /** @brief The shared state of the cache. */
+  std::shared_ptr<state> state_;
+};
+} // namespace tftp::storage
+#endif // TFTP_STORAGE_CACHED_HPP
@@ -0,0 +1,95 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file embedded.hpp
+ * @brief This file declares the embedded file storage backend.
+ */
+#pragma once
+#ifndef TFTP_STORAGE_EMBEDDED_HPP
+#define TFTP_STORAGE_EMBEDDED_HPP
+#include "storage.hpp"
+
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+/** @brief For TFTP storage backends. */
+namespace tftp::storage {
+/**
+ * @brief Serves files that are compiled into the executable.
+ * @details The embedded files are consulted before a fallback backend, so
+ * requests for them never touch storage. They are read-only: uploads to an
+ * embedded path are refused with `permission_denied`, and every other
+ * request is passed to the fallback.
+ */
+class embedded : public backend {
+public:
+  /** @brief An embedded file. */
+  struct entry {
+    /** @brief The path the file is served at. */
+    std::string_view path;
+    /** @brief The file contents. */
+    std::string_view contents;
+  };
+
+  /**
+   * @brief Gets the files compiled into the executable.
+   * @details The bundle is generated from the directory named by the
+   * `TFTP_EMBED_DIR` build option and is empty when it is not set.
+   * @returns The embedded files, sorted by path.
+   */
+  static auto bundle() noexcept -> std::span<const entry>;
+
+  /**
+   * @brief Constructs an embedded backend.
+   * @param fallback The backend to serve every other file from.
+   * @param files The files to embed.
+   */
+  explicit embedded(std::shared_ptr<backend> fallback,
+                    std::span<const entry> files = bundle());
+
+  /**
+   * @brief Looks up an embedded file.
+   * @param path The path of the file.
+   * @returns The file contents, or std::nullopt if the file is not embedded.
+   */
+  [[nodiscard]] auto find(const std::filesystem::path &path) const
+      -> std::optional<std::string_view>;
+
+  /** @brief Gets the number of embedded files. */
+  [[nodiscard]] auto size() const noexcept -> std::size_t;
+
+  /** @copydoc backend::open_read */
+  auto open_read(const std::filesystem::path &path,
+                 std::error_code &err) -> std::shared_ptr<file> override;
+
+  /** @copydoc backend::open_write */
+  auto open_write(const std::filesystem::path &path,
+                  std::error_code &err) -> std::shared_ptr<file> override;
+
+  /** @copydoc backend::stat */
+  auto stat(const std::filesystem::path &path,
+            std::error_code &err) -> file_status override;
+
+private:
+  /** @brief The backend to serve every other file from. */
+  std::shared_ptr<backend> fallback_;
+  /** @brief The embedded files keyed by path. */
+  std::unordered_map<std::string_view, std::string_view> files_;
+  /** @brief The time the embedded files are reported to be written. */
+  std::filesystem::file_time_type last_write_;
+};
+} // namespace tftp::storage
+#endif // TFTP_STORAGE_EMBEDDED_HPP
@@ -0,0 +1,117 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file memory.hpp
+ * @brief This file declares the in-memory storage backend.
+ */
+#pragma once
+#ifndef TFTP_STORAGE_MEMORY_HPP
+#define TFTP_STORAGE_MEMORY_HPP
+#include "storage.hpp"
+
+#include <vector>
+/** @brief For TFTP storage backends. */
+namespace tftp::storage {
+/**
+ * @brief Serves files from RAM.
+ * @details Each file is held in one contiguous buffer that is shared by
+ * every session reading it. Paths are normalized and stored relative, so
+ * `/boot/pxelinux.0` and `boot/pxelinux.0` name the same file. Uploads are
+ * kept in memory and fail with `no_space_on_device` once the backend would
+ * grow past its capacity.
+ */
+class memory : public backend {
+public:
+  /** @brief The contents of a file. */
+  using contents = std::vector<char>;
+  /** @brief The default capacity in bytes. */
+  static constexpr std::size_t DEFAULT_CAPACITY = 256UL * 1024 * 1024;
+
+  /**
+   * @brief Constructs an empty in-memory backend.
+   * @param capacity The maximum number of bytes that uploads may grow the
+   * backend to.
+   */
+  explicit memory(std::size_t capacity = DEFAULT_CAPACITY);
+
+  /**
+   * @brief Opens a buffer for reading as a file.
+   * @param bytes The file contents.
+   * @returns A shared pointer to an open file.
+   */
+  static auto reader(std::shared_ptr<const contents> bytes)
+      -> std::shared_ptr<file>;
+
+  /**
+   * @brief Inserts a file, replacing any file at the same path.
+   * @details Inserted files are not subject to the upload capacity.
+   * @param path The path to serve the file at.
+   * @param bytes The file contents.
+   */
+  auto insert(const std::filesystem::path &path, contents bytes) -> void;
+
+  /**
+   * @brief Removes a file.
+   * @param path The path of the file to remove.
+   * @returns true if a file was removed.
+   */
+  auto erase(const std::filesystem::path &path) -> bool;
+
+  /**
+   * @brief Gets the contents of a file.
+   * @param path The path of the file.
+   * @returns The file contents, or nullptr if there is no such file.
+   */
+  [[nodiscard]] auto find(const std::filesystem::path &path) const
+      -> std::shared_ptr<const contents>;
+
+  /**
+   * @brief Loads every regular file below a directory.
+   * @details Files are served at their path relative to `root`.
+   * @param root The directory to load.
+   * @param[out] err An error code that is cleared on success and set on error.
+   * @returns The number of files loaded.
+   */
+  auto load(const std::filesystem::path &root,
+            std::error_code &err) -> std::size_t;
+
+  /** @brief Gets the number of bytes held by the backend. */
+  [[nodiscard]] auto bytes() const -> std::size_t;
+
+  /** @brief Gets the capacity of the backend in bytes. */
+  [[nodiscard]] auto capacity() const noexcept -> std::size_t;
+
+  /** @copydoc backend::open_read */
+  auto open_read(const std::filesystem::path &path,
+                 std::error_code &err) -> std::shared_ptr<file> override;
+
+  /** @copydoc backend::open_write */
+  auto open_write(const std::filesystem::path &path,
+                  std::error_code &err) -> std::shared_ptr<file> override;
+
+  /** @copydoc backend::stat */
+  auto stat(const std::filesystem::path &path,
+            std::error_code &err) -> file_status override;
+
+  /** @brief The shared state of the backend. */
+  struct store;
+
+private:
+  /** @brief The shared state of the backend. */
+  std::shared_ptr<store> store_;
+};
+} // namespace tftp::storage
+#endif // TFTP_STORAGE_MEMORY_HPP
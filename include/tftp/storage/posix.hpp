@@ -0,0 +1,70 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file posix.hpp
+ * @brief This file declares the posix storage backend.
+ */
+#pragma once
+#ifndef TFTP_STORAGE_POSIX_HPP
+#define TFTP_STORAGE_POSIX_HPP
+#include "storage.hpp"
+
+#include <atomic>
+/** @brief For TFTP storage backends. */
+namespace tftp::storage {
+/**
+ * @brief Serves files from the local filesystem.
+ * @details Reads go through filesystem::open_read, so concurrent readers of
+ * a file share a descriptor. Writes go to a temporary file that is renamed
+ * over the target on commit.
+ *
+ * A SHA-256 digest is computed while an upload is written. If the upload is
+ * the same size as the target and has the same digest, the temporary file
+ * is dropped and the target is left untouched. Digests of committed files
+ * are cached in the `user.tftp.sha256` extended attribute where the
+ * filesystem supports it, and recomputed from the target otherwise. A
+ * cached digest is trusted as long as the size and modification time of
+ * the target match it.
+ */
+class posix : public backend {
+public:
+  /** @brief Upload counters. */
+  struct write_stats {
+    /** @brief The number of uploads published over their target. */
+    std::atomic<std::uint64_t> written{0};
+    /** @brief The number of uploads dropped because they were unchanged. */
+    std::atomic<std::uint64_t> avoided{0};
+    /** @brief The number of bytes not written over an unchanged target. */
+    std::atomic<std::uint64_t> bytes_avoided{0};
+  };
+
+  /** @brief Gets the process-wide upload counters. */
+  static auto stats() noexcept -> write_stats &;
+
+  /** @copydoc backend::open_read */
+  auto open_read(const std::filesystem::path &path,
+                 std::error_code &err) -> std::shared_ptr<file> override;
+
+  /** @copydoc backend::open_write */
+  auto open_write(const std::filesystem::path &path,
+                  std::error_code &err) -> std::shared_ptr<file> override;
+
+  /** @copydoc backend::stat */
+  auto stat(const std::filesystem::path &path,
+            std::error_code &err) -> file_status override;
+};
+} // namespace tftp::storage
+#endif // TFTP_STORAGE_POSIX_HPP
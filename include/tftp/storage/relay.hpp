@@ -0,0 +1,153 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file relay.hpp
+ * @brief This file declares the fetch-through relay storage backend.
+ */
+#pragma once
+#ifndef TFTP_STORAGE_RELAY_HPP
+#define TFTP_STORAGE_RELAY_HPP
+#include "storage.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <string>
+#include <string_view>
+/** @brief For TFTP storage backends. */
+namespace tftp::storage {
+/**
+ * @brief Serves files fetched from an upstream TFTP or HTTP origin.
+ * @details Files are kept in a bounded cache directory on local disk. A
+ * file that is not cached yet is downloaded from the origin on the first
+ * read, and clients are served from the partial download while it is still
+ * in progress. Concurrent requests for the same file share one download.
+ * Neither opens nor reads wait for the origin: a read of bytes that have not
+ * arrived yet fails with `operation_would_block`, and the file reports
+ * itself busy until they have.
+ * Once the cache holds more than its capacity, the least recently used
+ * files are deleted.
+ *
+ * The relay is read-only: uploads are refused with `permission_denied`.
+ */
+class relay : public backend {
+public:
+  /** @brief An upstream origin. */
+  struct origin {
+    /** @brief The protocols an origin can be reached with. */
+    enum protocol_t : std::uint8_t { TFTP, HTTP };
+
+    /** @brief The protocol. */
+    protocol_t protocol{TFTP};
+    /** @brief The host name or address. */
+    std::string host;
+    /** @brief The port. */
+    std::uint16_t port{0};
+    /** @brief The path prepended to every requested file. */
+    std::string prefix;
+
+    /**
+     * @brief Parses an origin URL.
+     * @details Accepts `tftp://host[:port][/prefix]` and
+     * `http://host[:port][/prefix]`. IPv6 hosts are written in brackets.
+     * @param url The URL to parse.
+     * @param[out] err An error code that is cleared on success and set to
+     * `invalid_argument` if the URL is malformed.
+     * @returns The origin, or std::nullopt on error.
+     */
+    static auto parse(std::string_view url,
+                      std::error_code &err) -> std::optional<origin>;
+  };
+
+  /** @brief The default cache capacity in bytes. */
+  static constexpr std::uint64_t DEFAULT_CAPACITY = 1024ULL * 1024 * 1024;
+  /** @brief The default time a download waits for the origin. */
+  static constexpr auto DEFAULT_TIMEOUT = std::chrono::milliseconds(5000);
+
+  /** @brief Relay counters. */
+  struct counters {
+    /** @brief The number of opens served from the cache directory. */
+    std::atomic<std::uint64_t> hits{0};
+    /** @brief The number of downloads started. */
+    std::atomic<std::uint64_t> fetches{0};
+    /** @brief The number of downloads that failed. */
+    std::atomic<std::uint64_t> failures{0};
+    /** @brief The number of files deleted to make room. */
+    std::atomic<std::uint64_t> evictions{0};
+    /** @brief The number of bytes downloaded. */
+    std::atomic<std::uint64_t> bytes_fetched{0};
+  };
+
+  /**
+   * @brief Constructs a relay.
+   * @details Files already in the cache directory are served without
+   * contacting the origin, oldest first in line for eviction.
+   * @param upstream The origin to fetch files from.
+   * @param cache_dir The directory to cache files in. It is created if it
+   * does not exist.
+   * @param capacity The maximum number of bytes to cache.
+   * @param timeout How long a download waits for the origin to respond
+   * before it fails.
+   */
+  relay(origin upstream, std::filesystem::path cache_dir,
+        std::uint64_t capacity = DEFAULT_CAPACITY,
+        std::chrono::milliseconds timeout = DEFAULT_TIMEOUT);
+  /** @brief Deleted copy constructor. */
+  relay(const relay &) = delete;
+  /** @brief Deleted move constructor. */
+  relay(relay &&) = delete;
+  /** @brief Deleted copy assignment. */
+  auto operator=(const relay &) -> relay & = delete;
+  /** @brief Deleted move assignment. */
+  auto operator=(relay &&) -> relay & = delete;
+  /** @brief Cancels downloads in progress. */
+  ~relay() override;
+
+  /** @brief Gets the number of bytes in the cache directory. */
+  [[nodiscard]] auto bytes() const -> std::uint64_t;
+
+  /** @brief Gets the relay counters. */
+  [[nodiscard]] auto stats() noexcept -> counters &;
+
+  /**
+   * @copydoc backend::open_read
+   * @details Files that are not cached yet are opened as soon as their
+   * download starts. Whether the origin has the file is reported by the
+   * file's busy() once the download fails.
+   */
+  auto open_read(const std::filesystem::path &path,
+                 std::error_code &err) -> std::shared_ptr<file> override;
+
+  /** @copydoc backend::open_write */
+  auto open_write(const std::filesystem::path &path,
+                  std::error_code &err) -> std::shared_ptr<file> override;
+
+  /**
+   * @copydoc backend::stat
+   * @details Only cached files are reported; the origin is not contacted.
+   */
+  auto stat(const std::filesystem::path &path,
+            std::error_code &err) -> file_status override;
+
+  /** @brief The shared state of the relay. */
+  struct state;
+
+private:
+  /** @brief The shared state of the relay. */
+  std::shared_ptr<state> state_;
+};
+} // namespace tftp::storage
+#endif // TFTP_STORAGE_RELAY_HPP
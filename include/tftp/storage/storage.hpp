@@ -0,0 +1,221 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file storage.hpp
+ * @brief This file declares the storage backend interface.
+ */
+#pragma once
+#ifndef TFTP_STORAGE_HPP
+#define TFTP_STORAGE_HPP
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <system_error>
+/** @brief For TFTP storage backends. */
+namespace tftp::storage {
+/** @brief File metadata reported by a backend. */
+struct file_status {
+  /** @brief The file size in bytes. */
+  std::uint64_t size{0};
+  /** @brief The last modification time. */
+  std::filesystem::file_time_type last_write;
+};
+
+/**
+ * @brief A file opened by a storage backend.
+ * @details A file is opened either for reading or for writing. Reads are
+ * positional so that backends can share the underlying data between
+ * sessions, and each file keeps a cursor for sequential reads. Writes are
+ * appended and only become visible at the target path on commit().
+ */
+class file {
+public:
+  /** @brief Default constructor. */
+  file() = default;
+  /** @brief Deleted copy constructor. */
+  file(const file &) = delete;
+  /** @brief Deleted move constructor. */
+  file(file &&) = delete;
+  /** @brief Deleted copy assignment. */
+  auto operator=(const file &) -> file & = delete;
+  /** @brief Deleted move assignment. */
+  auto operator=(file &&) -> file & = delete;
+  /** @brief Virtual destructor. */
+  virtual ~file() = default;
+
+  /**
+   * @brief Reads bytes from an offset into the file.
+   * @param offset The offset to read from.
+   * @param buf The buffer to read into.
+   * @param[out] err An error code that is cleared on success and set on error.
+   * @returns The number of bytes read. Short reads only happen at EOF.
+   */
+  virtual auto read_at(std::uint64_t offset, std::span<char> buf,
+                       std::error_code &err) -> std::size_t = 0;
+
+  /**
+   * @brief Appends bytes to a file opened for writing.
+   * @param buf The bytes to append.
+   * @param[out] err An error code that is cleared on success and set on error.
+   */
+  virtual auto append(std::span<const char> buf,
+                      std::error_code &err) -> void = 0;
+
+  /**
+   * @brief Publishes a file opened for writing at its target path.
+   * @details The file is closed afterwards.
+   * @param[out] err An error code that is cleared on success and set on error.
+   */
+  virtual auto commit(std::error_code &err) -> void = 0;
+
+  /**
+   * @brief Closes the file.
+   * @details Uncommitted writes are discarded.
+   */
+  virtual auto close() noexcept -> void = 0;
+
+  /** @brief Checks if the file is open. */
+  [[nodiscard]] virtual auto is_open() const noexcept -> bool = 0;
+
+  /** @brief Gets the size of the file in bytes. */
+  [[nodiscard]] virtual auto size() const noexcept -> std::uint64_t = 0;
+
+  /**
+   * @brief Checks if the file is still absorbing earlier writes, or still
+   * waiting for the bytes that are read next.
+   * @details Files that hand their writes to a slower consumer stay busy
+   * until it catches up, and no more data should be acknowledged until
+   * then. Files that are read while they still arrive from a slower
+   * producer stay busy until the bytes past the read cursor are there, and
+   * no more data should be sent until then. Other files are never busy.
+   * @param[out] err An error code that is cleared on success and set if an
+   * earlier write, or the producer, failed.
+   * @returns true if the file is busy.
+   */
+  virtual auto busy(std::error_code &err) -> bool
+  {
+    err.clear();
+    return false;
+  }
+
+  /**
+   * @brief Checks if every byte of the file is there to be read.
+   * @details Files that are read while they still arrive from a slower
+   * producer are incomplete until it finishes, and their size() only counts
+   * the bytes so far. Other files are always complete.
+   */
+  [[nodiscard]] virtual auto complete() const noexcept -> bool
+  {
+    return true;
+  }
+
+  /**
+   * @brief Reads the next bytes of the file into buf.
+   * @param buf The buffer to read into.
+   * @param[out] err An error code that is cleared on success and set on error.
+   * @returns The number of bytes read. Short reads only happen at EOF.
+   */
+  auto read(std::span<char> buf, std::error_code &err) -> std::size_t
+  {
+    auto len = read_at(offset_, buf, err);
+    offset_ += len;
+    return len;
+  }
+
+  /** @brief Gets the offset of the next sequential read. */
+  [[nodiscard]] auto offset() const noexcept -> std::uint64_t
+  {
+    return offset_;
+  }
+
+  /**
+   * @brief Moves the offset of the next sequential read.
+   * @param offset The new offset.
+   */
+  auto seek(std::uint64_t offset) noexcept -> void { offset_ = offset; }
+
+private:
+  /** @brief The offset of the next sequential read. */
+  std::uint64_t offset_{0};
+};
+
+/**
+ * @brief A storage backend.
+ * @details Backends report errors with std::errc values:
+ * `no_such_file_or_directory` if a file does not exist, `permission_denied`
+ * if it may not be accessed, and `no_space_on_device` or `file_too_large`
+ * if a write does not fit.
+ */
+class backend {
+public:
+  /** @brief Default constructor. */
+  backend() = default;
+  /** @brief Deleted copy constructor. */
+  backend(const backend &) = delete;
+  /** @brief Deleted move constructor. */
+  backend(backend &&) = delete;
+  /** @brief Deleted copy assignment. */
+  auto operator=(const backend &) -> backend & = delete;
+  /** @brief Deleted move assignment. */
+  auto operator=(backend &&) -> backend & = delete;
+  /** @brief Virtual destructor. */
+  virtual ~backend() = default;
+
+  /**
+   * @brief Opens a file for reading.
+   * @param path The file to open.
+   * @param[out] err An error code that is cleared on success and set on error.
+   * @returns A shared pointer to an open file.
+   */
+  virtual auto open_read(const std::filesystem::path &path,
+                         std::error_code &err) -> std::shared_ptr<file> = 0;
+
+  /**
+   * @brief Opens a file for writing.
+   * @param path The file to write.
+   * @param[out] err An error code that is cleared on success and set on error.
+   * @returns A shared pointer to an open file.
+   */
+  virtual auto open_write(const std::filesystem::path &path,
+                          std::error_code &err) -> std::shared_ptr<file> = 0;
+
+  /**
+   * @brief Gets the status of a file.
+   * @param path The file to inspect.
+   * @param[out] err An error code that is cleared on success and set on error.
+   * @returns The file status.
+   */
+  virtual auto stat(const std::filesystem::path &path,
+                    std::error_code &err) -> file_status = 0;
+};
+
+/**
+ * @brief Gets the backend that new sessions are served from.
+ * @details Defaults to the posix backend.
+ * @returns A shared pointer to the current backend.
+ */
+auto current() -> std::shared_ptr<backend>;
+
+/**
+ * @brief Installs the backend that new sessions are served from.
+ * @details Sessions that are already running keep the files they have open.
+ * @param next The backend to install.
+ * @returns The previously installed backend.
+ */
+auto install(std::shared_ptr<backend> next) -> std::shared_ptr<backend>;
+} // namespace tftp::storage
+#endif // TFTP_STORAGE_HPP
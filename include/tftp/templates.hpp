@@ -0,0 +1,205 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file templates.hpp
+ * @brief This file declares virtual files rendered on request.
+ */
+#pragma once
+#ifndef TFTP_TEMPLATES_HPP
+#define TFTP_TEMPLATES_HPP
+#include "detail/generator.hpp"
+#include "rewrite.hpp"
+#include "storage/memory.hpp"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+/** @brief For virtual files rendered on request. */
+namespace tftp::templates {
+/** @brief What a virtual file is rendered from. */
+struct context {
+  /** @brief The requesting client. */
+  rewrite::client client;
+  /** @brief The filename captures. captures[0] is the whole filename. */
+  std::vector<std::string> captures;
+};
+
+/**
+ * @brief Renders a virtual file.
+ * @details The file is produced lazily: each yielded chunk is pulled only
+ * when a client reads past the chunks before it. Yielded views must stay
+ * valid until the generator is resumed.
+ */
+using renderer = std::function<detail::generator<std::string_view>(context)>;
+
+/**
+ * @brief Virtual files that are rendered when they are requested.
+ * @details Each virtual file is a regex over requested filenames and a
+ * renderer. Rendered files are memoized by their inputs (the rule, the
+ * captures and, for rules that use them, the client's addresses), so a file
+ * is only rendered once for every distinct set of inputs until it is evicted
+ * or clear() is called. The patterns are narrowed down by a
+ * rewrite::pattern_filter, so a request only runs the ones that can match.
+ */
+class registry {
+public:
+  /** @brief Rendered file contents. */
+  using contents = storage::memory::contents;
+
+  /** @brief The default number of rendered files that are memoized. */
+  static constexpr std::size_t DEFAULT_MEMO_SIZE = 4096;
+
+  /** @brief Registry counters. */
+  struct counters {
+    /** @brief The number of files rendered. */
+    std::atomic<std::uint64_t> renders{0};
+    /** @brief The number of files served from the memo. */
+    std::atomic<std::uint64_t> hits{0};
+  };
+
+  /**
+   * @brief Constructs an empty registry.
+   * @param memo_size The number of rendered files to memoize.
+   */
+  explicit registry(std::size_t memo_size = DEFAULT_MEMO_SIZE);
+
+  /**
+   * @brief Renders a template.
+   * @details `$0`-`$9` expand to the filename captures, and `{ip}` and
+   * `{mac}` to the client's addresses.
+   * @param text The template.
+   * @param ctx The inputs to render with.
+   * @returns The rendered chunks.
+   */
+  static auto render(std::shared_ptr<const std::string> text,
+                     context ctx) -> detail::generator<std::string_view>;
+
+  /**
+   * @brief Adds a virtual file.
+   * @details Each call relinks the pattern filter. Use load() to add many
+   * files at once.
+   * @param pattern An ECMAScript regex that must match the whole filename.
+   * @param func The renderer.
+   * @param[out] err An error code that is cleared on success and set to
+   * `invalid_argument` if the pattern is malformed.
+   */
+  auto add(std::string_view pattern, renderer func,
+           std::error_code &err) -> void;
+
+  /**
+   * @brief Adds a virtual file rendered from a template.
+   * @details Each call relinks the pattern filter. Use load() to add many
+   * files at once.
+   * @param pattern An ECMAScript regex that must match the whole filename.
+   * @param text The template. See render().
+   * @param[out] err An error code that is cleared on success and set to
+   * `invalid_argument` if the pattern is malformed.
+   */
+  auto add_template(std::string_view pattern, std::string text,
+                    std::error_code &err) -> void;
+
+  /**
+   * @brief Loads virtual files from a file.
+   * @details Each line holds a pattern and the path of its template,
+   * separated by whitespace. Blank lines and lines starting with `#` are
+   * ignored. Relative template paths are resolved against the directory of
+   * the file.
+   * @param file The file to load.
+   * @param[out] err An error code that is cleared on success and set on error.
+   * @param[out] line If not null, set to the line number of a malformed line.
+   * @returns The registry, or nullptr on error.
+   */
+  static auto load(const std::filesystem::path &file, std::error_code &err,
+                   std::size_t *line = nullptr) -> std::shared_ptr<registry>;
+
+  /**
+   * @brief Opens a virtual file.
+   * @details The client MAC is looked up if the matching virtual file uses
+   * it and `who` does not carry it.
+   * @param filename The requested filename.
+   * @param who The requesting client.
+   * @returns The file, or nullptr if no virtual file matches.
+   */
+  auto open(std::string_view filename,
+            const rewrite::client &who) -> std::shared_ptr<storage::file>;
+
+  /** @brief Drops every memoized file. */
+  auto clear() -> void;
+
+  /** @brief Gets the number of memoized bytes. */
+  [[nodiscard]] auto bytes() const -> std::size_t;
+
+  /**
+   * @brief Drops the least recently used memoized files.
+   * @param bytes The number of bytes to free.
+   * @returns The number of bytes freed.
+   */
+  auto shrink(std::size_t bytes) -> std::size_t;
+
+  /** @brief Gets the number of virtual files. */
+  [[nodiscard]] auto size() const noexcept -> std::size_t;
+
+  /** @brief Gets the registry counters. */
+  [[nodiscard]] auto stats() noexcept -> counters &;
+
+  /** @brief The memoized files. */
+  struct memo;
+
+private:
+  /** @brief A virtual file. */
+  struct rule {
+    /** @brief The filename pattern. */
+    std::regex pattern;
+    /** @brief The renderer. */
+    renderer render;
+    /** @brief Set if the output depends on the client's addresses. */
+    bool uses_client;
+    /** @brief Set if the output depends on the client MAC. */
+    bool uses_mac;
+  };
+
+  /** @brief Adds a rule without linking the filter. */
+  auto add(std::string_view pattern, renderer func, bool uses_client,
+           bool uses_mac, std::error_code &err) -> void;
+
+  /** @brief Adds a template rule without linking the filter. */
+  auto insert_template(std::string_view pattern, std::string text,
+                       std::error_code &err) -> void;
+
+  /** @brief The virtual files in the order they were added. */
+  std::vector<rule> rules_;
+  /** @brief Narrows down the rules for a filename. */
+  rewrite::pattern_filter filter_;
+  /** @brief The memoized files. */
+  std::shared_ptr<memo> memo_;
+};
+
+/**
+ * @brief Gets the virtual files that are served ahead of storage.
+ * @returns The current registry, or nullptr if there are no virtual files.
+ */
+auto current() -> std::shared_ptr<registry>;
+
+/**
+ * @brief Installs the virtual files that are served ahead of storage.
+ * @param next The registry to install, or nullptr to remove it.
+ * @returns The previously installed registry.
+ */
+auto install(std::shared_ptr<registry> next) -> std::shared_ptr<registry>;
+} // namespace tftp::templates
+#endif // TFTP_TEMPLATES_HPP
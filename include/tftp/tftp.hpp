@@ -40,8 +40,36 @@ using iterator_t = sessions_t::iterator;
  */
 auto handle_request(messages::request req, iterator_t siter) -> std::uint16_t;
 
+/**
+ * @brief Checks if an RRQ must wait before its file is read.
+ * @details Files that still arrive from a slower producer, like a relay's
+ * origin, stay busy until the next blocks are there. The file must not be
+ * read until then.
+ * @param siter An iterator pointing to the session.
+ * @param[out] error Set to a non-zero TFTP error if the file failed, 0
+ * otherwise.
+ * @returns true if the session must wait.
+ */
+auto read_pending(iterator_t siter, std::uint16_t &error) -> bool;
+
+/**
+ * @brief Checks if the last DATA packet of an RRQ is due to be resent.
+ * @details A packet is due once the session timeout has passed since the
+ * later of the last new block and the last resend, so a timer that ticks
+ * more often than the timeout still spaces resends by the timeout.
+ * @param state The session state.
+ * @param now The current time.
+ * @param[in,out] resent When the packet was last resent. Set to now if the
+ * packet is due.
+ * @returns true if the packet is due to be resent.
+ */
+auto resend_due(const session::state_t &state, session::timestamp now,
+                session::timestamp &resent) noexcept -> bool;
+
 /**
  * @brief Processes an ack message.
+ * @details The first block of a file that was pending when the request was
+ * handled is sent on an ACK of block 0.
  * @param ack The TFTP ack to process.
  * @param siter An iterator pointing to the session.
  * @returns 0 if successful, a non-zero TFTP error otherwise.
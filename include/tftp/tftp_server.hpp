@@ -109,6 +109,29 @@ private:
            const std::shared_ptr<read_context> &rctx,
            std::span<const std::byte> msg, iterator_t siter) -> void;
 
+  /**
+   * @brief Advances an RRQ past an ACK and sends what comes next.
+   * @param ctx The asynchronous context of the message.
+   * @param socket The socket to send data on.
+   * @param siter An iterator pointing to the session.
+   * @param ack The ACK to process.
+   * @returns false if the session ended.
+   */
+  auto advance(async_context &ctx, const socket_dialog &socket,
+               iterator_t siter, messages::ack ack) -> bool;
+
+  /**
+   * @brief Processes an ACK once the file has the blocks it sends next.
+   * @details The file is polled every session::TIMEOUT_MIN and times out if
+   * it stays busy for too long. The event loop never waits on the file.
+   * @param ctx The asynchronous context of the message.
+   * @param socket The socket to send data on.
+   * @param siter An iterator pointing to the session.
+   * @param ack The ACK to process.
+   */
+  auto defer_read(async_context &ctx, const socket_dialog &socket,
+                  iterator_t siter, messages::ack ack) -> void;
+
   /**
    * @brief Services a write request.
    * @param ctx The asynchronous context of the message.
@@ -133,6 +156,26 @@ private:
             const std::shared_ptr<read_context> &rctx,
             std::span<const std::byte> buf, iterator_t siter) -> void;
 
+  /**
+   * @brief Waits for the next data packet after a block is acked.
+   * @param ctx The asynchronous context of the message.
+   * @param socket The socket that the message was read from.
+   * @param siter An iterator pointing to the session.
+   */
+  auto await_data(async_context &ctx, const socket_dialog &socket,
+                  iterator_t siter) -> void;
+
+  /**
+   * @brief Acks the current block once the upload is no longer busy.
+   * @details The upload is polled every session::TIMEOUT_MIN and times out
+   * if it stays busy for too long.
+   * @param ctx The asynchronous context of the message.
+   * @param socket The socket to send the ACK on.
+   * @param siter An iterator pointing to the session.
+   */
+  auto defer_ack(async_context &ctx, const socket_dialog &socket,
+                 iterator_t siter) -> void;
+
   /**
    * @brief Cleans-up the session from the server.
    * @param ctx The asynchronous context of the message.
@@ -142,6 +185,15 @@ private:
   auto cleanup(async_context &ctx, const socket_dialog &socket,
                iterator_t siter) -> void;
 
+  /**
+   * @brief Arms the retransmission timer of an RRQ after a send.
+   * @param ctx The asynchronous context of the message.
+   * @param socket The socket to retransmit on.
+   * @param siter An iterator pointing to the session.
+   */
+  auto arm_retransmit(async_context &ctx, const socket_dialog &socket,
+                      iterator_t siter) -> void;
+
   /**
    * @brief Sends the current block of data to the client.
    * @param ctx The asynchronous context of the message.
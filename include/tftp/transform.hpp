@@ -0,0 +1,423 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file transform.hpp
+ * @brief This file declares the streaming transform pipeline for served files.
+ */
+#pragma once
+#ifndef TFTP_TRANSFORM_HPP
+#define TFTP_TRANSFORM_HPP
+#include "tftp/storage/storage.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+/** @brief For transforms applied to served files. */
+namespace tftp::transform {
+/**
+ * @brief A stage of a transform pipeline.
+ * @details Stages pull bytes from the stage before them a span at a time, so
+ * there is one virtual call per span rather than per byte. Each stage keeps
+ * at most a fixed amount of buffered input and output of its own.
+ */
+class stage {
+public:
+  /** @brief Default constructor. */
+  stage() = default;
+  /** @brief Deleted copy constructor. */
+  stage(const stage &) = delete;
+  /** @brief Deleted move constructor. */
+  stage(stage &&) = delete;
+  /** @brief Deleted copy assignment. */
+  auto operator=(const stage &) -> stage & = delete;
+  /** @brief Deleted move assignment. */
+  auto operator=(stage &&) -> stage & = delete;
+  /** @brief Virtual destructor. */
+  virtual ~stage() = default;
+
+  /**
+   * @brief Produces the next bytes of the stream.
+   * @param buf The buffer to fill.
+   * @param[out] err An error code that is cleared on success and set on error.
+   * @returns The number of bytes written to buf, which may be short. 0 marks
+   * the end of the stream.
+   */
+  virtual auto pull(std::span<char> buf,
+                    std::error_code &err) -> std::size_t = 0;
+
+  /**
+   * @brief Moves to an offset in the output of the stage.
+   * @param offset The output offset to produce next.
+   * @param[out] err An error code that is cleared on success and set on
+   * error. Offsets past the end of the stream set `invalid_argument`.
+   * @returns false if the stage can not seek.
+   */
+  virtual auto seek(std::uint64_t offset, std::error_code &err) -> bool
+  {
+    err.clear();
+    return false;
+  }
+};
+
+/** @brief Builds a stage on top of the stage before it. */
+using factory = std::function<std::unique_ptr<stage>(std::unique_ptr<stage>)>;
+
+/** @brief Reads a file from its current offset. */
+class source final : public stage {
+public:
+  /**
+   * @brief Constructs a source.
+   * @param file The file to read.
+   */
+  explicit source(std::shared_ptr<storage::file> file) noexcept;
+
+  /** @copydoc stage::pull */
+  auto pull(std::span<char> buf, std::error_code &err) -> std::size_t override;
+
+  /**
+   * @copydoc stage::seek
+   * @details Moves the file cursor, so the next read is positional at
+   * offset without reading the bytes before it. The size of a file that is
+   * produced as it is read (e.g. a rendered virtual file) only counts the
+   * bytes so far, so an offset past it is only rejected once reading up to
+   * the offset comes up short.
+   */
+  auto seek(std::uint64_t offset, std::error_code &err) -> bool override;
+
+private:
+  /** @brief The file to read. */
+  std::shared_ptr<storage::file> file_;
+};
+
+/**
+ * @brief Checkpoints of a NETASCII encoding.
+ * @details NETASCII changes lengths, so the input offset of a DATA block can
+ * not be computed from its number. The encoder records its state every
+ * STRIDE output bytes as it runs, and a later seek restarts from the
+ * nearest checkpoint, transcoding at most STRIDE bytes to reach any block.
+ * Indexes are shared by every transfer of the same file contents.
+ */
+class netascii_index {
+public:
+  /** @brief The number of output bytes between checkpoints. */
+  static constexpr std::size_t STRIDE = 4096;
+  /** @brief The most indexes that are shared. */
+  static constexpr std::size_t MAX_SHARED = 1024;
+
+  /** @brief The encoder state at a checkpoint. */
+  struct checkpoint {
+    /** @brief The offset of the next input byte. */
+    std::uint64_t input{0};
+    /** @brief Encoded bytes that are yet to be output. */
+    std::array<char, 2> pending{};
+    /** @brief The number of bytes in pending. */
+    std::uint8_t pending_len{0};
+    /** @brief Set if a carriage return is held back. */
+    bool carriage_return{false};
+  };
+
+  /** @brief Constructs an empty index. */
+  netascii_index() = default;
+
+  /**
+   * @brief Constructs an index with room for a file's checkpoints.
+   * @details Encoding never shrinks a file, so reserving a checkpoint per
+   * STRIDE bytes of the file keeps recording from allocating for files
+   * without line endings, and amortizes it for the rest.
+   * @param size The size of the file.
+   */
+  explicit netascii_index(std::uint64_t size);
+
+  /**
+   * @brief Gets the shared index of a file.
+   * @details An index is keyed by the file's path and status, so a changed
+   * file gets a new index.
+   * @param name The file path.
+   * @param status The file status.
+   * @returns The index.
+   */
+  static auto shared(std::string_view name,
+                     const storage::file_status &status)
+      -> std::shared_ptr<netascii_index>;
+
+  /**
+   * @brief Records a checkpoint.
+   * @details Checkpoints are recorded in order; anything else is ignored.
+   * @param number The checkpoint number. Its output offset is number * STRIDE.
+   * @param point The encoder state.
+   */
+  auto record(std::size_t number, const checkpoint &point) -> void;
+
+  /**
+   * @brief Finds the last checkpoint at or before a checkpoint number.
+   * @param number The checkpoint number.
+   * @param[out] found The number of the checkpoint found.
+   * @returns The checkpoint, or std::nullopt if there are none.
+   */
+  [[nodiscard]] auto find(std::size_t number, std::size_t &found) const
+      -> std::optional<checkpoint>;
+
+  /** @brief Gets the number of checkpoints. */
+  [[nodiscard]] auto size() const -> std::size_t;
+
+private:
+  /** @brief Protects points_. */
+  mutable std::mutex mtx_;
+  /** @brief The checkpoints in order. */
+  std::vector<checkpoint> points_;
+};
+
+/**
+ * @brief Encodes a stream as NETASCII.
+ * @details Bare line feeds become `\r\n`, bare carriage returns become
+ * `\r\0`, and `\r\n` passes through unchanged. Bare null bytes are dropped
+ * so they can not be confused with the `\r\0` sequence. A carriage return
+ * is held back until the next byte is known, so a `\r\n` split across reads
+ * or blocks is encoded the same as one that is not.
+ */
+class netascii final : public stage {
+public:
+  /** @brief The size of the input buffer. */
+  static constexpr std::size_t BUFSIZE = 512;
+
+  /**
+   * @brief Constructs a NETASCII encoder.
+   * @param upstream The stage to encode.
+   * @param index Checkpoints to record to and seek with, if not null.
+   */
+  explicit netascii(std::unique_ptr<stage> upstream,
+                    std::shared_ptr<netascii_index> index = nullptr) noexcept;
+
+  /** @copydoc stage::pull */
+  auto pull(std::span<char> buf, std::error_code &err) -> std::size_t override;
+
+  /**
+   * @copydoc stage::seek
+   * @details Restarts from the nearest indexed checkpoint, or from the start
+   * of the stream, and transcodes forward to offset. Needs an upstream
+   * that can seek.
+   */
+  auto seek(std::uint64_t offset, std::error_code &err) -> bool override;
+
+private:
+  /** @brief Restores the encoder state at a checkpoint. */
+  auto restore(const netascii_index::checkpoint &point) noexcept -> void;
+
+  /** @brief The stage to encode. */
+  std::unique_ptr<stage> upstream_;
+  /** @brief Checkpoints of the encoding, if any. */
+  std::shared_ptr<netascii_index> index_;
+  /** @brief Input read from upstream. */
+  std::array<char, BUFSIZE> input_{};
+  /** @brief The upstream offset of input_. */
+  std::uint64_t input_offset_{0};
+  /** @brief The offset of the next unread input byte. */
+  std::size_t pos_{0};
+  /** @brief The number of bytes in input_. */
+  std::size_t len_{0};
+  /** @brief The number of bytes output so far. */
+  std::uint64_t produced_{0};
+  /** @brief Encoded bytes that are yet to be output. */
+  std::array<char, 2> pending_{};
+  /** @brief The offset of the next pending byte. */
+  std::uint8_t pending_pos_{0};
+  /** @brief The number of bytes in pending_. */
+  std::uint8_t pending_len_{0};
+  /** @brief Set if a carriage return is held back. */
+  bool carriage_return_{false};
+  /** @brief Set once upstream is exhausted. */
+  bool eof_{false};
+};
+
+#ifdef TFTP_ENABLE_ZSTD
+/**
+ * @brief Compresses a stream into a single zstd frame.
+ * @details The stream is compressed as it is pulled, at most about one zstd
+ * block of input per pull, so no single pull compresses the whole file. The
+ * output is kept as it is produced, so the stage can seek back to any
+ * offset it has produced, and seeking forward compresses up to the offset.
+ * Finished frames of streams with a key are kept in a process-wide LRU
+ * cache and validated against the file status, so hot files are only
+ * compressed once.
+ */
+class compressor final : public stage {
+public:
+  /** @brief The size of the largest file that is compressed. */
+  static constexpr std::uint64_t MAX_FILE_SIZE = 16UL * 1024 * 1024;
+  /** @brief The number of compressed bytes that are cached. */
+  static constexpr std::size_t CACHE_CAPACITY = 64UL * 1024 * 1024;
+  /** @brief The zstd compression level. */
+  static constexpr int LEVEL = 3;
+
+  /** @brief A compressed frame. */
+  using frame = std::string;
+
+  /** @brief Compression counters. */
+  struct counters {
+    /** @brief The number of frames served from the cache. */
+    std::atomic<std::uint64_t> hits{0};
+    /** @brief The number of streams that had to be compressed. */
+    std::atomic<std::uint64_t> misses{0};
+    /** @brief The number of uncompressed bytes compressed. */
+    std::atomic<std::uint64_t> input{0};
+    /** @brief The number of compressed bytes produced. */
+    std::atomic<std::uint64_t> output{0};
+  };
+
+  /**
+   * @brief Constructs a compressor.
+   * @param upstream The stage to compress.
+   * @param key Names the uncompressed stream in the cache. Frames of
+   * streams without a key are not cached.
+   * @param status The status of the file the stream is read from.
+   * @param length The length of the uncompressed stream, if it is known. It
+   * is recorded in the frame header.
+   */
+  explicit compressor(std::unique_ptr<stage> upstream, std::string key = {},
+                      storage::file_status status = {},
+                      std::optional<std::uint64_t> length = std::nullopt);
+
+  /** @brief Deleted copy constructor. */
+  compressor(const compressor &) = delete;
+  /** @brief Deleted move constructor. */
+  compressor(compressor &&) = delete;
+  /** @brief Deleted copy assignment. */
+  auto operator=(const compressor &) -> compressor & = delete;
+  /** @brief Deleted move assignment. */
+  auto operator=(compressor &&) -> compressor & = delete;
+  /** @brief Destructor. */
+  ~compressor() override;
+
+  /** @copydoc stage::pull */
+  auto pull(std::span<char> buf, std::error_code &err) -> std::size_t override;
+
+  /** @copydoc stage::seek */
+  auto seek(std::uint64_t offset, std::error_code &err) -> bool override;
+
+  /** @brief Gets the compression counters. */
+  [[nodiscard]] static auto stats() noexcept -> counters &;
+
+  /** @brief Gets the number of bytes held by cached frames. */
+  [[nodiscard]] static auto cached_bytes() -> std::size_t;
+
+  /**
+   * @brief Evicts the least recently used frames to free memory.
+   * @param bytes The number of bytes to free.
+   * @returns The number of bytes freed.
+   */
+  static auto shrink(std::size_t bytes) -> std::size_t;
+
+  /** @brief A compression in progress. */
+  struct stream;
+
+private:
+  /** @brief Looks up the cache, or starts compressing, on first use. */
+  auto load() -> void;
+
+  /**
+   * @brief Compresses more of upstream into the frame.
+   * @param[out] err An error code that is cleared on success and set on
+   * error. Upstream errors are passed on and the pull can be retried.
+   * @returns false once the frame is finished.
+   */
+  auto advance(std::error_code &err) -> bool;
+
+  /** @brief Gets the compressed bytes produced so far. */
+  [[nodiscard]] auto produced() const noexcept -> std::string_view;
+
+  /** @brief The stage to compress. */
+  std::unique_ptr<stage> upstream_;
+  /** @brief The cache key. */
+  std::string key_;
+  /** @brief The status of the file the stream is read from. */
+  storage::file_status status_;
+  /** @brief The length of the uncompressed stream, if it is known. */
+  std::optional<std::uint64_t> length_;
+  /** @brief The finished frame. */
+  std::shared_ptr<const frame> frame_;
+  /** @brief The compression in progress, until the frame is finished. */
+  std::unique_ptr<stream> stream_;
+  /** @brief The offset of the next compressed byte to output. */
+  std::uint64_t pos_{0};
+  /** @brief Set once the cache has been looked up. */
+  bool loaded_{false};
+};
+#endif // TFTP_ENABLE_ZSTD
+
+/**
+ * @brief A chain of stages that produces the contents of DATA blocks.
+ * @details The pipeline starts with a source that reads the file, and each
+ * pushed stage transforms the output of the one before it. Blocks are
+ * filled by pulling from the last stage until the block is full or the
+ * stream ends, so stages never need to know about block boundaries.
+ */
+class pipeline {
+public:
+  /**
+   * @brief Constructs a pipeline that reads a file unchanged.
+   * @param file The file to read.
+   */
+  explicit pipeline(std::shared_ptr<storage::file> file);
+
+  /**
+   * @brief Adds a stage to the end of the pipeline.
+   * @param make Builds the stage on top of the current last stage.
+   * @returns A reference to this pipeline.
+   */
+  auto push(const factory &make) -> pipeline &;
+
+  /**
+   * @brief Fills a buffer with the next bytes of the stream.
+   * @param buf The buffer to fill.
+   * @param[out] err An error code that is cleared on success and set on error.
+   * @returns The number of bytes written to buf. This is less than the size
+   * of buf only at the end of the stream.
+   */
+  auto fill(std::span<char> buf, std::error_code &err) -> std::size_t;
+
+  /**
+   * @brief Moves to an offset in the output of the pipeline.
+   * @param offset The output offset to produce next.
+   * @param[out] err An error code that is cleared on success and set on error.
+   * @returns false if a stage can not seek.
+   */
+  auto seek(std::uint64_t offset, std::error_code &err) -> bool;
+
+private:
+  /** @brief The last stage of the pipeline. */
+  std::unique_ptr<stage> last_;
+};
+
+/**
+ * @brief Builds the pipeline that serves a file in a transfer mode.
+ * @param file The file to serve.
+ * @param mode The TFTP transfer mode.
+ * @param index The NETASCII checkpoints of the file, if any.
+ * @returns The pipeline.
+ */
+auto make_pipeline(std::shared_ptr<storage::file> file, std::uint8_t mode,
+                   std::shared_ptr<netascii_index> index = nullptr)
+    -> std::unique_ptr<pipeline>;
+} // namespace tftp::transform
+#endif // TFTP_TRANSFORM_HPP
@@ -0,0 +1,165 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file watcher.hpp
+ * @brief This file declares a filesystem change watcher.
+ */
+#pragma once
+#ifndef TFTP_WATCHER_HPP
+#define TFTP_WATCHER_HPP
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+/** @brief For TFTP filesystem management. */
+namespace tftp::filesystem {
+/**
+ * @brief Watches a directory tree and reports changes to it.
+ * @details Every directory below the root is watched with inotify from a
+ * background thread, and subscribers are called with the path of each file
+ * or directory that is modified, created, moved or deleted. A path names
+ * everything below it, so subscribers should drop every cached entry with
+ * that prefix.
+ *
+ * If the tree can not be watched (e.g. the inotify watch limit is hit) the
+ * watcher is degraded: it no longer covers() any path and instead reports
+ * the whole root as changed once every interval, so caches fall back to
+ * periodic validation.
+ */
+class watcher {
+public:
+  /** @brief A change subscriber. */
+  using callback = std::function<void(const std::filesystem::path &)>;
+
+  /** @brief The default periodic validation interval. */
+  static constexpr auto DEFAULT_INTERVAL = std::chrono::milliseconds(1000);
+
+  /** @brief Watcher counters. */
+  struct counters {
+    /** @brief The number of change events received. */
+    std::atomic<std::uint64_t> events{0};
+    /** @brief The number of invalidations reported to subscribers. */
+    std::atomic<std::uint64_t> invalidations{0};
+    /** @brief The number of times the kernel event queue overflowed. */
+    std::atomic<std::uint64_t> overflows{0};
+    /** @brief The latency of the most recent measured invalidation. */
+    std::atomic<std::int64_t> last_latency_us{0};
+    /** @brief The largest measured invalidation latency. */
+    std::atomic<std::int64_t> max_latency_us{0};
+    /** @brief The sum of all measured invalidation latencies. */
+    std::atomic<std::int64_t> total_latency_us{0};
+    /** @brief The number of measured invalidation latencies. */
+    std::atomic<std::uint64_t> measured{0};
+  };
+
+  /**
+   * @brief Starts watching a directory tree.
+   * @param root The directory to watch.
+   * @param interval The periodic validation interval used when degraded.
+   */
+  explicit watcher(std::filesystem::path root,
+                   std::chrono::milliseconds interval = DEFAULT_INTERVAL);
+  /** @brief Deleted copy constructor. */
+  watcher(const watcher &) = delete;
+  /** @brief Deleted move constructor. */
+  watcher(watcher &&) = delete;
+  /** @brief Deleted copy assignment. */
+  auto operator=(const watcher &) -> watcher & = delete;
+  /** @brief Deleted move assignment. */
+  auto operator=(watcher &&) -> watcher & = delete;
+  /** @brief Stops watching. */
+  ~watcher();
+
+  /**
+   * @brief Subscribes to changes.
+   * @details Subscribers are called from the watcher thread.
+   * @param func The subscriber.
+   */
+  auto subscribe(callback func) -> void;
+
+  /**
+   * @brief Checks if changes to a path are reported.
+   * @details Relative paths are resolved against the working directory at
+   * the time the watcher was started.
+   * @param path The path to check.
+   * @returns true if the path is below the root and the watcher is not
+   * degraded.
+   */
+  [[nodiscard]] auto covers(const std::filesystem::path &path) const -> bool;
+
+  /**
+   * @brief Checks if a path may change without the change being reported.
+   * @details covers() only compares names, but a file reached through a
+   * symlink, or with hard links of its own, can be changed from outside the
+   * root. This resolves and stats the path, so callers check it once when
+   * they first cache a file rather than on every lookup.
+   * @param path The path to check.
+   * @returns true if the path differs from its canonical form, the file has
+   * more than one link, or the path can not be resolved.
+   */
+  [[nodiscard]] static auto aliased(const std::filesystem::path &path) -> bool;
+
+  /** @brief Checks if the watcher has fallen back to periodic validation. */
+  [[nodiscard]] auto degraded() const noexcept -> bool;
+
+  /** @brief Gets the watched root. */
+  [[nodiscard]] auto root() const noexcept -> const std::filesystem::path &;
+
+  /** @brief Gets the watcher counters. */
+  [[nodiscard]] auto stats() noexcept -> counters &;
+
+private:
+  /** @brief Watches dir and every directory below it. */
+  auto add_tree(const std::filesystem::path &dir) -> void;
+  /** @brief Reads and dispatches pending events. */
+  auto drain() -> void;
+  /** @brief Reports a change to every subscriber. */
+  auto notify(const std::filesystem::path &path) -> void;
+  /** @brief Records the latency between a change to path and its report. */
+  auto measure(const std::filesystem::path &path) -> void;
+  /** @brief Marks the watcher as degraded. */
+  auto degrade(const std::error_code &err) -> void;
+  /** @brief The watcher thread. */
+  auto run(const std::stop_token &token) -> void;
+
+  /** @brief The working directory used to resolve relative paths. */
+  std::filesystem::path cwd_;
+  /** @brief The watched root. */
+  std::filesystem::path root_;
+  /** @brief The periodic validation interval. */
+  std::chrono::milliseconds interval_;
+  /** @brief The inotify descriptor. */
+  int fd_{-1};
+  /** @brief The watched directories, keyed by watch descriptor. */
+  std::unordered_map<int, std::filesystem::path> dirs_;
+  /** @brief Set when the watcher falls back to periodic validation. */
+  std::atomic<bool> degraded_{false};
+  /** @brief Protects subscribers_. */
+  std::mutex mtx_;
+  /** @brief The change subscribers. */
+  std::vector<callback> subscribers_;
+  /** @brief The watcher counters. */
+  counters stats_;
+  /** @brief The watcher thread. */
+  std::jthread thread_;
+};
+} // namespace tftp::filesystem
+#endif // TFTP_WATCHER_HPP
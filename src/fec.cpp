@@ -0,0 +1,122 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file fec.cpp
+ * @brief This file defines forward error correction for RRQ transfers.
+ */
+#include "tftp/fec.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include <arpa/inet.h>
+namespace tftp::fec {
+
+auto encoder::reset(std::uint16_t first_block) noexcept -> void
+{
+  parity_.fill(0);
+  first_block_ = first_block;
+  count_ = 0;
+  length_ = 0;
+}
+
+auto encoder::add(std::span<const char> payload) noexcept -> void
+{
+  const auto len = std::min(payload.size(), parity_.size());
+  for (std::size_t i = 0; i < len; ++i)
+    parity_[i] = static_cast<char>(parity_[i] ^ payload[i]);
+
+  length_ ^= static_cast<std::uint16_t>(len);
+  ++count_;
+}
+
+auto encoder::size() const noexcept -> std::size_t { return count_; }
+
+auto encoder::packet() noexcept -> std::span<const char>
+{
+  const auto header = repair_header{.opc = htons(REPAIR),
+                                    .first_block = htons(first_block_),
+                                    .count = htons(count_),
+                                    .length = htons(length_)};
+  std::memcpy(packet_.data(), &header, sizeof(header));
+  std::ranges::copy(parity_, packet_.begin() + sizeof(header));
+  return packet_;
+}
+
+auto decoder::data(std::uint16_t block, std::span<const char> payload) -> void
+{
+  blocks_.insert_or_assign(block, std::string(payload.begin(), payload.end()));
+}
+
+auto decoder::repair(std::span<const char> packet)
+    -> std::optional<std::pair<std::uint16_t, std::string>>
+{
+  if (packet.size() < REPAIR_MSGLEN)
+    return std::nullopt;
+
+  auto header = repair_header{};
+  std::memcpy(&header, packet.data(), sizeof(header));
+  if (ntohs(header.opc) != REPAIR)
+    return std::nullopt;
+
+  auto parity = std::string(packet.begin() + sizeof(header),
+                            packet.begin() + REPAIR_MSGLEN);
+  const auto first = ntohs(header.first_block);
+  auto length = ntohs(header.length);
+  auto missing = std::optional<std::uint16_t>();
+  for (std::uint16_t i = 0; i < ntohs(header.count); ++i)
+  {
+    const auto block = static_cast<std::uint16_t>(first + i);
+    auto it = blocks_.find(block);
+    if (it == blocks_.end())
+    {
+      // Parity can only rebuild one block per group.
+      if (missing)
+        return std::nullopt;
+
+      missing = block;
+      continue;
+    }
+
+    const auto &payload = it->second;
+    for (std::size_t pos = 0; pos < payload.size(); ++pos)
+      parity[pos] = static_cast<char>(parity[pos] ^ payload[pos]);
+    length ^= static_cast<std::uint16_t>(payload.size());
+  }
+
+  if (!missing || length > messages::DATALEN)
+    return std::nullopt;
+
+  parity.resize(length);
+  data(*missing, parity);
+  return std::make_pair(*missing, std::move(parity));
+}
+
+auto decoder::find(std::uint16_t block) const -> const std::string *
+{
+  auto it = blocks_.find(block);
+  return (it == blocks_.end()) ? nullptr : &it->second;
+}
+
+auto decoder::release(std::uint16_t block) -> void
+{
+  // Block numbers wrap, so release the half window behind block.
+  constexpr auto HALF = std::uint16_t{0x8000};
+  std::erase_if(blocks_, [&](const auto &entry) {
+    return static_cast<std::uint16_t>(block - entry.first) < HALF;
+  });
+}
+} // namespace tftp::fec
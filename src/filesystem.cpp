@@ -18,11 +18,425 @@
  * @brief This file implements filesystem utilities.
  */
 #include "tftp/filesystem.hpp"
+#include "tftp/detail/single_flight.hpp"
+#include "tftp/watcher.hpp"
 
+#include <algorithm>
 #include <cstdio>
 #include <format>
+#include <map>
+#include <mutex>
+#include <string>
 #include <system_error>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <unistd.h>
 namespace tftp::filesystem {
+/** @brief The result of opening a descriptor. */
+struct open_result {
+  /** @brief The opened descriptor. */
+  std::shared_ptr<const descriptor> desc;
+  /** @brief The error if the open failed. */
+  std::error_code err;
+};
+
+/**
+ * @brief Gets the absolute, normalized form of a path.
+ * @details Trailing separators are dropped so that everything below the
+ * path shares the prefix `key + '/'`.
+ */
+static auto absolute_key(const std::filesystem::path &file) -> std::string
+{
+  auto err = std::error_code();
+  auto absolute = file.is_absolute()
+                      ? file.lexically_normal()
+                      : (std::filesystem::current_path(err) / file)
+                            .lexically_normal();
+  auto key = std::move(absolute).native();
+  while (!key.empty() && key.back() == '/')
+    key.pop_back();
+
+  return key;
+}
+
+/** @brief Read descriptors shared between sessions. */
+struct shared_descriptors {
+  /** @brief Sweep expired entries once the table grows past this size. */
+  static constexpr std::size_t SWEEP_THRESHOLD = 1024;
+
+  /** @brief An open descriptor. */
+  struct entry {
+    /** @brief The descriptor. */
+    std::weak_ptr<const descriptor> desc;
+    /** @brief The absolute_key() of the path it was opened by. */
+    std::string absolute;
+    /** @brief Set if the watcher reports every change to the file. */
+    bool reported{false};
+  };
+
+  /** @brief Protects open and paths. */
+  std::mutex mtx;
+  /** @brief Descriptors that are currently open, keyed by path. */
+  std::unordered_map<std::string, entry> open;
+  /** @brief The keys of open, ordered by their absolute_key(). */
+  std::multimap<std::string, std::string> paths;
+  /** @brief Opens that are currently in flight. */
+  detail::single_flight<std::string, open_result> flights;
+
+  /**
+   * @brief Finds a live descriptor for path.
+   * @param[out] reported Set if the watcher reports every change to it.
+   */
+  auto find(const std::string &path,
+            bool &reported) -> std::shared_ptr<const descriptor>
+  {
+    auto lock = std::lock_guard{mtx};
+    auto it = open.find(path);
+    if (it == open.end())
+      return {};
+
+    auto desc = it->second.desc.lock();
+    if (!desc)
+    {
+      erase(it);
+      return desc;
+    }
+
+    reported = it->second.reported;
+    return desc;
+  }
+
+  /** @brief Publishes a newly opened descriptor for path. */
+  auto insert(const std::string &path,
+              const std::shared_ptr<const descriptor> &desc,
+              bool reported) -> void
+  {
+    auto absolute = absolute_key(path);
+    auto lock = std::lock_guard{mtx};
+    if (open.size() >= SWEEP_THRESHOLD)
+    {
+      for (auto it = open.begin(); it != open.end();)
+      {
+        if (it->second.desc.expired())
+          it = erase(it);
+        else
+          ++it;
+      }
+    }
+
+    if (auto it = open.find(path); it != open.end())
+      erase(it);
+
+    paths.emplace(absolute, path);
+    open.emplace(path, entry{.desc = desc,
+                             .absolute = std::move(absolute),
+                             .reported = reported});
+  }
+
+  /** @brief Drops the descriptors of absolute and everything below it. */
+  auto drop(const std::string &absolute) -> std::size_t
+  {
+    auto lock = std::lock_guard{mtx};
+    auto dropped = std::size_t{0};
+    auto erase_range = [&](auto first, auto last) {
+      for (auto it = first; it != last;)
+      {
+        open.erase(it->second);
+        it = paths.erase(it);
+        ++dropped;
+      }
+    };
+
+    auto [first, last] = paths.equal_range(absolute);
+    erase_range(first, last);
+    // Every path below absolute sorts between absolute + '/' and
+    // absolute + '0', the character after '/'.
+    erase_range(paths.lower_bound(absolute + '/'),
+                paths.lower_bound(absolute + '0'));
+    return dropped;
+  }
+
+  /** @brief Erases an open descriptor and its entry in paths. */
+  auto erase(std::unordered_map<std::string, entry>::iterator it)
+      -> std::unordered_map<std::string, entry>::iterator
+  {
+    auto [first, last] = paths.equal_range(it->second.absolute);
+    for (; first != last; ++first)
+    {
+      if (first->second == it->first)
+      {
+        paths.erase(first);
+        break;
+      }
+    }
+
+    return open.erase(it);
+  }
+};
+
+/** @brief Paths interned by intern(). */
+struct interned_paths {
+  /** @brief Protects paths. */
+  std::mutex mtx;
+  /** @brief The live paths, keyed by a view of their own storage. */
+  std::unordered_map<std::string_view,
+                     std::weak_ptr<const std::filesystem::path>>
+      paths;
+};
+
+/** @brief Gets the process-wide path table. */
+static auto path_table() -> const std::shared_ptr<interned_paths> &
+{
+  // Handles keep the table alive, so they may outlive static destruction.
+  static const auto table = std::make_shared<interned_paths>();
+  return table;
+}
+
+/** @brief The installed change watcher. */
+struct installed_watcher {
+  /** @brief Protects current. */
+  std::mutex mtx;
+  /** @brief The current watcher. */
+  std::shared_ptr<watcher> current;
+};
+
+/** @brief Gets the process-wide installed watcher. */
+static auto watchers() -> installed_watcher &
+{
+  static auto installed = installed_watcher();
+  return installed;
+}
+
+/** @brief Checks if an installed watcher reports changes to file. */
+static auto watched(const std::filesystem::path &file) -> bool
+{
+  auto &installed = watchers();
+  auto lock = std::lock_guard{installed.mtx};
+  return installed.current && installed.current->covers(file);
+}
+
+/** @brief Gets the process-wide table of shared read descriptors. */
+static auto descriptors() -> shared_descriptors &
+{
+  static auto table = shared_descriptors();
+  return table;
+}
+
+/** @brief Opens a read-only descriptor for file. */
+static auto open_descriptor(const std::filesystem::path &file) -> open_result
+{
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg)
+  const int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == descriptor::INVALID_FD)
+  {
+    if (errno == ENOENT || errno == ENOTDIR)
+      return {{}, std::make_error_code(std::errc::no_such_file_or_directory)};
+
+    return {{}, std::make_error_code(std::errc::permission_denied)};
+  }
+
+  auto desc = std::make_shared<const descriptor>(fd);
+  if (!S_ISREG(desc->status().st_mode))
+    return {{}, std::make_error_code(std::errc::permission_denied)};
+
+  return {std::move(desc), {}};
+}
+
+descriptor::descriptor(int fd) noexcept : fd_(fd)
+{
+  if (::fstat(fd_, &status_)) [[unlikely]]
+    status_ = {}; // GCOVR_EXCL_LINE
+
+  // st_blocks is counted in 512 byte units.
+  static constexpr off_t BLOCK_UNIT = 512;
+  if (S_ISREG(status_.st_mode) &&
+      status_.st_blocks * BLOCK_UNIT < status_.st_size)
+  {
+    map_extents();
+  }
+}
+
+auto descriptor::map_extents() noexcept -> void
+{
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+  const auto size = status_.st_size;
+  try
+  {
+    for (off_t pos = 0; pos < size;)
+    {
+      auto data = ::lseek(fd_, pos, SEEK_DATA);
+      if (data < 0)
+      {
+        // ENXIO: there is no data past pos, so the rest is a hole.
+        if (errno != ENXIO)
+          return;
+        break;
+      }
+
+      auto hole = ::lseek(fd_, data, SEEK_HOLE);
+      if (hole < 0)
+        return;
+
+      // Too fragmented to be worth mapping; read it as a dense file.
+      if (extents_.size() == MAX_EXTENTS)
+      {
+        extents_.clear();
+        return;
+      }
+
+      extents_.push_back({.offset = static_cast<std::uint64_t>(data),
+                          .length = static_cast<std::uint64_t>(hole - data)});
+      pos = hole;
+    }
+  }
+  catch (const std::bad_alloc &)
+  {
+    extents_.clear();
+    return;
+  }
+  sparse_ = true;
+#endif
+}
+
+descriptor::~descriptor()
+{
+  if (fd_ != INVALID_FD)
+    (void)::close(fd_);
+}
+
+auto descriptor::current(const std::filesystem::path &file) const noexcept
+    -> bool
+{
+  struct stat now {};
+  if (::stat(file.c_str(), &now))
+    return false;
+
+  return now.st_dev == status_.st_dev && now.st_ino == status_.st_ino &&
+         now.st_size == status_.st_size &&
+         now.st_mtim.tv_sec == status_.st_mtim.tv_sec &&
+         now.st_mtim.tv_nsec == status_.st_mtim.tv_nsec;
+}
+
+/** @brief Reads a range of a descriptor with pread(). */
+static auto pread_all(int fd, std::uint64_t offset, std::span<char> buf,
+                      std::error_code &err) noexcept -> std::size_t
+{
+  std::size_t total = 0;
+  while (total < buf.size())
+  {
+    auto len = ::pread(fd, buf.data() + total, buf.size() - total,
+                       static_cast<off_t>(offset + total));
+    if (len == 0)
+      break;
+
+    if (len < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      err = {errno, std::system_category()};
+      break;
+    }
+
+    total += static_cast<std::size_t>(len);
+  }
+
+  return total;
+}
+
+auto file_handle::read_at(std::uint64_t offset, std::span<char> buf,
+                          std::error_code &err) const noexcept -> std::size_t
+{
+  err.clear();
+  if (!desc_)
+  {
+    err = std::make_error_code(std::errc::bad_file_descriptor);
+    return 0;
+  }
+
+  const auto fd = desc_->native_handle();
+  if (!desc_->sparse())
+    return pread_all(fd, offset, buf, err);
+
+  const auto size = static_cast<std::uint64_t>(desc_->status().st_size);
+  if (offset >= size)
+    return 0;
+
+  buf = buf.first(std::min<std::uint64_t>(buf.size(), size - offset));
+  auto extents = desc_->extents();
+  // The first extent that ends at or after offset.
+  auto ext = std::ranges::lower_bound(
+      extents, offset, {},
+      [](const auto &range) { return range.offset + range.length - 1; });
+
+  std::size_t total = 0;
+  while (total < buf.size())
+  {
+    auto pos = offset + total;
+    auto rest = buf.subspan(total);
+    if (ext == extents.end() || pos < ext->offset)
+    {
+      // Zero-fill the hole up to the next extent.
+      auto hole = ext == extents.end() ? rest.size()
+                                       : std::min<std::uint64_t>(
+                                             rest.size(), ext->offset - pos);
+      std::ranges::fill(rest.first(hole), '\0');
+      total += hole;
+      continue;
+    }
+
+    auto want = std::min<std::uint64_t>(rest.size(),
+                                        ext->offset + ext->length - pos);
+    auto len = pread_all(fd, pos, rest.first(want), err);
+    total += len;
+    if (err || len < want)
+      break;
+
+    ++ext;
+  }
+
+  return total;
+}
+
+auto file_handle::read(std::span<char> buf,
+                       std::error_code &err) noexcept -> std::size_t
+{
+  auto len = read_at(offset_, buf, err);
+  offset_ += len;
+  return len;
+}
+
+auto file_handle::write(std::span<const char> buf,
+                        std::error_code &err) noexcept -> void
+{
+  err.clear();
+  if (!desc_)
+  {
+    err = std::make_error_code(std::errc::bad_file_descriptor);
+    return;
+  }
+
+  std::size_t total = 0;
+  while (total < buf.size())
+  {
+    auto len = ::write(desc_->native_handle(), buf.data() + total,
+                       buf.size() - total);
+    if (len < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      err = {errno, std::system_category()}; // GCOVR_EXCL_LINE
+      break;                                 // GCOVR_EXCL_LINE
+    }
+
+    total += static_cast<std::size_t>(len);
+  }
+
+  offset_ += total;
+}
+
 auto count() noexcept -> std::atomic<std::uint16_t> &
 {
   static auto count = std::atomic<std::uint16_t>(0);
@@ -73,29 +487,111 @@ auto touch(const std::filesystem::path &file) -> std::error_code
 }
 // NOLINTEND(cppcoreguidelines-owning-memory)
 
+auto intern(std::string_view name) -> interned_path
+{
+  const auto &table = path_table();
+  auto lock = std::lock_guard{table->mtx};
+  if (auto it = table->paths.find(name); it != table->paths.end())
+  {
+    if (auto path = it->second.lock())
+      return path;
+
+    // The last handle is being released; its deleter must not erase the
+    // replacement below.
+    table->paths.erase(it);
+  }
+
+  auto release = [table](const std::filesystem::path *path) {
+    {
+      auto lock = std::lock_guard{table->mtx};
+      auto it = table->paths.find(path->native());
+      if (it != table->paths.end() &&
+          it->first.data() == path->native().data())
+      {
+        table->paths.erase(it);
+      }
+    }
+    delete path; // NOLINT(cppcoreguidelines-owning-memory)
+  };
+
+  // NOLINTNEXTLINE(cppcoreguidelines-owning-memory)
+  auto path = interned_path(new std::filesystem::path(name), release);
+  table->paths.emplace(path->native(), path);
+  return path;
+}
+
+auto interned() -> std::size_t
+{
+  const auto &table = path_table();
+  auto lock = std::lock_guard{table->mtx};
+  return table->paths.size();
+}
+
+auto contains(const std::filesystem::path &dir,
+              const std::filesystem::path &path) -> bool
+{
+  auto [dir_end, path_end] = std::ranges::mismatch(dir, path);
+  return dir_end == dir.end() ||
+         (std::next(dir_end) == dir.end() && dir_end->empty());
+}
+
+auto invalidate(const std::filesystem::path &path) -> std::size_t
+{
+  return descriptors().drop(absolute_key(path));
+}
+
+auto watch(std::shared_ptr<watcher> next) -> std::shared_ptr<watcher>
+{
+  if (next)
+  {
+    next->subscribe(
+        [](const std::filesystem::path &path) { invalidate(path); });
+  }
+
+  auto &installed = watchers();
+  auto lock = std::lock_guard{installed.mtx};
+  std::swap(installed.current, next);
+  return next;
+}
+
 auto open_read(const std::filesystem::path &file,
-               std::error_code &err) -> std::shared_ptr<std::fstream>
+               std::error_code &err) -> std::shared_ptr<file_handle>
 {
   err.clear();
-  auto fstream =
-      std::make_shared<std::fstream>(file, std::ios::in | std::ios::binary);
-  if (!fstream->is_open())
+  auto &table = descriptors();
+  const auto &key = file.native();
+
+  // The stat is skipped for files the watcher reports changes to, unless
+  // they are reached through a link that may lead outside its root.
+  auto reported = false;
+  auto desc = table.find(key, reported);
+  if (!desc || !((reported && watched(file)) || desc->current(file)))
   {
-    if (!std::filesystem::exists(file, err))
+    auto result = table.flights(key, [&]() {
+      auto opened = open_descriptor(file);
+      if (opened.desc)
+      {
+        table.insert(key, opened.desc,
+                     watched(file) && !watcher::aliased(file));
+      }
+
+      return opened;
+    });
+
+    if (result.err)
     {
-      err = std::make_error_code(std::errc::no_such_file_or_directory);
+      err = result.err;
       return {};
     }
 
-    err = std::make_error_code(std::errc::permission_denied);
-    return {};
+    desc = std::move(result.desc);
   }
 
-  return fstream;
+  return std::make_shared<file_handle>(std::move(desc));
 }
 
 auto open_write(const std::filesystem::path &file, std::filesystem::path &tmp,
-                std::error_code &err) -> std::shared_ptr<std::fstream>
+                std::error_code &err) -> std::shared_ptr<file_handle>
 {
   err.clear();
   err = touch(file);
@@ -103,15 +599,17 @@ auto open_write(const std::filesystem::path &file, std::filesystem::path &tmp,
     return {};
 
   tmp = tmpname();
-  auto fstream = std::make_shared<std::fstream>(
-      tmp, std::ios::out | std::ios::trunc | std::ios::binary);
-  if (!fstream->is_open())
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg)
+  const int fd =
+      ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+             S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+  if (fd == descriptor::INVALID_FD)
   {
     err = std::make_error_code(std::errc::permission_denied);
     return {};
   }
 
-  return fstream;
+  return std::make_shared<file_handle>(std::make_shared<const descriptor>(fd));
 }
 
 } // namespace tftp::filesystem
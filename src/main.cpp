@@ -14,12 +14,25 @@
  * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
  */
 #include "tftp/detail/argument_parser.hpp"
+#include "tftp/memory.hpp"
+#include "tftp/prefetch.hpp"
+#include "tftp/rewrite.hpp"
+#include "tftp/templates.hpp"
+#include "tftp/transform.hpp"
+#include "tftp/storage/archive.hpp"
+#include "tftp/storage/cached.hpp"
+#include "tftp/storage/embedded.hpp"
+#include "tftp/storage/memory.hpp"
+#include "tftp/storage/relay.hpp"
 #include "tftp/tftp_server.hpp"
+#include "tftp/watcher.hpp"
 
 #include <spdlog/cfg/helpers.h>
 #include <spdlog/spdlog.h>
 
 #include <charconv>
+#include <chrono>
+#include <condition_variable>
 #include <csignal>
 #include <cstdlib>
 #include <filesystem>
@@ -34,11 +47,38 @@ using tftp_server = basic_context_thread<server>;
 
 static constexpr unsigned short PORT = 69;
 static constexpr char const *const usage =
-    "usage: {} [-m <MAIL_PREFIX>] [-l <LEVEL>] [-p <PORT>]\n"
+    "usage: {} [-m <MAIL_PREFIX>] [-M <DIR> | -a <ARCHIVE> | -r <URL>] "
+    "[-w <DIR>] [-R <FILE>] [-T <FILE>] [-c <MiB>] [--preload=<FILE>] "
+    "[--snapshot=<FILE>] [--write-through] [--memory-limit=<MiB>] "
+    "[-l <LEVEL>] [-p <PORT>]\n"
     "\n"
     "Options:\n"
     "-h, --help                         print this help.\n"
     "-m, --mail-prefix=<MAIL_PREFIX>    set the  mailprefix.\n"
+    "-M, --memory=<DIR>                 serve files from RAM, preloaded from "
+    "DIR.\n"
+    "-a, --archive=<ARCHIVE>            serve files from a tar archive.\n"
+    "-r, --relay=<URL>                  fetch files from a tftp:// or http:// "
+    "origin.\n"
+    "--relay-cache=<DIR>                cache relayed files in DIR.\n"
+    "--relay-size=<MiB>                 cache at most MiB of relayed files "
+    "(default: 1024).\n"
+    "-w, --watch=<DIR>                  watch DIR for changes instead of "
+    "checking files on every open.\n"
+    "-R, --rewrite=<FILE>               rewrite requested filenames with the "
+    "rules in FILE.\n"
+    "-T, --templates=<FILE>             render the virtual files listed in "
+    "FILE.\n"
+    "-c, --cache=<MiB>                  cache up to MiB of file contents in "
+    "RAM.\n"
+    "--preload=<FILE>                   warm the cache with the files listed "
+    "in FILE.\n"
+    "--snapshot=<FILE>                  prefetch the hot set saved in FILE and "
+    "save it again on shutdown.\n"
+    "--write-through                    serve uploads from the cache as soon "
+    "as they complete.\n"
+    "--memory-limit=<MiB>               shrink caches, then refuse new "
+    "sessions, past MiB of memory.\n"
     "-l, --log-level=<LEVEL>            set the log-level (critical, error, "
     "warn, info, debug)\n"
     "-p, --port=<PORT>                  set the port to listen on (default: "
@@ -95,8 +135,55 @@ static auto signal_handler(tftp_server &server) -> std::jthread
   return {};
 }
 
+/** @brief How often the memory in use is logged. */
+static constexpr auto MEMORY_REPORT_INTERVAL = std::chrono::minutes(1);
+
+/** @brief Logs the memory in use by category. */
+static auto log_memory(memory::governor &governor) -> void
+{
+  auto usage = governor.usage();
+  spdlog::info("Memory: {} of {} bytes in use: {} sessions, {} buffers, "
+               "{} cache, {} compression, {} templates, {} uploads, "
+               "{} downloads.",
+               usage.total, usage.ceiling, usage.bytes[memory::SESSIONS],
+               usage.bytes[memory::BUFFERS], usage.bytes[memory::CACHE],
+               usage.bytes[memory::COMPRESSION],
+               usage.bytes[memory::TEMPLATES], usage.bytes[memory::UPLOADS],
+               usage.bytes[memory::DOWNLOADS]);
+}
+
+/** @brief Logs the memory in use every interval until stopped. */
+static auto memory_reporter(std::shared_ptr<memory::governor> governor)
+    -> std::jthread
+{
+  return std::jthread(
+      [governor = std::move(governor)](const std::stop_token &token) {
+        auto mtx = std::mutex();
+        auto wakeup = std::condition_variable_any();
+        auto lock = std::unique_lock{mtx};
+        while (!wakeup.wait_for(lock, token, MEMORY_REPORT_INTERVAL,
+                                [&] { return token.stop_requested(); }))
+        {
+          log_memory(*governor);
+        }
+      });
+}
+
 struct config {
   unsigned short port = PORT;
+  std::filesystem::path memory_root;
+  std::filesystem::path archive;
+  std::optional<storage::relay::origin> relay;
+  std::filesystem::path relay_cache;
+  std::uint64_t relay_mib = storage::relay::DEFAULT_CAPACITY / (1024 * 1024);
+  std::filesystem::path watch_root;
+  std::filesystem::path rewrite;
+  std::filesystem::path templates;
+  std::size_t cache_mib = 0;
+  std::filesystem::path preload;
+  std::filesystem::path snapshot;
+  bool write_through = false;
+  std::size_t memory_limit_mib = 0;
 };
 
 static auto set_loglevel(std::string_view value) -> int
@@ -160,6 +247,136 @@ auto parse_args(int argc, char const *const *argv) -> std::optional<config>
         return error();
       }
     }
+    else if (flag == "-M" || flag == "--memory")
+    {
+      if (value.empty())
+      {
+        std::cerr << "The memory backend needs a directory to load.\n";
+        return error();
+      }
+
+      conf.memory_root = value;
+    }
+    else if (flag == "-a" || flag == "--archive")
+    {
+      if (value.empty())
+      {
+        std::cerr << "The archive backend needs an archive to serve.\n";
+        return error();
+      }
+
+      conf.archive = value;
+    }
+    else if (flag == "-r" || flag == "--relay")
+    {
+      auto err = std::error_code();
+      conf.relay = storage::relay::origin::parse(value, err);
+      if (err)
+      {
+        std::cerr << std::format("Invalid relay origin: {}\n", value);
+        return error();
+      }
+    }
+    else if (flag == "--relay-cache")
+    {
+      if (value.empty())
+      {
+        std::cerr << "The relay needs a cache directory.\n";
+        return error();
+      }
+
+      conf.relay_cache = value;
+    }
+    else if (flag == "--relay-size")
+    {
+      auto [ptr, err] =
+          std::from_chars(value.cbegin(), value.cend(), conf.relay_mib);
+      if (err != std::errc{} || conf.relay_mib == 0)
+      {
+        std::cerr << std::format("Invalid relay cache size: {}\n", value);
+        return error();
+      }
+    }
+    else if (flag == "-w" || flag == "--watch")
+    {
+      if (value.empty())
+      {
+        std::cerr << "The watcher needs a directory to watch.\n";
+        return error();
+      }
+
+      conf.watch_root = value;
+    }
+    else if (flag == "-R" || flag == "--rewrite")
+    {
+      if (value.empty())
+      {
+        std::cerr << "The rewrite engine needs a rules file.\n";
+        return error();
+      }
+
+      conf.rewrite = value;
+    }
+    else if (flag == "-T" || flag == "--templates")
+    {
+      if (value.empty())
+      {
+        std::cerr << "Virtual files need a templates file.\n";
+        return error();
+      }
+
+      conf.templates = value;
+    }
+    else if (flag == "-c" || flag == "--cache")
+    {
+      auto [ptr, err] =
+          std::from_chars(value.cbegin(), value.cend(), conf.cache_mib);
+      if (err != std::errc{} || conf.cache_mib == 0)
+      {
+        std::cerr << std::format("Invalid cache size: {}\n", value);
+        return error();
+      }
+    }
+    else if (flag == "--preload")
+    {
+      if (value.empty())
+      {
+        std::cerr << "The cache needs a manifest to preload.\n";
+        return error();
+      }
+
+      conf.preload = value;
+    }
+    else if (flag == "--snapshot")
+    {
+      if (value.empty())
+      {
+        std::cerr << "The cache needs a snapshot file.\n";
+        return error();
+      }
+
+      conf.snapshot = value;
+    }
+    else if (flag == "--write-through")
+    {
+      if (!value.empty())
+      {
+        std::cerr << "--write-through does not take a value.\n";
+        return error();
+      }
+
+      conf.write_through = true;
+    }
+    else if (flag == "--memory-limit")
+    {
+      auto [ptr, err] =
+          std::from_chars(value.cbegin(), value.cend(), conf.memory_limit_mib);
+      if (err != std::errc{} || conf.memory_limit_mib == 0)
+      {
+        std::cerr << std::format("Invalid memory limit: {}\n", value);
+        return error();
+      }
+    }
     else if (flag == "-l" || flag == "--log-level")
     {
       if (!set_loglevel(value))
@@ -184,6 +401,24 @@ auto parse_args(int argc, char const *const *argv) -> std::optional<config>
     }
   }
 
+  if (!conf.memory_root.empty() + !conf.archive.empty() +
+          conf.relay.has_value() >
+      1)
+  {
+    std::cerr << "Only one of --memory, --archive and --relay may be given.\n";
+    return error();
+  }
+
+  if (conf.relay && conf.relay_cache.empty())
+  {
+    auto err = std::error_code();
+    conf.relay_cache = filesystem::temp_directory(err) / "tftpd-relay";
+  }
+
+  if (!conf.cache_mib && (!conf.preload.empty() || !conf.snapshot.empty() ||
+                          conf.write_through))
+    conf.cache_mib = storage::cached::DEFAULT_CAPACITY / (1024 * 1024);
+
   return {conf};
 }
 
@@ -193,6 +428,155 @@ auto main(int argc, char *argv[]) -> int
 
   if (auto conf = parse_args(argc, argv))
   {
+    if (!conf->rewrite.empty())
+    {
+      auto err = std::error_code();
+      auto line = std::size_t{0};
+      auto rules = rewrite::rules::load(conf->rewrite, err, &line);
+      if (!rules)
+      {
+        spdlog::critical("Unable to load rewrite rules {} (line {}): {}.",
+                         conf->rewrite.c_str(), line, err.message());
+        return 1;
+      }
+
+      spdlog::info("Loaded {} rewrite rules.", rules->size());
+      rewrite::install(std::move(rules));
+    }
+
+    if (!conf->templates.empty())
+    {
+      auto err = std::error_code();
+      auto line = std::size_t{0};
+      auto files = templates::registry::load(conf->templates, err, &line);
+      if (!files)
+      {
+        spdlog::critical("Unable to load virtual files {} (line {}): {}.",
+                         conf->templates.c_str(), line, err.message());
+        return 1;
+      }
+
+      spdlog::info("Serving {} virtual files.", files->size());
+      templates::install(std::move(files));
+    }
+
+    if (!conf->memory_root.empty())
+    {
+      auto memory = std::make_shared<storage::memory>();
+      auto err = std::error_code();
+      auto count = memory->load(conf->memory_root, err);
+      if (err)
+      {
+        spdlog::critical("Unable to load {} into memory: {}.",
+                         conf->memory_root.c_str(), err.message());
+        return 1;
+      }
+
+      spdlog::info("Serving {} files from memory.", count);
+      storage::install(std::move(memory));
+    }
+    else if (!conf->archive.empty())
+    {
+      auto err = std::error_code();
+      auto archive = storage::archive::open(conf->archive, err);
+      if (!archive)
+      {
+        spdlog::critical("Unable to open archive {}: {}.",
+                         conf->archive.c_str(), err.message());
+        return 1;
+      }
+
+      spdlog::info("Serving {} files from {}.", archive->size(),
+                   conf->archive.c_str());
+      storage::install(std::move(archive));
+    }
+    else if (conf->relay)
+    {
+      spdlog::info("Relaying files from {} through {}.", conf->relay->host,
+                   conf->relay_cache.c_str());
+      storage::install(std::make_shared<storage::relay>(
+          *conf->relay, conf->relay_cache, conf->relay_mib * 1024 * 1024));
+    }
+
+    auto cache = std::shared_ptr<storage::cached>();
+    if (conf->cache_mib)
+    {
+      cache = std::make_shared<storage::cached>(storage::current(),
+                                                conf->cache_mib * 1024 * 1024);
+      cache->write_through(conf->write_through);
+      storage::install(cache);
+
+      auto err = std::error_code();
+      if (!conf->preload.empty())
+      {
+        auto count = cache->preload(conf->preload, err);
+        if (err)
+          spdlog::warn("Unable to read manifest {}: {}.",
+                       conf->preload.c_str(), err.message());
+        else
+          spdlog::info("Preloaded {} files into the cache.", count);
+      }
+
+      if (!conf->snapshot.empty() &&
+          std::filesystem::exists(conf->snapshot, err))
+      {
+        auto count = cache->load_snapshot(conf->snapshot, err);
+        if (err)
+          spdlog::warn("Unable to read snapshot {}: {}.",
+                       conf->snapshot.c_str(), err.message());
+        else
+          spdlog::info("Prefetching {} hot files.", count);
+      }
+
+      prefetch::install(std::make_shared<prefetch::predictor>(
+          [cache](const std::filesystem::path &path) {
+            cache->prefetch(path);
+          }));
+    }
+
+    if (auto bundle = storage::embedded::bundle(); !bundle.empty())
+    {
+      spdlog::info("Serving {} embedded files.", bundle.size());
+      storage::install(
+          std::make_shared<storage::embedded>(storage::current(), bundle));
+    }
+
+    auto reporter = std::jthread();
+    if (conf->memory_limit_mib)
+    {
+      auto governor = std::make_shared<memory::governor>(
+          conf->memory_limit_mib * 1024 * 1024);
+      if (cache)
+        governor->reclaimable(
+            memory::CACHE, [cache] { return cache->bytes(); },
+            [cache](std::size_t bytes) { return cache->shrink(bytes); });
+#ifdef TFTP_ENABLE_ZSTD
+      governor->reclaimable(
+          memory::COMPRESSION,
+          [] { return transform::compressor::cached_bytes(); },
+          [](std::size_t bytes) {
+            return transform::compressor::shrink(bytes);
+          });
+#endif // TFTP_ENABLE_ZSTD
+      if (auto files = templates::current())
+        governor->reclaimable(
+            memory::TEMPLATES, [files] { return files->bytes(); },
+            [files](std::size_t bytes) { return files->shrink(bytes); });
+
+      spdlog::info("Limiting memory to {} MiB.", conf->memory_limit_mib);
+      reporter = memory_reporter(governor);
+      memory::install(std::move(governor));
+    }
+
+    auto watcher = std::shared_ptr<filesystem::watcher>();
+    if (!conf->watch_root.empty())
+    {
+      watcher = std::make_shared<filesystem::watcher>(conf->watch_root);
+      filesystem::watch(watcher);
+      if (cache)
+        cache->watch(watcher);
+    }
+
     auto address = socket_address<sockaddr_in6>{};
     address->sin6_family = AF_INET6;
     address->sin6_port = htons(conf->port);
@@ -206,6 +590,62 @@ auto main(int argc, char *argv[]) -> int
     server.state.wait(server.STARTED);
 
     spdlog::info("TFTP server stopped.");
+
+    if (watcher)
+    {
+      auto &stats = watcher->stats();
+      auto measured = std::max<std::uint64_t>(stats.measured, 1);
+      spdlog::info("Watcher: {} events, {} invalidations, {} overflows, "
+                   "invalidation latency mean {}us max {}us.",
+                   stats.events.load(), stats.invalidations.load(),
+                   stats.overflows.load(),
+                   stats.total_latency_us / static_cast<std::int64_t>(measured),
+                   stats.max_latency_us.load());
+      filesystem::watch(nullptr);
+    }
+
+    // Stopped first, so that the final breakdown is logged last.
+    reporter = std::jthread();
+    if (auto governor = memory::install(nullptr))
+    {
+      auto &stats = governor->stats();
+      log_memory(*governor);
+      spdlog::info("Memory: {} sessions admitted, {} refused, {} shrinks "
+                   "reclaimed {} bytes, {} cache insertions declined.",
+                   stats.admitted.load(), stats.refused.load(),
+                   stats.shrinks.load(), stats.reclaimed.load(),
+                   stats.declined.load());
+    }
+
+    if (auto predictor = prefetch::install(nullptr))
+    {
+      auto &stats = predictor->stats();
+      spdlog::info("Prefetch: {} requests, {} predicted, {} hits.",
+                   stats.observed.load(), stats.predicted.load(),
+                   stats.hits.load());
+    }
+
+    if (cache)
+    {
+      auto &stats = cache->stats();
+      spdlog::info("Cache: {} hits, {} misses, {} prefetched, {} written, "
+                   "{} evictions, {} invalidations.",
+                   stats.hits.load(), stats.misses.load(),
+                   stats.prefetched.load(), stats.written.load(),
+                   stats.evictions.load(), stats.invalidations.load());
+
+      auto usage = cache->memory_usage();
+      spdlog::info("Cache: {} files, {} logical bytes in {} physical bytes "
+                   "({} blocks).",
+                   usage.files, usage.logical, usage.physical, usage.blocks);
+
+      auto err = std::error_code();
+      if (!conf->snapshot.empty())
+        cache->save_snapshot(conf->snapshot, err);
+      if (err)
+        spdlog::warn("Unable to save snapshot {}: {}.",
+                     conf->snapshot.c_str(), err.message());
+    }
   }
   return 0;
 }
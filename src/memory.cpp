@@ -0,0 +1,219 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file memory.cpp
+ * @brief This file implements the process-wide memory governor.
+ */
+#include "tftp/memory.hpp"
+
+#include <algorithm>
+#include <utility>
+namespace tftp::memory {
+governor::governor(std::size_t ceiling) noexcept : ceiling_(ceiling) {}
+
+auto governor::reclaimable(category cat, usage_fn usage,
+                           shrink_fn shrink) -> void
+{
+  auto lock = std::lock_guard{mtx_};
+  caches_.push_back(
+      {.cat = cat, .usage = std::move(usage), .shrink = std::move(shrink)});
+}
+
+auto governor::admit(std::size_t bytes) -> bool
+{
+  auto lock = std::lock_guard{mtx_};
+  if (!fit(bytes))
+  {
+    ++stats_.refused;
+    return false;
+  }
+
+  ++stats_.admitted;
+  return true;
+}
+
+auto governor::make_room(std::size_t bytes) -> bool
+{
+  auto lock = std::lock_guard{mtx_};
+  if (!fit(bytes))
+  {
+    ++stats_.declined;
+    return false;
+  }
+
+  return true;
+}
+
+auto governor::fit(std::size_t bytes) -> bool
+{
+  auto total = [&] {
+    auto sum = std::size_t{0};
+    for (const auto &count : charged_)
+      sum += count.load(std::memory_order_relaxed);
+    for (const auto &entry : caches_)
+      sum += entry.usage();
+    return sum;
+  };
+
+  auto used = total();
+  if (used + bytes <= ceiling_)
+    return true;
+
+  // Caches are shrunk before anything is turned away.
+  ++stats_.shrinks;
+  for (const auto &entry : caches_)
+  {
+    stats_.reclaimed += entry.shrink(used + bytes - ceiling_);
+    used = total();
+    if (used + bytes <= ceiling_)
+      return true;
+  }
+
+  return false;
+}
+
+auto governor::charge(category cat, std::size_t bytes) noexcept -> void
+{
+  charged_.at(cat).fetch_add(bytes, std::memory_order_relaxed);
+}
+
+auto governor::discharge(category cat, std::size_t bytes) noexcept -> void
+{
+  charged_.at(cat).fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+auto governor::usage() const -> breakdown
+{
+  auto result = breakdown{.ceiling = ceiling_};
+  for (std::size_t cat = 0; cat < CATEGORIES; ++cat)
+    result.bytes.at(cat) = charged_.at(cat).load(std::memory_order_relaxed);
+
+  {
+    auto lock = std::lock_guard{mtx_};
+    for (const auto &entry : caches_)
+      result.bytes.at(entry.cat) += entry.usage();
+  }
+
+  for (auto count : result.bytes)
+    result.total += count;
+
+  return result;
+}
+
+auto governor::ceiling() const noexcept -> std::size_t { return ceiling_; }
+
+auto governor::stats() noexcept -> counters & { return stats_; }
+
+reservation::reservation(std::shared_ptr<governor> owner) noexcept
+    : owner_(std::move(owner))
+{}
+
+reservation::reservation(reservation &&other) noexcept
+    : owner_(std::move(other.owner_)),
+      bytes_(std::exchange(other.bytes_, {}))
+{}
+
+auto reservation::operator=(reservation &&other) noexcept -> reservation &
+{
+  if (this != &other)
+  {
+    release();
+    owner_ = std::move(other.owner_);
+    bytes_ = std::exchange(other.bytes_, {});
+  }
+  return *this;
+}
+
+reservation::~reservation() { release(); }
+
+auto reservation::add(category cat, std::size_t bytes) noexcept -> void
+{
+  if (!owner_)
+    return;
+
+  owner_->charge(cat, bytes);
+  bytes_.at(cat) += bytes;
+}
+
+auto reservation::remove(category cat, std::size_t bytes) noexcept -> void
+{
+  if (!owner_)
+    return;
+
+  bytes = std::min(bytes, bytes_.at(cat));
+  owner_->discharge(cat, bytes);
+  bytes_.at(cat) -= bytes;
+}
+
+auto reservation::bytes() const noexcept -> std::size_t
+{
+  auto sum = std::size_t{0};
+  for (auto count : bytes_)
+    sum += count;
+  return sum;
+}
+
+auto reservation::release() noexcept -> void
+{
+  if (!owner_)
+    return;
+
+  for (std::size_t cat = 0; cat < CATEGORIES; ++cat)
+  {
+    if (bytes_.at(cat))
+      owner_->discharge(static_cast<category>(cat), bytes_.at(cat));
+  }
+
+  bytes_ = {};
+  owner_.reset();
+}
+
+/** @brief The installed governor. */
+struct installed {
+  /** @brief Protects current. */
+  std::mutex mtx;
+  /** @brief The current governor. */
+  std::shared_ptr<governor> current;
+};
+
+/** @brief Gets the process-wide installed governor. */
+static auto governors() -> installed &
+{
+  static auto governors = installed();
+  return governors;
+}
+
+auto current() -> std::shared_ptr<governor>
+{
+  auto &installed = governors();
+  auto lock = std::lock_guard{installed.mtx};
+  return installed.current;
+}
+
+auto make_room(std::size_t bytes) -> bool
+{
+  auto governor = current();
+  return !governor || governor->make_room(bytes);
+}
+
+auto install(std::shared_ptr<governor> next) -> std::shared_ptr<governor>
+{
+  auto &installed = governors();
+  auto lock = std::lock_guard{installed.mtx};
+  std::swap(installed.current, next);
+  return next;
+}
+} // namespace tftp::memory
@@ -0,0 +1,186 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file prefetch.cpp
+ * @brief This file implements the boot chain prefetch predictor.
+ */
+#include "tftp/prefetch.hpp"
+
+#include <algorithm>
+namespace tftp::prefetch {
+/** @brief Keys the successors of file in a chain of class cls. */
+static auto transition(std::string_view cls,
+                       std::string_view file) -> std::string
+{
+  auto key = std::string(cls);
+  key.push_back('\0');
+  key.append(file);
+  return key;
+}
+
+predictor::predictor(callback func, std::size_t fanout, clock::duration gap)
+    : prefetch_(std::move(func)), fanout_(fanout), gap_(gap)
+{}
+
+auto predictor::observe(std::string_view client,
+                        const std::filesystem::path &file,
+                        clock::time_point now) -> std::vector<std::string>
+{
+  auto name = file.lexically_normal().generic_string();
+  auto next = std::vector<std::string>();
+  {
+    auto lock = std::lock_guard{mtx_};
+    auto key = std::string(client);
+    auto it = clients_.find(key);
+    if (it == clients_.end())
+    {
+      // Forget idle clients, and the least recently seen ones once full.
+      while (!lru_.empty() && (clients_.size() >= MAX_TRACKED ||
+                               now - clients_.at(lru_.back()).seen > gap_))
+      {
+        clients_.erase(lru_.back());
+        lru_.pop_back();
+      }
+
+      lru_.push_front(key);
+      it = clients_.emplace(std::move(key), chain{.lru = lru_.begin()}).first;
+    }
+    else
+    {
+      lru_.splice(lru_.begin(), lru_, it->second.lru);
+    }
+
+    auto &state = it->second;
+    if (state.cls.empty() || now - state.seen > gap_)
+    {
+      state.cls = name;
+      state.pending.clear();
+    }
+    else if (state.last != name)
+    {
+      if (std::ranges::find(state.pending, name) != state.pending.end())
+        ++stats_.hits;
+
+      auto &count = transitions_[transition(state.cls, state.last)][name];
+      if (count++ == 0 && ++tracked_ > MAX_TRACKED)
+        age();
+    }
+
+    state.last = name;
+    state.seen = now;
+    next = predict_locked(transition(state.cls, name));
+    state.pending = next;
+  }
+
+  ++stats_.observed;
+  stats_.predicted += next.size();
+  for (const auto &path : next)
+    prefetch_(path);
+
+  return next;
+}
+
+auto predictor::predict(std::string_view cls, std::string_view file) const
+    -> std::vector<std::string>
+{
+  auto lock = std::lock_guard{mtx_};
+  return predict_locked(transition(cls, file));
+}
+
+auto predictor::predict_locked(const std::string &from) const
+    -> std::vector<std::string>
+{
+  auto it = transitions_.find(from);
+  if (it == transitions_.end())
+    return {};
+
+  auto total = std::uint64_t{0};
+  for (const auto &[name, count] : it->second)
+    total += count;
+
+  // Only predict successors seen often enough to be more than noise.
+  auto likely = std::vector<std::pair<std::uint32_t, std::string>>();
+  for (const auto &[name, count] : it->second)
+  {
+    if (count >= MIN_COUNT && count * 4 >= total)
+      likely.emplace_back(count, name);
+  }
+
+  std::ranges::sort(likely, [](const auto &lhs, const auto &rhs) {
+    return lhs.first > rhs.first ||
+           (lhs.first == rhs.first && lhs.second < rhs.second);
+  });
+
+  auto next = std::vector<std::string>();
+  for (auto &[count, name] : likely)
+  {
+    if (next.size() == fanout_)
+      break;
+
+    next.push_back(std::move(name));
+  }
+  return next;
+}
+
+auto predictor::age() -> void
+{
+  tracked_ = 0;
+  for (auto it = transitions_.begin(); it != transitions_.end();)
+  {
+    auto &successors = it->second;
+    for (auto next = successors.begin(); next != successors.end();)
+    {
+      next = (next->second /= 2) == 0 ? successors.erase(next)
+                                      : std::next(next);
+    }
+
+    tracked_ += it->second.size();
+    it = it->second.empty() ? transitions_.erase(it) : std::next(it);
+  }
+}
+
+auto predictor::stats() noexcept -> counters & { return stats_; }
+
+/** @brief The installed predictor. */
+struct installed {
+  /** @brief Protects current. */
+  std::mutex mtx;
+  /** @brief The current predictor. */
+  std::shared_ptr<predictor> current;
+};
+
+/** @brief Gets the process-wide installed predictor. */
+static auto predictors() -> installed &
+{
+  static auto predictors = installed();
+  return predictors;
+}
+
+auto current() -> std::shared_ptr<predictor>
+{
+  auto &installed = predictors();
+  auto lock = std::lock_guard{installed.mtx};
+  return installed.current;
+}
+
+auto install(std::shared_ptr<predictor> next) -> std::shared_ptr<predictor>
+{
+  auto &installed = predictors();
+  auto lock = std::lock_guard{installed.mtx};
+  std::swap(installed.current, next);
+  return next;
+}
+} // namespace tftp::prefetch
@@ -0,0 +1,562 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file rewrite.cpp
+ * @brief This file implements the filename rewrite rules engine.
+ */
+#include "tftp/rewrite.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <queue>
+#include <span>
+#include <sstream>
+namespace tftp::rewrite {
+/** @brief Characters that end the literal text a regex starts with. */
+static constexpr auto REGEX_SPECIAL = std::string_view("\\^$.|?*+()[]{}");
+
+/** @brief Applies the `slashes` and `lowercase` folds. */
+static auto fold(std::span<char> name, bool slashes, bool lowercase) -> void
+{
+  if (slashes)
+    std::ranges::replace(name, '\\', '/');
+
+  if (lowercase)
+  {
+    std::ranges::transform(name, name.begin(), [](unsigned char chr) {
+      return static_cast<char>(std::tolower(chr));
+    });
+  }
+}
+
+/**
+ * @brief Gets the literal text that every match of a pattern starts with.
+ * @param pattern An ECMAScript regex.
+ * @returns The literal prefix, which may be empty.
+ */
+static auto literal_prefix(std::string_view pattern) -> std::string
+{
+  // An alternation may match without the leading text.
+  if (pattern.find('|') != std::string_view::npos)
+    return {};
+
+  if (pattern.starts_with('^'))
+    pattern.remove_prefix(1);
+
+  auto literal = std::string();
+  for (const auto chr : pattern)
+  {
+    if (REGEX_SPECIAL.find(chr) != std::string_view::npos)
+    {
+      // Optional quantifiers apply to the last literal character.
+      if ((chr == '?' || chr == '*' || chr == '{') && !literal.empty())
+        literal.pop_back();
+      break;
+    }
+    literal.push_back(chr);
+  }
+  return literal;
+}
+
+/** @brief Gets the position just past the class that starts at pos. */
+static auto skip_class(std::string_view pattern,
+                       std::size_t pos) -> std::size_t
+{
+  for (++pos; pos < pattern.size(); ++pos)
+  {
+    if (pattern[pos] == '\\')
+      ++pos;
+    else if (pattern[pos] == ']')
+      return pos + 1;
+  }
+  return pattern.size();
+}
+
+/** @brief Gets the position just past the group that starts at pos. */
+static auto skip_group(std::string_view pattern,
+                       std::size_t pos) -> std::size_t
+{
+  auto depth = 0;
+  while (pos < pattern.size())
+  {
+    auto chr = pattern[pos];
+    if (chr == '\\')
+    {
+      pos += 2;
+    }
+    else if (chr == '[')
+    {
+      pos = skip_class(pattern, pos);
+    }
+    else
+    {
+      ++pos;
+      if (chr == '(')
+        ++depth;
+      else if (chr == ')' && --depth == 0)
+        return pos;
+    }
+  }
+  return pattern.size();
+}
+
+/**
+ * @brief Gets the longest literal text that every match of a pattern
+ * contains.
+ * @details Groups, classes, and escapes other than escaped punctuation count
+ * as unknown text, so the result may be shorter than what the pattern
+ * really requires, but every match contains it.
+ * @param pattern An ECMAScript regex.
+ * @returns The required literal, which may be empty.
+ */
+static auto required_literal(std::string_view pattern) -> std::string
+{
+  auto best = std::string();
+  auto run = std::string();
+  auto flush = [&] {
+    if (run.size() > best.size())
+      best = run;
+    run.clear();
+  };
+
+  for (std::size_t pos = 0; pos < pattern.size();)
+  {
+    // Reads one atom.
+    auto literal = std::optional<char>();
+    auto end = pos + 1;
+    switch (pattern[pos])
+    {
+      case '|':
+        // A top-level alternation requires none of its branches.
+        return {};
+      case '\\':
+        end = std::min(pos + 2, pattern.size());
+        if (end == pos + 2 &&
+            !std::isalnum(static_cast<unsigned char>(pattern[pos + 1])))
+        {
+          literal = pattern[pos + 1];
+        }
+        break;
+      case '(':
+        end = skip_group(pattern, pos);
+        break;
+      case '[':
+        end = skip_class(pattern, pos);
+        break;
+      case '.':
+      case '^':
+      case '$':
+        break;
+      default:
+        literal = pattern[pos];
+    }
+
+    // Reads its quantifier, if any.
+    auto quantifier = end < pattern.size() ? pattern[end] : '\0';
+    if (quantifier == '?' || quantifier == '*' || quantifier == '{')
+    {
+      // The atom may be absent.
+      end = quantifier == '{' ? pattern.find('}', end) : end;
+      end = end == std::string_view::npos ? pattern.size() : end + 1;
+      literal.reset();
+    }
+    else if (quantifier == '+')
+    {
+      // The atom is present, but what follows it may not be adjacent.
+      if (literal)
+        run.push_back(*literal);
+      literal.reset();
+      ++end;
+    }
+    else
+    {
+      quantifier = '\0';
+    }
+    if (quantifier && end < pattern.size() && pattern[end] == '?')
+      ++end; // A lazy quantifier.
+
+    if (literal)
+      run.push_back(*literal);
+    else
+      flush();
+    pos = end;
+  }
+
+  flush();
+  return best;
+}
+
+/** @brief Replaces every occurrence of a placeholder in text. */
+static auto replace_all(std::pmr::string &text, std::string_view from,
+                        std::string_view to) -> void
+{
+  for (auto pos = text.find(from); pos != std::string::npos;
+       pos = text.find(from, pos + to.size()))
+  {
+    text.replace(pos, from.size(), to);
+  }
+}
+
+/** @brief Expands `{ip}` and `{mac}` in a replacement. */
+static auto expand(std::string_view replacement, const client &who,
+                   std::pmr::memory_resource *resource) -> std::pmr::string
+{
+  auto text = std::pmr::string(replacement, resource);
+  replace_all(text, "{ip}", who.ip);
+  replace_all(text, "{mac}", who.mac);
+  return text;
+}
+
+/** @brief Gets the child of a trie node along chr, or 0 if there is none. */
+template <typename Node>
+static auto child_of(const Node &parent, char chr) -> std::uint32_t
+{
+  const auto &children = parent.children;
+  auto it = std::ranges::lower_bound(children, chr, {},
+                                     &std::pair<char, std::uint32_t>::first);
+  return it == children.end() || it->first != chr ? 0 : it->second;
+}
+
+/** @brief Finds or adds the node for a key in a trie rooted at node 0. */
+template <typename Node>
+static auto insert_key(std::vector<Node> &nodes,
+                       std::string_view key) -> std::uint32_t
+{
+  std::uint32_t index = 0;
+  for (const auto chr : key)
+  {
+    auto &children = nodes[index].children;
+    auto it = std::ranges::lower_bound(children, chr, {},
+                                       &std::pair<char, std::uint32_t>::first);
+    if (it == children.end() || it->first != chr)
+    {
+      auto child = static_cast<std::uint32_t>(nodes.size());
+      children.emplace(it, chr, child);
+      nodes.emplace_back();
+      index = child;
+    }
+    else
+    {
+      index = it->second;
+    }
+  }
+  return index;
+}
+
+auto pattern_filter::link() -> void
+{
+  // Breadth first, so every fail link points at a node that is linked.
+  auto pending = std::queue<std::uint32_t>();
+  for (const auto &[chr, child] : literals_[0].children)
+    pending.push(child);
+
+  while (!pending.empty())
+  {
+    auto index = pending.front();
+    pending.pop();
+    for (const auto &[chr, child] : literals_[index].children)
+    {
+      auto fail = literals_[index].fail;
+      while (fail != 0 && child_of(literals_[fail], chr) == 0)
+        fail = literals_[fail].fail;
+
+      auto &linked = literals_[child];
+      linked.fail = child_of(literals_[fail], chr);
+      linked.output = literals_[linked.fail].patterns.empty()
+                          ? literals_[linked.fail].output
+                          : linked.fail;
+      pending.push(child);
+    }
+  }
+}
+
+auto pattern_filter::add(std::string_view pattern) -> std::uint32_t
+{
+  auto index = size_++;
+  if (auto prefix = literal_prefix(pattern); !prefix.empty())
+    prefixes_[insert_key(prefixes_, prefix)].patterns.push_back(index);
+  else if (auto literal = required_literal(pattern); !literal.empty())
+    literals_[insert_key(literals_, literal)].patterns.push_back(index);
+  else
+    unfiltered_.push_back(index);
+  return index;
+}
+
+auto pattern_filter::candidates(std::string_view name,
+                                std::pmr::vector<std::uint32_t> &found) const
+    -> void
+{
+  found.assign(unfiltered_.begin(), unfiltered_.end());
+
+  // Every literal prefix of name.
+  for (std::uint32_t index = 0; const auto chr : name)
+  {
+    if ((index = child_of(prefixes_[index], chr)) == 0)
+      break;
+    const auto &patterns = prefixes_[index].patterns;
+    found.insert(found.end(), patterns.begin(), patterns.end());
+  }
+
+  // Every literal that occurs in name.
+  for (std::uint32_t index = 0; const auto chr : name)
+  {
+    while (index != 0 && child_of(literals_[index], chr) == 0)
+      index = literals_[index].fail;
+    index = child_of(literals_[index], chr);
+
+    auto output = literals_[index].patterns.empty() ? literals_[index].output
+                                                    : index;
+    for (; output != 0; output = literals_[output].output)
+    {
+      const auto &patterns = literals_[output].patterns;
+      found.insert(found.end(), patterns.begin(), patterns.end());
+    }
+  }
+
+  // A literal that occurs more than once reports its patterns each time.
+  std::ranges::sort(found);
+  auto duplicates = std::ranges::unique(found);
+  found.erase(duplicates.begin(), duplicates.end());
+}
+
+
+auto rules::compile(std::string_view text, std::error_code &err,
+                    std::size_t *line) -> std::shared_ptr<rules>
+{
+  err.clear();
+  auto compiled = std::make_shared<rules>();
+  auto prefixes = std::vector<std::pair<std::string, std::string>>();
+
+  auto stream = std::istringstream(std::string(text));
+  std::size_t lineno = 0;
+  for (auto current = std::string(); std::getline(stream, current);)
+  {
+    ++lineno;
+    auto words = std::istringstream(current);
+    auto tokens =
+        std::vector<std::string>(std::istream_iterator<std::string>(words),
+                                 std::istream_iterator<std::string>());
+    if (tokens.empty() || tokens[0].starts_with('#'))
+      continue;
+
+    auto &kind = tokens[0];
+    auto valid = true;
+    if (kind == "slashes" && tokens.size() == 1)
+    {
+      compiled->slashes_ = true;
+    }
+    else if (kind == "lowercase" && tokens.size() == 1)
+    {
+      compiled->lowercase_ = true;
+    }
+    else if ((kind == "prefix" || kind == "regex") && tokens.size() == 3)
+    {
+      auto &to = tokens[2];
+      if (to == "-")
+        to.clear();
+      compiled->needs_mac_ |= to.find("{mac}") != std::string::npos;
+
+      if (kind == "prefix")
+      {
+        prefixes.emplace_back(std::move(tokens[1]), std::move(to));
+      }
+      else
+      {
+        try
+        {
+          compiled->patterns_.push_back(
+              {.pattern = std::regex(tokens[1], std::regex::ECMAScript |
+                                                    std::regex::optimize),
+               .to = std::move(to)});
+          compiled->filter_.add(tokens[1]);
+        }
+        catch (const std::regex_error &)
+        {
+          valid = false;
+        }
+      }
+    }
+    else
+    {
+      valid = false;
+    }
+
+    if (!valid)
+    {
+      err = std::make_error_code(std::errc::invalid_argument);
+      if (line)
+        *line = lineno;
+      return nullptr;
+    }
+  }
+
+  // Prefixes match the folded filename, so fold them the same way.
+  for (auto &[from, to] : prefixes)
+  {
+    fold(from, compiled->slashes_, compiled->lowercase_);
+    auto node = compiled->insert(from);
+    if (!compiled->nodes_[node].prefix)
+    {
+      compiled->nodes_[node].prefix =
+          static_cast<std::uint32_t>(compiled->prefixes_.size());
+      compiled->prefixes_.push_back(
+          {.length = from.size(), .to = std::move(to)});
+    }
+  }
+
+  compiled->filter_.link();
+  return compiled;
+}
+
+auto rules::load(const std::filesystem::path &file, std::error_code &err,
+                 std::size_t *line) -> std::shared_ptr<rules>
+{
+  auto stream = std::ifstream(file);
+  if (!stream.is_open())
+  {
+    err = std::make_error_code(std::errc::no_such_file_or_directory);
+    return nullptr;
+  }
+
+  auto text = std::string(std::istreambuf_iterator<char>(stream),
+                          std::istreambuf_iterator<char>());
+  return compile(text, err, line);
+}
+
+auto rules::insert(std::string_view key) -> std::uint32_t
+{
+  return insert_key(nodes_, key);
+}
+
+auto rules::apply(std::string_view filename, const client &who,
+                  std::pmr::memory_resource *resource) const
+    -> std::pmr::string
+{
+  using match_results = std::match_results<
+      std::pmr::string::const_iterator,
+      std::pmr::polymorphic_allocator<
+          std::sub_match<std::pmr::string::const_iterator>>>;
+
+  auto name = std::pmr::string(filename, resource);
+  fold(name, slashes_, lowercase_);
+
+  auto longest = nodes_[0].prefix;
+  for (std::uint32_t index = 0; const auto chr : name)
+  {
+    if ((index = child_of(nodes_[index], chr)) == 0)
+      break;
+    if (nodes_[index].prefix)
+      longest = nodes_[index].prefix;
+  }
+
+  if (longest)
+  {
+    const auto &rule = prefixes_[*longest];
+    auto rewritten = expand(rule.to, who, resource);
+    rewritten.append(name, rule.length);
+    name = std::move(rewritten);
+  }
+
+  auto candidates = std::pmr::vector<std::uint32_t>(resource);
+  filter_.candidates(name, candidates);
+
+  for (auto index : candidates)
+  {
+    const auto &rule = patterns_[index];
+    auto match = match_results(resource);
+    if (!std::regex_match(name, match, rule.pattern))
+      continue;
+
+    auto replaced = std::pmr::string(resource);
+    match.format(std::back_inserter(replaced), rule.to);
+    return expand(replaced, who, resource);
+  }
+
+  return name;
+}
+
+auto rules::size() const noexcept -> std::size_t
+{
+  return static_cast<std::size_t>(slashes_) +
+         static_cast<std::size_t>(lowercase_) + prefixes_.size() +
+         patterns_.size();
+}
+
+auto lookup_mac(std::string_view ip, std::pmr::memory_resource *resource)
+    -> std::pmr::string
+{
+  // IPv4 clients of a dual-stack socket show up as IPv4-mapped addresses.
+  if (ip.starts_with("::ffff:"))
+    ip.remove_prefix(std::string_view("::ffff:").size());
+
+  auto table = std::ifstream("/proc/net/arp");
+  for (auto line = std::pmr::string(resource); std::getline(table, line);)
+  {
+    // IP address, HW type, Flags and HW address.
+    auto fields = std::array<std::string_view, 4>();
+    auto rest = std::string_view(line);
+    for (auto &field : fields)
+    {
+      rest.remove_prefix(std::min(rest.find_first_not_of(" \t"), rest.size()));
+      field = rest.substr(0, rest.find_first_of(" \t"));
+      rest.remove_prefix(field.size());
+    }
+    if (fields.back().empty() || fields.front() != ip)
+      continue;
+
+    auto mac = std::pmr::string("01-", resource);
+    mac.append(fields.back());
+    std::ranges::replace(mac, ':', '-');
+    fold(mac, false, true);
+    return mac;
+  }
+  return std::pmr::string(resource);
+}
+
+/** @brief The installed rules. */
+struct installed {
+  /** @brief Protects current. */
+  std::mutex mtx;
+  /** @brief The current rules. */
+  std::shared_ptr<const rules> current;
+};
+
+/** @brief Gets the process-wide installed rules. */
+static auto installed_rules() -> installed &
+{
+  static auto rules = installed();
+  return rules;
+}
+
+auto current() -> std::shared_ptr<const rules>
+{
+  auto &installed = installed_rules();
+  auto lock = std::lock_guard{installed.mtx};
+  return installed.current;
+}
+
+auto install(std::shared_ptr<const rules> next) -> std::shared_ptr<const rules>
+{
+  auto &installed = installed_rules();
+  auto lock = std::lock_guard{installed.mtx};
+  std::swap(installed.current, next);
+  return next;
+}
+} // namespace tftp::rewrite
@@ -0,0 +1,444 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file sink.cpp
+ * @brief This file defines in-process consumers of uploaded files.
+ */
+#include "tftp/sink.hpp"
+#include "tftp/memory.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+namespace tftp::sink {
+struct upload_state;
+
+/** @brief Hands queued payloads to consumers on a fixed number of threads. */
+struct registry::workers {
+  /** @brief Protects ready and stopping. */
+  std::mutex mtx;
+  /** @brief Signals the threads. */
+  std::condition_variable cv;
+  /** @brief Uploads with work for a thread, in the order they got it. */
+  std::deque<std::shared_ptr<upload_state>> ready;
+  /** @brief Set once no new work is accepted. */
+  std::atomic<bool> stopping{false};
+  /** @brief The threads. */
+  std::vector<std::thread> threads;
+
+  /** @brief Starts the threads. */
+  explicit workers(std::size_t count);
+
+  /**
+   * @brief Hands an upload to a thread.
+   * @details Once stopping, the upload is cancelled and finished on the
+   * calling thread instead.
+   */
+  auto run(const std::shared_ptr<upload_state> &state) -> void;
+
+  /** @brief Finishes the queued work and joins the threads. */
+  auto stop() -> void;
+};
+
+/** @brief The state shared by an upload and the workers. */
+struct upload_state {
+  /** @brief Protects the state. */
+  std::mutex mtx;
+  /** @brief Payloads waiting for the consumer. */
+  std::deque<std::vector<char>> queue;
+  /** @brief The number of bytes in queue and being consumed. */
+  std::size_t queued{0};
+  /** @brief The number of bytes queued before the upload is busy. */
+  std::size_t window{0};
+  /** @brief Charges the queued bytes to the memory governor. */
+  memory::reservation memory;
+  /** @brief Set while the upload is queued for or held by a worker. */
+  bool scheduled{false};
+  /** @brief Set once the upload is committed. */
+  bool committing{false};
+  /** @brief Set if the upload is closed without being committed. */
+  bool closed{false};
+  /** @brief Set once the consumer is finished. */
+  bool done{false};
+  /** @brief Set if the consumer failed the upload. */
+  std::error_code failed;
+  /** @brief The consumer. */
+  std::unique_ptr<consumer> sink;
+  /** @brief The registry counters. */
+  std::shared_ptr<registry::counters> stats;
+  /** @brief The workers that run the consumer. */
+  std::shared_ptr<registry::workers> pool;
+
+  /**
+   * @brief Claims the upload for a worker.
+   * @details Requires mtx to be held.
+   * @returns true if the caller must hand the upload to the workers.
+   */
+  auto claim() noexcept -> bool
+  {
+    if (scheduled || done)
+      return false;
+
+    scheduled = true;
+    return true;
+  }
+};
+
+/**
+ * @brief Hands the next queued payload of an upload to its consumer.
+ * @details One payload is handed over at a time, so a busy upload takes
+ * turns with the others instead of holding on to a worker.
+ * @returns true if the upload has more work.
+ */
+static auto step(const std::shared_ptr<upload_state> &state) -> bool
+{
+  auto lock = std::unique_lock{state->mtx};
+  // Committed uploads are finished when the workers stop; the rest are
+  // cancelled.
+  if (!state->failed && !state->committing &&
+      state->pool->stopping.load(std::memory_order_relaxed))
+  {
+    state->failed = std::make_error_code(std::errc::operation_canceled);
+  }
+
+  if (state->closed || state->failed)
+  {
+    state->queue.clear();
+    state->queued = 0;
+    state->memory = memory::reservation();
+    state->scheduled = false;
+    state->done = true;
+    lock.unlock();
+    state->sink->abort();
+    return false;
+  }
+
+  if (state->queue.empty())
+  {
+    if (!state->committing)
+    {
+      state->scheduled = false;
+      return false;
+    }
+
+    lock.unlock();
+    auto err = std::error_code();
+    state->sink->commit(err);
+    lock.lock();
+    if (err)
+    {
+      state->failed = err;
+      state->stats->failures.fetch_add(1, std::memory_order_relaxed);
+    }
+    state->scheduled = false;
+    state->done = true;
+    return false;
+  }
+
+  auto chunk = std::move(state->queue.front());
+  state->queue.pop_front();
+  lock.unlock();
+
+  auto err = std::error_code();
+  state->sink->write(chunk, err);
+  state->stats->bytes.fetch_add(chunk.size(), std::memory_order_relaxed);
+
+  lock.lock();
+  state->queued -= chunk.size();
+  state->memory.remove(memory::UPLOADS, chunk.size());
+  if (err)
+  {
+    state->failed = err;
+    state->stats->failures.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  if (state->queue.empty() && !state->committing && !state->closed &&
+      !state->failed)
+  {
+    state->scheduled = false;
+    return false;
+  }
+
+  return true;
+}
+
+registry::workers::workers(std::size_t count)
+{
+  threads.reserve(count);
+  for (std::size_t i = 0; i < count; ++i)
+  {
+    threads.emplace_back([this] {
+      auto lock = std::unique_lock{mtx};
+      while (true)
+      {
+        cv.wait(lock, [&] { return !ready.empty() || stopping; });
+        // Queued work is finished before the threads exit.
+        if (ready.empty())
+          return;
+
+        auto state = std::move(ready.front());
+        ready.pop_front();
+        lock.unlock();
+        auto more = step(state);
+        lock.lock();
+        if (more)
+          ready.push_back(std::move(state));
+      }
+    });
+  }
+}
+
+auto registry::workers::run(const std::shared_ptr<upload_state> &state)
+    -> void
+{
+  {
+    auto lock = std::lock_guard{mtx};
+    if (!stopping)
+    {
+      ready.push_back(state);
+      cv.notify_one();
+      return;
+    }
+  }
+
+  while (step(state))
+    ;
+}
+
+auto registry::workers::stop() -> void
+{
+  {
+    auto lock = std::lock_guard{mtx};
+    stopping = true;
+  }
+  cv.notify_all();
+  for (auto &thread : threads)
+    thread.join();
+  threads.clear();
+}
+
+/** @brief An upload streamed to a consumer. */
+class upload final : public storage::file {
+public:
+  explicit upload(std::shared_ptr<upload_state> state)
+      : state_{std::move(state)}
+  {}
+  upload(const upload &) = delete;
+  upload(upload &&) = delete;
+  auto operator=(const upload &) -> upload & = delete;
+  auto operator=(upload &&) -> upload & = delete;
+  ~upload() override { close(); }
+
+  auto read_at(std::uint64_t, std::span<char>,
+               std::error_code &err) -> std::size_t override
+  {
+    err = std::make_error_code(std::errc::bad_file_descriptor);
+    return 0;
+  }
+
+  auto append(std::span<const char> buf, std::error_code &err) -> void override
+  {
+    {
+      auto lock = std::lock_guard{state_->mtx};
+      err = state_->failed;
+      if (err)
+        return;
+
+      if (state_->committing || state_->closed)
+      {
+        err = std::make_error_code(std::errc::bad_file_descriptor);
+        return;
+      }
+
+      state_->queue.emplace_back(buf.begin(), buf.end());
+      state_->queued += buf.size();
+      state_->memory.add(memory::UPLOADS, buf.size());
+      size_ += buf.size();
+      if (state_->queued > state_->window && !stalled_)
+      {
+        stalled_ = true;
+        state_->stats->stalls.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      if (!state_->claim())
+        return;
+    }
+    state_->pool->run(state_);
+  }
+
+  auto commit(std::error_code &err) -> void override
+  {
+    {
+      auto lock = std::lock_guard{state_->mtx};
+      err = state_->failed;
+      if (err)
+        return;
+
+      if (state_->committing || state_->closed)
+      {
+        err = std::make_error_code(std::errc::bad_file_descriptor);
+        return;
+      }
+
+      state_->committing = true;
+      if (!state_->claim())
+        return;
+    }
+    state_->pool->run(state_);
+  }
+
+  auto close() noexcept -> void override
+  {
+    {
+      auto lock = std::lock_guard{state_->mtx};
+      // A committed upload is left to finish.
+      if (state_->committing || state_->closed)
+        return;
+
+      state_->closed = true;
+      if (!state_->claim())
+        return;
+    }
+    state_->pool->run(state_);
+  }
+
+  [[nodiscard]] auto is_open() const noexcept -> bool override
+  {
+    auto lock = std::lock_guard{state_->mtx};
+    return !state_->committing && !state_->closed;
+  }
+
+  [[nodiscard]] auto size() const noexcept -> std::uint64_t override
+  {
+    return size_;
+  }
+
+  auto busy(std::error_code &err) -> bool override
+  {
+    auto lock = std::lock_guard{state_->mtx};
+    err = state_->failed;
+    if (state_->queued <= state_->window)
+      stalled_ = false;
+
+    return !err && (stalled_ || (state_->committing && !state_->done));
+  }
+
+private:
+  /** @brief The state shared with the workers. */
+  std::shared_ptr<upload_state> state_;
+  /** @brief The number of bytes appended. */
+  std::uint64_t size_{0};
+  /** @brief Set while the upload is over its window. */
+  bool stalled_{false};
+};
+
+registry::registry(std::size_t threads)
+    : stats_{std::make_shared<counters>()},
+      workers_{std::make_shared<workers>(threads)}
+{}
+
+registry::~registry() { workers_->stop(); }
+
+auto registry::add(std::filesystem::path prefix, factory make,
+                   std::size_t window) -> void
+{
+  auto generic = prefix.lexically_normal().generic_string();
+  while (generic.size() > 1 && generic.back() == '/')
+    generic.pop_back();
+
+  routes_.push_back({.prefix = std::move(generic),
+                     .make = std::move(make),
+                     .window = window});
+}
+
+auto registry::open(const std::filesystem::path &path,
+                    std::error_code &err) -> std::shared_ptr<storage::file>
+{
+  err.clear();
+  auto target = path.lexically_normal().generic_string();
+  const route *best = nullptr;
+  for (const auto &route : routes_)
+  {
+    const auto &prefix = route.prefix;
+    if (!target.starts_with(prefix))
+      continue;
+
+    // Only match whole path components.
+    if (target.size() != prefix.size() && !prefix.empty() &&
+        prefix.back() != '/' && target[prefix.size()] != '/')
+    {
+      continue;
+    }
+
+    if (!best || prefix.size() > best->prefix.size())
+      best = &route;
+  }
+
+  if (!best)
+    return nullptr;
+
+  auto sink = best->make(path);
+  if (!sink)
+  {
+    err = std::make_error_code(std::errc::permission_denied);
+    return nullptr;
+  }
+
+  auto state = std::make_shared<upload_state>();
+  state->window = best->window;
+  state->memory = memory::reservation(memory::current());
+  state->sink = std::move(sink);
+  state->stats = stats_;
+  state->pool = workers_;
+  stats_->uploads.fetch_add(1, std::memory_order_relaxed);
+  return std::make_shared<upload>(std::move(state));
+}
+
+auto registry::size() const noexcept -> std::size_t { return routes_.size(); }
+
+auto registry::stats() noexcept -> counters & { return *stats_; }
+
+/** @brief The installed registry. */
+struct installed {
+  /** @brief Protects current. */
+  std::mutex mtx;
+  /** @brief The current registry. */
+  std::shared_ptr<registry> current;
+};
+
+/** @brief Gets the process-wide installed registry. */
+static auto registries() -> installed &
+{
+  static auto registries = installed();
+  return registries;
+}
+
+auto current() -> std::shared_ptr<registry>
+{
+  auto &installed = registries();
+  auto lock = std::lock_guard{installed.mtx};
+  return installed.current;
+}
+
+auto install(std::shared_ptr<registry> next) -> std::shared_ptr<registry>
+{
+  auto &installed = registries();
+  auto lock = std::lock_guard{installed.mtx};
+  std::swap(installed.current, next);
+  return next;
+}
+} // namespace tftp::sink
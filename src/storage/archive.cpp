@@ -0,0 +1,623 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file archive.cpp
+ * @brief This file implements the tar archive storage backend.
+ */
+#include "tftp/storage/archive.hpp"
+#include "tftp/filesystem.hpp"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <string_view>
+#include <vector>
+
+#ifdef TFTP_ENABLE_ZSTD
+#include <list>
+#include <mutex>
+
+#include <zstd.h>
+#endif
+namespace tftp::storage {
+// NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers)
+/** @brief The size of a tar block. */
+static constexpr std::size_t BLOCK_SIZE = 512;
+/** @brief The magic number at the start of a zstd frame. */
+static constexpr std::uint32_t ZSTD_MAGIC = 0xFD2FB528;
+/** @brief The magic number at the end of a zstd seek table. */
+static constexpr std::uint32_t SEEKABLE_MAGIC = 0x8F92EAB1;
+/** @brief The size of the zstd seek table footer. */
+static constexpr std::size_t SEEKABLE_FOOTER_SIZE = 9;
+
+/** @brief Normalizes a path into an index key. */
+static auto key(const std::filesystem::path &path) -> std::string
+{
+  return path.lexically_normal().relative_path().generic_string();
+}
+
+/** @brief Loads a little-endian 32-bit unsigned integer. */
+static auto load_le32(const unsigned char *ptr) noexcept -> std::uint32_t
+{
+  return static_cast<std::uint32_t>(ptr[0]) |
+         static_cast<std::uint32_t>(ptr[1]) << 8U |
+         static_cast<std::uint32_t>(ptr[2]) << 16U |
+         static_cast<std::uint32_t>(ptr[3]) << 24U;
+}
+
+class archive::source {
+public:
+  source() = default;
+  source(const source &) = delete;
+  source(source &&) = delete;
+  auto operator=(const source &) -> source & = delete;
+  auto operator=(source &&) -> source & = delete;
+  virtual ~source() = default;
+
+  /**
+   * @brief Reads decompressed archive bytes.
+   * @returns The number of bytes read. Short reads only happen at EOF.
+   */
+  virtual auto read_at(std::uint64_t offset, std::span<char> buf,
+                       std::error_code &err) -> std::size_t = 0;
+
+  /** @brief Reads exactly buf.size() bytes, failing on a short read. */
+  auto read_exact(std::uint64_t offset, std::span<char> buf,
+                  std::error_code &err) -> bool
+  {
+    auto len = read_at(offset, buf, err);
+    if (!err && len < buf.size())
+      err = std::make_error_code(std::errc::invalid_argument);
+
+    return !err;
+  }
+};
+
+/** @brief An uncompressed archive. */
+class plain_source : public archive::source {
+public:
+  explicit plain_source(
+      std::shared_ptr<filesystem::file_handle> handle) noexcept
+      : handle_(std::move(handle))
+  {}
+
+  auto read_at(std::uint64_t offset, std::span<char> buf,
+               std::error_code &err) -> std::size_t override
+  {
+    return handle_->read_at(offset, buf, err);
+  }
+
+private:
+  std::shared_ptr<filesystem::file_handle> handle_;
+};
+
+#ifdef TFTP_ENABLE_ZSTD
+/**
+ * @brief An archive compressed with zstd in the seekable format.
+ * @details The seek table at the end of the archive lists the compressed
+ * and decompressed size of every frame, so any offset can be served by
+ * decompressing a single frame.
+ */
+class zstd_source : public archive::source {
+public:
+  /** @brief A compressed frame. */
+  struct frame {
+    /** @brief The offset of the frame in the compressed archive. */
+    std::uint64_t compressed_offset{0};
+    /** @brief The compressed size of the frame. */
+    std::uint32_t compressed_size{0};
+    /** @brief The offset of the frame in the decompressed archive. */
+    std::uint64_t offset{0};
+    /** @brief The decompressed size of the frame. */
+    std::uint32_t size{0};
+  };
+
+  zstd_source(std::shared_ptr<filesystem::file_handle> handle,
+              std::vector<frame> frames, std::size_t cached) noexcept
+      : handle_(std::move(handle)), frames_(std::move(frames)),
+        capacity_(std::max<std::size_t>(cached, 1))
+  {}
+
+  /** @brief Parses the seek table of a seekable zstd archive. */
+  static auto open(std::shared_ptr<filesystem::file_handle> handle,
+                   std::size_t cached,
+                   std::error_code &err) -> std::shared_ptr<zstd_source>
+  {
+    auto footer = std::array<unsigned char, SEEKABLE_FOOTER_SIZE>();
+    auto file_size = handle->size();
+    auto *bytes = reinterpret_cast<char *>(footer.data());
+    if (handle->read_at(file_size - footer.size(),
+                        std::span(bytes, footer.size()), err);
+        err)
+    {
+      return {};
+    }
+
+    auto count = load_le32(footer.data());
+    auto has_checksum = (footer[4] & 0x80U) != 0;
+    auto entry_size = std::size_t{has_checksum ? 12U : 8U};
+    auto table_size = count * entry_size;
+    // The table is wrapped in an 8-byte skippable frame header.
+    if (table_size + footer.size() + 8 > file_size)
+    {
+      err = std::make_error_code(std::errc::invalid_argument);
+      return {};
+    }
+
+    auto table = std::vector<unsigned char>(table_size);
+    auto table_offset = file_size - footer.size() - table_size;
+    if (handle->read_at(table_offset,
+                        std::span(reinterpret_cast<char *>(table.data()),
+                                  table.size()),
+                        err);
+        err)
+    {
+      return {};
+    }
+
+    auto frames = std::vector<frame>();
+    frames.reserve(count);
+    std::uint64_t compressed_offset = 0;
+    std::uint64_t offset = 0;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      const auto *entry = table.data() + (i * entry_size);
+      auto next = frame{.compressed_offset = compressed_offset,
+                        .compressed_size = load_le32(entry),
+                        .offset = offset,
+                        .size = load_le32(entry + 4)};
+      compressed_offset += next.compressed_size;
+      offset += next.size;
+      frames.push_back(next);
+    }
+
+    if (compressed_offset > table_offset - 8)
+    {
+      err = std::make_error_code(std::errc::invalid_argument);
+      return {};
+    }
+
+    return std::make_shared<zstd_source>(std::move(handle), std::move(frames),
+                                         cached);
+  }
+
+  auto read_at(std::uint64_t offset, std::span<char> buf,
+               std::error_code &err) -> std::size_t override
+  {
+    err.clear();
+    auto it = std::ranges::upper_bound(frames_, offset, {}, &frame::offset);
+    auto index = static_cast<std::size_t>(it - frames_.begin()) - 1;
+
+    std::size_t total = 0;
+    for (; total < buf.size() && index < frames_.size(); ++index)
+    {
+      const auto &current = frames_[index];
+      auto pos = offset + total - current.offset;
+      if (pos >= current.size)
+        break;
+
+      auto data = decompressed(index, err);
+      if (err)
+        break;
+
+      auto len = std::min<std::uint64_t>(buf.size() - total,
+                                         current.size - pos);
+      std::copy_n(data->begin() + static_cast<std::ptrdiff_t>(pos), len,
+                  buf.begin() + static_cast<std::ptrdiff_t>(total));
+      total += len;
+    }
+
+    return total;
+  }
+
+private:
+  /** @brief Decompressed frame data. */
+  using data_t = std::shared_ptr<const std::vector<char>>;
+
+  /** @brief Gets a decompressed frame, using the cache when possible. */
+  auto decompressed(std::size_t index, std::error_code &err) -> data_t
+  {
+    {
+      auto lock = std::lock_guard{mtx_};
+      auto it = std::ranges::find(cache_, index, &cached_frame::first);
+      if (it != cache_.end())
+      {
+        cache_.splice(cache_.begin(), cache_, it);
+        return it->second;
+      }
+    }
+
+    const auto &current = frames_[index];
+    auto compressed = std::vector<char>(current.compressed_size);
+    if (handle_->read_at(current.compressed_offset, compressed, err); err)
+      return {};
+
+    auto data = std::vector<char>(current.size);
+    auto len = ZSTD_decompress(data.data(), data.size(), compressed.data(),
+                               compressed.size());
+    if (ZSTD_isError(len) || len != data.size())
+    {
+      err = std::make_error_code(std::errc::illegal_byte_sequence);
+      return {};
+    }
+
+    auto frame_data =
+        std::make_shared<const std::vector<char>>(std::move(data));
+    auto lock = std::lock_guard{mtx_};
+    cache_.emplace_front(index, frame_data);
+    if (cache_.size() > capacity_)
+      cache_.pop_back();
+
+    return frame_data;
+  }
+
+  /** @brief A cached frame. */
+  using cached_frame = std::pair<std::size_t, data_t>;
+
+  std::shared_ptr<filesystem::file_handle> handle_;
+  std::vector<frame> frames_;
+  /** @brief Protects cache_. */
+  std::mutex mtx_;
+  /** @brief The most recently used frames, most recent first. */
+  std::list<cached_frame> cache_;
+  /** @brief The maximum number of cached frames. */
+  std::size_t capacity_;
+};
+#endif // TFTP_ENABLE_ZSTD
+
+/** @brief A file inside an archive. */
+class archive_file : public file {
+public:
+  archive_file(std::shared_ptr<archive::source> data,
+               archive::member member) noexcept
+      : source_(std::move(data)), member_(member)
+  {}
+
+  auto read_at(std::uint64_t offset, std::span<char> buf,
+               std::error_code &err) -> std::size_t override
+  {
+    err.clear();
+    if (!source_)
+    {
+      err = std::make_error_code(std::errc::bad_file_descriptor);
+      return 0;
+    }
+
+    if (offset >= member_.size)
+      return 0;
+
+    auto len = std::min<std::uint64_t>(buf.size(), member_.size - offset);
+    return source_->read_at(member_.offset + offset, buf.first(len), err);
+  }
+
+  auto append(std::span<const char> /*buf*/,
+              std::error_code &err) -> void override
+  {
+    err = std::make_error_code(std::errc::bad_file_descriptor);
+  }
+
+  auto commit(std::error_code &err) -> void override
+  {
+    err = std::make_error_code(std::errc::bad_file_descriptor);
+  }
+
+  auto close() noexcept -> void override { source_.reset(); }
+
+  [[nodiscard]] auto is_open() const noexcept -> bool override
+  {
+    return static_cast<bool>(source_);
+  }
+
+  [[nodiscard]] auto size() const noexcept -> std::uint64_t override
+  {
+    return member_.size;
+  }
+
+private:
+  std::shared_ptr<archive::source> source_;
+  archive::member member_;
+};
+
+/** @brief A tar header block. */
+using header_t = std::array<char, BLOCK_SIZE>;
+
+/** @brief Gets a NUL-terminated field of a tar header. */
+static auto field(const header_t &header, std::size_t offset,
+                  std::size_t len) -> std::string_view
+{
+  auto str = std::string_view(header.data() + offset, len);
+  return str.substr(0, str.find('\0'));
+}
+
+/** @brief Parses a numeric field of a tar header (octal or base-256). */
+static auto number(const header_t &header, std::size_t offset,
+                   std::size_t len) -> std::uint64_t
+{
+  const auto *ptr = header.data() + offset;
+  std::uint64_t value = 0;
+  if (static_cast<unsigned char>(*ptr) & 0x80U)
+  {
+    value = static_cast<unsigned char>(*ptr) & 0x7FU;
+    for (std::size_t i = 1; i < len; ++i)
+      value = (value << 8U) | static_cast<unsigned char>(ptr[i]);
+
+    return value;
+  }
+
+  auto str = std::string_view(ptr, len);
+  auto begin = str.find_first_of("01234567");
+  if (begin == std::string_view::npos)
+    return 0;
+
+  for (auto chr : str.substr(begin))
+  {
+    if (chr < '0' || chr > '7')
+      break;
+
+    value = (value << 3U) | static_cast<std::uint64_t>(chr - '0');
+  }
+  return value;
+}
+
+/** @brief Checks the header checksum. */
+static auto valid(const header_t &header) -> bool
+{
+  static constexpr std::size_t CHKSUM = 148;
+  static constexpr std::size_t CHKSUM_LEN = 8;
+
+  std::uint64_t sum = 0;
+  for (std::size_t i = 0; i < header.size(); ++i)
+  {
+    auto in_chksum = i >= CHKSUM && i < CHKSUM + CHKSUM_LEN;
+    sum += in_chksum ? ' ' : static_cast<unsigned char>(header[i]);
+  }
+  return sum == number(header, CHKSUM, CHKSUM_LEN);
+}
+
+/** @brief Gets the value of a pax extended header record. */
+static auto pax_record(std::string_view records,
+                       std::string_view name) -> std::optional<std::string>
+{
+  while (!records.empty())
+  {
+    // Each record is "<len> <key>=<value>\n", with len counting the record.
+    auto space = records.find(' ');
+    if (space == std::string_view::npos)
+      break;
+
+    std::size_t len = 0;
+    for (auto chr : records.substr(0, space))
+      len = (len * 10) + static_cast<std::size_t>(chr - '0');
+
+    if (len <= space || len > records.size())
+      break;
+
+    auto record = records.substr(space + 1, len - space - 2);
+    if (auto equals = record.find('=');
+        equals != std::string_view::npos && record.substr(0, equals) == name)
+    {
+      return std::string(record.substr(equals + 1));
+    }
+    records.remove_prefix(len);
+  }
+  return std::nullopt;
+}
+
+/** @brief Indexes every regular file in a tar archive. */
+static auto index(archive::source &data, std::error_code &err)
+    -> std::unordered_map<std::string, archive::member>
+{
+  auto members = std::unordered_map<std::string, archive::member>();
+  auto header = header_t();
+  auto long_name = std::optional<std::string>();
+  auto long_size = std::optional<std::uint64_t>();
+
+  std::uint64_t offset = 0;
+  while (auto len = data.read_at(offset, header, err))
+  {
+    if (err || len < header.size())
+      break;
+
+    if (std::ranges::all_of(header, [](char chr) { return chr == '\0'; }))
+      return members;
+
+    if (!valid(header))
+    {
+      err = std::make_error_code(std::errc::invalid_argument);
+      return {};
+    }
+
+    auto size = long_size.value_or(number(header, 124, 12));
+    auto type = header[156];
+    auto data_offset = offset + BLOCK_SIZE;
+    offset = data_offset + ((size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE);
+
+    // GNU long names and pax headers describe the member that follows.
+    if (type == 'L' || type == 'x')
+    {
+      auto extended = std::string(size, '\0');
+      if (!data.read_exact(data_offset, extended, err))
+        return {};
+
+      if (type == 'L')
+      {
+        long_name = extended.substr(0, extended.find('\0'));
+        continue;
+      }
+
+      if (auto path = pax_record(extended, "path"))
+        long_name = std::move(path);
+      if (auto pax_size = pax_record(extended, "size"))
+      {
+        std::uint64_t value = 0;
+        auto [ptr, ec] = std::from_chars(
+            pax_size->data(), pax_size->data() + pax_size->size(), value);
+        if (ec == std::errc{})
+          long_size = value;
+      }
+      continue;
+    }
+
+    auto name = std::string(field(header, 0, 100));
+    if (long_name)
+    {
+      name = std::move(*long_name);
+    }
+    else if (field(header, 257, 5) == "ustar")
+    {
+      if (auto prefix = field(header, 345, 155); !prefix.empty())
+        name = std::string(prefix) + "/" + name;
+    }
+    long_name.reset();
+    long_size.reset();
+
+    using namespace std::chrono;
+    auto mtime = sys_seconds(seconds(number(header, 136, 12)));
+    auto member = archive::member{.offset = data_offset,
+                                  .size = size,
+                                  .last_write = file_clock::from_sys(mtime)};
+    switch (type)
+    {
+      case '0':
+      case '\0':
+      case '7':
+        members.insert_or_assign(key(name), member);
+        break;
+
+      case '1':
+        if (auto it = members.find(key(std::string(field(header, 157, 100))));
+            it != members.end())
+        {
+          members.insert_or_assign(key(name), it->second);
+        }
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  // Archives may end without the terminating zero blocks.
+  if (!err && offset > 0 && data.read_at(offset, header, err) == 0 && !err)
+    return members;
+
+  if (!err)
+    err = std::make_error_code(std::errc::invalid_argument);
+  return {};
+}
+
+auto archive::open(const std::filesystem::path &path, std::error_code &err,
+                   [[maybe_unused]] std::size_t cached_frames)
+    -> std::shared_ptr<archive>
+{
+  auto handle = filesystem::open_read(path, err);
+  if (!handle)
+    return {};
+
+  auto magic = std::array<unsigned char, 4>();
+  auto *magic_bytes = reinterpret_cast<char *>(magic.data());
+  auto file_size = handle->size();
+  auto seekable = false;
+  if (file_size >= SEEKABLE_FOOTER_SIZE)
+  {
+    handle->read_at(file_size - magic.size(), std::span(magic_bytes, 4), err);
+    seekable = !err && load_le32(magic.data()) == SEEKABLE_MAGIC;
+  }
+  handle->read_at(0, std::span(magic_bytes, 4), err);
+  auto compressed = seekable || (!err && load_le32(magic.data()) == ZSTD_MAGIC);
+
+  auto data = std::shared_ptr<source>();
+  if (!compressed)
+  {
+    data = std::make_shared<plain_source>(std::move(handle));
+  }
+#ifdef TFTP_ENABLE_ZSTD
+  else if (seekable)
+  {
+    data = zstd_source::open(std::move(handle), cached_frames, err);
+    if (!data)
+      return {};
+  }
+#endif
+  else
+  {
+    // Zstd archives must be seekable to serve files without decompressing
+    // the whole archive.
+    err = std::make_error_code(std::errc::not_supported);
+    return {};
+  }
+
+  auto members = index(*data, err);
+  if (err)
+    return {};
+
+  return std::make_shared<archive>(std::move(data), std::move(members));
+}
+
+archive::archive(std::shared_ptr<source> data,
+                 std::unordered_map<std::string, member> index) noexcept
+    : source_(std::move(data)), index_(std::move(index))
+{}
+
+auto archive::find(const std::filesystem::path &path) const
+    -> std::optional<member>
+{
+  auto it = index_.find(key(path));
+  if (it == index_.end())
+    return std::nullopt;
+
+  return it->second;
+}
+
+auto archive::size() const noexcept -> std::size_t { return index_.size(); }
+
+auto archive::open_read(const std::filesystem::path &path,
+                        std::error_code &err) -> std::shared_ptr<file>
+{
+  err.clear();
+  auto found = find(path);
+  if (!found)
+  {
+    err = std::make_error_code(std::errc::no_such_file_or_directory);
+    return {};
+  }
+
+  return std::make_shared<archive_file>(source_, *found);
+}
+
+auto archive::open_write(const std::filesystem::path & /*path*/,
+                         std::error_code &err) -> std::shared_ptr<file>
+{
+  err = std::make_error_code(std::errc::permission_denied);
+  return {};
+}
+
+auto archive::stat(const std::filesystem::path &path,
+                   std::error_code &err) -> file_status
+{
+  err.clear();
+  auto found = find(path);
+  if (!found)
+  {
+    err = std::make_error_code(std::errc::no_such_file_or_directory);
+    return {};
+  }
+
+  return {.size = found->size, .last_write = found->last_write};
+}
+// NOLINTEND(cppcoreguidelines-avoid-magic-numbers)
+} // namespace tftp::storage
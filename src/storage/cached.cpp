@@ -0,0 +1,889 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file cached.cpp
+ * @brief This file implements the content caching storage backend.
+ */
+#include "tftp/storage/cached.hpp"
+#include "tftp/detail/single_flight.hpp"
+#include "tftp/filesystem.hpp"
+#include "tftp/memory.hpp"
+#include "tftp/watcher.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <list>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+namespace tftp::storage {
+/** @brief Normalizes a path into a cache key. */
+static auto key(const std::filesystem::path &path) -> std::string
+{
+  return path.lexically_normal().generic_string();
+}
+
+/** @brief A content-addressed block of cached file data. */
+struct block {
+  /** @brief The block contents. */
+  cached::contents data;
+  /** @brief The hash of data. */
+  std::size_t hash{0};
+  /** @brief The number of cached files that use the block. Guarded by the
+   * cache mutex. */
+  mutable std::size_t refs{0};
+};
+
+/** @brief The blocks of a cached file. */
+struct block_map {
+  /** @brief The blocks in file order. Every block but the last is full. */
+  std::vector<std::shared_ptr<const block>> blocks;
+  /** @brief The file size. */
+  std::uint64_t size{0};
+};
+
+/** @brief Splits appended bytes into hashed blocks. */
+class block_builder {
+public:
+  /** @brief Appends bytes to the file. */
+  auto append(std::span<const char> buf) -> void
+  {
+    while (!buf.empty())
+    {
+      if (blocks_.empty() ||
+          blocks_.back()->data.size() == cached::BLOCK_SIZE)
+      {
+        seal();
+        blocks_.push_back(std::make_shared<block>());
+        blocks_.back()->data.reserve(cached::BLOCK_SIZE);
+      }
+
+      auto &data = blocks_.back()->data;
+      auto len = std::min(buf.size(), cached::BLOCK_SIZE - data.size());
+      data.insert(data.end(), buf.begin(), buf.begin() + len);
+      buf = buf.subspan(len);
+      size_ += len;
+    }
+  }
+
+  /** @brief Gets the number of bytes appended. */
+  [[nodiscard]] auto size() const noexcept -> std::uint64_t { return size_; }
+
+  /** @brief Hashes the last block and returns every block. */
+  auto finish() -> std::vector<std::shared_ptr<block>>
+  {
+    seal();
+    size_ = 0;
+    return std::move(blocks_);
+  }
+
+private:
+  /** @brief Hashes the last block. */
+  auto seal() -> void
+  {
+    if (blocks_.empty())
+      return;
+
+    auto &last = *blocks_.back();
+    last.hash = std::hash<std::string_view>{}(
+        std::string_view(last.data.data(), last.data.size()));
+  }
+
+  std::vector<std::shared_ptr<block>> blocks_;
+  std::uint64_t size_{0};
+};
+
+/** @brief A cached file served from its blocks. */
+class block_file : public file {
+public:
+  explicit block_file(std::shared_ptr<const block_map> map) noexcept
+      : map_(std::move(map))
+  {}
+
+  auto read_at(std::uint64_t offset, std::span<char> buf,
+               std::error_code &err) -> std::size_t override
+  {
+    err.clear();
+    if (!map_)
+    {
+      err = std::make_error_code(std::errc::bad_file_descriptor);
+      return 0;
+    }
+
+    std::size_t total = 0;
+    while (total < buf.size() && offset + total < map_->size)
+    {
+      auto pos = offset + total;
+      const auto &data = map_->blocks[pos / cached::BLOCK_SIZE]->data;
+      auto start = pos % cached::BLOCK_SIZE;
+      auto len = std::min<std::size_t>(buf.size() - total, data.size() - start);
+      std::copy_n(data.begin() + static_cast<std::ptrdiff_t>(start), len,
+                  buf.begin() + static_cast<std::ptrdiff_t>(total));
+      total += len;
+    }
+    return total;
+  }
+
+  auto append(std::span<const char>, std::error_code &err) -> void override
+  {
+    err = std::make_error_code(std::errc::bad_file_descriptor);
+  }
+
+  auto commit(std::error_code &err) -> void override
+  {
+    err = std::make_error_code(std::errc::bad_file_descriptor);
+  }
+
+  auto close() noexcept -> void override { map_.reset(); }
+
+  [[nodiscard]] auto is_open() const noexcept -> bool override
+  {
+    return static_cast<bool>(map_);
+  }
+
+  [[nodiscard]] auto size() const noexcept -> std::uint64_t override
+  {
+    return map_ ? map_->size : 0;
+  }
+
+private:
+  std::shared_ptr<const block_map> map_;
+};
+
+struct cached::state {
+  /** @brief The most paths whose open counts are tracked. */
+  static constexpr std::size_t MAX_TRACKED = 65536;
+
+  /** @brief A cached file. */
+  struct entry {
+    /** @brief The file blocks. */
+    std::shared_ptr<const block_map> map;
+    /** @brief The file status when it was loaded. */
+    file_status status;
+    /** @brief The position of the file in the LRU list. */
+    std::list<std::string>::iterator lru;
+    /** @brief The absolute() of the name. */
+    std::string absolute;
+    /** @brief Set if the file was installed by write-through. */
+    bool written{false};
+    /** @brief Set if the file must be validated with stat() on open. */
+    bool revalidate{false};
+    /** @brief Set if the file may change without the watcher reporting it. */
+    bool aliased{true};
+  };
+
+  /** @brief The result of loading a file. */
+  struct load_result {
+    /** @brief The loaded blocks, or nullptr if the file is not cached. */
+    std::shared_ptr<const block_map> map;
+    /** @brief The error if the load failed. */
+    std::error_code err;
+  };
+
+  state(std::shared_ptr<backend> inner, std::size_t capacity,
+        std::size_t max_file_size)
+      : inner(std::move(inner)), capacity(capacity),
+        max_file_size(max_file_size)
+  {
+    auto err = std::error_code();
+    cwd = std::filesystem::current_path(err);
+  }
+
+  /**
+   * @brief Resolves a path against the working directory.
+   * @returns The lexically normal path without a trailing separator.
+   */
+  [[nodiscard]] auto absolute(const std::filesystem::path &path) const
+      -> std::string
+  {
+    auto key =
+        (path.is_absolute() ? path : cwd / path).lexically_normal().native();
+    while (!key.empty() && key.back() == '/')
+      key.pop_back();
+
+    return key;
+  }
+
+  /** @brief Counts an open of name. */
+  auto touch(const std::string &name) -> void
+  {
+    auto lock = std::lock_guard{mtx};
+    if (accesses.size() >= MAX_TRACKED && !accesses.contains(name))
+    {
+      // Age every count so that paths that are no longer hot drop out.
+      for (auto it = accesses.begin(); it != accesses.end();)
+        it = (it->second /= 2) == 0 ? accesses.erase(it) : std::next(it);
+    }
+    ++accesses[name];
+  }
+
+  /** @brief Finds a cached file that is still current. */
+  auto find(const std::filesystem::path &path,
+            const std::string &name) -> std::shared_ptr<const block_map>
+  {
+    auto status = file_status{};
+    {
+      auto lock = std::lock_guard{mtx};
+      auto it = entries.find(name);
+      if (it == entries.end())
+        return {};
+
+      lru.splice(lru.begin(), lru, it->second.lru);
+      if (watcher && watcher->covers(path) && !it->second.aliased &&
+          !it->second.revalidate)
+      {
+        return it->second.map;
+      }
+
+      status = it->second.status;
+    }
+
+    auto err = std::error_code();
+    auto now = inner->stat(path, err);
+    if (!err && now.size == status.size && now.last_write == status.last_write)
+    {
+      auto lock = std::lock_guard{mtx};
+      auto it = entries.find(name);
+      if (it == entries.end())
+        return nullptr;
+
+      it->second.revalidate = false;
+      return it->second.map;
+    }
+
+    drop(path);
+    return {};
+  }
+
+  /** @brief Loads a file into the cache. */
+  auto load(const std::filesystem::path &path,
+            const std::string &name) -> load_result
+  {
+    auto err = std::error_code();
+    auto status = inner->stat(path, err);
+    if (err || status.size > max_file_size || status.size > capacity)
+      return {};
+
+    auto file = inner->open_read(path, err);
+    if (err)
+      return {{}, err};
+
+    auto builder = block_builder();
+    auto chunk = std::array<char, BLOCK_SIZE>();
+    while (builder.size() < status.size)
+    {
+      auto len = file->read_at(builder.size(), chunk, err);
+      if (err)
+        return {{}, err};
+
+      if (len == 0)
+        break;
+
+      builder.append(std::span(chunk.data(), len));
+    }
+
+    // The file changed between stat() and the read; serve it uncached.
+    auto tail = std::array<char, 1>();
+    if (builder.size() != status.size ||
+        file->read_at(builder.size(), tail, err) != 0)
+    {
+      return {};
+    }
+
+    return {insert(name, builder.finish(), status), {}};
+  }
+
+  /**
+   * @brief Replaces blocks with identical blocks that are already cached.
+   * @details Requires mtx to be held.
+   */
+  auto intern(std::vector<std::shared_ptr<block>> fresh)
+      -> std::shared_ptr<const block_map>
+  {
+    auto map = std::make_shared<block_map>();
+    map->blocks.reserve(fresh.size());
+    for (auto &next : fresh)
+    {
+      auto found = std::shared_ptr<const block>();
+      auto [first, last] = store.equal_range(next->hash);
+      for (auto it = first; it != last && !found; ++it)
+      {
+        if (it->second->data == next->data)
+          found = it->second;
+      }
+
+      if (!found)
+      {
+        next->data.shrink_to_fit();
+        physical += next->data.size();
+        store.emplace(next->hash, next);
+        found = std::move(next);
+      }
+
+      ++found->refs;
+      map->size += found->data.size();
+      map->blocks.push_back(std::move(found));
+    }
+    return map;
+  }
+
+  /**
+   * @brief Releases the blocks of an erased file.
+   * @details Requires mtx to be held.
+   */
+  auto release(const block_map &map) -> void
+  {
+    for (const auto &used : map.blocks)
+    {
+      if (--used->refs > 0)
+        continue;
+
+      auto [first, last] = store.equal_range(used->hash);
+      for (auto it = first; it != last; ++it)
+      {
+        if (it->second == used)
+        {
+          physical -= used->data.size();
+          store.erase(it);
+          break;
+        }
+      }
+    }
+  }
+
+  /**
+   * @brief Inserts a file, evicting the least recently used files.
+   * @details Eviction is by physical bytes, so a file that shares most of
+   * its blocks with cached files evicts little. If the memory governor can
+   * not make room for the file, any older copy is erased and nullptr is
+   * returned.
+   */
+  auto insert(const std::string &name,
+              std::vector<std::shared_ptr<block>> fresh,
+              const file_status &status,
+              bool written = false) -> std::shared_ptr<const block_map>
+  {
+    auto size = std::size_t{0};
+    for (const auto &next : fresh)
+      size += next->data.size();
+    // Asked before locking, since the governor may shrink this cache.
+    auto fits = tftp::memory::make_room(size);
+    auto aliased = filesystem::watcher::aliased(name);
+    auto resolved = absolute(name);
+
+    auto lock = std::lock_guard{mtx};
+    erase(name);
+    if (!fits)
+      return nullptr;
+
+    auto map = intern(std::move(fresh));
+    while (!lru.empty() && physical > capacity)
+    {
+      erase(lru.back());
+      ++stats.evictions;
+    }
+
+    lru.push_front(name);
+    paths.emplace(resolved, name);
+    entries.emplace(name, entry{.map = map,
+                                .status = status,
+                                .lru = lru.begin(),
+                                .absolute = std::move(resolved),
+                                .written = written,
+                                .revalidate = written,
+                                .aliased = aliased});
+    logical += map->size;
+    return map;
+  }
+
+  /** @brief Erases a cached file. Requires mtx to be held. */
+  auto erase(const std::string &name) -> bool
+  {
+    auto it = entries.find(name);
+    if (it == entries.end())
+      return false;
+
+    auto [first, last] = paths.equal_range(it->second.absolute);
+    for (; first != last; ++first)
+    {
+      if (first->second == name)
+      {
+        paths.erase(first);
+        break;
+      }
+    }
+
+    auto pos = it->second.lru;
+    logical -= it->second.map->size;
+    release(*it->second.map);
+    entries.erase(it);
+    lru.erase(pos);
+    return true;
+  }
+
+  /**
+   * @brief Drops cached files at or below path.
+   * @details Files installed by write-through are kept and validated with
+   * stat() on their next open instead, since the watcher reports every
+   * upload after it is already cached.
+   */
+  auto drop(const std::filesystem::path &path) -> std::size_t
+  {
+    auto changed = absolute(path);
+    auto lock = std::lock_guard{mtx};
+    auto dropped = std::size_t{0};
+    auto drop_range = [&](auto first, auto last) {
+      while (first != last)
+      {
+        // Erasing the entry also erases its position in paths.
+        const auto name = (first++)->second;
+        auto &found = entries.at(name);
+        if (found.written)
+          found.revalidate = true;
+        else if (erase(name))
+          ++dropped;
+      }
+    };
+
+    auto [first, last] = paths.equal_range(changed);
+    drop_range(first, last);
+    // Every path below changed sorts between changed + '/' and changed + '0',
+    // the character after '/'.
+    drop_range(paths.lower_bound(changed + '/'),
+               paths.lower_bound(changed + '0'));
+
+    stats.invalidations += dropped;
+    return dropped;
+  }
+
+  /** @brief Queues a file for prefetching. */
+  auto enqueue(std::string name) -> void
+  {
+    {
+      auto lock = std::lock_guard{queue_mtx};
+      if (!queued.insert(name).second)
+        return;
+
+      queue.push_back(std::move(name));
+    }
+    queue_cv.notify_one();
+  }
+
+  /** @brief Prefetches queued files until stopped. */
+  auto prefetch(const std::stop_token &token) -> void
+  {
+    while (!token.stop_requested())
+    {
+      auto name = std::string();
+      {
+        auto lock = std::unique_lock{queue_mtx};
+        if (!queue_cv.wait(lock, token, [&] { return !queue.empty(); }))
+          return;
+
+        name = std::move(queue.front());
+        queue.pop_front();
+        queued.erase(name);
+      }
+
+      auto lock = std::unique_lock{mtx};
+      if (entries.contains(name))
+        continue;
+      lock.unlock();
+
+      auto result = flights(name, [&] { return load(name, name); });
+      if (result.map)
+        ++stats.prefetched;
+    }
+  }
+
+  /** @brief The cached backend. */
+  std::shared_ptr<backend> inner;
+  /** @brief The maximum number of bytes to cache. */
+  const std::size_t capacity;
+  /** @brief Files larger than this are not cached. */
+  const std::size_t max_file_size;
+  /** @brief The working directory used to resolve relative paths. */
+  std::filesystem::path cwd;
+  /** @brief Invalidates changed files, if set. */
+  std::shared_ptr<filesystem::watcher> watcher;
+  /** @brief Set if committed uploads are installed in the cache. */
+  std::atomic<bool> write_through{false};
+  /** @brief The cache counters. */
+  counters stats;
+
+  /** @brief Protects the members below. */
+  mutable std::mutex mtx;
+  /** @brief The cached files. */
+  std::unordered_map<std::string, entry> entries;
+  /** @brief Cached file names, most recently used first. */
+  std::list<std::string> lru;
+  /** @brief The names of entries, ordered by their absolute(). */
+  std::multimap<std::string, std::string> paths;
+  /** @brief The cached blocks, keyed by hash. */
+  std::unordered_multimap<std::size_t, std::shared_ptr<const block>> store;
+  /** @brief The size of every cached file. */
+  std::size_t logical{0};
+  /** @brief The size of every cached block. */
+  std::size_t physical{0};
+  /** @brief Open counts by path. */
+  std::unordered_map<std::string, std::uint64_t> accesses;
+
+  /** @brief Coalesces concurrent loads. */
+  detail::single_flight<std::string, load_result> flights;
+
+  /** @brief Protects the prefetch queue. */
+  std::mutex queue_mtx;
+  /** @brief Signals the prefetch worker. */
+  std::condition_variable_any queue_cv;
+  /** @brief Files waiting to be prefetched. */
+  std::deque<std::string> queue;
+  /** @brief The files in queue. */
+  std::unordered_set<std::string> queued;
+  /** @brief The prefetch worker. Declared last so it stops first. */
+  std::jthread worker;
+};
+
+/** @brief A file being written through the cache. */
+class cached_writer : public file {
+public:
+  cached_writer(std::shared_ptr<file> inner,
+                std::weak_ptr<cached::state> cache, std::filesystem::path path,
+                std::size_t retain_limit) noexcept
+      : inner_(std::move(inner)), cache_(std::move(cache)),
+        path_(std::move(path)), retain_limit_(retain_limit)
+  {}
+
+  auto read_at(std::uint64_t offset, std::span<char> buf,
+               std::error_code &err) -> std::size_t override
+  {
+    return inner_->read_at(offset, buf, err);
+  }
+
+  auto append(std::span<const char> buf,
+              std::error_code &err) -> void override
+  {
+    inner_->append(buf, err);
+    if (err || !retain_)
+      return;
+
+    // Stop retaining uploads that are too large to cache.
+    if (retained_.size() + buf.size() > retain_limit_)
+    {
+      retain_ = false;
+      retained_ = {};
+      return;
+    }
+
+    retained_.append(buf);
+  }
+
+  auto commit(std::error_code &err) -> void override
+  {
+    inner_->commit(err);
+    auto cache = cache_.lock();
+    if (!cache || err)
+      return;
+
+    if (retain_)
+    {
+      auto stat_err = std::error_code();
+      auto status = cache->inner->stat(path_, stat_err);
+      if (!stat_err && status.size == retained_.size())
+      {
+        if (cache->insert(key(path_), retained_.finish(), status, true))
+        {
+          ++cache->stats.written;
+          return;
+        }
+      }
+    }
+
+    cache->drop(path_);
+  }
+
+  auto close() noexcept -> void override
+  {
+    inner_->close();
+    retained_ = {};
+  }
+
+  [[nodiscard]] auto is_open() const noexcept -> bool override
+  {
+    return inner_->is_open();
+  }
+
+  [[nodiscard]] auto size() const noexcept -> std::uint64_t override
+  {
+    return inner_->size();
+  }
+
+private:
+  std::shared_ptr<file> inner_;
+  std::weak_ptr<cached::state> cache_;
+  std::filesystem::path path_;
+  /** @brief The most bytes that are retained for the cache. */
+  std::size_t retain_limit_;
+  /** @brief Set while the upload is retained for the cache. */
+  bool retain_{retain_limit_ > 0};
+  /** @brief The blocks written so far. */
+  block_builder retained_;
+};
+
+cached::cached(std::shared_ptr<backend> inner, std::size_t capacity,
+               std::size_t max_file_size)
+    : state_(std::make_shared<state>(std::move(inner), capacity, max_file_size))
+{
+  state_->worker = std::jthread(
+      [cache = state_.get()](const std::stop_token &token) {
+        cache->prefetch(token);
+      });
+}
+
+cached::~cached()
+{
+  state_->worker.request_stop();
+  if (state_->worker.joinable())
+    state_->worker.join();
+}
+
+auto cached::watch(std::shared_ptr<filesystem::watcher> watcher) -> void
+{
+  watcher->subscribe([cache = std::weak_ptr(state_)](
+                         const std::filesystem::path &path) {
+    if (auto state = cache.lock())
+      state->drop(path);
+  });
+
+  auto lock = std::lock_guard{state_->mtx};
+  state_->watcher = std::move(watcher);
+}
+
+auto cached::write_through(bool enable) noexcept -> void
+{
+  state_->write_through = enable;
+}
+
+auto cached::invalidate(const std::filesystem::path &path) -> std::size_t
+{
+  return state_->drop(path);
+}
+
+auto cached::warm(const std::filesystem::path &path,
+                  std::error_code &err) -> bool
+{
+  auto name = key(path);
+  auto result = state_->flights(name, [&] { return state_->load(path, name); });
+  err = result.err;
+  return static_cast<bool>(result.map);
+}
+
+auto cached::prefetch(const std::filesystem::path &path) -> void
+{
+  state_->enqueue(key(path));
+}
+
+auto cached::preload(const std::filesystem::path &manifest,
+                     std::error_code &err) -> std::size_t
+{
+  err.clear();
+  auto stream = std::ifstream(manifest);
+  if (!stream.is_open())
+  {
+    err = std::make_error_code(std::errc::no_such_file_or_directory);
+    return 0;
+  }
+
+  std::size_t count = 0;
+  for (auto line = std::string(); std::getline(stream, line);)
+  {
+    auto first = line.find_first_not_of(" \t");
+    if (first == std::string::npos || line[first] == '#')
+      continue;
+
+    auto last = line.find_last_not_of(" \t\r");
+    auto load_err = std::error_code();
+    if (warm(line.substr(first, last - first + 1), load_err))
+      ++count;
+  }
+  return count;
+}
+
+auto cached::hot_set(std::size_t limit) const -> std::vector<hot_entry>
+{
+  auto entries = std::vector<hot_entry>();
+  {
+    auto lock = std::lock_guard{state_->mtx};
+    entries.assign(state_->accesses.begin(), state_->accesses.end());
+  }
+
+  auto hotter = [](const hot_entry &lhs, const hot_entry &rhs) {
+    return lhs.second > rhs.second ||
+           (lhs.second == rhs.second && lhs.first < rhs.first);
+  };
+  limit = std::min(limit, entries.size());
+  std::ranges::partial_sort(
+      entries, entries.begin() + static_cast<std::ptrdiff_t>(limit), hotter);
+  entries.resize(limit);
+  return entries;
+}
+
+auto cached::save_snapshot(const std::filesystem::path &snapshot,
+                           std::error_code &err, std::size_t limit) const
+    -> void
+{
+  err.clear();
+  auto tmp = std::filesystem::path(snapshot).concat(".tmp");
+  {
+    auto stream = std::ofstream(tmp, std::ios::out | std::ios::trunc);
+    if (!stream.is_open())
+    {
+      err = std::make_error_code(std::errc::permission_denied);
+      return;
+    }
+
+    for (const auto &[name, count] : hot_set(limit))
+      stream << count << '\t' << name << '\n';
+
+    if (!stream.flush())
+    {
+      err = std::make_error_code(std::errc::no_space_on_device);
+      return;
+    }
+  }
+
+  std::filesystem::rename(tmp, snapshot, err);
+}
+
+auto cached::load_snapshot(const std::filesystem::path &snapshot,
+                           std::error_code &err) -> std::size_t
+{
+  err.clear();
+  auto stream = std::ifstream(snapshot);
+  if (!stream.is_open())
+  {
+    err = std::make_error_code(std::errc::no_such_file_or_directory);
+    return 0;
+  }
+
+  std::size_t count = 0;
+  for (auto line = std::string(); std::getline(stream, line);)
+  {
+    auto tab = line.find('\t');
+    auto accesses = std::uint64_t{0};
+    if (tab == std::string::npos ||
+        std::from_chars(line.data(), line.data() + tab, accesses).ec !=
+            std::errc{})
+    {
+      continue;
+    }
+
+    auto name = line.substr(tab + 1);
+    {
+      auto lock = std::lock_guard{state_->mtx};
+      state_->accesses[name] += accesses;
+    }
+    state_->enqueue(std::move(name));
+    ++count;
+  }
+  return count;
+}
+
+auto cached::bytes() const -> std::size_t
+{
+  auto lock = std::lock_guard{state_->mtx};
+  return state_->physical;
+}
+
+auto cached::memory_usage() const -> usage
+{
+  auto lock = std::lock_guard{state_->mtx};
+  return {.files = state_->entries.size(),
+          .blocks = state_->store.size(),
+          .logical = state_->logical,
+          .physical = state_->physical};
+}
+
+auto cached::shrink(std::size_t bytes) -> std::size_t
+{
+  auto lock = std::lock_guard{state_->mtx};
+  const auto before = state_->physical;
+  while (!state_->lru.empty() && before - state_->physical < bytes)
+  {
+    state_->erase(state_->lru.back());
+    ++state_->stats.evictions;
+  }
+
+  return before - state_->physical;
+}
+
+auto cached::stats() noexcept -> counters & { return state_->stats; }
+
+auto cached::open_read(const std::filesystem::path &path,
+                       std::error_code &err) -> std::shared_ptr<file>
+{
+  err.clear();
+  auto name = key(path);
+
+  // Only opens that succeed are counted, so names that do not exist never
+  // reach the hot-set snapshot.
+  if (auto map = state_->find(path, name))
+  {
+    ++state_->stats.hits;
+    state_->touch(name);
+    return std::make_shared<block_file>(std::move(map));
+  }
+
+  ++state_->stats.misses;
+  auto result = state_->flights(name, [&] { return state_->load(path, name); });
+  if (result.map)
+  {
+    state_->touch(name);
+    return std::make_shared<block_file>(std::move(result.map));
+  }
+
+  // The file is not cacheable, so read it from the backend.
+  auto file = state_->inner->open_read(path, err);
+  if (file)
+    state_->touch(name);
+
+  return file;
+}
+
+auto cached::open_write(const std::filesystem::path &path,
+                        std::error_code &err) -> std::shared_ptr<file>
+{
+  auto inner = state_->inner->open_write(path, err);
+  if (!inner)
+    return {};
+
+  auto retain_limit =
+      state_->write_through ? std::min(state_->max_file_size, state_->capacity)
+                            : 0;
+  return std::make_shared<cached_writer>(std::move(inner), state_, path,
+                                         retain_limit);
+}
+
+auto cached::stat(const std::filesystem::path &path,
+                  std::error_code &err) -> file_status
+{
+  return state_->inner->stat(path, err);
+}
+} // namespace tftp::storage
@@ -0,0 +1,137 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file embedded.cpp
+ * @brief This file implements the embedded file storage backend.
+ */
+#include "tftp/storage/embedded.hpp"
+
+#include <string>
+namespace tftp::storage {
+/** @brief Normalizes a path into an index key. */
+static auto key(const std::filesystem::path &path) -> std::string
+{
+  return path.lexically_normal().relative_path().generic_string();
+}
+
+/** @brief A file in read-only memory. */
+class rodata_file : public file {
+public:
+  explicit rodata_file(std::string_view contents) noexcept
+      : contents_(contents)
+  {}
+
+  auto read_at(std::uint64_t offset, std::span<char> buf,
+               std::error_code &err) -> std::size_t override
+  {
+    err.clear();
+    if (!open_)
+    {
+      err = std::make_error_code(std::errc::bad_file_descriptor);
+      return 0;
+    }
+
+    if (offset >= contents_.size())
+      return 0;
+
+    return contents_.copy(buf.data(), buf.size(), offset);
+  }
+
+  auto append(std::span<const char> /*buf*/,
+              std::error_code &err) -> void override
+  {
+    err = std::make_error_code(std::errc::bad_file_descriptor);
+  }
+
+  auto commit(std::error_code &err) -> void override
+  {
+    err = std::make_error_code(std::errc::bad_file_descriptor);
+  }
+
+  auto close() noexcept -> void override { open_ = false; }
+
+  [[nodiscard]] auto is_open() const noexcept -> bool override
+  {
+    return open_;
+  }
+
+  [[nodiscard]] auto size() const noexcept -> std::uint64_t override
+  {
+    return contents_.size();
+  }
+
+private:
+  std::string_view contents_;
+  bool open_{true};
+};
+
+embedded::embedded(std::shared_ptr<backend> fallback,
+                   std::span<const entry> files)
+    : fallback_(std::move(fallback)),
+      last_write_(std::filesystem::file_time_type::clock::now())
+{
+  for (const auto &[path, contents] : files)
+    files_.insert_or_assign(path, contents);
+}
+
+auto embedded::find(const std::filesystem::path &path) const
+    -> std::optional<std::string_view>
+{
+  auto it = files_.find(key(path));
+  if (it == files_.end())
+    return std::nullopt;
+
+  return it->second;
+}
+
+auto embedded::size() const noexcept -> std::size_t { return files_.size(); }
+
+auto embedded::open_read(const std::filesystem::path &path,
+                         std::error_code &err) -> std::shared_ptr<file>
+{
+  if (auto contents = find(path))
+  {
+    err.clear();
+    return std::make_shared<rodata_file>(*contents);
+  }
+
+  return fallback_->open_read(path, err);
+}
+
+auto embedded::open_write(const std::filesystem::path &path,
+                          std::error_code &err) -> std::shared_ptr<file>
+{
+  if (find(path))
+  {
+    err = std::make_error_code(std::errc::permission_denied);
+    return {};
+  }
+
+  return fallback_->open_write(path, err);
+}
+
+auto embedded::stat(const std::filesystem::path &path,
+                    std::error_code &err) -> file_status
+{
+  if (auto contents = find(path))
+  {
+    err.clear();
+    return {.size = contents->size(), .last_write = last_write_};
+  }
+
+  return fallback_->stat(path, err);
+}
+} // namespace tftp::storage
@@ -0,0 +1,25 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file embedded_bundle.cpp
+ * @brief This file defines the empty embedded file bundle.
+ * @details It is replaced by a generated bundle when the `TFTP_EMBED_DIR`
+ * build option is set.
+ */
+#include "tftp/storage/embedded.hpp"
+namespace tftp::storage {
+auto embedded::bundle() noexcept -> std::span<const entry> { return {}; }
+} // namespace tftp::storage
@@ -0,0 +1,313 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file memory.cpp
+ * @brief This file implements the in-memory storage backend.
+ */
+#include "tftp/storage/memory.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+namespace tftp::storage {
+/** @brief Normalizes a path into a store key. */
+static auto key(const std::filesystem::path &path) -> std::string
+{
+  return path.lexically_normal().relative_path().generic_string();
+}
+
+struct memory::store {
+  /** @brief A stored file. */
+  struct entry {
+    /** @brief The file contents. */
+    std::shared_ptr<const contents> bytes;
+    /** @brief The time the file was stored. */
+    std::filesystem::file_time_type last_write;
+  };
+
+  /** @brief Constructs a store with a capacity. */
+  explicit store(std::size_t capacity) noexcept : capacity(capacity) {}
+
+  /** @brief Reserves space for an upload. */
+  auto reserve(std::size_t len) -> bool
+  {
+    auto lock = std::lock_guard{mtx};
+    if (bytes + reserved + len > capacity)
+      return false;
+
+    reserved += len;
+    return true;
+  }
+
+  /** @brief Releases space reserved for an upload. */
+  auto release(std::size_t len) -> void
+  {
+    auto lock = std::lock_guard{mtx};
+    reserved -= len;
+  }
+
+  /** @brief Stores a file, releasing `len` reserved bytes. */
+  auto publish(std::string name, contents data, std::size_t len) -> void
+  {
+    using clock = std::filesystem::file_time_type::clock;
+    auto value = entry{
+        .bytes = std::make_shared<const contents>(std::move(data)),
+        .last_write = clock::now()};
+
+    auto lock = std::lock_guard{mtx};
+    reserved -= len;
+    bytes += value.bytes->size();
+
+    auto [it, inserted] = files.try_emplace(std::move(name), value);
+    if (!inserted)
+    {
+      bytes -= it->second.bytes->size();
+      it->second = std::move(value);
+    }
+  }
+
+  /** @brief Protects the members below. */
+  mutable std::shared_mutex mtx;
+  /** @brief The stored files. */
+  std::unordered_map<std::string, entry> files;
+  /** @brief The number of bytes stored. */
+  std::size_t bytes{0};
+  /** @brief The number of bytes reserved by uploads in progress. */
+  std::size_t reserved{0};
+  /** @brief The maximum number of bytes that uploads may grow to. */
+  const std::size_t capacity;
+};
+
+/** @brief A file held in memory. */
+class memory_file : public file {
+public:
+  /** @brief Opens a memory file for reading. */
+  explicit memory_file(std::shared_ptr<const memory::contents> data) noexcept
+      : data_(std::move(data))
+  {}
+
+  /** @brief Opens a memory file for writing. */
+  memory_file(std::shared_ptr<memory::store> store, std::string name) noexcept
+      : store_(std::move(store)), name_(std::move(name))
+  {}
+
+  memory_file(const memory_file &) = delete;
+  memory_file(memory_file &&) = delete;
+  auto operator=(const memory_file &) -> memory_file & = delete;
+  auto operator=(memory_file &&) -> memory_file & = delete;
+
+  ~memory_file() override { memory_file::close(); }
+
+  auto read_at(std::uint64_t offset, std::span<char> buf,
+               std::error_code &err) -> std::size_t override
+  {
+    err.clear();
+    if (!data_)
+    {
+      err = std::make_error_code(std::errc::bad_file_descriptor);
+      return 0;
+    }
+
+    if (offset >= data_->size())
+      return 0;
+
+    auto len = std::min<std::uint64_t>(buf.size(), data_->size() - offset);
+    std::copy_n(data_->begin() + static_cast<std::ptrdiff_t>(offset), len,
+                buf.begin());
+    return len;
+  }
+
+  auto append(std::span<const char> buf,
+              std::error_code &err) -> void override
+  {
+    err.clear();
+    if (!store_)
+    {
+      err = std::make_error_code(std::errc::bad_file_descriptor);
+      return;
+    }
+
+    if (!store_->reserve(buf.size()))
+    {
+      err = std::make_error_code(std::errc::no_space_on_device);
+      return;
+    }
+
+    buffer_.insert(buffer_.end(), buf.begin(), buf.end());
+  }
+
+  auto commit(std::error_code &err) -> void override
+  {
+    err.clear();
+    if (!store_)
+    {
+      err = std::make_error_code(std::errc::bad_file_descriptor);
+      return;
+    }
+
+    auto len = buffer_.size();
+    store_->publish(std::move(name_), std::move(buffer_), len);
+    buffer_ = {};
+    store_.reset();
+  }
+
+  auto close() noexcept -> void override
+  {
+    data_.reset();
+    if (store_)
+    {
+      store_->release(buffer_.size());
+      store_.reset();
+    }
+    buffer_ = {};
+  }
+
+  [[nodiscard]] auto is_open() const noexcept -> bool override
+  {
+    return data_ || store_;
+  }
+
+  [[nodiscard]] auto size() const noexcept -> std::uint64_t override
+  {
+    return data_ ? data_->size() : buffer_.size();
+  }
+
+private:
+  std::shared_ptr<const memory::contents> data_;
+  std::shared_ptr<memory::store> store_;
+  std::string name_;
+  memory::contents buffer_;
+};
+
+memory::memory(std::size_t capacity)
+    : store_(std::make_shared<store>(capacity))
+{}
+
+auto memory::reader(std::shared_ptr<const contents> bytes)
+    -> std::shared_ptr<file>
+{
+  return std::make_shared<memory_file>(std::move(bytes));
+}
+
+auto memory::insert(const std::filesystem::path &path, contents bytes) -> void
+{
+  store_->publish(key(path), std::move(bytes), 0);
+}
+
+auto memory::erase(const std::filesystem::path &path) -> bool
+{
+  auto lock = std::lock_guard{store_->mtx};
+  auto it = store_->files.find(key(path));
+  if (it == store_->files.end())
+    return false;
+
+  store_->bytes -= it->second.bytes->size();
+  store_->files.erase(it);
+  return true;
+}
+
+auto memory::find(const std::filesystem::path &path) const
+    -> std::shared_ptr<const contents>
+{
+  auto lock = std::shared_lock{store_->mtx};
+  auto it = store_->files.find(key(path));
+  if (it == store_->files.end())
+    return {};
+
+  return it->second.bytes;
+}
+
+auto memory::load(const std::filesystem::path &root,
+                  std::error_code &err) -> std::size_t
+{
+  using std::filesystem::recursive_directory_iterator;
+  err.clear();
+
+  std::size_t count = 0;
+  for (auto it = recursive_directory_iterator(root, err);
+       !err && it != recursive_directory_iterator(); it.increment(err))
+  {
+    if (!it->is_regular_file(err))
+      continue;
+
+    auto stream = std::ifstream(it->path(), std::ios::in | std::ios::binary);
+    if (!stream.is_open())
+    {
+      err = std::make_error_code(std::errc::permission_denied);
+      return count;
+    }
+
+    auto bytes = contents(std::istreambuf_iterator<char>(stream),
+                          std::istreambuf_iterator<char>());
+    insert(it->path().lexically_relative(root), std::move(bytes));
+    ++count;
+  }
+
+  return count;
+}
+
+auto memory::bytes() const -> std::size_t
+{
+  auto lock = std::shared_lock{store_->mtx};
+  return store_->bytes;
+}
+
+auto memory::capacity() const noexcept -> std::size_t
+{
+  return store_->capacity;
+}
+
+auto memory::open_read(const std::filesystem::path &path,
+                       std::error_code &err) -> std::shared_ptr<file>
+{
+  err.clear();
+  auto bytes = find(path);
+  if (!bytes)
+  {
+    err = std::make_error_code(std::errc::no_such_file_or_directory);
+    return {};
+  }
+
+  return reader(std::move(bytes));
+}
+
+auto memory::open_write(const std::filesystem::path &path,
+                        std::error_code &err) -> std::shared_ptr<file>
+{
+  err.clear();
+  return std::make_shared<memory_file>(store_, key(path));
+}
+
+auto memory::stat(const std::filesystem::path &path,
+                  std::error_code &err) -> file_status
+{
+  err.clear();
+  auto lock = std::shared_lock{store_->mtx};
+  auto it = store_->files.find(key(path));
+  if (it == store_->files.end())
+  {
+    err = std::make_error_code(std::errc::no_such_file_or_directory);
+    return {};
+  }
+
+  return {.size = it->second.bytes->size(),
+          .last_write = it->second.last_write};
+}
+} // namespace tftp::storage
@@ -0,0 +1,316 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file posix.cpp
+ * @brief This file implements the posix storage backend.
+ */
+#include "tftp/storage/posix.hpp"
+#include "tftp/detail/sha256.hpp"
+#include "tftp/filesystem.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <array>
+#include <cstdio>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <vector>
+
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/xattr.h>
+#endif
+namespace tftp::storage {
+/** @brief The extended attribute that caches the digest of a file. */
+static constexpr auto DIGEST_XATTR = "user.tftp.sha256";
+
+/** @brief The digest of a file's contents. */
+struct digest {
+  /** @brief The SHA-256 of the contents. */
+  detail::sha256::value_type hash{};
+  /** @brief The size of the contents. */
+  std::uint64_t size{0};
+};
+
+/** @brief Gets the modification time of a file in nanoseconds. */
+static auto mtime_ns(const struct stat &status) noexcept -> long long
+{
+  static constexpr long long NS_PER_SEC = 1'000'000'000;
+  return (static_cast<long long>(status.st_mtim.tv_sec) * NS_PER_SEC) +
+         status.st_mtim.tv_nsec;
+}
+
+/**
+ * @brief Reads the cached digest of a file.
+ * @details The digest is only used if the file has not been modified since
+ * it was cached.
+ */
+static auto cached_digest([[maybe_unused]] const std::filesystem::path &path,
+                          [[maybe_unused]] const struct stat &status)
+    -> std::optional<digest>
+{
+#ifdef __linux__
+  static constexpr std::size_t XATTR_LEN = 128;
+  auto value = std::array<char, XATTR_LEN>();
+  auto len =
+      ::getxattr(path.c_str(), DIGEST_XATTR, value.data(), value.size() - 1);
+  if (len <= 0)
+    return std::nullopt;
+  value[static_cast<std::size_t>(len)] = '\0';
+
+  auto cached = digest{};
+  auto hex = std::array<char, (2 * sizeof(cached.hash)) + 1>();
+  unsigned long long size = 0;
+  long long mtime = 0;
+  // NOLINTNEXTLINE(cert-err34-c)
+  if (std::sscanf(value.data(), "%64s %llu %lld", hex.data(), &size, &mtime) !=
+          3 ||
+      size != static_cast<unsigned long long>(status.st_size) ||
+      mtime != mtime_ns(status))
+  {
+    return std::nullopt;
+  }
+
+  for (std::size_t i = 0; i < cached.hash.size(); ++i)
+  {
+    unsigned int byte = 0;
+    // NOLINTNEXTLINE(cert-err34-c)
+    if (std::sscanf(&hex[2 * i], "%2x", &byte) != 1)
+      return std::nullopt;
+    cached.hash[i] = static_cast<std::uint8_t>(byte);
+  }
+
+  cached.size = size;
+  return cached;
+#else
+  return std::nullopt;
+#endif
+}
+
+/** @brief Caches the digest of a file, if the filesystem supports it. */
+static auto cache_digest([[maybe_unused]] const std::filesystem::path &path,
+                         [[maybe_unused]] const digest &value) noexcept -> void
+{
+#ifdef __linux__
+  struct stat status{};
+  if (::stat(path.c_str(), &status))
+    return;
+
+  auto str = std::string();
+  for (auto byte : value.hash)
+    std::format_to(std::back_inserter(str), "{:02x}", unsigned{byte});
+  std::format_to(std::back_inserter(str), " {} {}", value.size,
+                 mtime_ns(status));
+  ::setxattr(path.c_str(), DIGEST_XATTR, str.data(), str.size(), 0);
+#endif
+}
+
+/** @brief Computes the digest of a file from its contents. */
+static auto compute_digest(const std::filesystem::path &path)
+    -> std::optional<digest>
+{
+  static constexpr std::size_t CHUNK_SIZE = 64UL * 1024;
+  auto stream = std::ifstream(path, std::ios::in | std::ios::binary);
+  if (!stream.is_open())
+    return std::nullopt;
+
+  auto sha = detail::sha256();
+  auto value = digest{};
+  auto chunk = std::vector<char>(CHUNK_SIZE);
+  while (stream.read(chunk.data(), static_cast<std::streamsize>(chunk.size())),
+         stream.gcount() > 0)
+  {
+    auto len = static_cast<std::size_t>(stream.gcount());
+    sha.update(std::span(chunk.data(), len));
+    value.size += len;
+  }
+
+  if (stream.bad())
+    return std::nullopt;
+
+  value.hash = sha.value();
+  return value;
+}
+
+/**
+ * @brief Gets the digest of an upload's target.
+ * @details Returns std::nullopt without reading the target if its size
+ * differs from `size`, since the upload must then change it.
+ */
+static auto target_digest(const std::filesystem::path &target,
+                          std::uint64_t size) -> std::optional<digest>
+{
+  struct stat status{};
+  if (::stat(target.c_str(), &status) || !S_ISREG(status.st_mode) ||
+      static_cast<std::uint64_t>(status.st_size) != size)
+  {
+    return std::nullopt;
+  }
+
+  if (auto cached = cached_digest(target, status))
+    return cached;
+
+  auto computed = compute_digest(target);
+  if (computed)
+    cache_digest(target, *computed);
+
+  return computed;
+}
+
+/** @brief A file on the local filesystem. */
+class posix_file : public file {
+public:
+  /** @brief Opens a posix file for reading. */
+  explicit posix_file(std::shared_ptr<filesystem::file_handle> handle) noexcept
+      : handle_(std::move(handle))
+  {}
+
+  /** @brief Opens a posix file for writing. */
+  posix_file(std::shared_ptr<filesystem::file_handle> handle,
+             std::filesystem::path target, std::filesystem::path tmp) noexcept
+      : handle_(std::move(handle)), target_(std::move(target)),
+        tmp_(std::move(tmp))
+  {}
+
+  posix_file(const posix_file &) = delete;
+  posix_file(posix_file &&) = delete;
+  auto operator=(const posix_file &) -> posix_file & = delete;
+  auto operator=(posix_file &&) -> posix_file & = delete;
+
+  ~posix_file() override { posix_file::close(); }
+
+  auto read_at(std::uint64_t offset, std::span<char> buf,
+               std::error_code &err) -> std::size_t override
+  {
+    return handle_->read_at(offset, buf, err);
+  }
+
+  auto append(std::span<const char> buf,
+              std::error_code &err) -> void override
+  {
+    handle_->write(buf, err);
+    if (!err)
+      sha_.update(buf);
+  }
+
+  auto commit(std::error_code &err) -> void override
+  {
+    err.clear();
+    auto upload = digest{.hash = sha_.value(), .size = handle_->offset()};
+    handle_->close();
+
+    // Leave the target untouched if the upload would not change it. SHA-256
+    // matches are trusted, so the target is not read again to confirm one.
+    if (auto current = target_digest(target_, upload.size);
+        current && current->hash == upload.hash)
+    {
+      auto &stats = posix::stats();
+      ++stats.avoided;
+      stats.bytes_avoided += upload.size;
+      spdlog::debug("Upload to {} is unchanged, skipped writing it.",
+                    target_.c_str());
+      close();
+      return;
+    }
+
+    cache_digest(tmp_, upload);
+    std::filesystem::rename(tmp_, target_, err);
+    if (!err)
+    {
+      tmp_.clear();
+      ++posix::stats().written;
+    }
+  }
+
+  auto close() noexcept -> void override
+  {
+    auto err = std::error_code();
+    handle_->close();
+
+    // Delete any uncommitted temporary file.
+    if (!tmp_.empty() && !std::filesystem::remove(tmp_, err) && err)
+        [[unlikely]]
+    {
+      spdlog::warn(                                          // GCOVR_EXCL_LINE
+          "Failed to delete temporary file {} "              // GCOVR_EXCL_LINE
+          "with error: {}",                                  // GCOVR_EXCL_LINE
+          tmp_.c_str(), err.message());                      // GCOVR_EXCL_LINE
+    }
+    tmp_.clear();
+  }
+
+  [[nodiscard]] auto is_open() const noexcept -> bool override
+  {
+    return handle_->is_open();
+  }
+
+  [[nodiscard]] auto size() const noexcept -> std::uint64_t override
+  {
+    if (!tmp_.empty())
+      return handle_->offset();
+
+    return handle_->size();
+  }
+
+private:
+  std::shared_ptr<filesystem::file_handle> handle_;
+  std::filesystem::path target_;
+  std::filesystem::path tmp_;
+  detail::sha256 sha_;
+};
+
+auto posix::stats() noexcept -> write_stats &
+{
+  static auto stats = write_stats();
+  return stats;
+}
+
+auto posix::open_read(const std::filesystem::path &path,
+                      std::error_code &err) -> std::shared_ptr<file>
+{
+  auto handle = filesystem::open_read(path, err);
+  if (!handle)
+    return {};
+
+  return std::make_shared<posix_file>(std::move(handle));
+}
+
+auto posix::open_write(const std::filesystem::path &path,
+                       std::error_code &err) -> std::shared_ptr<file>
+{
+  auto tmp = std::filesystem::path();
+  auto handle = filesystem::open_write(path, tmp, err);
+  if (!handle)
+    return {};
+
+  return std::make_shared<posix_file>(std::move(handle), path, std::move(tmp));
+}
+
+auto posix::stat(const std::filesystem::path &path,
+                 std::error_code &err) -> file_status
+{
+  err.clear();
+  auto status = file_status{};
+  status.size = std::filesystem::file_size(path, err);
+  if (err)
+    return {};
+
+  status.last_write = std::filesystem::last_write_time(path, err);
+  return status;
+}
+} // namespace tftp::storage
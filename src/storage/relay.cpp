@@ -0,0 +1,958 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file relay.cpp
+ * @brief This file implements the fetch-through relay storage backend.
+ */
+#include "tftp/storage/relay.hpp"
+#include "tftp/filesystem.hpp"
+#include "tftp/memory.hpp"
+#include "tftp/protocol/tftp_protocol.hpp"
+#include "tftp/storage/posix.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+namespace tftp::storage {
+/** @brief The directory below the cache directory that downloads go to. */
+static constexpr auto PARTIAL_DIR = ".partial";
+/** @brief How often a download checks if it was cancelled. */
+static constexpr auto POLL_INTERVAL = std::chrono::milliseconds(100);
+/** @brief How often an unanswered TFTP request or ACK is retransmitted. */
+static constexpr auto RETRANSMIT_INTERVAL = std::chrono::milliseconds(1000);
+/** @brief The largest HTTP response header that is accepted. */
+static constexpr std::size_t MAX_HEADER = 16384;
+/**
+ * @brief The bytes past the read cursor that must arrive before a partial
+ * download stops being busy.
+ * @details This covers a window of the largest forward error correction
+ * group, so a session never has to wait in the middle of one.
+ */
+static constexpr std::uint64_t READ_AHEAD = 16UL * messages::DATALEN;
+
+/** @brief The size of the buffer an HTTP download receives into. */
+static constexpr std::size_t RECEIVE_BUFFER = 16UL * 1024;
+
+using clock = std::chrono::steady_clock;
+
+/** @brief A file being downloaded from the origin. */
+struct download {
+  download(int fd, std::filesystem::path tmp)
+      : file(std::make_shared<const filesystem::descriptor>(fd)),
+        tmp(std::move(tmp))
+  {}
+
+  /** @brief Marks the download as started. */
+  auto start(std::optional<std::uint64_t> len) -> void
+  {
+    auto lock = std::lock_guard{mtx};
+    started = true;
+    length = len;
+  }
+
+  /** @brief Appends downloaded bytes. */
+  auto append(std::span<const char> buf, std::error_code &error) -> void
+  {
+    writer.write(buf, error);
+    if (error)
+      return;
+
+    auto lock = std::lock_guard{mtx};
+    received += buf.size();
+  }
+
+  /** @brief Marks the download as done. */
+  auto finish(std::error_code error) -> void
+  {
+    auto lock = std::lock_guard{mtx};
+    done = true;
+    err = error;
+    if (!err)
+      length = received;
+  }
+
+  /** @brief The temporary file being written. */
+  std::shared_ptr<const filesystem::descriptor> file;
+  /** @brief Writes to file. */
+  filesystem::file_handle writer{file};
+  /** @brief The path of the temporary file. */
+  std::filesystem::path tmp;
+  /** @brief Set once the worker thread is about to exit. */
+  std::atomic<bool> exited{false};
+  /** @brief Charges the download to the memory governor until it ends. */
+  tftp::memory::reservation memory;
+
+  /** @brief Protects the members below. */
+  std::mutex mtx;
+  /** @brief The number of bytes written to file. */
+  std::uint64_t received{0};
+  /** @brief The file size, if the origin reported it. */
+  std::optional<std::uint64_t> length;
+  /** @brief Set when the origin starts sending the file. */
+  bool started{false};
+  /** @brief Set when the download completes or fails. */
+  bool done{false};
+  /** @brief The error if the download failed. */
+  std::error_code err;
+};
+
+/**
+ * @brief A file served from a download in progress.
+ * @details Reads never wait for the origin. A read of bytes that have not
+ * arrived yet fails with `operation_would_block`, and the file stays busy
+ * until the bytes past its read cursor have arrived.
+ */
+class relay_file : public file {
+public:
+  explicit relay_file(std::shared_ptr<download> source) noexcept
+      : source_(std::move(source)), handle_(source_->file)
+  {}
+
+  auto read_at(std::uint64_t offset, std::span<char> buf,
+               std::error_code &err) -> std::size_t override
+  {
+    err.clear();
+    if (!open_)
+    {
+      err = std::make_error_code(std::errc::bad_file_descriptor);
+      return 0;
+    }
+
+    // Short reads only happen at EOF, so the whole range must be here.
+    auto want = offset + buf.size();
+    auto avail = std::uint64_t{0};
+    {
+      auto lock = std::lock_guard{source_->mtx};
+      if (source_->err)
+      {
+        err = source_->err;
+        return 0;
+      }
+
+      if (source_->length)
+        want = std::min(want, *source_->length);
+
+      if (!source_->done && source_->received < want)
+      {
+        err = std::make_error_code(std::errc::operation_would_block);
+        return 0;
+      }
+      avail = source_->received;
+    }
+
+    if (offset >= avail)
+      return 0;
+
+    auto len = std::min<std::uint64_t>(buf.size(), avail - offset);
+    return handle_.read_at(offset, buf.first(len), err);
+  }
+
+  auto append(std::span<const char> /*buf*/,
+              std::error_code &err) -> void override
+  {
+    err = std::make_error_code(std::errc::bad_file_descriptor);
+  }
+
+  auto commit(std::error_code &err) -> void override
+  {
+    err = std::make_error_code(std::errc::bad_file_descriptor);
+  }
+
+  auto close() noexcept -> void override { open_ = false; }
+
+  [[nodiscard]] auto is_open() const noexcept -> bool override
+  {
+    return open_;
+  }
+
+  [[nodiscard]] auto size() const noexcept -> std::uint64_t override
+  {
+    auto lock = std::lock_guard{source_->mtx};
+    return source_->length.value_or(source_->received);
+  }
+
+  /**
+   * @brief Checks if the download is still behind the read cursor.
+   * @details The file is busy until READ_AHEAD bytes past offset() have
+   * arrived or the download ends. A failed download sets err.
+   */
+  auto busy(std::error_code &err) -> bool override
+  {
+    auto lock = std::lock_guard{source_->mtx};
+    err = source_->err;
+    auto want = offset() + READ_AHEAD;
+    if (source_->length)
+      want = std::min(want, *source_->length);
+
+    return !source_->done && source_->received < want;
+  }
+
+  [[nodiscard]] auto complete() const noexcept -> bool override
+  {
+    auto lock = std::lock_guard{source_->mtx};
+    return source_->done && !source_->err;
+  }
+
+private:
+  std::shared_ptr<download> source_;
+  filesystem::file_handle handle_;
+  bool open_{true};
+};
+
+/** @brief Checks if a socket call failed because its timeout expired. */
+static auto timed_out() noexcept -> bool
+{
+  return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+/** @brief Opens a socket to the origin. */
+static auto connect_to(const relay::origin &upstream, int type,
+                       sockaddr_storage &addr, socklen_t &addrlen,
+                       std::chrono::milliseconds timeout,
+                       std::error_code &err) -> int
+{
+  auto hints = addrinfo{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = type;
+
+  addrinfo *found = nullptr;
+  auto service = std::to_string(upstream.port);
+  if (::getaddrinfo(upstream.host.c_str(), service.c_str(), &hints, &found))
+  {
+    err = std::make_error_code(std::errc::host_unreachable);
+    return -1;
+  }
+
+  auto to_timeval = [](std::chrono::milliseconds interval) {
+    auto usec = std::chrono::duration_cast<std::chrono::microseconds>(interval);
+    return timeval{.tv_sec = static_cast<time_t>(usec.count() / 1000000),
+                   .tv_usec = static_cast<suseconds_t>(usec.count() % 1000000)};
+  };
+  auto poll = to_timeval(POLL_INTERVAL);
+  auto wait = to_timeval(timeout);
+  err = std::make_error_code(std::errc::connection_refused);
+
+  int fd = -1;
+  for (auto *info = found; info && fd < 0; info = info->ai_next)
+  {
+    fd = ::socket(info->ai_family, info->ai_socktype | SOCK_CLOEXEC,
+                  info->ai_protocol);
+    if (fd < 0)
+      continue;
+
+    (void)::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &wait, sizeof(wait));
+    (void)::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &poll, sizeof(poll));
+    if (type == SOCK_STREAM && ::connect(fd, info->ai_addr, info->ai_addrlen))
+    {
+      (void)::close(fd);
+      fd = -1;
+      continue;
+    }
+
+    std::memcpy(&addr, info->ai_addr, info->ai_addrlen);
+    addrlen = info->ai_addrlen;
+    err.clear();
+  }
+
+  ::freeaddrinfo(found);
+  return fd;
+}
+
+/** @brief Percent-encodes a path for use in an HTTP request. */
+static auto encode(std::string_view path) -> std::string
+{
+  static constexpr auto hex = std::string_view("0123456789ABCDEF");
+  auto encoded = std::string();
+  for (const auto chr : path)
+  {
+    auto byte = static_cast<unsigned char>(chr);
+    if (std::isalnum(byte) ||
+        std::string_view("-._~/").find(chr) != std::string_view::npos)
+    {
+      encoded.push_back(chr);
+      continue;
+    }
+
+    encoded.push_back('%');
+    encoded.push_back(hex[byte >> 4U]);
+    encoded.push_back(hex[byte & 0xFU]);
+  }
+  return encoded;
+}
+
+/** @brief Gets the value of an HTTP header, if present. */
+static auto header_value(std::string_view header,
+                         std::string_view name) -> std::string_view
+{
+  auto lower = [](char chr) {
+    return static_cast<char>(std::tolower(static_cast<unsigned char>(chr)));
+  };
+
+  for (auto pos = header.find("\r\n"); pos != std::string_view::npos;)
+  {
+    auto line = header.substr(pos + 2);
+    auto end = line.find("\r\n");
+    line = line.substr(0, end);
+    pos = end == std::string_view::npos ? end : pos + 2 + end;
+
+    auto colon = line.find(':');
+    if (colon != name.size() ||
+        !std::ranges::equal(line.substr(0, colon), name, {}, lower, lower))
+    {
+      continue;
+    }
+
+    auto value = line.substr(colon + 1);
+    value.remove_prefix(std::min(value.find_first_not_of(' '), value.size()));
+    return value;
+  }
+  return {};
+}
+
+/** @brief Gets the path of a file on the relay's disk. */
+static auto cache_name(const std::filesystem::path &path) -> std::string
+{
+  auto name = path.relative_path().lexically_normal();
+  if (name.empty() || *name.begin() == ".." || *name.begin() == "." ||
+      *name.begin() == PARTIAL_DIR)
+  {
+    return {};
+  }
+  return name.generic_string();
+}
+
+struct relay::state {
+  /** @brief A file in the cache directory. */
+  struct entry {
+    /** @brief The file size. */
+    std::uint64_t size;
+    /** @brief The position of the file in the LRU list. */
+    std::list<std::string>::iterator lru;
+  };
+
+  /** @brief A download and the thread running it. */
+  using worker = std::pair<std::shared_ptr<download>, std::jthread>;
+
+  state(origin upstream, std::filesystem::path dir, std::uint64_t capacity,
+        std::chrono::milliseconds timeout)
+      : upstream(std::move(upstream)), dir(std::move(dir)),
+        capacity(capacity), timeout(timeout)
+  {}
+
+  /** @brief Indexes the files already in the cache directory. */
+  auto scan() -> void
+  {
+    auto err = std::error_code();
+    std::filesystem::remove_all(dir / PARTIAL_DIR, err);
+    std::filesystem::create_directories(dir / PARTIAL_DIR, err);
+
+    using found_file = std::tuple<std::filesystem::file_time_type,
+                                  std::string, std::uint64_t>;
+    auto found = std::vector<found_file>();
+    using std::filesystem::recursive_directory_iterator;
+    for (auto it = recursive_directory_iterator(dir, err);
+         !err && it != recursive_directory_iterator(); it.increment(err))
+    {
+      auto name = cache_name(it->path().lexically_relative(dir));
+      if (!name.empty() && it->is_regular_file(err))
+        found.emplace_back(it->last_write_time(err), name, it->file_size(err));
+    }
+
+    std::ranges::sort(found);
+    auto lock = std::lock_guard{mtx};
+    for (auto &[time, name, size] : found)
+      insert(std::move(name), size);
+    evict();
+  }
+
+  /** @brief Adds a file to the cache. Requires mtx to be held. */
+  auto insert(std::string name, std::uint64_t size) -> void
+  {
+    if (auto it = cached.find(name); it != cached.end())
+    {
+      used -= it->second.size;
+      lru.erase(it->second.lru);
+      cached.erase(it);
+    }
+
+    lru.push_front(name);
+    cached.emplace(std::move(name), entry{.size = size, .lru = lru.begin()});
+    used += size;
+  }
+
+  /** @brief Deletes least recently used files. Requires mtx to be held. */
+  auto evict() -> void
+  {
+    while (used > capacity && !lru.empty())
+    {
+      auto err = std::error_code();
+      std::filesystem::remove(dir / lru.back(), err);
+      auto it = cached.find(lru.back());
+      used -= it->second.size;
+      cached.erase(it);
+      lru.pop_back();
+      ++stats.evictions;
+    }
+  }
+
+  /** @brief Moves a finished download into the cache. */
+  auto publish(download &source, const std::string &name) -> void
+  {
+    auto err = std::error_code();
+    auto size = source.received;
+    if (size > capacity)
+    {
+      std::filesystem::remove(source.tmp, err);
+      return;
+    }
+
+    auto target = dir / name;
+    std::filesystem::create_directories(target.parent_path(), err);
+    std::filesystem::rename(source.tmp, target, err);
+    if (err)
+    {
+      std::filesystem::remove(source.tmp, err);
+      return;
+    }
+
+    auto lock = std::lock_guard{mtx};
+    insert(name, size);
+    evict();
+  }
+
+  /** @brief Downloads a file over HTTP. */
+  auto http_get(download &source, const std::string &name,
+                const std::stop_token &token) -> std::error_code
+  {
+    auto err = std::error_code();
+    auto addr = sockaddr_storage{};
+    auto addrlen = socklen_t{};
+    auto sock = filesystem::descriptor(
+        connect_to(upstream, SOCK_STREAM, addr, addrlen, timeout, err));
+    if (err)
+      return err;
+
+    auto host = upstream.host.find(':') != std::string::npos
+                    ? "[" + upstream.host + "]"
+                    : upstream.host;
+    auto request = "GET " + encode(upstream.prefix + "/" + name) +
+                   " HTTP/1.0\r\nHost: " + host + ":" +
+                   std::to_string(upstream.port) +
+                   "\r\nConnection: close\r\n\r\n";
+    if (::send(sock.native_handle(), request.data(), request.size(),
+               MSG_NOSIGNAL) != static_cast<ssize_t>(request.size()))
+    {
+      return std::make_error_code(std::errc::connection_aborted);
+    }
+
+    auto header = std::string();
+    auto buf = std::array<char, RECEIVE_BUFFER>();
+    auto last = clock::now();
+    while (true)
+    {
+      if (token.stop_requested())
+        return std::make_error_code(std::errc::operation_canceled);
+
+      auto len = ::recv(sock.native_handle(), buf.data(), buf.size(), 0);
+      if (len < 0 && timed_out())
+      {
+        if (clock::now() - last > timeout)
+          return std::make_error_code(std::errc::timed_out);
+        continue;
+      }
+
+      if (len < 0)
+        return std::make_error_code(std::errc::connection_aborted);
+
+      last = clock::now();
+      auto bytes =
+          std::span<const char>(buf.data(), static_cast<std::size_t>(len));
+      if (!source.started)
+      {
+        header.append(bytes.begin(), bytes.end());
+        auto end = header.find("\r\n\r\n");
+        if (end == std::string::npos)
+        {
+          if (len == 0 || header.size() > MAX_HEADER)
+            return std::make_error_code(std::errc::protocol_error);
+          continue;
+        }
+
+        auto status = 0;
+        if (!header.starts_with("HTTP/1.") || header.size() < 12 ||
+            std::from_chars(header.data() + 9, header.data() + 12, status).ec !=
+                std::errc{})
+        {
+          return std::make_error_code(std::errc::protocol_error);
+        }
+
+        if (status == 404 || status == 410)
+          return std::make_error_code(std::errc::no_such_file_or_directory);
+        if (status == 401 || status == 403)
+          return std::make_error_code(std::errc::permission_denied);
+        if (status != 200)
+          return std::make_error_code(std::errc::io_error);
+
+        auto length = std::optional<std::uint64_t>();
+        auto value = header_value(std::string_view(header).substr(0, end),
+                                  "content-length");
+        if (auto size = std::uint64_t{0};
+            std::from_chars(value.data(), value.data() + value.size(), size)
+                .ec == std::errc{})
+        {
+          length = size;
+        }
+
+        source.start(length);
+        bytes = std::span<const char>(header).subspan(end + 4);
+      }
+      else if (len == 0)
+      {
+        if (source.length && *source.length != source.received)
+          return std::make_error_code(std::errc::connection_aborted);
+        return {};
+      }
+
+      if (source.length)
+      {
+        bytes = bytes.first(std::min<std::uint64_t>(
+            bytes.size(), *source.length - source.received));
+      }
+
+      source.append(bytes, err);
+      if (err)
+        return err;
+      stats.bytes_fetched += bytes.size();
+
+      if (source.length && *source.length == source.received)
+        return {};
+    }
+  }
+
+  /** @brief Downloads a file over TFTP. */
+  auto tftp_get(download &source, const std::string &name,
+                const std::stop_token &token) -> std::error_code
+  {
+    using enum messages::opcode_t;
+
+    auto err = std::error_code();
+    auto server = sockaddr_storage{};
+    auto server_len = socklen_t{};
+    auto sock = filesystem::descriptor(
+        connect_to(upstream, SOCK_DGRAM, server, server_len, timeout, err));
+    if (err)
+      return err;
+
+    auto prefix = std::string_view(upstream.prefix);
+    prefix.remove_prefix(
+        std::min(prefix.find_first_not_of('/'), prefix.size()));
+    auto target = prefix.empty() ? name : std::string(prefix) + "/" + name;
+
+    // Unanswered packets are resent to the server until it picks a TID.
+    auto packet = std::vector<char>(sizeof(std::uint16_t));
+    auto opc = htons(RRQ);
+    std::memcpy(packet.data(), &opc, sizeof(opc));
+    packet.insert(packet.end(), target.begin(), target.end());
+    packet.push_back('\0');
+    for (auto chr : std::string_view("octet"))
+      packet.push_back(chr);
+    packet.push_back('\0');
+
+    auto peer = server;
+    auto peer_len = server_len;
+    auto bound = false;
+    auto transmit = [&] {
+      (void)::sendto(sock.native_handle(), packet.data(), packet.size(), 0,
+                     reinterpret_cast<const sockaddr *>(&peer), peer_len);
+      return clock::now();
+    };
+
+    auto expected = std::uint16_t{1};
+    auto buf = std::array<char, messages::DATAMSG_MAXLEN>();
+    auto last_sent = transmit();
+    auto last = last_sent;
+    while (true)
+    {
+      if (token.stop_requested())
+        return std::make_error_code(std::errc::operation_canceled);
+
+      auto from = sockaddr_storage{};
+      auto from_len = socklen_t{sizeof(from)};
+      auto len = ::recvfrom(sock.native_handle(), buf.data(), buf.size(), 0,
+                            reinterpret_cast<sockaddr *>(&from), &from_len);
+      if (len < 0)
+      {
+        auto now = clock::now();
+        if (now - last > timeout)
+          return std::make_error_code(std::errc::timed_out);
+        if (now - last_sent >= RETRANSMIT_INTERVAL)
+          last_sent = transmit();
+        continue;
+      }
+
+      if (len < static_cast<ssize_t>(sizeof(messages::data)) ||
+          (bound && (from_len != peer_len ||
+                     std::memcmp(&from, &peer, peer_len))))
+      {
+        continue;
+      }
+
+      auto header = messages::data{};
+      std::memcpy(&header, buf.data(), sizeof(header));
+      if (ntohs(header.opc) == ERROR)
+      {
+        switch (ntohs(header.block_num))
+        {
+          case messages::FILE_NOT_FOUND:
+            return std::make_error_code(std::errc::no_such_file_or_directory);
+          case messages::ACCESS_VIOLATION:
+            return std::make_error_code(std::errc::permission_denied);
+          default:
+            return std::make_error_code(std::errc::io_error);
+        }
+      }
+
+      if (ntohs(header.opc) != DATA)
+        continue;
+
+      if (!bound)
+      {
+        peer = from;
+        peer_len = from_len;
+        bound = true;
+      }
+
+      auto block = ntohs(header.block_num);
+      if (block != expected)
+      {
+        // Our ACK was lost; acknowledge the block again.
+        if (static_cast<std::uint16_t>(block + 1) == expected)
+          last_sent = transmit();
+        continue;
+      }
+
+      if (expected == 1)
+        source.start(std::nullopt);
+
+      auto payload = std::span<const char>(buf).subspan(
+          sizeof(header), static_cast<std::size_t>(len) - sizeof(header));
+      source.append(payload, err);
+      if (err)
+        return err;
+      stats.bytes_fetched += payload.size();
+
+      auto ack =
+          messages::ack{.opc = htons(ACK), .block_num = header.block_num};
+      packet.resize(sizeof(ack));
+      std::memcpy(packet.data(), &ack, sizeof(ack));
+      last = last_sent = transmit();
+      ++expected;
+
+      if (payload.size() < messages::DATALEN)
+        return {};
+    }
+  }
+
+  /** @brief Runs a download. */
+  auto fetch(const std::shared_ptr<download> &source, const std::string &name,
+             const std::stop_token &token) -> void
+  {
+    auto err = upstream.protocol == origin::HTTP
+                   ? http_get(*source, name, token)
+                   : tftp_get(*source, name, token);
+    if (err)
+    {
+      ++stats.failures;
+      auto ignored = std::error_code();
+      std::filesystem::remove(source->tmp, ignored);
+    }
+    else
+    {
+      publish(*source, name);
+    }
+
+    {
+      auto lock = std::lock_guard{mtx};
+      if (auto it = inflight.find(name);
+          it != inflight.end() && it->second == source)
+      {
+        inflight.erase(it);
+      }
+    }
+
+    source->memory = tftp::memory::reservation();
+    source->finish(err);
+    source->exited = true;
+  }
+
+  /** @brief Starts a download. Requires mtx to be held. */
+  auto start(const std::string &name,
+             std::error_code &err) -> std::shared_ptr<download>
+  {
+    auto tmp = dir / PARTIAL_DIR / std::to_string(partials++);
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg)
+    const int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                          S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0)
+    {
+      err = std::make_error_code(std::errc::permission_denied);
+      return {};
+    }
+
+    auto source = std::make_shared<download>(fd, std::move(tmp));
+    source->memory = tftp::memory::reservation(tftp::memory::current());
+    source->memory.add(tftp::memory::DOWNLOADS,
+                       sizeof(download) + RECEIVE_BUFFER);
+    inflight.emplace(name, source);
+    auto run = [this, source, name](const std::stop_token &token) {
+      fetch(source, name, token);
+    };
+    workers.emplace_back(source, std::jthread(std::move(run)));
+    ++stats.fetches;
+    return source;
+  }
+
+  /** @brief The origin. */
+  const origin upstream;
+  /** @brief The cache directory. */
+  const std::filesystem::path dir;
+  /** @brief The maximum number of bytes to cache. */
+  const std::uint64_t capacity;
+  /** @brief How long to wait for the origin. */
+  const std::chrono::milliseconds timeout;
+  /** @brief Serves files from the cache directory. */
+  posix disk;
+  /** @brief The relay counters. */
+  counters stats;
+
+  /** @brief Protects the members below. */
+  mutable std::mutex mtx;
+  /** @brief The files in the cache directory. */
+  std::unordered_map<std::string, entry> cached;
+  /** @brief Cached file names, most recently used first. */
+  std::list<std::string> lru;
+  /** @brief The number of cached bytes. */
+  std::uint64_t used{0};
+  /** @brief Downloads in progress, keyed by file. */
+  std::unordered_map<std::string, std::shared_ptr<download>> inflight;
+  /** @brief Names temporary files. */
+  std::uint64_t partials{0};
+  /** @brief The download threads. */
+  std::list<worker> workers;
+};
+
+auto relay::origin::parse(std::string_view url,
+                          std::error_code &err) -> std::optional<origin>
+{
+  err = std::make_error_code(std::errc::invalid_argument);
+  auto result = origin();
+
+  auto scheme_end = url.find("://");
+  if (scheme_end == std::string_view::npos)
+    return std::nullopt;
+
+  auto scheme = url.substr(0, scheme_end);
+  if (scheme == "tftp")
+  {
+    result.protocol = TFTP;
+    result.port = 69; // NOLINT(cppcoreguidelines-avoid-magic-numbers)
+  }
+  else if (scheme == "http")
+  {
+    result.protocol = HTTP;
+    result.port = 80; // NOLINT(cppcoreguidelines-avoid-magic-numbers)
+  }
+  else
+  {
+    return std::nullopt;
+  }
+
+  auto rest = url.substr(scheme_end + 3);
+  auto slash = rest.find('/');
+  auto authority = rest.substr(0, slash);
+  if (slash != std::string_view::npos)
+    result.prefix = rest.substr(slash);
+  while (result.prefix.ends_with('/'))
+    result.prefix.pop_back();
+
+  auto port = std::string_view();
+  if (authority.starts_with('['))
+  {
+    auto close = authority.find(']');
+    if (close == std::string_view::npos)
+      return std::nullopt;
+
+    result.host = authority.substr(1, close - 1);
+    auto after = authority.substr(close + 1);
+    if (!after.empty() && !after.starts_with(':'))
+      return std::nullopt;
+    port = after.substr(std::min<std::size_t>(1, after.size()));
+  }
+  else if (auto colon = authority.rfind(':'); colon != std::string_view::npos)
+  {
+    result.host = authority.substr(0, colon);
+    port = authority.substr(colon + 1);
+  }
+  else
+  {
+    result.host = authority;
+  }
+
+  if (result.host.empty())
+    return std::nullopt;
+
+  if (!port.empty())
+  {
+    auto [ptr, ec] =
+        std::from_chars(port.data(), port.data() + port.size(), result.port);
+    if (ec != std::errc{} || ptr != port.data() + port.size() || !result.port)
+      return std::nullopt;
+  }
+
+  err.clear();
+  return result;
+}
+
+relay::relay(origin upstream, std::filesystem::path cache_dir,
+             std::uint64_t capacity, std::chrono::milliseconds timeout)
+    : state_(std::make_shared<state>(std::move(upstream), std::move(cache_dir),
+                                     capacity, timeout))
+{
+  state_->scan();
+}
+
+relay::~relay()
+{
+  auto workers = std::list<state::worker>();
+  {
+    auto lock = std::lock_guard{state_->mtx};
+    workers.swap(state_->workers);
+  }
+  // Destroying the threads cancels and joins them.
+}
+
+auto relay::bytes() const -> std::uint64_t
+{
+  auto lock = std::lock_guard{state_->mtx};
+  return state_->used;
+}
+
+auto relay::stats() noexcept -> counters & { return state_->stats; }
+
+auto relay::open_read(const std::filesystem::path &path,
+                      std::error_code &err) -> std::shared_ptr<file>
+{
+  err.clear();
+  auto name = cache_name(path);
+  if (name.empty())
+  {
+    err = std::make_error_code(std::errc::no_such_file_or_directory);
+    return {};
+  }
+
+  auto &cache = *state_;
+  auto finished = std::list<state::worker>();
+  auto source = std::shared_ptr<download>();
+  {
+    auto lock = std::unique_lock{cache.mtx};
+    if (auto it = cache.cached.find(name); it != cache.cached.end())
+    {
+      cache.lru.splice(cache.lru.begin(), cache.lru, it->second.lru);
+      lock.unlock();
+      if (auto hit = cache.disk.open_read(cache.dir / name, err))
+      {
+        ++cache.stats.hits;
+        return hit;
+      }
+
+      // The file was removed behind our back; fetch it again.
+      err.clear();
+      lock.lock();
+      if (it = cache.cached.find(name); it != cache.cached.end())
+      {
+        cache.used -= it->second.size;
+        cache.lru.erase(it->second.lru);
+        cache.cached.erase(it);
+      }
+    }
+
+    // Collect finished download threads; they are joined after unlocking.
+    for (auto it = cache.workers.begin(); it != cache.workers.end();)
+    {
+      auto next = std::next(it);
+      if (it->first->exited)
+        finished.splice(finished.end(), cache.workers, it);
+      it = next;
+    }
+
+    if (auto it = cache.inflight.find(name); it != cache.inflight.end())
+      source = it->second;
+    else
+      source = cache.start(name, err);
+  }
+
+  if (!source)
+    return {};
+
+  // The open does not wait for the origin. Sessions poll busy() until the
+  // first bytes arrive, and learn of a failed download from it.
+  {
+    auto lock = std::lock_guard{source->mtx};
+    if (source->done && source->err)
+    {
+      err = source->err;
+      return {};
+    }
+  }
+
+  return std::make_shared<relay_file>(std::move(source));
+}
+
+auto relay::open_write(const std::filesystem::path & /*path*/,
+                       std::error_code &err) -> std::shared_ptr<file>
+{
+  err = std::make_error_code(std::errc::permission_denied);
+  return {};
+}
+
+auto relay::stat(const std::filesystem::path &path,
+                 std::error_code &err) -> file_status
+{
+  err.clear();
+  auto name = cache_name(path);
+  {
+    auto lock = std::lock_guard{state_->mtx};
+    if (name.empty() || !state_->cached.contains(name))
+    {
+      err = std::make_error_code(std::errc::no_such_file_or_directory);
+      return {};
+    }
+  }
+  return state_->disk.stat(state_->dir / name, err);
+}
+} // namespace tftp::storage
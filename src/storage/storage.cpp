@@ -0,0 +1,54 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file storage.cpp
+ * @brief This file implements storage backend selection.
+ */
+#include "tftp/storage/storage.hpp"
+#include "tftp/storage/posix.hpp"
+
+#include <mutex>
+namespace tftp::storage {
+/** @brief The installed backend. */
+struct installed {
+  /** @brief Protects current. */
+  std::mutex mtx;
+  /** @brief The current backend. */
+  std::shared_ptr<backend> current = std::make_shared<posix>();
+};
+
+/** @brief Gets the process-wide installed backend. */
+static auto backends() -> installed &
+{
+  static auto backends = installed();
+  return backends;
+}
+
+auto current() -> std::shared_ptr<backend>
+{
+  auto &installed = backends();
+  auto lock = std::lock_guard{installed.mtx};
+  return installed.current;
+}
+
+auto install(std::shared_ptr<backend> next) -> std::shared_ptr<backend>
+{
+  auto &installed = backends();
+  auto lock = std::lock_guard{installed.mtx};
+  std::swap(installed.current, next);
+  return next;
+}
+} // namespace tftp::storage
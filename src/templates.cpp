@@ -0,0 +1,462 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file templates.cpp
+ * @brief This file implements virtual files rendered on request.
+ */
+#include "tftp/templates.hpp"
+#include "tftp/memory.hpp"
+
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+namespace tftp::templates {
+struct registry::memo {
+  /** @brief A memoized file. */
+  struct entry {
+    /** @brief The rendered contents. */
+    std::shared_ptr<const contents> bytes;
+    /** @brief The position of the file in the LRU list. */
+    std::list<std::string>::iterator lru;
+  };
+
+  explicit memo(std::size_t capacity) : capacity(capacity) {}
+
+  /** @brief Finds a memoized file. */
+  auto find(const std::string &key) -> std::shared_ptr<const contents>
+  {
+    auto lock = std::lock_guard{mtx};
+    auto it = entries.find(key);
+    if (it == entries.end())
+      return {};
+
+    lru.splice(lru.begin(), lru, it->second.lru);
+    return it->second.bytes;
+  }
+
+  /**
+   * @brief Memoizes a rendered file.
+   * @details The file is not memoized if the memory governor can not make
+   * room for it.
+   */
+  auto insert(const std::string &key, std::shared_ptr<const contents> data)
+      -> void
+  {
+    {
+      auto lock = std::lock_guard{mtx};
+      if (entries.contains(key) || !capacity)
+        return;
+    }
+
+    // Asked without the lock, since the governor may shrink the memo.
+    if (!memory::make_room(data->size()))
+      return;
+
+    auto lock = std::lock_guard{mtx};
+    if (entries.contains(key))
+      return;
+
+    if (entries.size() >= capacity)
+      evict();
+
+    lru.push_front(key);
+    bytes += data->size();
+    entries.emplace(key, entry{.bytes = std::move(data), .lru = lru.begin()});
+  }
+
+  /** @brief Drops the least recently used file. Requires mtx. */
+  auto evict() -> void
+  {
+    auto it = entries.find(lru.back());
+    bytes -= it->second.bytes->size();
+    entries.erase(it);
+    lru.pop_back();
+  }
+
+  /** @brief The number of files to memoize. */
+  const std::size_t capacity;
+  /** @brief The registry counters. */
+  counters stats;
+  /** @brief Protects the members below. */
+  std::mutex mtx;
+  /** @brief The memoized files. */
+  std::unordered_map<std::string, entry> entries;
+  /** @brief Memoized keys, most recently used first. */
+  std::list<std::string> lru;
+  /** @brief The number of memoized bytes. */
+  std::size_t bytes{0};
+};
+
+/**
+ * @brief A virtual file that is rendered as it is read.
+ * @details Chunks are pulled from the renderer only as far as reads need
+ * them. Once the renderer is exhausted the whole file is memoized.
+ */
+class rendered_file : public storage::file {
+public:
+  rendered_file(detail::generator<std::string_view> chunks,
+                std::weak_ptr<registry::memo> cache, std::string key) noexcept
+      : chunks_(std::move(chunks)), memo_(std::move(cache)),
+        key_(std::move(key))
+  {}
+
+  auto read_at(std::uint64_t offset, std::span<char> buf,
+               std::error_code &err) -> std::size_t override
+  {
+    err.clear();
+    if (!open_)
+    {
+      err = std::make_error_code(std::errc::bad_file_descriptor);
+      return 0;
+    }
+
+    try
+    {
+      while (!done_ && buffer_.size() < offset + buf.size())
+        pull();
+    }
+    catch (...)
+    {
+      err = std::make_error_code(std::errc::io_error);
+      return 0;
+    }
+
+    if (offset >= buffer_.size())
+      return 0;
+
+    auto len = std::min<std::uint64_t>(buf.size(), buffer_.size() - offset);
+    std::copy_n(buffer_.begin() + static_cast<std::ptrdiff_t>(offset), len,
+                buf.begin());
+    return len;
+  }
+
+  auto append(std::span<const char> /*buf*/,
+              std::error_code &err) -> void override
+  {
+    err = std::make_error_code(std::errc::bad_file_descriptor);
+  }
+
+  auto commit(std::error_code &err) -> void override
+  {
+    err = std::make_error_code(std::errc::bad_file_descriptor);
+  }
+
+  auto close() noexcept -> void override { open_ = false; }
+
+  [[nodiscard]] auto is_open() const noexcept -> bool override
+  {
+    return open_;
+  }
+
+  /**
+   * @details Only counts the bytes rendered so far until rendering ends.
+   * Files are rendered as they are read rather than up front, so seeks past
+   * the size read forward instead of failing; see transform::source::seek().
+   */
+  [[nodiscard]] auto size() const noexcept -> std::uint64_t override
+  {
+    return buffer_.size();
+  }
+
+private:
+  /** @brief Renders the next chunk. */
+  auto pull() -> void
+  {
+    if (!started_)
+    {
+      it_ = chunks_.begin();
+      started_ = true;
+    }
+    else
+    {
+      ++it_;
+    }
+
+    if (it_ == chunks_.end())
+    {
+      done_ = true;
+      if (auto cache = memo_.lock())
+      {
+        cache->insert(key_,
+                      std::make_shared<const registry::contents>(buffer_));
+      }
+      return;
+    }
+
+    buffer_.insert(buffer_.end(), it_->begin(), it_->end());
+  }
+
+  detail::generator<std::string_view> chunks_;
+  detail::generator<std::string_view>::iterator it_;
+  std::weak_ptr<registry::memo> memo_;
+  std::string key_;
+  registry::contents buffer_;
+  bool started_{false};
+  bool done_{false};
+  bool open_{true};
+};
+
+registry::registry(std::size_t memo_size)
+    : memo_(std::make_shared<memo>(memo_size))
+{}
+
+auto registry::render(std::shared_ptr<const std::string> text,
+                      context ctx) -> detail::generator<std::string_view>
+{
+  auto view = std::string_view(*text);
+  auto literal = std::size_t{0};
+  for (auto pos = std::size_t{0}; pos < view.size();)
+  {
+    auto rest = view.substr(pos);
+    auto value = std::string_view();
+    auto length = std::size_t{0};
+    if (rest.size() > 1 && rest[0] == '$' && rest[1] >= '0' && rest[1] <= '9')
+    {
+      auto index = static_cast<std::size_t>(rest[1] - '0');
+      if (index < ctx.captures.size())
+        value = ctx.captures[index];
+      length = 2;
+    }
+    else if (rest.starts_with("{ip}"))
+    {
+      value = ctx.client.ip;
+      length = 4;
+    }
+    else if (rest.starts_with("{mac}"))
+    {
+      value = ctx.client.mac;
+      length = 5;
+    }
+    else
+    {
+      ++pos;
+      continue;
+    }
+
+    if (pos > literal)
+      co_yield view.substr(literal, pos - literal);
+    if (!value.empty())
+      co_yield value;
+
+    pos += length;
+    literal = pos;
+  }
+
+  if (literal < view.size())
+    co_yield view.substr(literal);
+}
+
+auto registry::add(std::string_view pattern, renderer func, bool uses_client,
+                   bool uses_mac, std::error_code &err) -> void
+{
+  err.clear();
+  try
+  {
+    rules_.push_back({.pattern = std::regex(pattern.begin(), pattern.end(),
+                                            std::regex::ECMAScript |
+                                                std::regex::optimize),
+                      .render = std::move(func),
+                      .uses_client = uses_client,
+                      .uses_mac = uses_mac});
+    filter_.add(pattern);
+  }
+  catch (const std::regex_error &)
+  {
+    err = std::make_error_code(std::errc::invalid_argument);
+  }
+}
+
+auto registry::add(std::string_view pattern, renderer func,
+                   std::error_code &err) -> void
+{
+  add(pattern, std::move(func), true, true, err);
+  filter_.link();
+}
+
+auto registry::add_template(std::string_view pattern, std::string text,
+                            std::error_code &err) -> void
+{
+  insert_template(pattern, std::move(text), err);
+  filter_.link();
+}
+
+auto registry::insert_template(std::string_view pattern, std::string text,
+                               std::error_code &err) -> void
+{
+  auto uses_mac = text.find("{mac}") != std::string::npos;
+  auto uses_client = uses_mac || text.find("{ip}") != std::string::npos;
+  auto shared = std::make_shared<const std::string>(std::move(text));
+  add(
+      pattern,
+      [shared](context ctx) { return render(shared, std::move(ctx)); },
+      uses_client, uses_mac, err);
+}
+
+auto registry::load(const std::filesystem::path &file, std::error_code &err,
+                    std::size_t *line) -> std::shared_ptr<registry>
+{
+  auto stream = std::ifstream(file);
+  if (!stream.is_open())
+  {
+    err = std::make_error_code(std::errc::no_such_file_or_directory);
+    return nullptr;
+  }
+
+  auto files = std::make_shared<registry>();
+  std::size_t lineno = 0;
+  for (auto current = std::string(); std::getline(stream, current);)
+  {
+    ++lineno;
+    auto words = std::istringstream(current);
+    auto pattern = std::string();
+    auto path = std::filesystem::path();
+    if (!(words >> pattern) || pattern.starts_with('#'))
+      continue;
+
+    auto text = std::string();
+    if (words >> path)
+    {
+      auto source = std::ifstream(file.parent_path() / path);
+      text.assign(std::istreambuf_iterator<char>(source),
+                  std::istreambuf_iterator<char>());
+      err = source.is_open()
+                ? std::error_code()
+                : std::make_error_code(std::errc::no_such_file_or_directory);
+    }
+    else
+    {
+      err = std::make_error_code(std::errc::invalid_argument);
+    }
+
+    if (!err)
+      files->insert_template(pattern, std::move(text), err);
+
+    if (err)
+    {
+      if (line)
+        *line = lineno;
+      return nullptr;
+    }
+  }
+
+  files->filter_.link();
+  err.clear();
+  return files;
+}
+
+auto registry::open(std::string_view filename, const rewrite::client &who)
+    -> std::shared_ptr<storage::file>
+{
+  auto name = std::string(filename);
+  auto candidates = std::pmr::vector<std::uint32_t>();
+  filter_.candidates(name, candidates);
+  for (auto index : candidates)
+  {
+    const auto &rule = rules_[index];
+    auto match = std::smatch();
+    if (!std::regex_match(name, match, rule.pattern))
+      continue;
+
+    auto ctx = context{.client = rule.uses_client ? who : rewrite::client{}};
+    if (rule.uses_mac && ctx.client.mac.empty())
+      ctx.client.mac = rewrite::lookup_mac(ctx.client.ip);
+
+    auto key = std::to_string(index);
+    for (const auto &capture : match)
+    {
+      ctx.captures.push_back(capture.str());
+      key.push_back('\0');
+      key.append(ctx.captures.back());
+    }
+    for (const auto &address : {ctx.client.ip, ctx.client.mac})
+    {
+      key.push_back('\0');
+      key.append(address);
+    }
+
+    if (auto bytes = memo_->find(key))
+    {
+      ++memo_->stats.hits;
+      return storage::memory::reader(std::move(bytes));
+    }
+
+    ++memo_->stats.renders;
+    return std::make_shared<rendered_file>(rule.render(std::move(ctx)), memo_,
+                                           std::move(key));
+  }
+  return nullptr;
+}
+
+auto registry::clear() -> void
+{
+  auto lock = std::lock_guard{memo_->mtx};
+  memo_->entries.clear();
+  memo_->lru.clear();
+  memo_->bytes = 0;
+}
+
+auto registry::bytes() const -> std::size_t
+{
+  auto lock = std::lock_guard{memo_->mtx};
+  return memo_->bytes;
+}
+
+auto registry::shrink(std::size_t bytes) -> std::size_t
+{
+  auto lock = std::lock_guard{memo_->mtx};
+  const auto before = memo_->bytes;
+  while (!memo_->lru.empty() && before - memo_->bytes < bytes)
+    memo_->evict();
+
+  return before - memo_->bytes;
+}
+
+auto registry::size() const noexcept -> std::size_t { return rules_.size(); }
+
+auto registry::stats() noexcept -> counters & { return memo_->stats; }
+
+/** @brief The installed registry. */
+struct installed {
+  /** @brief Protects current. */
+  std::mutex mtx;
+  /** @brief The current registry. */
+  std::shared_ptr<registry> current;
+};
+
+/** @brief Gets the process-wide installed registry. */
+static auto registries() -> installed &
+{
+  static auto registries = installed();
+  return registries;
+}
+
+auto current() -> std::shared_ptr<registry>
+{
+  auto &installed = registries();
+  auto lock = std::lock_guard{installed.mtx};
+  return installed.current;
+}
+
+auto install(std::shared_ptr<registry> next) -> std::shared_ptr<registry>
+{
+  auto &installed = registries();
+  auto lock = std::lock_guard{installed.mtx};
+  std::swap(installed.current, next);
+  return next;
+}
+} // namespace tftp::templates
@@ -18,132 +18,281 @@
  * @brief This file defines the TFTP application logic.
  */
 #include "tftp/tftp.hpp"
+#include "tftp/detail/arena.hpp"
+#include "tftp/fec.hpp"
 #include "tftp/filesystem.hpp"
+#include "tftp/memory.hpp"
+#include "tftp/prefetch.hpp"
+#include "tftp/rewrite.hpp"
+#include "tftp/sink.hpp"
+#include "tftp/storage/storage.hpp"
+#include "tftp/templates.hpp"
+#include "tftp/transform.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <memory_resource>
+#include <optional>
+#include <string_view>
+
+#include <arpa/inet.h>
 namespace tftp {
+/** @brief The memory a new session is admitted with. */
+static constexpr auto SESSION_BYTES = sizeof(session) +
+                                      sizeof(session::transfer_t) +
+                                      messages::DATAMSG_MAXLEN;
+
 /**
- * @brief Inserts data into a buffer, handling NETASCII conversion.
- * @details This function appends data from a source span (`buf`) to a
- * destination vector (`buffer`). If the transfer mode is `NETASCII`, it
- * performs line-ending conversions as specified by the TFTP protocol.
- *
- *          NETASCII Conversion Rules:
- *          - Bare carriage returns (`\r`) are converted to `\r\0`.
- *          - Bare line feeds (`\n`) are converted to `\r\n`.
- *          - A `\r\n` sequence in the input is handled correctly to produce a
- *            `\r\n` sequence in the output buffer by observing that a `\n`
- *            is preceded by a `\r\0` from a previous conversion.
- *          - Bare null bytes (`\0`) in the input are skipped to avoid ambiguity
- *            with the `\r\0` sequence.
+ * @brief Prepares the next data block to be sent for a file transfer session.
+ * @details The session buffer is reused for each packet. The DATA header is
+ * written at the start of the buffer and the block is filled from the
+ * session's transform pipeline, which holds any bytes that a transform
+ * produced beyond the end of the previous block. The buffer is then trimmed
+ * to the length of the packet, so a short buffer marks the last block.
  *
- * @param[in,out] buffer The destination buffer to which data will be inserted.
- * @param[in]     buf    A span of characters representing the source data.
- * @param[in]     mode   The TFTP transfer mode (e.g., `NETASCII` or `OCTET`).
+ * @param siter An iterator pointing to the current session in the sessions map.
+ * @return std::uint16_t Returns 0 on success. If there is a file read error, it
+ * returns `messages::ACCESS_VIOLATION`.
  */
-static inline auto insert_data(std::vector<char> &buffer,
-                               std::span<const char> buf,
-                               std::uint8_t mode) -> void
+static inline auto send_next(iterator_t siter) -> std::uint16_t
 {
-  using enum messages::mode_t;
+  using enum messages::opcode_t;
+
+  auto &[key, session] = *siter;
+  auto &state = session.state;
+  auto &buffer = state.transfer->buffer;
+
+  state.block_num += 1; // block_num wraps on overflow.
+
+  buffer.resize(messages::DATAMSG_MAXLEN);
+  auto *msg = reinterpret_cast<messages::data *>(buffer.data());
+  msg->opc = htons(DATA);
+  msg->block_num = htons(state.block_num);
+
+  auto err = std::error_code();
+  auto len = state.transfer->pipeline->fill(
+      std::span(buffer).subspan(sizeof(messages::data)), err);
+  if (err) [[unlikely]]
+    return messages::ACCESS_VIOLATION; // GCOVR_EXCL_LINE
 
-  if (mode != NETASCII)
+  buffer.resize(sizeof(messages::data) + len);
+  return 0;
+}
+
+/**
+ * @brief Prepares the next window of an RRQ with forward error correction.
+ * @details Fills up to a group of DATA blocks from the pipeline, stopping
+ * after the last block of the file, and follows them with the repair packet
+ * of the group. The session buffer is left holding the last DATA block.
+ * @param siter An iterator pointing to the current session in the sessions map.
+ * @return std::uint16_t Returns 0 on success, or the error of send_next().
+ */
+static inline auto send_window(iterator_t siter) -> std::uint16_t
+{
+  auto &[key, session] = *siter;
+  auto &state = session.state;
+  auto &window = *state.transfer->fec;
+
+  window.packets.clear();
+  window.ends.clear();
+  window.first_block = static_cast<std::uint16_t>(state.block_num + 1);
+  window.count = 0;
+  window.parity.reset(window.first_block);
+  while (window.count < window.group && !window.last)
   {
-    buffer.insert(buffer.end(), buf.begin(), buf.end());
-    return;
+    if (auto err = send_next(siter))
+      return err; // GCOVR_EXCL_LINE
+
+    const auto &buffer = state.transfer->buffer;
+    window.packets.insert(window.packets.end(), buffer.begin(), buffer.end());
+    window.ends.push_back(window.packets.size());
+    window.parity.add(std::span(buffer).subspan(sizeof(messages::data)));
+    window.last = buffer.size() < messages::DATAMSG_MAXLEN;
+    ++window.count;
   }
 
-  // NETASCII processing.
-  for (const auto chr : buf)
-  {
-    // Skip bare \0 bytes so as to not confuse \r\0 handling.
-    if (chr == '\0')
-      continue;
+  auto repair = window.parity.packet();
+  window.packets.insert(window.packets.end(), repair.begin(), repair.end());
+  window.ends.push_back(window.packets.size());
+  ++window.sequence;
+  return 0;
+}
 
-    if (chr == '\n')
-    {
-      if (buffer.size() > sizeof(messages::data) && buffer.back() == '\0')
-      {
-        // If the previous byte is \0 then it must be from a \r\0 sequence.
-        buffer.pop_back();
-      }
-      else
-      {
-        // Otherwise this is a bare \n.
-        buffer.push_back('\r');
-      }
-    }
+/**
+ * @brief Processes the ACK of a window.
+ * @details The client acknowledges the last block it holds in order, after
+ * rebuilding what it can from the repair packet. A partial ACK restarts the
+ * window at the first missing block. ACKs of no new blocks are ignored, as
+ * the retransmission timer resends the window.
+ * @param block The acknowledged block number.
+ * @param siter An iterator pointing to the current session in the sessions map.
+ * @returns 0 if successful, a non-zero TFTP error otherwise.
+ */
+static inline auto ack_window(std::uint16_t block,
+                              iterator_t siter) -> std::uint16_t
+{
+  auto &[key, session] = *siter;
+  auto &state = session.state;
+  auto &window = *state.transfer->fec;
 
-    buffer.push_back(chr);
+  const auto held = static_cast<std::uint16_t>(block - window.first_block + 1);
+  if (held == 0 || held > window.count)
+    return 0;
 
-    // Bare \r must be followed by a \0.
-    if (chr == '\r')
-    {
-      buffer.push_back('\0');
-    }
+  if (held == window.count && window.last)
+  {
+    state.transfer->file->close();
+    return 0;
   }
+
+  window.start += static_cast<std::uint64_t>(held) * messages::DATALEN;
+  if (held < window.count)
+  {
+    auto err = std::error_code();
+    if (!state.transfer->pipeline->seek(window.start, err)) [[unlikely]]
+      return messages::ACCESS_VIOLATION; // GCOVR_EXCL_LINE
+
+    state.block_num = block;
+    window.last = false;
+  }
+
+  return send_window(siter);
+}
+
+/** @brief Appends an option name and value to an OACK. */
+static inline auto append_option(std::vector<char> &buffer,
+                                 std::string_view name,
+                                 std::string_view value) -> void
+{
+  buffer.insert(buffer.end(), name.begin(), name.end());
+  buffer.push_back('\0');
+  buffer.insert(buffer.end(), value.begin(), value.end());
+  buffer.push_back('\0');
 }
 
 /**
- * @brief Prepares the next data block to be sent for a file transfer session.
- * @details This function constructs the next data packet to be sent to the
- * client.
- *
- * The session buffer is reused for each packet. If a previous operation (like
- * NETASCII conversion) resulted in more data than could fit in a single packet,
- * that "overflow" data is present at the end of the buffer. This function moves
- * that overflow data to the beginning of the buffer to be sent in the current
- * packet. The buffer layout is conceptualized as:
- * `[header][512 bytes data][overflow]`.
- *
- * To prevent reallocations, the buffer capacity is reserved to hold a full data
- * packet plus space for NETASCII expansion. The buffer is resized to at least
- * hold the DATA packet header.
- *
- * New file data is read into a temporary buffer. This data is then processed
- * for NETASCII conversion (if required for the session's mode) and appended to
- * the session buffer after the header and any overflow data.
- *
+ * @brief Prepares an option acknowledgment for an RRQ.
+ * @details The OACK replaces the first DATA block. The client acknowledges
+ * it with block 0 (RFC 2347), and blocks are then numbered from 1 starting
+ * at the negotiated offset.
  * @param siter An iterator pointing to the current session in the sessions map.
- * @return std::uint16_t Returns 0 on success. If there is a file read error, it
- * returns `messages::ACCESS_VIOLATION`.
+ * @param accepted The request with only the accepted options set.
  */
-static inline auto send_next(iterator_t siter) -> std::uint16_t
+static inline auto prepare_oack(iterator_t siter,
+                                const messages::request &accepted) -> void
 {
   using enum messages::opcode_t;
+  constexpr auto DIGITS = std::numeric_limits<std::uint64_t>::digits10 + 1;
 
   auto &[key, session] = *siter;
-  auto &state = session.state;
-  auto &buffer = state.buffer;
+  auto &buffer = session.state.transfer->buffer;
+  auto digits = std::array<char, DIGITS>();
 
-  state.block_num += 1; // block_num wraps on overflow.
-
-  buffer.reserve(messages::DATAMSG_MAXLEN + messages::DATALEN);
-  if (buffer.size() < sizeof(messages::data))
-    buffer.resize(sizeof(messages::data));
+  const auto opc = htons(OACK);
+  const auto *opc_bytes = reinterpret_cast<const char *>(&opc);
+  buffer.assign(opc_bytes, opc_bytes + sizeof(opc));
+  if (accepted.compress)
+  {
+    append_option(buffer, messages::COMPRESS_OPTION,
+                  messages::ZSTD_COMPRESSION);
+  }
 
-  auto data_start = buffer.begin() + sizeof(messages::data);
+  if (accepted.offset)
+  {
+    auto [end, ec] =
+        std::to_chars(digits.begin(), digits.end(), *accepted.offset);
+    append_option(buffer, messages::OFFSET_OPTION,
+                  std::string_view(digits.begin(), end));
+  }
 
-  if (buffer.size() > messages::DATAMSG_MAXLEN)
+  if (accepted.fec)
   {
-    auto overflow_start = data_start + messages::DATALEN;
-    data_start = std::copy(overflow_start, buffer.end(), data_start);
+    auto [end, ec] = std::to_chars(digits.begin(), digits.end(), accepted.fec);
+    append_option(buffer, messages::FEC_OPTION,
+                  std::string_view(digits.begin(), end));
   }
 
-  data_start = buffer.erase(data_start, buffer.end());
+  session.state.block_num = 0;
+}
 
-  auto *msg = reinterpret_cast<messages::data *>(buffer.data());
-  msg->opc = htons(DATA);
-  msg->block_num = htons(state.block_num);
+/** @brief Checks if the session buffer holds an OACK. */
+static inline auto sent_oack(const session::state_t &state) noexcept -> bool
+{
+  using enum messages::opcode_t;
 
-  auto read_size =
-      static_cast<std::streamsize>(messages::DATAMSG_MAXLEN - buffer.size());
-  auto read_buf = std::array<char, messages::DATALEN>();
-  state.file->read(read_buf.data(), read_size);
-  if (state.file->bad()) [[unlikely]]
-    return messages::ACCESS_VIOLATION; // GCOVR_EXCL_LINE
+  auto opc = std::uint16_t{0};
+  if (state.transfer->buffer.size() < sizeof(opc))
+    return false;
 
-  insert_data(buffer, std::span(read_buf.data(), state.file->gcount()),
-              state.mode);
-  return 0;
+  std::memcpy(&opc, state.transfer->buffer.data(), sizeof(opc));
+  return ntohs(opc) == OACK;
+}
+
+/**
+ * @brief Gets the IP address of a client as text.
+ * @details IPv4-mapped addresses are printed in dotted-quad form. The port
+ * is left out because every request from a client arrives from a new one.
+ * @param addr The client socket address.
+ * @param scratch The memory resource to allocate from.
+ * @returns The client IP address.
+ */
+static inline auto client_ip(io::socket::socket_address<sockaddr_in6> addr,
+                             std::pmr::memory_resource *scratch)
+    -> std::pmr::string
+{
+  auto buf = std::array<char, INET6_ADDRSTRLEN>();
+  if (addr->sin6_family == AF_INET)
+  {
+    const auto *addr_v4 =
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        reinterpret_cast<sockaddr_in *>(std::ranges::data(addr));
+    inet_ntop(AF_INET, &addr_v4->sin_addr, buf.data(), buf.size());
+  }
+  else if (IN6_IS_ADDR_V4MAPPED(&addr->sin6_addr))
+  {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    inet_ntop(AF_INET, &addr->sin6_addr.s6_addr[12], buf.data(), buf.size());
+  }
+  else
+  {
+    inet_ntop(AF_INET6, &addr->sin6_addr, buf.data(), buf.size());
+  }
+  return std::pmr::string(buf.data(), scratch);
+}
+
+/**
+ * @brief Gets the generic form of a path in scratch memory.
+ * @param path The path.
+ * @param scratch The memory resource to allocate from.
+ * @returns The path with `/` separators.
+ */
+static inline auto generic_name(const std::filesystem::path &path,
+                                std::pmr::memory_resource *scratch)
+    -> std::pmr::string
+{
+  using allocator = std::pmr::polymorphic_allocator<char>;
+  return path.generic_string<char, std::char_traits<char>, allocator>(
+      allocator(scratch));
+}
+
+/**
+ * @brief Appends a name to a path in scratch memory.
+ * @details Joins the way std::filesystem::path::operator/= does on POSIX:
+ * an absolute name replaces the path.
+ * @param path The path.
+ * @param name The name to append.
+ */
+static inline auto append_path(std::pmr::string &path,
+                               std::string_view name) -> void
+{
+  if (name.starts_with('/'))
+    path.clear();
+  else if (!path.empty() && !path.ends_with('/'))
+    path.push_back('/');
+  path.append(name);
 }
 
 #ifndef TFTP_SERVER_STATIC_TEST
@@ -160,29 +309,83 @@ auto handle_request(messages::request req, iterator_t siter) -> std::uint16_t
 
   auto &[key, session] = *siter;
   auto &state = session.state;
+  auto &transfer = *state.transfer;
+  // Scratch strings are only needed while the request is handled.
+  auto *scratch = detail::arena::current().resource();
+
+  // New sessions are refused once memory runs out and the caches can not
+  // be shrunk to make room.
+  if (auto governor = memory::current())
+  {
+    if (!governor->admit(SESSION_BYTES))
+      return messages::BUSY;
+
+    transfer.memory = memory::reservation(std::move(governor));
+    transfer.memory.add(memory::SESSIONS,
+                        sizeof(session) + sizeof(session::transfer_t));
+  }
 
   state.opc = req.opc;
-  state.target = req.filename;
   state.mode = req.mode;
+  // Every packet of the session fits without reallocating.
+  transfer.buffer.reserve(messages::DATAMSG_MAXLEN);
+  transfer.memory.add(memory::BUFFERS, transfer.buffer.capacity());
+
+  auto client = rewrite::client{.ip = client_ip(key, scratch),
+                                .mac = std::pmr::string(scratch)};
+  // Sessions for the same file share one copy of its path.
+  if (auto rules = rewrite::current(); rules && req.mode != messages::MAIL)
+  {
+    if (rules->needs_mac())
+      client.mac = rewrite::lookup_mac(client.ip, scratch);
+
+    transfer.target =
+        filesystem::intern(rules->apply(req.filename, client, scratch));
+  }
+  else
+  {
+    transfer.target = filesystem::intern(req.filename);
+  }
 
   if (req.opc == WRQ && req.mode == messages::MAIL)
   {
-    state.target =
-        filesystem::mail_directory() / state.target /
-        std::format("{:%Y%m%d_%H%M%S}", std::chrono::system_clock::now());
+    auto stamp = std::pmr::string(scratch);
+    std::format_to(std::back_inserter(stamp), "{:%Y%m%d_%H%M%S}",
+                   std::chrono::system_clock::now());
+    auto mailbox =
+        std::pmr::string(filesystem::mail_directory().native(), scratch);
+    append_path(mailbox, transfer.target->native());
+    append_path(mailbox, stamp);
+    transfer.target = filesystem::intern(mailbox);
   }
 
+  const auto &target = *transfer.target;
   auto err = std::error_code();
+  auto backend = storage::current();
+  auto stored = false;
   if (req.opc == WRQ)
   {
-    state.file = filesystem::open_write(state.target, state.tmp, err);
+    // Uploads with an in-process consumer never touch storage.
+    if (auto sinks = sink::current())
+      transfer.file = sinks->open(target, err);
+
+    if (!transfer.file && !err)
+      transfer.file = backend->open_write(target, err);
   }
   else
   {
-    state.file = filesystem::open_read(state.target, err);
+    // Virtual files are rendered ahead of storage.
+    if (auto files = templates::current())
+      transfer.file = files->open(generic_name(target, scratch), client);
+
+    if (!transfer.file)
+    {
+      transfer.file = backend->open_read(target, err);
+      stored = true;
+    }
   }
 
-  if (!state.file)
+  if (!transfer.file)
   {
     if (err == std::errc::no_such_file_or_directory)
     {
@@ -196,11 +399,128 @@ auto handle_request(messages::request req, iterator_t siter) -> std::uint16_t
   }
 
   if (req.opc == RRQ)
+  {
+    // Start loading the files this client is likely to ask for next.
+    if (auto predictor = prefetch::current())
+      predictor->observe(client.ip, target);
+
+    // Only files read from storage have a status to key shared state on. A
+    // virtual file with the same name must not share it.
+    auto stat_err = std::error_code();
+    auto status = storage::file_status();
+    if (stored)
+      status = backend->stat(target, stat_err);
+    const auto keyed = stored && !stat_err;
+
+    // NETASCII seeks resume from checkpoints shared by every reader of the
+    // same version of the file.
+    auto index = std::shared_ptr<transform::netascii_index>();
+    if (state.mode == messages::NETASCII && keyed)
+      index = transform::netascii_index::shared(
+          generic_name(target, scratch), status);
+
+    transfer.pipeline = transform::make_pipeline(transfer.file, state.mode,
+                                              std::move(index));
+
+    // Compression is only negotiated for files small enough to keep the
+    // compressed frame in memory. Files that are still arriving are not
+    // compressed either, since the compressor reads far ahead of the client.
+    // Other files are sent as they are.
+    auto compress = false;
+#ifdef TFTP_ENABLE_ZSTD
+    if (req.compress && transfer.file->complete() &&
+        transfer.file->size() <= transform::compressor::MAX_FILE_SIZE)
+    {
+      compress = true;
+      auto cache_key = std::string();
+      auto length = std::optional<std::uint64_t>();
+      if (keyed)
+      {
+        cache_key = target.generic_string();
+        cache_key += (state.mode == messages::NETASCII) ? ":netascii"
+                                                        : ":octet";
+        if (state.mode != messages::NETASCII)
+          length = status.size;
+      }
+
+      transfer.pipeline->push([&](std::unique_ptr<transform::stage> upstream) {
+        return std::make_unique<transform::compressor>(
+            std::move(upstream), std::move(cache_key), status, length);
+      });
+    }
+#endif // TFTP_ENABLE_ZSTD
+
+    if (req.offset)
+    {
+      // Resume after the blocks the client already has. The pipeline seeks
+      // straight to the offset, so the skipped blocks are never read.
+      constexpr auto MAX_OFFSET =
+          std::numeric_limits<std::uint64_t>::max() / messages::DATALEN;
+      auto seek_err = std::error_code();
+      if (*req.offset > MAX_OFFSET ||
+          !transfer.pipeline->seek(*req.offset * messages::DATALEN, seek_err))
+      {
+        return messages::ILLEGAL_OPERATION;
+      }
+    }
+
+    auto accepted = messages::request{.offset = req.offset,
+                                      .compress = compress};
+    if (req.fec)
+    {
+      accepted.fec = static_cast<std::uint16_t>(
+          std::min<std::size_t>(req.fec, fec::MAX_GROUP));
+      transfer.fec = std::make_unique<fec::window>();
+      transfer.memory.add(memory::BUFFERS,
+                          sizeof(fec::window) +
+                              (accepted.fec + 1UL) * messages::DATAMSG_MAXLEN);
+      transfer.fec->group = accepted.fec;
+      transfer.fec->start = req.offset.value_or(0) * messages::DATALEN;
+    }
+
+    if (accepted.offset || accepted.compress || accepted.fec)
+    {
+      prepare_oack(siter, accepted);
+      return 0;
+    }
+
+    // The first block of a file that is still arriving is sent once it is
+    // there, leaving the buffer empty until then.
+    if (auto error = std::uint16_t{0}; read_pending(siter, error) || error)
+      return error;
+
     return send_next(siter);
+  }
 
   return 0;
 }
 
+auto read_pending(iterator_t siter, std::uint16_t &error) -> bool
+{
+  auto &[key, session] = *siter;
+  auto err = std::error_code();
+  auto busy = session.state.transfer->file->busy(err);
+
+  error = 0;
+  if (err == std::errc::no_such_file_or_directory)
+    error = messages::FILE_NOT_FOUND;
+  else if (err)
+    error = messages::ACCESS_VIOLATION;
+
+  return busy;
+}
+
+auto resend_due(const session::state_t &state, session::timestamp now,
+                session::timestamp &resent) noexcept -> bool
+{
+  auto idle = std::max(state.statistics.start_time, resent);
+  if (now - idle < state.timeout)
+    return false;
+
+  resent = now;
+  return true;
+}
+
 /**
  * @brief Processes an ack message.
  * @param ack The TFTP ack to process.
@@ -217,14 +537,30 @@ auto handle_ack(messages::ack ack, iterator_t siter) -> std::uint16_t
   if (state.opc != RRQ)
     return messages::UNKNOWN_TID;
 
-  if (state.buffer.size() >= messages::DATAMSG_MAXLEN &&
+  // Nothing was sent yet because the file was still arriving.
+  if (state.transfer->buffer.empty())
+    return ntohs(ack.block_num) == 0 ? send_next(siter) : 0;
+
+  // The client accepted the negotiated options.
+  if (sent_oack(state))
+  {
+    if (ntohs(ack.block_num) != 0)
+      return 0;
+
+    return state.transfer->fec ? send_window(siter) : send_next(siter);
+  }
+
+  if (state.transfer->fec)
+    return ack_window(ntohs(ack.block_num), siter);
+
+  if (state.transfer->buffer.size() >= messages::DATAMSG_MAXLEN &&
       ntohs(ack.block_num) == state.block_num)
   {
     return send_next(siter);
   }
 
   if (ntohs(ack.block_num) == state.block_num)
-    state.file->close();
+    state.transfer->file->close();
 
   return 0;
 }
@@ -237,8 +573,6 @@ auto handle_data(const messages::data *data, std::size_t len,
   auto &[key, session] = *siter;
   auto &opc = session.state.opc;
   auto &block_num = session.state.block_num;
-  auto &target = session.state.target;
-  auto &tmp = session.state.tmp;
 
   if (opc != WRQ)
     return messages::UNKNOWN_TID;
@@ -254,18 +588,17 @@ auto handle_data(const messages::data *data, std::size_t len,
   block_num = next_block;
 
   // Write the data to the file.
-  auto &file = session.state.file;
-  file->write(payload, static_cast<std::streamsize>(len));
-  if (file->fail())
+  auto &file = session.state.transfer->file;
+  auto err = std::error_code();
+  file->append(std::span(payload, len), err);
+  if (err)
     return messages::DISK_FULL; // GCOVR_EXCL_LINE
 
   // File writing is complete.
   if (len < messages::DATALEN)
   {
-    file->close();
-    auto err = std::error_code();
-    std::filesystem::rename(tmp, target, err);
-    if (err != std::errc{}) [[unlikely]]
+    file->commit(err);
+    if (err) [[unlikely]]
       return messages::ACCESS_VIOLATION; // GCOVR_EXCL_LINE
   }
 
@@ -18,23 +18,34 @@
  * @brief This file defines the TFTP server.
  */
 #include "tftp/tftp_server.hpp"
+#include "tftp/detail/arena.hpp"
 #include "tftp/protocol/tftp_protocol.hpp"
 
 #include <net/timers/timers.hpp>
 #include <spdlog/spdlog.h>
 
 #include <algorithm>
+#include <bit>
 #include <cassert>
+#include <charconv>
 #include <filesystem>
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <strings.h>
+#include <sys/socket.h>
 #include <unistd.h>
 namespace tftp {
 /** @brief Additional buffer length for <PORT>,[],: and null.  */
 static constexpr auto ADDR_BUFLEN = 9UL;
+/** @brief The longest an ACK is held back for a busy upload. */
+static constexpr auto ACK_DEFER_MAX = std::chrono::seconds(10);
+/** @brief The longest a block is held back for a file that is arriving. */
+static constexpr auto READ_DEFER_MAX = std::chrono::seconds(10);
 /** @brief Socket address type. */
 template <typename T> using socket_address = ::io::socket::socket_address<T>;
+/** @brief The most retransmissions of a block before a session times out. */
+static constexpr auto MAX_RETRIES = 5;
 
 /** @brief Milliseconds type. */
 using milliseconds = std::chrono::milliseconds;
@@ -89,6 +100,33 @@ to_str(std::span<char> buf,
   return {buf.data()};
 }
 
+/**
+ * @brief Sends a packet on a session's socket without blocking.
+ * @details UDP sends rarely block, so packets are written directly and only
+ * handed to the async scope, which allocates an operation state per send,
+ * when the socket buffer is full.
+ * @param sock The session socket.
+ * @param key The client address.
+ * @param buf The packet.
+ * @returns true if the packet was sent.
+ */
+static inline auto try_send(session::socket_type sock,
+                            socket_address<sockaddr_in6> key,
+                            std::span<const char> buf) noexcept -> bool
+{
+  if (sock == session::INVALID_SOCKET)
+    return false;
+
+  const auto *addr =
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+      reinterpret_cast<const sockaddr *>(std::ranges::data(key));
+  const auto addrlen = (addr->sa_family == AF_INET) ? sizeof(sockaddr_in)
+                                                    : sizeof(sockaddr_in6);
+  auto len = ::sendto(sock, buf.data(), buf.size(), MSG_DONTWAIT, addr,
+                      static_cast<socklen_t>(addrlen));
+  return len == static_cast<ssize_t>(buf.size());
+}
+
 /** @brief Converts valid C strings to string views. */
 static inline auto to_view(const char *str,
                            std::size_t maxlen) -> std::string_view
@@ -123,6 +161,14 @@ static inline auto to_mode(std::string_view mode) noexcept -> messages::mode_t
   return {};
 }
 
+/** @brief Compares strings ignoring case. */
+static inline auto iequals(std::string_view lhs, std::string_view rhs) noexcept
+    -> bool
+{
+  return lhs.size() == rhs.size() &&
+         strncasecmp(lhs.data(), rhs.data(), lhs.size()) == 0;
+}
+
 /**
  * @brief Parses a TFTP request and returns a session::state_t if valid.
  * @param msg A span providing a view into the message.
@@ -155,6 +201,44 @@ parse_request(std::span<const std::byte> msg) -> messages::request
     return req;
 
   req.mode = to_mode(mode);
+  buf += mode.size() + 1;
+
+  // RFC 2347 options follow as name and value pairs. Unknown options and
+  // malformed values are ignored so the request is served without them.
+  while (buf < end)
+  {
+    auto name = to_view(reinterpret_cast<const char *>(buf), end - buf);
+    if (name.empty())
+      break;
+
+    buf += name.size() + 1;
+    auto value = to_view(reinterpret_cast<const char *>(buf), end - buf);
+    if (value.empty())
+      break;
+
+    buf += value.size() + 1;
+    if (iequals(name, messages::COMPRESS_OPTION))
+    {
+      req.compress = iequals(value, messages::ZSTD_COMPRESSION);
+    }
+    else if (iequals(name, messages::OFFSET_OPTION))
+    {
+      auto offset = std::uint64_t{0};
+      const auto *last = value.data() + value.size();
+      auto [ptr, ec] = std::from_chars(value.data(), last, offset);
+      if (ec == std::errc{} && ptr == last)
+        req.offset = offset;
+    }
+    else if (iequals(name, messages::FEC_OPTION))
+    {
+      auto group = std::uint16_t{0};
+      const auto *last = value.data() + value.size();
+      auto [ptr, ec] = std::from_chars(value.data(), last, group);
+      if (ec == std::errc{} && ptr == last)
+        req.fec = group;
+    }
+  }
+
   return req;
 }
 
@@ -168,6 +252,34 @@ clamped_exp_weighted_average(milliseconds curr,
   return avg;
 }
 
+/**
+ * @brief Gets the period of a timer that enforces a timeout.
+ * @details Periods are powers of two milliseconds no longer than half the
+ * timeout, so the timer only needs replacing when the RTT estimate moves
+ * across a power of two, and expires at most half a timeout late.
+ */
+static constexpr auto timer_period(milliseconds timeout) noexcept
+    -> milliseconds
+{
+  auto half = std::max(timeout / 2, session::TIMEOUT_MIN);
+  return milliseconds(std::bit_floor(static_cast<std::uint64_t>(half.count())));
+}
+
+/**
+ * @brief Sets the timeout a periodic session timer enforces.
+ * @returns true if the timer has to be replaced for the new timeout.
+ */
+static inline auto retime(session::state_t &state,
+                          milliseconds timeout) noexcept -> bool
+{
+  // A zero timeout marks a timer that is not periodic.
+  auto replace = state.timer == session::INVALID_TIMER ||
+                 state.timeout == milliseconds::zero() ||
+                 timer_period(state.timeout) != timer_period(timeout);
+  state.timeout = timeout;
+  return replace;
+}
+
 /** @brief Update session RTT statistics. */
 static inline auto
 update_statistics(session::state_t::statistics_t &statistics) noexcept -> void
@@ -218,6 +330,10 @@ auto server::error(async_context &ctx, const socket_dialog &socket,
       msg.buffers = errors::illegal_operation();
       break;
 
+    case BUSY:
+      msg.buffers = errors::busy();
+      break;
+
     case TIMED_OUT:
       msg.buffers = errors::timed_out();
       [[fallthrough]];
@@ -241,7 +357,6 @@ auto server::ack(async_context &ctx, const socket_dialog &socket,
                  const std::shared_ptr<read_context> &rctx,
                  std::span<const std::byte> msg, iterator_t siter) -> void
 {
-  using enum messages::opcode_t;
   using enum messages::error_t;
   auto addrbuf = std::array<char, INET6_ADDRSTRLEN + ADDR_BUFLEN>{};
 
@@ -249,47 +364,111 @@ auto server::ack(async_context &ctx, const socket_dialog &socket,
     return error(ctx, socket, siter, ILLEGAL_OPERATION);
 
   auto &[key, session] = *siter;
-  auto addrstr = to_str(addrbuf, key);
   auto &state = session.state;
-  auto prev_block = state.block_num;
-  auto &[start_time, avg_rtt] = state.statistics;
+  if (state.opc != messages::RRQ)
+    return cleanup(ctx, socket, siter);
 
   const auto *ack = reinterpret_cast<const messages::ack *>(msg.data());
-  auto err = handle_ack(*ack, siter);
+  auto err = std::uint16_t{0};
+  if (read_pending(siter, err))
+  {
+    // Retransmitted ACKs are ignored while the read is deferred.
+    if (state.timeout != milliseconds::zero())
+      defer_read(ctx, socket, siter, *ack);
+  }
+  else if (err)
+  {
+    spdlog::error("RRQ:{}:{}", to_str(addrbuf, key), errors::errstr(err));
+    return error(ctx, socket, siter, err);
+  }
+  else if (!advance(ctx, socket, siter, *ack))
+  {
+    return;
+  }
+
+  submit_recv(ctx, socket, rctx);
+}
+
+auto server::advance(async_context &ctx, const socket_dialog &socket,
+                     iterator_t siter, messages::ack ack) -> bool
+{
+  auto addrbuf = std::array<char, INET6_ADDRSTRLEN + ADDR_BUFLEN>{};
+  auto &[key, session] = *siter;
+  auto &state = session.state;
+  auto prev_block = state.block_num;
+  auto &transfer = *state.transfer;
+  auto prev_window = transfer.fec ? transfer.fec->sequence : 0;
+
+  auto err = handle_ack(ack, siter);
   if (err)
   {
     if (err == messages::UNKNOWN_TID)
-      return cleanup(ctx, socket, siter);
+    {
+      cleanup(ctx, socket, siter);
+      return false;
+    }
 
-    spdlog::error("RRQ:{}:{}", addrstr, errors::errstr(err)); // GCOVR_EXCL_LINE
-    return error(ctx, socket, siter, err);                    // GCOVR_EXCL_LINE
+    spdlog::error("RRQ:{}:{}", to_str(addrbuf, key),      // GCOVR_EXCL_LINE
+                  errors::errstr(err));                   // GCOVR_EXCL_LINE
+    error(ctx, socket, siter, err);                       // GCOVR_EXCL_LINE
+    return false;                                         // GCOVR_EXCL_LINE
   }
 
-  if (!state.file->is_open())
+  if (!transfer.file->is_open())
   {
-    spdlog::info("RRQ:{}:Completed {}.", addrstr, state.target.c_str());
-    return cleanup(ctx, socket, siter);
+    spdlog::info("RRQ:{}:Completed {}.", to_str(addrbuf, key),
+                 transfer.target->c_str());
+    cleanup(ctx, socket, siter);
+    return false;
   }
 
-  if (prev_block != state.block_num)
+  // A window resent after a loss can end on the same block.
+  if (prev_block != state.block_num ||
+      (transfer.fec && transfer.fec->sequence != prev_window))
   {
     send_data(ctx, socket, siter);
 
     update_statistics(state.statistics);
-    state.timer = ctx.timers.remove(state.timer);
-    state.timer = ctx.timers.add(
-        2 * avg_rtt,
-        [&, siter, socket, retries = 0](auto timer_id) mutable {
-          constexpr auto MAX_RETRIES = 5;
-          if (retries++ >= MAX_RETRIES)
-            return error(ctx, socket, siter, messages::TIMED_OUT);
-
-          send_data(ctx, socket, siter);
-        },
-        2 * avg_rtt);
+    arm_retransmit(ctx, socket, siter);
   }
 
-  submit_recv(ctx, socket, rctx);
+  return true;
+}
+
+auto server::defer_read(async_context &ctx, const socket_dialog &socket,
+                        iterator_t siter, messages::ack ack) -> void
+{
+  using enum messages::error_t;
+  auto &[key, session] = *siter;
+  auto &timer = session.state.timer;
+
+  // Make arm_retransmit() replace the polling timer.
+  session.state.timeout = {};
+  timer = ctx.timers.remove(timer);
+  timer = ctx.timers.add(
+      session::TIMEOUT_MIN,
+      [&, siter, socket, ack, waited = milliseconds(0)](auto) mutable {
+        auto err = std::uint16_t{0};
+        if (read_pending(siter, err))
+        {
+          waited += session::TIMEOUT_MIN;
+          if (waited >= READ_DEFER_MAX)
+            return error(ctx, socket, siter, TIMED_OUT);
+
+          return;
+        }
+
+        if (err)
+        {
+          auto addrbuf = std::array<char, INET6_ADDRSTRLEN + ADDR_BUFLEN>{};
+          spdlog::error("RRQ:{}:{}", to_str(addrbuf, siter->first),
+                        errors::errstr(err));
+          return error(ctx, socket, siter, err);
+        }
+
+        advance(ctx, socket, siter, ack);
+      },
+      session::TIMEOUT_MIN);
 }
 
 auto server::rrq(async_context &ctx, const socket_dialog &socket,
@@ -303,7 +482,6 @@ auto server::rrq(async_context &ctx, const socket_dialog &socket,
 
   auto &[key, session] = *siter;
   auto &state = session.state;
-  auto &[start_time, avg_rtt] = state.statistics;
 
   // Out-of-the-blue packet, already a session running on this socket.
   if (state.opc != 0)
@@ -321,24 +499,51 @@ auto server::rrq(async_context &ctx, const socket_dialog &socket,
 
   // Bind the TFTP session to this socket.
   state.socket = static_cast<session::socket_type>(*socket.socket);
+  state.transfer->memory.add(memory::BUFFERS, sizeof(read_context));
+
+  // The file is still arriving, so its first block is sent once it is here.
+  if (state.transfer->buffer.empty())
+  {
+    defer_read(ctx, socket, siter,
+               messages::ack{.opc = htons(messages::ACK), .block_num = 0});
+    return submit_recv(ctx, socket, rctx);
+  }
 
   send_data(ctx, socket, siter);
 
   update_statistics(state.statistics);
+  arm_retransmit(ctx, socket, siter);
+
+  submit_recv(ctx, socket, rctx);
+}
+
+auto server::arm_retransmit(async_context &ctx, const socket_dialog &socket,
+                            iterator_t siter) -> void
+{
+  auto &[key, session] = *siter;
+  auto &state = session.state;
+
+  // The timer ticks at a quantized period and its handler checks the exact
+  // timeout, so steady-state ACKs do not build a new timer closure.
+  state.retries = 0;
+  if (!retime(state, 2 * state.statistics.avg_rtt))
+    return;
 
+  const auto period = timer_period(state.timeout);
   state.timer = ctx.timers.remove(state.timer);
   state.timer = ctx.timers.add(
-      2 * avg_rtt,
-      [&, siter, socket, retries = 0](auto timer_id) mutable {
-        constexpr auto MAX_RETRIES = 5;
-        if (++retries >= MAX_RETRIES)
+      period,
+      [&, siter, socket, resent = session::timestamp()](auto) mutable {
+        auto &current = siter->second.state;
+        if (!resend_due(current, session::clock::now(), resent))
+          return;
+
+        if (current.retries++ >= MAX_RETRIES)
           return error(ctx, socket, siter, messages::TIMED_OUT);
 
         send_data(ctx, socket, siter);
       },
-      2 * avg_rtt);
-
-  submit_recv(ctx, socket, rctx);
+      period);
 }
 
 auto server::send_data(async_context &ctx, const socket_dialog &socket,
@@ -346,10 +551,33 @@ auto server::send_data(async_context &ctx, const socket_dialog &socket,
 {
   using namespace stdexec;
   auto &[key, session] = *siter;
-  auto &buffer = session.state.buffer;
+  auto &buffer = session.state.transfer->buffer;
+
+  // A window of DATA blocks and its repair packet are sent back to back.
+  const auto &window = session.state.transfer->fec;
+  if (window && !window->ends.empty())
+  {
+    auto begin = std::size_t{0};
+    for (auto end : window->ends)
+    {
+      auto span = std::span(window->packets).subspan(begin, end - begin);
+      begin = end;
+      if (try_send(session.state.socket, key, span))
+        continue;
+
+      sender auto sendmsg =
+          io::sendmsg(socket,
+                      socket_message{.address = {key}, .buffers = span}, 0) |
+          then([](auto &&) noexcept {}) | upon_error([](auto &&) noexcept {});
+      ctx.scope.spawn(std::move(sendmsg));
+    }
+    return;
+  }
 
   auto span = std::span(buffer.data(),
                         std::min(buffer.size(), messages::DATAMSG_MAXLEN));
+  if (try_send(session.state.socket, key, span))
+    return;
 
   sender auto sendmsg =
       io::sendmsg(socket, socket_message{.address = {key}, .buffers = span},
@@ -388,6 +616,7 @@ auto server::wrq(async_context &ctx, const socket_dialog &socket,
 
   // Bind the TFTP session to this socket.
   session.state.socket = static_cast<session::socket_type>(*socket.socket);
+  session.state.transfer->memory.add(memory::BUFFERS, sizeof(read_context));
 
   send_ack(ctx, socket, siter);
 
@@ -414,46 +643,121 @@ auto server::data(async_context &ctx, const socket_dialog &socket,
     return error(ctx, socket, siter, ILLEGAL_OPERATION);
 
   auto &[key, session] = *siter;
-  auto addrstr = to_str(addrbuf, key);
   auto &block_num = session.state.block_num;
-  auto &timer = session.state.timer;
-  auto &[start_time, avg_rtt] = session.state.statistics;
-  auto &file = session.state.file;
-  auto &target = session.state.target;
+  auto &file = session.state.transfer->file;
 
   const auto *data = reinterpret_cast<const messages::data *>(buf.data());
   auto prev_block = block_num;
   auto err = handle_data(data, buf.size(), siter);
   if (err)
   {
-    spdlog::error("WRQ:{}:{}", addrstr, errors::errstr(err));
+    spdlog::error("WRQ:{}:{}", to_str(addrbuf, key), errors::errstr(err));
     return error(ctx, socket, siter, err);
   }
 
   if (ntohs(data->block_num) == block_num)
   {
-    send_ack(ctx, socket, siter);
-
-    if (prev_block != block_num)
+    auto write_err = std::error_code();
+    auto busy = file->busy(write_err);
+    if (write_err)
     {
-      if (!file->is_open())
-        spdlog::info("WRQ:{}:Completed {}.", addrstr, target.c_str());
-
-      update_statistics(session.state.statistics);
-      timer = ctx.timers.remove(timer);
-      // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers)
-      timer = ctx.timers.add(5 * avg_rtt, [&, siter, socket](auto) {
-        if (file->is_open())
-          return error(ctx, socket, siter, TIMED_OUT);
+      spdlog::error("WRQ:{}:{}", to_str(addrbuf, key), write_err.message());
+      return error(ctx, socket, siter, ACCESS_VIOLATION);
+    }
 
-        cleanup(ctx, socket, siter);
-      });
+    if (!busy)
+    {
+      send_ack(ctx, socket, siter);
+      if (prev_block != block_num)
+        await_data(ctx, socket, siter);
+    }
+    else if (prev_block != block_num)
+    {
+      // Hold the ACK back until the upload's consumer catches up.
+      // Retransmissions of this block are not acked in the meantime.
+      defer_ack(ctx, socket, siter);
     }
   }
 
   submit_recv(ctx, socket, rctx);
 }
 
+auto server::await_data(async_context &ctx, const socket_dialog &socket,
+                        iterator_t siter) -> void
+{
+  using enum messages::error_t;
+  auto &[key, session] = *siter;
+  auto &timer = session.state.timer;
+  auto &[start_time, avg_rtt] = session.state.statistics;
+
+  if (!session.state.transfer->file->is_open())
+  {
+    auto addrbuf = std::array<char, INET6_ADDRSTRLEN + ADDR_BUFLEN>{};
+    spdlog::info("WRQ:{}:Completed {}.", to_str(addrbuf, key),
+                 session.state.transfer->target->c_str());
+  }
+
+  update_statistics(session.state.statistics);
+
+  // The idle timer ticks at a quantized period and its handler checks the
+  // exact timeout, so steady-state DATA packets do not build a new closure.
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers)
+  if (!retime(session.state, 5 * avg_rtt))
+    return;
+
+  const auto period = timer_period(session.state.timeout);
+  timer = ctx.timers.remove(timer);
+  timer = ctx.timers.add(
+      period,
+      [&, siter, socket](auto) {
+        auto &current = siter->second.state;
+        if (session::clock::now() - current.statistics.start_time <
+            current.timeout)
+        {
+          return;
+        }
+
+        if (current.transfer->file->is_open())
+          return error(ctx, socket, siter, TIMED_OUT);
+
+        cleanup(ctx, socket, siter);
+      },
+      period);
+}
+
+auto server::defer_ack(async_context &ctx, const socket_dialog &socket,
+                       iterator_t siter) -> void
+{
+  using enum messages::error_t;
+  auto &[key, session] = *siter;
+  auto &timer = session.state.timer;
+  auto &file = session.state.transfer->file;
+
+  // Make await_data() replace the polling timer.
+  session.state.timeout = {};
+  timer = ctx.timers.remove(timer);
+  timer = ctx.timers.add(
+      session::TIMEOUT_MIN,
+      [&, siter, socket, waited = milliseconds(0)](auto) mutable {
+        auto err = std::error_code();
+        if (file->busy(err))
+        {
+          waited += session::TIMEOUT_MIN;
+          if (waited >= ACK_DEFER_MAX)
+            return error(ctx, socket, siter, TIMED_OUT);
+
+          return;
+        }
+
+        if (err)
+          return error(ctx, socket, siter, ACCESS_VIOLATION);
+
+        send_ack(ctx, socket, siter);
+        await_data(ctx, socket, siter);
+      },
+      session::TIMEOUT_MIN);
+}
+
 /** @brief Acks the current block of data to the client.. */
 auto server::send_ack(async_context &ctx, const socket_dialog &socket,
                       iterator_t siter) -> void
@@ -463,7 +767,7 @@ auto server::send_ack(async_context &ctx, const socket_dialog &socket,
   using socket_message = io::socket::socket_message<sockaddr_in6>;
 
   auto &[key, session] = *siter;
-  auto &buffer = session.state.buffer;
+  auto &buffer = session.state.transfer->buffer;
   auto &block_num = session.state.block_num;
 
   buffer.resize(sizeof(messages::ack));
@@ -471,6 +775,8 @@ auto server::send_ack(async_context &ctx, const socket_dialog &socket,
   auto *ack = reinterpret_cast<messages::ack *>(buffer.data());
   ack->opc = htons(ACK);
   ack->block_num = htons(block_num);
+  if (try_send(session.state.socket, key, buffer))
+    return;
 
   sender auto sendmsg =
       io::sendmsg(socket, socket_message{.address = {key}, .buffers = buffer},
@@ -483,26 +789,18 @@ auto server::send_ack(async_context &ctx, const socket_dialog &socket,
 auto server::cleanup(async_context &ctx, const socket_dialog &socket,
                      iterator_t siter) -> void
 {
-  auto err = std::error_code();
   auto &[key, session] = *siter;
   auto &timer = session.state.timer;
-  auto &file = session.state.file;
-  auto &tmp = session.state.tmp;
+  auto &file = session.state.transfer->file;
 
   // Delete any associated timers.
   timer = ctx.timers.remove(timer);
 
-  // Close the file if it is open.
+  // Close the file if it is open, discarding any uncommitted writes.
+  if (file)
+    file->close();
   file.reset();
 
-  // Delete any temporary files.
-  if (!tmp.empty() && !remove(tmp, err) && err) [[unlikely]]
-  {
-    spdlog::warn(                                            // GCOVR_EXCL_LINE
-        "Failed to delete temporary file {} with error: {}", // GCOVR_EXCL_LINE
-        tmp.c_str(), err.message());                         // GCOVR_EXCL_LINE
-  }
-
   // Shutdown the read-side of the socket.
   // This removes the socket from the underlying event-loop if
   // we have reached here due to a timeout.
@@ -550,6 +848,8 @@ auto server::service(async_context &ctx, const socket_dialog &socket,
   using enum messages::opcode_t;
   using enum messages::error_t;
   using namespace io::socket;
+  // Scratch memory used while handling the message is freed on return.
+  auto event = detail::arena::scope();
   if (!rctx)
     return;
 
@@ -0,0 +1,629 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file transform.cpp
+ * @brief This file defines the streaming transform pipeline for served files.
+ */
+#include "tftp/transform.hpp"
+#include "tftp/memory.hpp"
+#include "tftp/protocol/tftp_protocol.hpp"
+
+#include <array>
+#include <cstring>
+#include <list>
+#include <map>
+#include <unordered_map>
+
+#ifdef TFTP_ENABLE_ZSTD
+#include <zstd.h>
+#endif
+namespace tftp::transform {
+
+source::source(std::shared_ptr<storage::file> file) noexcept
+    : file_{std::move(file)}
+{}
+
+auto source::pull(std::span<char> buf, std::error_code &err) -> std::size_t
+{
+  return file_->read(buf, err);
+}
+
+auto source::seek(std::uint64_t offset, std::error_code &err) -> bool
+{
+  err.clear();
+  // Reading the byte before the offset makes a file that is produced as it
+  // is read catch up to it.
+  auto last = std::array<char, 1>();
+  if (offset > file_->size() && file_->read_at(offset - 1, last, err) == 0)
+  {
+    if (!err)
+      err = std::make_error_code(std::errc::invalid_argument);
+    return false;
+  }
+
+  file_->seek(offset);
+  return true;
+}
+
+/** @brief The shared NETASCII indexes. */
+struct shared_indexes {
+  /** @brief A shared index. */
+  struct entry {
+    /** @brief The file status the index was built for. */
+    storage::file_status status;
+    /** @brief The index. */
+    std::shared_ptr<netascii_index> index;
+    /** @brief The position of the entry in the LRU list. */
+    std::list<std::string>::iterator lru;
+  };
+
+  /** @brief Protects the members below. */
+  std::mutex mtx;
+  /** @brief The indexes keyed by path. */
+  std::map<std::string, entry, std::less<>> entries;
+  /** @brief Indexed paths, most recently used first. */
+  std::list<std::string> lru;
+};
+
+/** @brief Gets the process-wide shared indexes. */
+static auto indexes() -> shared_indexes &
+{
+  static auto table = shared_indexes();
+  return table;
+}
+
+auto netascii_index::shared(std::string_view name,
+                            const storage::file_status &status)
+    -> std::shared_ptr<netascii_index>
+{
+  auto &table = indexes();
+  auto lock = std::lock_guard{table.mtx};
+  auto it = table.entries.find(name);
+  if (it != table.entries.end())
+  {
+    table.lru.splice(table.lru.begin(), table.lru, it->second.lru);
+    if (it->second.status.size == status.size &&
+        it->second.status.last_write == status.last_write)
+    {
+      return it->second.index;
+    }
+
+    it->second.status = status;
+    it->second.index = std::make_shared<netascii_index>(status.size);
+    return it->second.index;
+  }
+
+  if (table.entries.size() >= MAX_SHARED)
+  {
+    table.entries.erase(table.lru.back());
+    table.lru.pop_back();
+  }
+
+  table.lru.emplace_front(name);
+  auto index = std::make_shared<netascii_index>(status.size);
+  table.entries.emplace(
+      table.lru.front(), shared_indexes::entry{
+                .status = status, .index = index, .lru = table.lru.begin()});
+  return index;
+}
+
+netascii_index::netascii_index(std::uint64_t size)
+{
+  points_.reserve(size / STRIDE + 1);
+}
+
+auto netascii_index::record(std::size_t number,
+                            const checkpoint &point) -> void
+{
+  auto lock = std::lock_guard{mtx_};
+  if (number == points_.size())
+    points_.push_back(point);
+}
+
+auto netascii_index::find(std::size_t number, std::size_t &found) const
+    -> std::optional<checkpoint>
+{
+  auto lock = std::lock_guard{mtx_};
+  if (points_.empty())
+    return std::nullopt;
+
+  found = std::min(number, points_.size() - 1);
+  return points_[found];
+}
+
+auto netascii_index::size() const -> std::size_t
+{
+  auto lock = std::lock_guard{mtx_};
+  return points_.size();
+}
+
+netascii::netascii(std::unique_ptr<stage> upstream,
+                   std::shared_ptr<netascii_index> index) noexcept
+    : upstream_{std::move(upstream)}, index_{std::move(index)}
+{}
+
+auto netascii::pull(std::span<char> buf, std::error_code &err) -> std::size_t
+{
+  err.clear();
+  auto out = buf.begin();
+  // Queues an encoded pair. The pair is output before more input is read.
+  auto emit = [&](char first, char second) {
+    pending_ = {first, second};
+    pending_pos_ = 0;
+    pending_len_ = 2;
+  };
+
+  while (true)
+  {
+    while (pending_pos_ < pending_len_ && out != buf.end())
+    {
+      if (index_ && produced_ % netascii_index::STRIDE == 0)
+      {
+        auto point = netascii_index::checkpoint{
+            .input = input_offset_ + pos_,
+            .pending_len = static_cast<std::uint8_t>(pending_len_ -
+                                                     pending_pos_),
+            .carriage_return = carriage_return_};
+        std::copy(pending_.begin() + pending_pos_,
+                  pending_.begin() + pending_len_, point.pending.begin());
+        index_->record(produced_ / netascii_index::STRIDE, point);
+      }
+
+      *out++ = pending_[pending_pos_++];
+      ++produced_;
+    }
+
+    if (out == buf.end())
+      break;
+
+    pending_pos_ = pending_len_ = 0;
+    if (pos_ == len_)
+    {
+      if (eof_)
+        break;
+
+      input_offset_ += len_;
+      len_ = upstream_->pull(input_, err);
+      pos_ = 0;
+      if (err) [[unlikely]]
+        return 0;
+
+      if (len_ == 0)
+      {
+        eof_ = true;
+        if (carriage_return_)
+        {
+          carriage_return_ = false;
+          emit('\r', '\0');
+        }
+      }
+      continue;
+    }
+
+    const auto chr = input_[pos_++];
+    // Skip bare \0 bytes so as to not confuse \r\0 handling.
+    if (chr == '\0')
+      continue;
+
+    if (carriage_return_)
+    {
+      carriage_return_ = false;
+      if (chr == '\n')
+      {
+        emit('\r', '\n');
+        continue;
+      }
+
+      // Re-read chr once the held back carriage return is output.
+      --pos_;
+      emit('\r', '\0');
+      continue;
+    }
+
+    if (chr == '\r')
+      carriage_return_ = true;
+    else if (chr == '\n')
+      emit('\r', '\n');
+    else
+      pending_ = {chr}, pending_len_ = 1;
+  }
+
+  return static_cast<std::size_t>(out - buf.begin());
+}
+
+auto netascii::restore(const netascii_index::checkpoint &point) noexcept
+    -> void
+{
+  input_offset_ = point.input;
+  pos_ = len_ = 0;
+  pending_ = point.pending;
+  pending_pos_ = 0;
+  pending_len_ = point.pending_len;
+  carriage_return_ = point.carriage_return;
+  eof_ = false;
+}
+
+auto netascii::seek(std::uint64_t offset, std::error_code &err) -> bool
+{
+  err.clear();
+  auto point = netascii_index::checkpoint{};
+  auto found = std::size_t{0};
+  if (index_)
+  {
+    if (auto indexed = index_->find(offset / netascii_index::STRIDE, found))
+      point = *indexed;
+  }
+
+  if (!upstream_->seek(point.input, err))
+    return false;
+
+  restore(point);
+  produced_ = static_cast<std::uint64_t>(found) * netascii_index::STRIDE;
+
+  // Transcode forward from the checkpoint to offset.
+  auto scratch = std::array<char, BUFSIZE>();
+  while (produced_ < offset)
+  {
+    auto want = std::min<std::uint64_t>(scratch.size(), offset - produced_);
+    if (pull(std::span(scratch.data(), want), err) == 0 || err)
+      break;
+  }
+
+  if (!err && produced_ < offset)
+    err = std::make_error_code(std::errc::invalid_argument);
+
+  return !err;
+}
+
+#ifdef TFTP_ENABLE_ZSTD
+/** @brief The cached compressed frames. */
+struct compressed_frames {
+  /** @brief A cached frame. */
+  struct entry {
+    /** @brief The file status the frame was compressed from. */
+    storage::file_status status;
+    /** @brief The frame. */
+    std::shared_ptr<const compressor::frame> frame;
+    /** @brief The position of the entry in the LRU list. */
+    std::list<std::string>::iterator lru;
+  };
+
+  /** @brief Protects the members below. */
+  std::mutex mtx;
+  /** @brief The frames keyed by stream. */
+  std::unordered_map<std::string, entry> entries;
+  /** @brief Cached keys, most recently used first. */
+  std::list<std::string> lru;
+  /** @brief The number of cached compressed bytes. */
+  std::size_t bytes{0};
+  /** @brief Compression counters. */
+  compressor::counters stats;
+
+  /** @brief Gets a frame if it is cached for status. */
+  auto find(const std::string &key, const storage::file_status &status)
+      -> std::shared_ptr<const compressor::frame>
+  {
+    auto lock = std::lock_guard{mtx};
+    auto it = entries.find(key);
+    if (it == entries.end() || it->second.status.size != status.size ||
+        it->second.status.last_write != status.last_write)
+    {
+      return nullptr;
+    }
+
+    lru.splice(lru.begin(), lru, it->second.lru);
+    return it->second.frame;
+  }
+
+  /**
+   * @brief Caches a frame, evicting the least recently used frames.
+   * @details If the memory governor can not make room for the frame, any
+   * older frame of the stream is dropped instead.
+   */
+  auto insert(const std::string &key, const storage::file_status &status,
+              std::shared_ptr<const compressor::frame> frame) -> void
+  {
+    if (frame->size() > compressor::CACHE_CAPACITY)
+      return;
+
+    // Asked before locking, since the governor may shrink this cache.
+    auto fits = memory::make_room(frame->size());
+
+    auto lock = std::lock_guard{mtx};
+    if (auto it = entries.find(key); it != entries.end())
+    {
+      bytes -= it->second.frame->size();
+      lru.erase(it->second.lru);
+      entries.erase(it);
+    }
+
+    if (!fits)
+      return;
+
+    while (!lru.empty() && bytes + frame->size() > compressor::CACHE_CAPACITY)
+      evict();
+
+    lru.push_front(key);
+    bytes += frame->size();
+    entries.emplace(key, entry{.status = status,
+                               .frame = std::move(frame),
+                               .lru = lru.begin()});
+  }
+
+  /** @brief Evicts the least recently used frame. Requires mtx. */
+  auto evict() -> void
+  {
+    auto it = entries.find(lru.back());
+    bytes -= it->second.frame->size();
+    entries.erase(it);
+    lru.pop_back();
+  }
+};
+
+/** @brief Gets the process-wide compressed frames. */
+static auto frames() -> compressed_frames &
+{
+  static auto table = compressed_frames();
+  return table;
+}
+
+struct compressor::stream {
+  /** @brief Frees a compression context. */
+  struct free_context {
+    auto operator()(ZSTD_CCtx *ctx) const noexcept -> void
+    {
+      ZSTD_freeCCtx(ctx);
+    }
+  };
+
+  /** @brief The compression context. */
+  std::unique_ptr<ZSTD_CCtx, free_context> ctx{ZSTD_createCCtx()};
+  /** @brief Input pulled from upstream. */
+  std::vector<char> input = std::vector<char>(ZSTD_CStreamInSize());
+  /** @brief The offset of the next input byte to compress. */
+  std::size_t pos{0};
+  /** @brief The number of bytes in input. */
+  std::size_t len{0};
+  /** @brief The number of bytes pulled from upstream. */
+  std::uint64_t consumed{0};
+  /** @brief Set once upstream is exhausted. */
+  bool eof{false};
+  /** @brief Set if the compression failed for good. */
+  std::error_code failed;
+  /** @brief The compressed bytes produced so far. */
+  frame output;
+};
+
+compressor::compressor(std::unique_ptr<stage> upstream, std::string key,
+                       storage::file_status status,
+                       std::optional<std::uint64_t> length)
+    : upstream_{std::move(upstream)}, key_{std::move(key)},
+      status_{std::move(status)}, length_{length}
+{}
+
+compressor::~compressor() = default;
+
+auto compressor::load() -> void
+{
+  if (loaded_)
+    return;
+
+  loaded_ = true;
+  auto &table = frames();
+  if (!key_.empty() && (frame_ = table.find(key_, status_)))
+  {
+    table.stats.hits += 1;
+    return;
+  }
+
+  table.stats.misses += 1;
+  stream_ = std::make_unique<stream>();
+  auto *ctx = stream_->ctx.get();
+  if (!ctx ||
+      ZSTD_isError(ZSTD_CCtx_setParameter(ctx, ZSTD_c_compressionLevel,
+                                          LEVEL)) ||
+      (length_ && ZSTD_isError(ZSTD_CCtx_setPledgedSrcSize(ctx, *length_))))
+  {
+    stream_->failed = std::make_error_code(std::errc::not_enough_memory);
+  }
+}
+
+auto compressor::advance(std::error_code &err) -> bool
+{
+  // NETASCII at most doubles the size of the file.
+  constexpr auto MAX_STREAM = 2 * MAX_FILE_SIZE;
+
+  err.clear();
+  if (!stream_)
+    return false;
+
+  auto &current = *stream_;
+  // zstd holds output back until it has a block of input, so this reads
+  // upstream until a block is out or the frame ends.
+  for (const auto before = current.output.size();
+       current.output.size() == before && !current.failed;)
+  {
+    if (current.pos == current.len && !current.eof)
+    {
+      current.len = upstream_->pull(current.input, err);
+      current.pos = 0;
+      if (err)
+        return true;
+
+      current.eof = current.len == 0;
+      current.consumed += current.len;
+      if (current.consumed > MAX_STREAM)
+      {
+        current.failed = std::make_error_code(std::errc::file_too_large);
+        break;
+      }
+    }
+
+    auto in = ZSTD_inBuffer{.src = current.input.data(),
+                            .size = current.len,
+                            .pos = current.pos};
+    const auto used = current.output.size();
+    current.output.resize(used + ZSTD_CStreamOutSize());
+    auto out = ZSTD_outBuffer{.dst = current.output.data() + used,
+                              .size = ZSTD_CStreamOutSize(),
+                              .pos = 0};
+    auto remaining = ZSTD_compressStream2(
+        current.ctx.get(), &out, &in,
+        current.eof ? ZSTD_e_end : ZSTD_e_continue);
+    current.output.resize(used + out.pos);
+    current.pos = in.pos;
+    if (ZSTD_isError(remaining)) [[unlikely]]
+    {
+      current.failed = std::make_error_code(std::errc::io_error);
+      break;
+    }
+
+    if (current.eof && remaining == 0)
+    {
+      auto &table = frames();
+      table.stats.input += current.consumed;
+      table.stats.output += current.output.size();
+
+      current.output.shrink_to_fit();
+      frame_ = std::make_shared<const frame>(std::move(current.output));
+      stream_.reset();
+      if (!key_.empty())
+        table.insert(key_, status_, frame_);
+      return false;
+    }
+  }
+
+  err = current.failed;
+  return true;
+}
+
+auto compressor::produced() const noexcept -> std::string_view
+{
+  if (frame_)
+    return *frame_;
+  if (stream_)
+    return stream_->output;
+  return {};
+}
+
+auto compressor::pull(std::span<char> buf, std::error_code &err)
+    -> std::size_t
+{
+  err.clear();
+  load();
+  while (pos_ == produced().size())
+  {
+    auto more = advance(err);
+    if (err)
+      return 0;
+    if (!more)
+      break;
+  }
+
+  auto bytes = produced();
+  auto len = std::min<std::uint64_t>(buf.size(), bytes.size() - pos_);
+  std::memcpy(buf.data(), bytes.data() + pos_, len);
+  pos_ += len;
+  return len;
+}
+
+auto compressor::seek(std::uint64_t offset, std::error_code &err) -> bool
+{
+  err.clear();
+  load();
+  while (offset > produced().size())
+  {
+    auto more = advance(err);
+    if (err)
+      return false;
+    if (!more)
+      break;
+  }
+
+  if (offset > produced().size())
+  {
+    err = std::make_error_code(std::errc::invalid_argument);
+    return false;
+  }
+
+  pos_ = offset;
+  return true;
+}
+
+auto compressor::stats() noexcept -> counters & { return frames().stats; }
+
+auto compressor::cached_bytes() -> std::size_t
+{
+  auto &table = frames();
+  auto lock = std::lock_guard{table.mtx};
+  return table.bytes;
+}
+
+auto compressor::shrink(std::size_t bytes) -> std::size_t
+{
+  auto &table = frames();
+  auto lock = std::lock_guard{table.mtx};
+  const auto before = table.bytes;
+  while (!table.lru.empty() && before - table.bytes < bytes)
+    table.evict();
+
+  return before - table.bytes;
+}
+#endif // TFTP_ENABLE_ZSTD
+
+pipeline::pipeline(std::shared_ptr<storage::file> file)
+    : last_{std::make_unique<source>(std::move(file))}
+{}
+
+auto pipeline::push(const factory &make) -> pipeline &
+{
+  last_ = make(std::move(last_));
+  return *this;
+}
+
+auto pipeline::fill(std::span<char> buf, std::error_code &err) -> std::size_t
+{
+  auto total = std::size_t{0};
+  while (total < buf.size())
+  {
+    auto len = last_->pull(buf.subspan(total), err);
+    if (err || len == 0)
+      break;
+
+    total += len;
+  }
+  return total;
+}
+
+auto pipeline::seek(std::uint64_t offset, std::error_code &err) -> bool
+{
+  return last_->seek(offset, err);
+}
+
+auto make_pipeline(std::shared_ptr<storage::file> file, std::uint8_t mode,
+                   std::shared_ptr<netascii_index> index)
+    -> std::unique_ptr<pipeline>
+{
+  auto chain = std::make_unique<pipeline>(std::move(file));
+  if (mode == messages::NETASCII)
+  {
+    chain->push([&](std::unique_ptr<stage> upstream) {
+      return std::make_unique<netascii>(std::move(upstream), std::move(index));
+    });
+  }
+  return chain;
+}
+} // namespace tftp::transform
@@ -0,0 +1,268 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file watcher.cpp
+ * @brief This file implements the filesystem change watcher.
+ */
+#include "tftp/watcher.hpp"
+#include "tftp/filesystem.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+namespace tftp::filesystem {
+/** @brief The events that invalidate cached entries. */
+static constexpr std::uint32_t WATCH_MASK =
+    IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE |
+    IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+/** @brief How long the watcher thread waits for events between stop checks. */
+static constexpr int POLL_TIMEOUT_MS = 50;
+
+watcher::watcher(std::filesystem::path root,
+                 std::chrono::milliseconds interval)
+    : interval_(interval)
+{
+  auto err = std::error_code();
+  cwd_ = std::filesystem::current_path(err);
+  root_ = (root.is_absolute() ? root : cwd_ / root).lexically_normal();
+
+  // NOLINTNEXTLINE(cppcoreguidelines-prefer-member-initializer)
+  fd_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd_ < 0)
+    degrade({errno, std::system_category()});
+  else
+    add_tree(root_);
+
+  thread_ = std::jthread([this](const std::stop_token &token) { run(token); });
+}
+
+watcher::~watcher()
+{
+  thread_.request_stop();
+  if (thread_.joinable())
+    thread_.join();
+
+  if (fd_ >= 0)
+    (void)::close(fd_);
+}
+
+auto watcher::subscribe(callback func) -> void
+{
+  auto lock = std::lock_guard{mtx_};
+  subscribers_.push_back(std::move(func));
+}
+
+auto watcher::covers(const std::filesystem::path &path) const -> bool
+{
+  if (degraded())
+    return false;
+
+  return contains(root_,
+                  (path.is_absolute() ? path : cwd_ / path).lexically_normal());
+}
+
+auto watcher::aliased(const std::filesystem::path &path) -> bool
+{
+  auto err = std::error_code();
+  auto absolute =
+      (path.is_absolute() ? path : std::filesystem::current_path(err) / path)
+          .lexically_normal();
+  auto canonical = std::filesystem::weakly_canonical(absolute, err);
+
+  struct stat status{};
+  return err || canonical != absolute ||
+         ::stat(absolute.c_str(), &status) != 0 || status.st_nlink > 1;
+}
+
+auto watcher::degraded() const noexcept -> bool
+{
+  return degraded_.load(std::memory_order_acquire);
+}
+
+auto watcher::root() const noexcept -> const std::filesystem::path &
+{
+  return root_;
+}
+
+auto watcher::stats() noexcept -> counters & { return stats_; }
+
+auto watcher::add_tree(const std::filesystem::path &dir) -> void
+{
+  using std::filesystem::directory_options;
+  using std::filesystem::recursive_directory_iterator;
+
+  auto add = [&](const std::filesystem::path &path) {
+    auto wd = ::inotify_add_watch(fd_, path.c_str(), WATCH_MASK | IN_ONLYDIR);
+    if (wd < 0)
+    {
+      // Directories may vanish while they are being walked.
+      if (errno != ENOENT && errno != ENOTDIR && errno != EACCES)
+        degrade({errno, std::system_category()});
+      else if (path == root_)
+        degrade(std::make_error_code(std::errc::no_such_file_or_directory));
+      return false;
+    }
+
+    dirs_.insert_or_assign(wd, path);
+    return true;
+  };
+
+  if (!add(dir))
+    return;
+
+  auto err = std::error_code();
+  for (auto it = recursive_directory_iterator(
+           dir, directory_options::skip_permission_denied, err);
+       !err && it != recursive_directory_iterator(); it.increment(err))
+  {
+    if (it->is_directory(err) && !it->is_symlink(err) && !add(it->path()))
+    {
+      if (degraded())
+        return;
+    }
+  }
+}
+
+auto watcher::drain() -> void
+{
+  alignas(inotify_event) auto buf = std::array<char, 4096>();
+  while (true)
+  {
+    auto len = ::read(fd_, buf.data(), buf.size());
+    if (len <= 0)
+      return;
+
+    for (auto pos = std::size_t{0}; pos < static_cast<std::size_t>(len);)
+    {
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+      const auto *event = reinterpret_cast<const inotify_event *>(&buf[pos]);
+      pos += sizeof(inotify_event) + event->len;
+      ++stats_.events;
+
+      if (event->mask & IN_Q_OVERFLOW)
+      {
+        // Events were lost, so anything may have changed.
+        ++stats_.overflows;
+        notify(root_);
+        continue;
+      }
+
+      auto dir = dirs_.find(event->wd);
+      if (dir == dirs_.end())
+        continue;
+
+      if (event->mask & IN_IGNORED)
+      {
+        dirs_.erase(dir);
+        continue;
+      }
+
+      // Nothing below a deleted or moved root can be watched any more.
+      if ((event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) &&
+          dir->second == root_)
+      {
+        degrade(std::make_error_code(std::errc::no_such_file_or_directory));
+      }
+
+      auto path = event->len ? dir->second / event->name : dir->second;
+      if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && (event->mask & IN_ISDIR))
+        add_tree(path);
+
+      if (!(event->mask & (IN_DELETE | IN_MOVED_FROM | IN_DELETE_SELF)))
+        measure(path);
+
+      notify(path);
+    }
+  }
+}
+
+auto watcher::notify(const std::filesystem::path &path) -> void
+{
+  ++stats_.invalidations;
+  auto lock = std::lock_guard{mtx_};
+  for (const auto &subscriber : subscribers_)
+    subscriber(path);
+}
+
+auto watcher::measure(const std::filesystem::path &path) -> void
+{
+  using namespace std::chrono;
+
+  struct stat status{};
+  if (::lstat(path.c_str(), &status))
+    return;
+
+  // The later of mtime and ctime is when the change happened.
+  const auto &changed = std::max(status.st_mtim, status.st_ctim,
+                                 [](const auto &lhs, const auto &rhs) {
+                                   return lhs.tv_sec < rhs.tv_sec ||
+                                          (lhs.tv_sec == rhs.tv_sec &&
+                                           lhs.tv_nsec < rhs.tv_nsec);
+                                 });
+  auto at = system_clock::time_point(duration_cast<system_clock::duration>(
+      seconds(changed.tv_sec) + nanoseconds(changed.tv_nsec)));
+  auto latency = std::max<std::int64_t>(
+      duration_cast<microseconds>(system_clock::now() - at).count(), 0);
+
+  stats_.last_latency_us = latency;
+  stats_.total_latency_us += latency;
+  ++stats_.measured;
+  auto max = stats_.max_latency_us.load();
+  while (latency > max &&
+         !stats_.max_latency_us.compare_exchange_weak(max, latency))
+  {
+  }
+}
+
+auto watcher::degrade(const std::error_code &err) -> void
+{
+  if (!degraded_.exchange(true, std::memory_order_acq_rel))
+  {
+    spdlog::warn("Unable to watch {} for changes: {}. Falling back to "
+                 "periodic validation.",
+                 root_.c_str(), err.message());
+  }
+}
+
+auto watcher::run(const std::stop_token &token) -> void
+{
+  auto next = std::chrono::steady_clock::now() + interval_;
+  while (!token.stop_requested())
+  {
+    if (degraded())
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(POLL_TIMEOUT_MS));
+      if (auto now = std::chrono::steady_clock::now(); now >= next)
+      {
+        notify(root_);
+        next = now + interval_;
+      }
+      continue;
+    }
+
+    auto pfd = pollfd{.fd = fd_, .events = POLLIN, .revents = 0};
+    if (::poll(&pfd, 1, POLL_TIMEOUT_MS) > 0)
+      drain();
+  }
+}
+} // namespace tftp::filesystem
@@ -0,0 +1,63 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "tftp/detail/arena.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+using namespace tftp::detail;
+
+TEST(TestArena, AllocatesFromBuffer)
+{
+  auto scratch = arena();
+  auto str = std::pmr::string(100, 'a', scratch.resource());
+
+  EXPECT_TRUE(scratch.owns(str.data()));
+  EXPECT_FALSE(scratch.owns(&str));
+}
+
+TEST(TestArena, SpillsToHeap)
+{
+  auto scratch = arena();
+  auto vec = std::pmr::vector<char>(2 * arena::SIZE, 'a', scratch.resource());
+
+  EXPECT_FALSE(scratch.owns(vec.data()));
+  EXPECT_EQ(vec.back(), 'a');
+}
+
+TEST(TestArena, ReleaseRewinds)
+{
+  auto scratch = arena();
+  auto *first = scratch.resource()->allocate(64);
+  scratch.resource()->allocate(64);
+  scratch.release();
+
+  EXPECT_EQ(scratch.resource()->allocate(64), first);
+}
+
+TEST(TestArena, ScopeReleasesCurrentArena)
+{
+  void *first = nullptr;
+  {
+    auto event = arena::scope();
+    first = arena::current().resource()->allocate(64);
+  }
+
+  EXPECT_EQ(arena::current().resource()->allocate(64), first);
+  arena::current().release();
+}
@@ -0,0 +1,211 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+// NOLINTBEGIN
+#include "tftp/fec.hpp"
+#include "tftp/filesystem.hpp"
+#include "tftp/tftp.hpp"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace tftp;
+using enum messages::opcode_t;
+using enum messages::mode_t;
+static constexpr auto DATALEN = messages::DATALEN;
+
+static auto payload(std::size_t len, char fill) -> std::string
+{
+  auto text = std::string(len, fill);
+  for (std::size_t i = 0; i < len; ++i)
+    text[i] = static_cast<char>(fill + i % 13);
+  return text;
+}
+
+TEST(TestFec, RebuildsOneBlockPerGroup)
+{
+  auto blocks = std::vector<std::string>{
+      payload(DATALEN, 'a'), payload(DATALEN, 'k'), payload(100, 'z')};
+
+  auto encoder = fec::encoder();
+  encoder.reset(7);
+  for (const auto &block : blocks)
+    encoder.add(block);
+  ASSERT_EQ(encoder.size(), blocks.size());
+  auto packet = std::string(encoder.packet().begin(), encoder.packet().end());
+  ASSERT_EQ(packet.size(), fec::REPAIR_MSGLEN);
+
+  for (std::size_t lost = 0; lost < blocks.size(); ++lost)
+  {
+    auto decoder = fec::decoder();
+    for (std::size_t i = 0; i < blocks.size(); ++i)
+    {
+      if (i != lost)
+        decoder.data(static_cast<std::uint16_t>(7 + i), blocks[i]);
+    }
+
+    auto rebuilt = decoder.repair(packet);
+    ASSERT_TRUE(rebuilt) << "lost " << lost;
+    EXPECT_EQ(rebuilt->first, 7 + lost);
+    EXPECT_EQ(rebuilt->second, blocks[lost]);
+    ASSERT_NE(decoder.find(rebuilt->first), nullptr);
+  }
+
+  // Two losses in a group can not be repaired.
+  auto decoder = fec::decoder();
+  decoder.data(7, blocks[0]);
+  EXPECT_FALSE(decoder.repair(packet));
+}
+
+TEST(TestFec, ReleasesAcrossWraparound)
+{
+  auto decoder = fec::decoder();
+  for (std::uint16_t block : {65534, 65535, 0, 1, 2})
+    decoder.data(block, "x");
+
+  decoder.release(0);
+  EXPECT_EQ(decoder.find(65534), nullptr);
+  EXPECT_EQ(decoder.find(0), nullptr);
+  EXPECT_NE(decoder.find(1), nullptr);
+  EXPECT_NE(decoder.find(2), nullptr);
+}
+
+class TestFecTransfer : public ::testing::Test {
+protected:
+  sessions_t sessions;
+  std::filesystem::path path;
+
+  void TearDown() override
+  {
+    for (auto &[addr, sess] : sessions)
+    {
+      if (sess.state.transfer->file)
+        sess.state.transfer->file->close();
+    }
+    sessions.clear();
+    std::filesystem::remove(path);
+  }
+
+  /** @brief Counts of a simulated lossy transfer. */
+  struct result {
+    std::string received;
+    std::size_t windows{0};
+    std::size_t resends{0};
+    std::size_t rebuilt{0};
+  };
+
+  // Transfers a file over a link that drops packets with probability loss.
+  // The client rebuilds what it can and acks the last block it holds in
+  // order; a window that brings nothing new is resent by the server timer.
+  auto transfer(const std::string &content, std::uint16_t group, double loss)
+      -> result
+  {
+    path = filesystem::tmpname();
+    std::ofstream(path) << content;
+
+    auto siter = sessions.emplace(io::socket::socket_address<sockaddr_in6>(),
+                                  session{});
+    auto req = messages::request{
+        .opc = RRQ, .mode = OCTET, .filename = path.c_str(), .fec = group};
+    EXPECT_EQ(handle_request(req, siter), 0);
+    auto &state = siter->second.state;
+    EXPECT_TRUE(state.transfer->fec);
+    EXPECT_EQ(handle_ack({.opc = htons(ACK), .block_num = 0}, siter), 0);
+
+    auto rng = std::mt19937(42);
+    auto drop = std::bernoulli_distribution(loss);
+    auto decoder = fec::decoder();
+    auto next = std::uint16_t{1};
+    auto out = result{};
+    while (state.transfer->file->is_open())
+    {
+      const auto &window = *state.transfer->fec;
+      out.windows += 1;
+      auto begin = std::size_t{0};
+      for (auto end : window.ends)
+      {
+        auto packet = std::span(window.packets).subspan(begin, end - begin);
+        begin = end;
+        if (drop(rng))
+          continue;
+
+        auto header = messages::data{};
+        std::memcpy(&header, packet.data(), sizeof(header));
+        if (ntohs(header.opc) == DATA)
+          decoder.data(ntohs(header.block_num), packet.subspan(sizeof(header)));
+        else if (decoder.repair(packet))
+          out.rebuilt += 1;
+      }
+
+      auto last = false;
+      while (const auto *block = decoder.find(next))
+      {
+        out.received += *block;
+        last = block->size() < DATALEN;
+        next += 1;
+      }
+
+      const auto acked = static_cast<std::uint16_t>(next - 1);
+      decoder.release(acked);
+      auto sequence = window.sequence;
+      EXPECT_EQ(handle_ack({.opc = htons(ACK), .block_num = htons(acked)},
+                           siter),
+                0);
+      if (last)
+        break;
+
+      if (window.sequence == sequence)
+        out.resends += 1; // Timed out, so the same window is sent again.
+    }
+
+    EXPECT_FALSE(state.transfer->file->is_open());
+    return out;
+  }
+};
+
+TEST_F(TestFecTransfer, DeliversWithoutLoss)
+{
+  auto content = payload(40 * DATALEN + 17, 'a');
+  auto out = transfer(content, 8, 0.0);
+  EXPECT_EQ(out.received, content);
+  EXPECT_EQ(out.windows, 6);
+  EXPECT_EQ(out.resends, 0);
+}
+
+TEST_F(TestFecTransfer, RepairsSimulatedLoss)
+{
+  auto content = payload(2000 * DATALEN + 300, 'a');
+  auto out = transfer(content, 8, 0.03);
+  EXPECT_EQ(out.received, content);
+  EXPECT_GT(out.rebuilt, 0);
+
+  // Most lost blocks are rebuilt instead of costing a resent window.
+  EXPECT_LT(out.windows - (2000 / 8 + 1), out.rebuilt);
+}
+
+TEST_F(TestFecTransfer, ClampsTheGroupSize)
+{
+  auto content = payload(100, 'a');
+  auto out = transfer(content, 1000, 0.0);
+  EXPECT_EQ(out.received, content);
+  const auto &state = sessions.begin()->second.state;
+  EXPECT_EQ(state.transfer->fec->group, fec::MAX_GROUP);
+}
+// NOLINTEND
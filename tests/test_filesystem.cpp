@@ -17,10 +17,12 @@
 // NOLINTBEGIN
 #include "tftp/filesystem.hpp"
 
+#include <array>
 #include <cstdlib>
 #include <filesystem>
 #include <fstream>
 #include <gtest/gtest.h>
+#include <string>
 #include <system_error>
 
 using namespace tftp::filesystem;
@@ -120,6 +122,32 @@ TEST_F(TestFileSystem, MailDirectoryReturnsValidPath)
   EXPECT_TRUE(path.is_absolute());
 }
 
+TEST_F(TestFileSystem, InternSharesPaths)
+{
+  auto before = interned();
+  auto first = intern("boot/pxelinux.0");
+  auto second = intern(std::string("boot/") + "pxelinux.0");
+  auto other = intern("boot/ldlinux.c32");
+
+  EXPECT_EQ(first.get(), second.get());
+  EXPECT_NE(first.get(), other.get());
+  EXPECT_EQ(*first, std::filesystem::path("boot/pxelinux.0"));
+  EXPECT_EQ(interned(), before + 2);
+}
+
+TEST_F(TestFileSystem, InternReleasesUnusedPaths)
+{
+  auto before = interned();
+  auto first = intern("boot/vmlinuz");
+  first.reset();
+
+  EXPECT_EQ(interned(), before);
+
+  auto again = intern("boot/vmlinuz");
+  EXPECT_EQ(*again, std::filesystem::path("boot/vmlinuz"));
+  EXPECT_EQ(interned(), before + 1);
+}
+
 TEST_F(TestFileSystem, OpenReadOpensFileForReading)
 {
   const auto path = tmpname();
@@ -134,6 +162,118 @@ TEST_F(TestFileSystem, OpenReadOpensFileForReading)
   std::filesystem::remove(path);
 }
 
+TEST_F(TestFileSystem, OpenReadHandlesReadIndependently)
+{
+  const auto path = tmpname();
+  std::ofstream(path) << "0123456789";
+
+  std::error_code err;
+  auto first = open_read(path, err);
+  ASSERT_FALSE(err);
+  auto second = open_read(path, err);
+  ASSERT_FALSE(err);
+
+  auto buf = std::array<char, 4>();
+  EXPECT_EQ(first->read(buf, err), 4);
+  EXPECT_EQ(std::string_view(buf.data(), 4), "0123");
+
+  EXPECT_EQ(second->read(buf, err), 4);
+  EXPECT_EQ(std::string_view(buf.data(), 4), "0123");
+
+  first->close();
+  EXPECT_EQ(second->read(buf, err), 4);
+  EXPECT_EQ(std::string_view(buf.data(), 4), "4567");
+  EXPECT_EQ(second->read(buf, err), 2);
+  EXPECT_EQ(second->offset(), 10);
+
+  std::filesystem::remove(path);
+}
+
+TEST_F(TestFileSystem, OpenReadSeesReplacedFile)
+{
+  const auto path = tmpname();
+  std::ofstream(path) << "old";
+
+  std::error_code err;
+  auto first = open_read(path, err);
+  ASSERT_FALSE(err);
+
+  const auto replacement = tmpname();
+  std::ofstream(replacement) << "new!";
+  std::filesystem::rename(replacement, path);
+
+  auto second = open_read(path, err);
+  ASSERT_FALSE(err);
+
+  auto buf = std::array<char, 8>();
+  EXPECT_EQ(first->read(buf, err), 3);
+  EXPECT_EQ(std::string_view(buf.data(), 3), "old");
+  EXPECT_EQ(second->read(buf, err), 4);
+  EXPECT_EQ(std::string_view(buf.data(), 4), "new!");
+
+  std::filesystem::remove(path);
+}
+
+TEST_F(TestFileSystem, OpenReadZeroFillsHoles)
+{
+  constexpr auto MiB = 1024L * 1024;
+  const auto path = tmpname();
+  {
+    // 4 MiB with data at 1 MiB and at the end, and holes everywhere else.
+    auto stream = std::ofstream(path, std::ios::binary);
+    stream.seekp(MiB);
+    stream << "data";
+    stream.seekp(4 * MiB - 3);
+    stream << "end";
+  }
+
+  std::error_code err;
+  auto handle = open_read(path, err);
+  ASSERT_TRUE(handle);
+  ASSERT_EQ(handle->size(), 4 * MiB);
+
+  struct stat status{};
+  ::stat(path.c_str(), &status);
+  if (status.st_blocks * 512 >= status.st_size)
+  {
+    std::filesystem::remove(path);
+    GTEST_SKIP() << "The filesystem does not support sparse files.";
+  }
+
+  auto expected = std::string(4 * MiB, '\0');
+  expected.replace(MiB, 4, "data");
+  expected.replace(4 * MiB - 3, 3, "end");
+
+  // Reads that start, end and straddle holes and data all match.
+  for (auto [offset, len] : std::array<std::pair<long, long>, 6>{{
+           {0, 512},
+           {MiB - 2, 8},
+           {MiB + 1, 512},
+           {4 * MiB - 512, 512},
+           {4 * MiB - 2, 512},
+           {0, 4 * MiB + 10},
+       }})
+  {
+    auto buf = std::string(len, 'x');
+    auto read = handle->read_at(offset, buf, err);
+    ASSERT_FALSE(err);
+    auto want = expected.substr(offset, len);
+    ASSERT_EQ(read, want.size()) << offset;
+    EXPECT_EQ(buf.substr(0, read), want) << offset;
+  }
+
+  std::filesystem::remove(path);
+}
+
+TEST_F(TestFileSystem, OpenReadRejectsDirectories)
+{
+  std::error_code err;
+  auto handle = open_read(std::filesystem::temp_directory_path(), err);
+
+  EXPECT_FALSE(handle);
+  EXPECT_EQ(err, std::errc::permission_denied);
+}
+
 TEST_F(TestFileSystem, OpenReadReturnsErrorOnNonExistentFile)
 {
   const auto path = tmpname();
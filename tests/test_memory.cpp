@@ -0,0 +1,224 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// NOLINTBEGIN
+#include "tftp/memory.hpp"
+#include "tftp/storage/cached.hpp"
+#include "tftp/tftp.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+using namespace tftp;
+
+TEST(TestMemory, ReservationsChargeByCategory)
+{
+  auto governor = std::make_shared<memory::governor>(1024);
+  {
+    auto reservation = memory::reservation(governor);
+    reservation.add(memory::SESSIONS, 100);
+    reservation.add(memory::BUFFERS, 50);
+    reservation.add(memory::BUFFERS, 50);
+
+    auto usage = governor->usage();
+    EXPECT_EQ(usage.bytes[memory::SESSIONS], 100);
+    EXPECT_EQ(usage.bytes[memory::BUFFERS], 100);
+    EXPECT_EQ(usage.total, 200);
+    EXPECT_EQ(usage.ceiling, 1024);
+    EXPECT_EQ(reservation.bytes(), 200);
+
+    auto moved = std::move(reservation);
+    EXPECT_EQ(moved.bytes(), 200);
+    EXPECT_EQ(governor->usage().total, 200);
+
+    // Only what was added can be given back.
+    moved.remove(memory::BUFFERS, 30);
+    moved.remove(memory::SESSIONS, 1000);
+    EXPECT_EQ(moved.bytes(), 70);
+    EXPECT_EQ(governor->usage().bytes[memory::BUFFERS], 70);
+    EXPECT_EQ(governor->usage().total, 70);
+  }
+
+  EXPECT_EQ(governor->usage().total, 0);
+
+  // A reservation without a governor accounts nothing.
+  auto detached = memory::reservation();
+  detached.add(memory::SESSIONS, 100);
+  EXPECT_EQ(detached.bytes(), 0);
+}
+
+TEST(TestMemory, ShrinksCachesBeforeRefusing)
+{
+  auto governor = std::make_shared<memory::governor>(1000);
+  auto cached = std::size_t{600};
+  governor->reclaimable(
+      memory::CACHE, [&] { return cached; },
+      [&](std::size_t bytes) {
+        auto freed = std::min(bytes, cached);
+        cached -= freed;
+        return freed;
+      });
+
+  auto sessions = std::vector<memory::reservation>();
+  auto open = [&] {
+    if (!governor->admit(300))
+      return false;
+
+    sessions.emplace_back(governor).add(memory::SESSIONS, 300);
+    return true;
+  };
+
+  // 600 + 300 fits below the ceiling.
+  EXPECT_TRUE(open());
+  EXPECT_EQ(cached, 600);
+
+  // The cache gives up exactly what the next session needs.
+  EXPECT_TRUE(open());
+  EXPECT_EQ(cached, 400);
+  EXPECT_TRUE(open());
+  EXPECT_EQ(cached, 100);
+  EXPECT_EQ(governor->usage().bytes[memory::CACHE], 100);
+
+  // Once the cache is empty, sessions are refused.
+  EXPECT_FALSE(open());
+  EXPECT_EQ(cached, 0);
+  EXPECT_EQ(governor->usage().total, 900);
+
+  auto &stats = governor->stats();
+  EXPECT_EQ(stats.admitted, 3);
+  EXPECT_EQ(stats.refused, 1);
+  EXPECT_EQ(stats.shrinks, 3);
+  EXPECT_EQ(stats.reclaimed, 600);
+
+  // Closing a session makes room again.
+  sessions.pop_back();
+  EXPECT_TRUE(open());
+}
+
+TEST(TestMemory, CachesMakeRoomBeforeGrowing)
+{
+  auto governor = std::make_shared<memory::governor>(1000);
+  auto cached = std::size_t{600};
+  governor->reclaimable(
+      memory::CACHE, [&] { return cached; },
+      [&](std::size_t bytes) {
+        auto freed = std::min(bytes, cached);
+        cached -= freed;
+        return freed;
+      });
+
+  auto session = memory::reservation(governor);
+  session.add(memory::SESSIONS, 300);
+
+  // 900 + 200 only fits once 100 bytes are evicted.
+  EXPECT_TRUE(governor->make_room(200));
+  EXPECT_EQ(cached, 500);
+
+  // Growth that can not fit is declined, not charged.
+  EXPECT_FALSE(governor->make_room(1000));
+  EXPECT_EQ(cached, 0);
+  EXPECT_EQ(governor->stats().declined, 1);
+  EXPECT_EQ(governor->stats().refused, 0);
+
+  // The content cache asks before it loads a file.
+  auto files = std::make_shared<storage::memory>();
+  files->insert("boot/kernel", storage::memory::contents(4096, 'k'));
+  auto cache = std::make_shared<storage::cached>(files);
+  auto previous = memory::install(governor);
+
+  auto err = std::error_code();
+  EXPECT_FALSE(cache->warm("boot/kernel", err));
+  EXPECT_FALSE(err);
+  EXPECT_EQ(cache->bytes(), 0);
+  EXPECT_EQ(governor->stats().declined, 2);
+
+  memory::install(std::move(previous));
+  EXPECT_TRUE(cache->warm("boot/kernel", err));
+  EXPECT_EQ(cache->bytes(), 4096);
+}
+
+TEST(TestMemory, RequestsPastTheCeilingAreRefused)
+{
+  using enum messages::opcode_t;
+  using enum messages::mode_t;
+
+  // Every block of the kernel differs, so none are shared in the cache.
+  auto kernel = storage::memory::contents(64 * 1024);
+  for (std::size_t i = 0; i < kernel.size(); ++i)
+    kernel[i] = static_cast<char>(i % 251);
+
+  auto files = std::make_shared<storage::memory>();
+  files->insert("boot/kernel", std::move(kernel));
+  files->insert("boot/pxelinux.0", storage::memory::contents(1024, 'p'));
+  auto cache = std::make_shared<storage::cached>(files);
+  auto previous_backend = storage::install(cache);
+
+  auto err = std::error_code();
+  ASSERT_TRUE(cache->warm("boot/kernel", err));
+  ASSERT_EQ(cache->bytes(), 64 * 1024);
+
+  // Room for the cached kernel and a few sessions.
+  constexpr auto SESSION_BYTES = 4 * 1024;
+  auto governor =
+      std::make_shared<memory::governor>(64 * 1024 + 4 * SESSION_BYTES);
+  governor->reclaimable(
+      memory::CACHE, [&] { return cache->bytes(); },
+      [&](std::size_t bytes) { return cache->shrink(bytes); });
+  auto previous_governor = memory::install(governor);
+
+  auto sessions = sessions_t();
+  auto addr = io::socket::socket_address<sockaddr_in6>();
+  auto request = messages::request{
+      .opc = RRQ, .mode = OCTET, .filename = "boot/pxelinux.0"};
+
+  // Drive the server past its ceiling: the cache is evicted first, then
+  // new sessions are refused.
+  auto admitted = std::size_t{0};
+  auto result = std::uint16_t{0};
+  while (admitted < 1000)
+  {
+    auto siter = sessions.emplace(addr, session{});
+    result = handle_request(request, siter);
+    if (result)
+    {
+      sessions.erase(siter);
+      break;
+    }
+    ++admitted;
+  }
+
+  EXPECT_EQ(result, messages::BUSY);
+  EXPECT_GT(admitted, 4);
+  EXPECT_EQ(cache->bytes(), 0);
+  EXPECT_GE(cache->stats().evictions, 1);
+
+  auto usage = governor->usage();
+  EXPECT_LE(usage.total, usage.ceiling);
+  EXPECT_GT(usage.bytes[memory::SESSIONS], 0);
+  EXPECT_GT(usage.bytes[memory::BUFFERS], 0);
+  EXPECT_EQ(governor->stats().refused, 1);
+  EXPECT_EQ(governor->stats().admitted, admitted);
+
+  // Finished sessions give their memory back.
+  sessions.clear();
+  EXPECT_EQ(governor->usage().total, 0);
+
+  memory::install(std::move(previous_governor));
+  storage::install(std::move(previous_backend));
+}
+// NOLINTEND
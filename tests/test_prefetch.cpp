@@ -0,0 +1,124 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+// NOLINTBEGIN
+#include "tftp/prefetch.hpp"
+
+#include <gtest/gtest.h>
+
+#include <format>
+#include <string>
+#include <vector>
+
+using namespace tftp;
+using namespace std::chrono_literals;
+
+class TestPredictor : public ::testing::Test {
+protected:
+  void SetUp() override
+  {
+    predictor = std::make_unique<prefetch::predictor>(
+        [&](const std::filesystem::path &path) {
+          prefetched.push_back(path.string());
+        });
+  }
+
+  /** @brief Boots a client through a chain of files. */
+  auto boot(std::string_view client, std::vector<std::string> chain) -> void
+  {
+    for (const auto &file : chain)
+    {
+      predictor->observe(client, file, now);
+      now += 1s;
+    }
+    now += prefetch::predictor::DEFAULT_CHAIN_GAP * 2;
+  }
+
+  std::unique_ptr<prefetch::predictor> predictor;
+  std::vector<std::string> prefetched;
+  prefetch::predictor::clock::time_point now{};
+};
+
+TEST_F(TestPredictor, LearnsBootChains)
+{
+  auto chain = std::vector<std::string>{"pxelinux.0", "ldlinux.c32",
+                                        "pxelinux.cfg/default", "vmlinuz"};
+  boot("client-a", chain);
+  EXPECT_TRUE(prefetched.empty());
+
+  boot("client-b", chain);
+  EXPECT_EQ(predictor->predict("pxelinux.0", "pxelinux.0"),
+            std::vector<std::string>{"ldlinux.c32"});
+
+  prefetched.clear();
+  auto next = predictor->observe("client-c", "pxelinux.0", now);
+  EXPECT_EQ(next, std::vector<std::string>{"ldlinux.c32"});
+  EXPECT_EQ(prefetched, next);
+
+  predictor->observe("client-c", "ldlinux.c32", now + 1s);
+  EXPECT_EQ(prefetched.back(), "pxelinux.cfg/default");
+  EXPECT_EQ(predictor->stats().hits, 1);
+}
+
+TEST_F(TestPredictor, SeparatesClientClasses)
+{
+  boot("bios-a", {"pxelinux.0", "ldlinux.c32"});
+  boot("bios-b", {"pxelinux.0", "ldlinux.c32"});
+  boot("uefi-a", {"grubx64.efi", "grub/grub.cfg"});
+  boot("uefi-b", {"grubx64.efi", "grub/grub.cfg"});
+
+  EXPECT_EQ(predictor->predict("grubx64.efi", "grubx64.efi"),
+            std::vector<std::string>{"grub/grub.cfg"});
+  EXPECT_TRUE(predictor->predict("grubx64.efi", "pxelinux.0").empty());
+}
+
+TEST_F(TestPredictor, IgnoresRareSuccessors)
+{
+  for (int i = 0; i < 8; ++i)
+    boot("client", {"pxelinux.0", "ldlinux.c32"});
+  boot("client", {"pxelinux.0", "memtest"});
+  boot("client", {"pxelinux.0", "memtest"});
+
+  // memtest was seen twice, but only in 2 of 10 chains.
+  EXPECT_EQ(predictor->predict("pxelinux.0", "pxelinux.0"),
+            std::vector<std::string>{"ldlinux.c32"});
+}
+
+TEST_F(TestPredictor, IdleClientsStartANewChain)
+{
+  predictor->observe("client", "pxelinux.0", now);
+  predictor->observe("client", "pxelinux.0", now + 1s);
+  predictor->observe("client", "ldlinux.c32",
+                     now + prefetch::predictor::DEFAULT_CHAIN_GAP * 2);
+
+  // The retransmitted request and the late request are not transitions.
+  EXPECT_TRUE(predictor->predict("pxelinux.0", "pxelinux.0").empty());
+  EXPECT_EQ(predictor->stats().observed, 3);
+}
+
+TEST_F(TestPredictor, ForgetsTheLeastRecentlySeenClient)
+{
+  for (int round = 0; round < 2; ++round)
+  {
+    predictor->observe("client", "pxelinux.0", now);
+    for (std::size_t i = 0; i < prefetch::predictor::MAX_TRACKED; ++i)
+      predictor->observe(std::format("other-{}", i), "bootx64.efi", now);
+    predictor->observe("client", "ldlinux.c32", now);
+  }
+
+  // The client was forgotten before its second request each round.
+  EXPECT_TRUE(predictor->predict("pxelinux.0", "pxelinux.0").empty());
+}
+// NOLINTEND
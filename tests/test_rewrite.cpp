@@ -0,0 +1,172 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+// NOLINTBEGIN
+#include "tftp/rewrite.hpp"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+using namespace tftp;
+
+static auto compile(std::string_view text) -> std::shared_ptr<rewrite::rules>
+{
+  auto err = std::error_code();
+  auto rules = rewrite::rules::compile(text, err);
+  EXPECT_FALSE(err);
+  return rules;
+}
+
+TEST(TestRewrite, FoldsLegacySpellings)
+{
+  auto rules = compile("slashes\n"
+                       "lowercase\n");
+  auto who = rewrite::client{};
+
+  EXPECT_EQ(rules->apply("BOOT\\PXELINUX.0", who), "boot/pxelinux.0");
+  EXPECT_EQ(rules->size(), 2);
+}
+
+TEST(TestRewrite, AppliesTheLongestPrefix)
+{
+  auto rules = compile("# strip legacy roots\n"
+                       "lowercase\n"
+                       "prefix /TFTPBOOT/ -\n"
+                       "prefix /tftpboot/hosts/ hosts/{ip}/\n"
+                       "prefix /tftpboot/old/ /tftpboot/new/\n");
+  auto who = rewrite::client{.ip = "192.0.2.10"};
+
+  EXPECT_EQ(rules->apply("/tftpboot/pxelinux.0", who), "pxelinux.0");
+  EXPECT_EQ(rules->apply("/tftpboot/hosts/grub.cfg", who),
+            "hosts/192.0.2.10/grub.cfg");
+  EXPECT_EQ(rules->apply("/tftpboot/old/x", who), "/tftpboot/new/x");
+  EXPECT_EQ(rules->apply("/srv/pxelinux.0", who), "/srv/pxelinux.0");
+}
+
+TEST(TestRewrite, SubstitutesCapturesAndClientAddresses)
+{
+  auto rules = compile(
+      "regex pxelinux\\.cfg/01-([0-9a-f-]+) configs/$1.cfg\n"
+      "regex pxelinux\\.cfg/default configs/{mac}.cfg\n"
+      "regex .*\\.efi efi/{ip}/$&\n"
+      "regex (.*) fallback/$1\n");
+  auto who = rewrite::client{.ip = "192.0.2.10", .mac = "01-aa-bb-cc-dd-ee-ff"};
+
+  EXPECT_TRUE(rules->needs_mac());
+  EXPECT_EQ(rules->apply("pxelinux.cfg/01-00-11-22-33-44-55", who),
+            "configs/00-11-22-33-44-55.cfg");
+  EXPECT_EQ(rules->apply("pxelinux.cfg/default", who),
+            "configs/01-aa-bb-cc-dd-ee-ff.cfg");
+  EXPECT_EQ(rules->apply("grubx64.efi", who), "efi/192.0.2.10/grubx64.efi");
+
+  // Rules apply in file order, even when a later rule has a longer literal.
+  EXPECT_EQ(rules->apply("vmlinuz", who), "fallback/vmlinuz");
+}
+
+TEST(TestRewrite, ScalesToThousandsOfRules)
+{
+  auto text = std::string();
+  for (int i = 0; i < 2000; ++i)
+  {
+    text += "prefix hosts/" + std::to_string(i) + "/ h" + std::to_string(i) +
+            "/\n";
+    text += "regex images/" + std::to_string(i) + "/v([0-9]+)\\.img i" +
+            std::to_string(i) + "-$1\n";
+  }
+  auto rules = compile(text);
+  auto who = rewrite::client{};
+
+  EXPECT_EQ(rules->size(), 4000);
+  EXPECT_EQ(rules->apply("hosts/1234/pxelinux.cfg", who),
+            "h1234/pxelinux.cfg");
+  EXPECT_EQ(rules->apply("images/1234/v7.img", who), "i1234-7");
+  EXPECT_EQ(rules->apply("images/1234/latest", who), "images/1234/latest");
+}
+
+TEST(TestRewrite, FiltersPatternsByRequiredLiterals)
+{
+  auto rules = compile("regex .*abcd.* first\n"
+                       "regex .*\\.efi efi/$&\n"
+                       "regex (.*)-x64(\\..*) $1$2\n"
+                       "regex .*bc.* second\n"
+                       "regex (boot)?loader\\.(\\d+) loader-$2\n"
+                       "regex x|y either\n"
+                       "regex (.*) fallback/$1\n");
+  auto who = rewrite::client{};
+
+  EXPECT_EQ(rules->apply("grub-x64.efi", who), "efi/grub-x64.efi");
+  EXPECT_EQ(rules->apply("shim-x64.bin", who), "shim.bin");
+  EXPECT_EQ(rules->apply("a.efi.efi", who), "efi/a.efi.efi");
+  EXPECT_EQ(rules->apply("zabcdz", who), "first");
+  EXPECT_EQ(rules->apply("zabcez", who), "second");
+  EXPECT_EQ(rules->apply("bootloader.3", who), "loader-3");
+  EXPECT_EQ(rules->apply("loader.12", who), "loader-12");
+  EXPECT_EQ(rules->apply("y", who), "either");
+  EXPECT_EQ(rules->apply("pxe", who), "fallback/pxe");
+}
+
+TEST(TestRewrite, Benchmark_ThousandsOfUnanchoredRules)
+{
+  constexpr auto RULES = 5000;
+  constexpr auto LOOKUPS = 2000;
+
+  auto text = std::string();
+  for (int i = 0; i < RULES; ++i)
+  {
+    auto id = std::to_string(i);
+    text += "regex .*/node-" + id + "\\.img n" + id + "\n";
+  }
+  auto rules = compile(text);
+  auto who = rewrite::client{};
+  ASSERT_EQ(rules->apply("images/node-4321.img", who), "n4321");
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < LOOKUPS; ++i)
+  {
+    auto name = "images/node-" + std::to_string(i * 7 % RULES) + ".img";
+    EXPECT_EQ(std::string_view(rules->apply(name, who)),
+              "n" + std::to_string(i * 7 % RULES));
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  auto per_lookup =
+      std::chrono::duration_cast<std::chrono::microseconds>(elapsed) /
+      LOOKUPS;
+
+  std::cout << RULES << " unanchored rules: " << per_lookup.count()
+            << " us per lookup\n";
+  // Trying every pattern costs milliseconds per lookup at this size.
+  EXPECT_LT(per_lookup, std::chrono::microseconds(500));
+}
+
+TEST(TestRewrite, ReportsMalformedRules)
+{
+  auto err = std::error_code();
+  auto line = std::size_t{0};
+  EXPECT_FALSE(
+      rewrite::rules::compile("lowercase\nprefix only-one\n", err, &line));
+  EXPECT_EQ(err, std::errc::invalid_argument);
+  EXPECT_EQ(line, 2);
+
+  EXPECT_FALSE(rewrite::rules::compile("regex ([a-z] x\n", err, &line));
+  EXPECT_EQ(line, 1);
+
+  EXPECT_FALSE(rewrite::rules::compile("unknown\n", err, &line));
+  EXPECT_FALSE(rewrite::rules::load("/nonexistent/rules", err));
+  EXPECT_EQ(err, std::errc::no_such_file_or_directory);
+}
+// NOLINTEND
@@ -18,12 +18,18 @@
 #ifndef TFTP_TEST_SERVER_FIXTURE_HPP
 #define TFTP_TEST_SERVER_FIXTURE_HPP
 #include "tftp/protocol/tftp_protocol.hpp"
+#include "tftp/storage/memory.hpp"
 #include "tftp/tftp_server.hpp"
 
 #include <gtest/gtest.h>
 
+#include <cstdlib>
 #include <filesystem>
 #include <format>
+#include <fstream>
+#include <iterator>
+#include <span>
+#include <string_view>
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -40,6 +46,14 @@ protected:
     using enum messages::opcode_t;
     using enum net::service::async_context::context_states;
 
+    // TFTP_TEST_STORAGE=memory runs the server against the memory backend.
+    if (const char *backend = std::getenv("TFTP_TEST_STORAGE");
+        backend && std::string_view(backend) == "memory")
+    {
+      memory = std::make_shared<storage::memory>();
+      previous_backend = storage::install(memory);
+    }
+
     addr_v4->sin_family = AF_INET;
     unsigned short port = std::rand() % (UINT16_MAX - 6000) + 6000;
     addr_v4->sin_port = htons(port);
@@ -90,6 +104,38 @@ protected:
     ASSERT_EQ(server_->state, STARTED);
   }
 
+  auto TearDown() noexcept -> void override
+  {
+    if (memory)
+      storage::install(previous_backend);
+  }
+
+  /** @brief Writes the test file to the backend under test. */
+  auto write_test_file(std::span<const char> data) -> void
+  {
+    auto outf = std::ofstream(test_file);
+    outf.write(data.data(), data.size());
+
+    if (memory)
+      memory->insert(test_file, {data.begin(), data.end()});
+  }
+
+  /** @brief Reads the test file from the backend under test. */
+  auto read_test_file() -> std::vector<char>
+  {
+    if (memory)
+    {
+      auto bytes = memory->find(test_file);
+      return bytes ? *bytes : std::vector<char>();
+    }
+
+    auto inf = std::ifstream(test_file);
+    return {std::istreambuf_iterator<char>(inf),
+            std::istreambuf_iterator<char>()};
+  }
+
+  std::shared_ptr<storage::memory> memory;
+  std::shared_ptr<storage::backend> previous_backend;
   io::socket::socket_address<sockaddr_in> addr_v4;
   std::unique_ptr<tftp_server> server_;
   std::filesystem::path test_file;
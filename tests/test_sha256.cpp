@@ -0,0 +1,68 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "tftp/detail/sha256.hpp"
+
+#include <gtest/gtest.h>
+
+#include <format>
+#include <string>
+#include <string_view>
+
+using namespace tftp::detail;
+
+static auto digest(std::string_view str) -> std::string
+{
+  auto sha = sha256();
+  sha.update(str);
+  auto hex = std::string();
+  for (auto byte : sha.value())
+    hex += std::format("{:02x}", static_cast<unsigned>(byte));
+  return hex;
+}
+
+TEST(TestSha256, MatchesKnownValues)
+{
+  EXPECT_EQ(digest(""), "e3b0c44298fc1c149afbf4c8996fb924"
+                        "27ae41e4649b934ca495991b7852b855");
+  EXPECT_EQ(digest("abc"), "ba7816bf8f01cfea414140de5dae2223"
+                           "b00361a396177a9cb410ff61f20015ad");
+  EXPECT_EQ(digest("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"),
+            "248d6a61d20638b8e5c026930c3e6039"
+            "a33ce45964ff2167f6ecedd419db06c1");
+  EXPECT_EQ(digest(std::string(1000000, 'a')),
+            "cdc76e5c9914fb9281a1c7e284d73e67"
+            "f1809a48a497200e046d39ccc7112cd0");
+}
+
+TEST(TestSha256, UpdatesIncrementally)
+{
+  auto data = std::string();
+  for (int i = 0; i < 1000; ++i)
+    data.push_back(static_cast<char>(i * 7));
+
+  auto sha = sha256();
+  for (std::size_t pos = 0; pos < data.size(); pos += 13)
+  {
+    sha.update(std::string_view(data).substr(pos, 13));
+
+    // Reading the digest does not disturb later updates.
+    [[maybe_unused]] auto partial = sha.value();
+  }
+
+  auto whole = sha256();
+  whole.update(data);
+  EXPECT_EQ(sha.value(), whole.value());
+}
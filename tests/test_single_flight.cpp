@@ -0,0 +1,98 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// NOLINTBEGIN
+#include "tftp/detail/single_flight.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <latch>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace tftp::detail;
+
+TEST(SingleFlightTest, RunsOperationOnce)
+{
+  auto flights = single_flight<std::string, int>();
+  auto calls = std::atomic<int>(0);
+
+  EXPECT_EQ(flights("a", [&] { return ++calls; }), 1);
+  EXPECT_EQ(flights.in_flight(), 0);
+  // Completed flights are not remembered.
+  EXPECT_EQ(flights("a", [&] { return ++calls; }), 2);
+}
+
+TEST(SingleFlightTest, CoalescesConcurrentCalls)
+{
+  constexpr auto THREADS = 8;
+  auto flights = single_flight<std::string, int>();
+  auto calls = std::atomic<int>(0);
+  auto leader_started = std::latch(1);
+  auto followers_waiting = std::latch(THREADS);
+  auto results = std::vector<int>(THREADS + 1);
+
+  auto leader = std::thread([&] {
+    results[0] = flights("kernel", [&] {
+      leader_started.count_down();
+      followers_waiting.wait();
+      // Give the followers time to block on the shared result.
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      return ++calls;
+    });
+  });
+
+  leader_started.wait();
+  auto followers = std::vector<std::thread>();
+  for (int i = 1; i <= THREADS; ++i)
+  {
+    followers.emplace_back([&, i] {
+      followers_waiting.count_down();
+      results[i] = flights("kernel", [&] { return ++calls; });
+    });
+  }
+
+  leader.join();
+  for (auto &follower : followers)
+    follower.join();
+
+  EXPECT_EQ(calls, 1);
+  for (auto result : results)
+    EXPECT_EQ(result, 1);
+}
+
+TEST(SingleFlightTest, DistinctKeysDoNotCoalesce)
+{
+  auto flights = single_flight<std::string, std::string>();
+
+  EXPECT_EQ(flights("a", [] { return std::string("a"); }), "a");
+  EXPECT_EQ(flights("b", [] { return std::string("b"); }), "b");
+}
+
+TEST(SingleFlightTest, PropagatesExceptions)
+{
+  auto flights = single_flight<std::string, int>();
+
+  EXPECT_THROW(
+      flights("a", []() -> int { throw std::runtime_error("failed"); }),
+      std::runtime_error);
+  EXPECT_EQ(flights.in_flight(), 0);
+  EXPECT_EQ(flights("a", [] { return 1; }), 1);
+}
+// NOLINTEND
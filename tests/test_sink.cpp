@@ -0,0 +1,353 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+// NOLINTBEGIN
+#include "tftp/memory.hpp"
+#include "tftp/sink.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace tftp;
+
+/** @brief Records what an upload delivered. */
+struct record {
+  std::mutex mtx;
+  std::string contents;
+  bool committed = false;
+  bool aborted = false;
+};
+
+class collector : public sink::consumer {
+public:
+  explicit collector(std::shared_ptr<record> rec,
+                     std::shared_future<void> gate = {},
+                     bool fail = false)
+      : rec_{std::move(rec)}, gate_{std::move(gate)}, fail_{fail}
+  {}
+
+  auto write(std::span<const char> buf, std::error_code &err) -> void override
+  {
+    if (gate_.valid())
+      gate_.wait();
+
+    if (fail_)
+    {
+      err = std::make_error_code(std::errc::io_error);
+      return;
+    }
+
+    auto lock = std::lock_guard{rec_->mtx};
+    rec_->contents.append(buf.data(), buf.size());
+  }
+
+  auto commit(std::error_code &err) -> void override
+  {
+    auto lock = std::lock_guard{rec_->mtx};
+    rec_->committed = true;
+  }
+
+  auto abort() noexcept -> void override
+  {
+    auto lock = std::lock_guard{rec_->mtx};
+    rec_->aborted = true;
+  }
+
+private:
+  std::shared_ptr<record> rec_;
+  std::shared_future<void> gate_;
+  bool fail_;
+};
+
+static auto settle(storage::file &file, std::error_code &err) -> bool
+{
+  for (int i = 0; i < 1000; ++i)
+  {
+    if (!file.busy(err))
+      return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return false;
+}
+
+TEST(TestSink, RoutesByLongestPrefix)
+{
+  auto dumps = std::make_shared<record>();
+  auto cores = std::make_shared<record>();
+  auto sinks = sink::registry();
+  sinks.add("dumps", [&](const auto &) {
+    return std::make_unique<collector>(dumps);
+  });
+  sinks.add("dumps/core/", [&](const auto &) {
+    return std::make_unique<collector>(cores);
+  });
+  sinks.add("refused", [](const auto &) {
+    return std::unique_ptr<sink::consumer>();
+  });
+  EXPECT_EQ(sinks.size(), 3);
+
+  auto err = std::error_code();
+  auto file = sinks.open("dumps/core/node1", err);
+  ASSERT_TRUE(file);
+  file->append(std::string_view("core"), err);
+  file->commit(err);
+  ASSERT_TRUE(settle(*file, err));
+  EXPECT_EQ(cores->contents, "core");
+  EXPECT_TRUE(dumps->contents.empty());
+
+  EXPECT_TRUE(sinks.open("dumps/./node2", err));
+  EXPECT_FALSE(sinks.open("dumpster/node3", err));
+  EXPECT_FALSE(err);
+
+  EXPECT_FALSE(sinks.open("refused/node4", err));
+  EXPECT_EQ(err, std::errc::permission_denied);
+  EXPECT_EQ(sinks.stats().uploads, 2);
+}
+
+TEST(TestSink, DeliversPayloadsInOrder)
+{
+  auto rec = std::make_shared<record>();
+  auto sinks = sink::registry();
+  sinks.add("upload", [&](const auto &) {
+    return std::make_unique<collector>(rec);
+  });
+
+  auto err = std::error_code();
+  auto file = sinks.open("upload/image.bin", err);
+  ASSERT_TRUE(file);
+  EXPECT_TRUE(file->is_open());
+
+  auto expected = std::string();
+  for (int i = 0; i < 100; ++i)
+  {
+    auto block = std::string(512, static_cast<char>('a' + i % 26));
+    file->append(block, err);
+    ASSERT_FALSE(err);
+    expected += block;
+  }
+  file->commit(err);
+  ASSERT_FALSE(err);
+  EXPECT_FALSE(file->is_open());
+  EXPECT_EQ(file->size(), expected.size());
+
+  ASSERT_TRUE(settle(*file, err));
+  EXPECT_FALSE(err);
+  EXPECT_EQ(rec->contents, expected);
+  EXPECT_TRUE(rec->committed);
+  EXPECT_FALSE(rec->aborted);
+  EXPECT_EQ(sinks.stats().bytes, expected.size());
+
+  // Closing after the commit leaves the upload alone.
+  file->close();
+  EXPECT_FALSE(rec->aborted);
+}
+
+TEST(TestSink, IsBusyWhileConsumerIsBehind)
+{
+  auto rec = std::make_shared<record>();
+  auto release = std::promise<void>();
+  auto gate = release.get_future().share();
+  auto sinks = sink::registry();
+  sinks.add(
+      "slow",
+      [&](const auto &) { return std::make_unique<collector>(rec, gate); },
+      1024);
+
+  auto err = std::error_code();
+  auto file = sinks.open("slow/capture", err);
+  ASSERT_TRUE(file);
+
+  auto block = std::string(512, 'x');
+  file->append(block, err);
+  file->append(block, err);
+  EXPECT_FALSE(file->busy(err));
+
+  file->append(block, err);
+  EXPECT_TRUE(file->busy(err));
+  EXPECT_FALSE(err);
+  EXPECT_EQ(sinks.stats().stalls, 1);
+
+  release.set_value();
+  ASSERT_TRUE(settle(*file, err));
+  EXPECT_EQ(rec->contents.size(), 3 * block.size());
+
+  // The final ACK waits for the consumer to commit.
+  file->commit(err);
+  ASSERT_TRUE(settle(*file, err));
+  EXPECT_TRUE(rec->committed);
+}
+
+TEST(TestSink, ChargesQueuedBytes)
+{
+  auto rec = std::make_shared<record>();
+  auto release = std::promise<void>();
+  auto gate = release.get_future().share();
+  auto sinks = sink::registry();
+  sinks.add("slow", [&](const auto &) {
+    return std::make_unique<collector>(rec, gate);
+  });
+
+  auto governor = std::make_shared<memory::governor>(1024 * 1024);
+  auto previous = memory::install(governor);
+  auto err = std::error_code();
+  auto file = sinks.open("slow/capture", err);
+  memory::install(std::move(previous));
+  ASSERT_TRUE(file);
+
+  auto block = std::string(512, 'x');
+  file->append(block, err);
+  file->append(block, err);
+  EXPECT_EQ(governor->usage().bytes[memory::UPLOADS], 2 * block.size());
+
+  // Consumed payloads are given back.
+  release.set_value();
+  for (int i = 0; i < 1000; ++i)
+  {
+    if (governor->usage().bytes[memory::UPLOADS] == 0)
+      break;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(governor->usage().bytes[memory::UPLOADS], 0);
+
+  file->commit(err);
+  ASSERT_TRUE(settle(*file, err));
+  EXPECT_EQ(rec->contents.size(), 2 * block.size());
+  EXPECT_EQ(governor->usage().total, 0);
+}
+
+TEST(TestSink, ReportsConsumerFailures)
+{
+  auto rec = std::make_shared<record>();
+  auto sinks = sink::registry();
+  sinks.add("broken", [&](const auto &) {
+    return std::make_unique<collector>(rec, std::shared_future<void>(), true);
+  });
+
+  auto err = std::error_code();
+  auto file = sinks.open("broken/dump", err);
+  ASSERT_TRUE(file);
+  file->append(std::string_view("data"), err);
+  ASSERT_FALSE(err);
+
+  for (int i = 0; i < 1000 && !err; ++i)
+  {
+    EXPECT_FALSE(file->busy(err));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(err, std::errc::io_error);
+  file->append(std::string_view("more"), err);
+  EXPECT_EQ(err, std::errc::io_error);
+  EXPECT_EQ(sinks.stats().failures, 1);
+
+  // An upload that is not committed is aborted.
+  auto aborted = std::make_shared<record>();
+  sinks.add("abandoned", [&](const auto &) {
+    return std::make_unique<collector>(aborted);
+  });
+  file = sinks.open("abandoned/dump", err);
+  ASSERT_TRUE(file);
+  file->append(std::string_view("partial"), err);
+  file->close();
+  for (int i = 0; i < 1000; ++i)
+  {
+    auto lock = std::lock_guard{aborted->mtx};
+    if (aborted->aborted)
+      break;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_TRUE(aborted->aborted);
+  EXPECT_FALSE(aborted->committed);
+}
+
+TEST(TestSink, RunsConsumersOnABoundedPool)
+{
+  auto release = std::promise<void>();
+  auto gate = release.get_future().share();
+  auto entered = std::make_shared<std::atomic<int>>(0);
+  auto records = std::vector<std::shared_ptr<record>>();
+  auto sinks = sink::registry(2);
+  sinks.add("slow", [&](const auto &) {
+    records.push_back(std::make_shared<record>());
+    // Counts the consumers that start writing before the gate opens.
+    auto wait = std::async(std::launch::deferred, [gate, entered] {
+      ++*entered;
+      gate.wait();
+    });
+    return std::make_unique<collector>(records.back(), wait.share());
+  });
+
+  // Three uploads with work share two worker threads.
+  auto err = std::error_code();
+  auto files = std::vector<std::shared_ptr<storage::file>>();
+  for (int i = 0; i < 3; ++i)
+  {
+    files.push_back(sinks.open("slow/" + std::to_string(i), err));
+    files.back()->append(std::string_view("data"), err);
+    files.back()->commit(err);
+  }
+
+  for (int i = 0; i < 1000 && *entered < 2; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_EQ(*entered, 2);
+
+  release.set_value();
+  for (const auto &file : files)
+    ASSERT_TRUE(settle(*file, err));
+  for (const auto &rec : records)
+    EXPECT_TRUE(rec->committed);
+}
+
+TEST(TestSink, DestroyingTheRegistryJoinsTheWorkers)
+{
+  auto committed = std::make_shared<record>();
+  auto open = std::make_shared<record>();
+  auto err = std::error_code();
+  auto finished = std::shared_ptr<storage::file>();
+  auto pending = std::shared_ptr<storage::file>();
+  {
+    auto sinks = sink::registry();
+    sinks.add("done", [&](const auto &) {
+      return std::make_unique<collector>(committed);
+    });
+    sinks.add("open", [&](const auto &) {
+      return std::make_unique<collector>(open);
+    });
+
+    finished = sinks.open("done/dump", err);
+    pending = sinks.open("open/dump", err);
+    finished->append(std::string_view("data"), err);
+    finished->commit(err);
+    pending->append(std::string_view("partial"), err);
+  }
+
+  // Committed uploads are finished before the workers are joined.
+  EXPECT_TRUE(committed->committed);
+  EXPECT_EQ(committed->contents, "data");
+
+  // Uploads that are still open are cancelled.
+  pending->append(std::string_view("more"), err);
+  EXPECT_TRUE(settle(*pending, err));
+  EXPECT_EQ(err, std::errc::operation_canceled);
+  EXPECT_TRUE(open->aborted);
+  EXPECT_FALSE(open->committed);
+}
+// NOLINTEND
@@ -0,0 +1,224 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// NOLINTBEGIN
+#include "tftp/filesystem.hpp"
+#include "tftp/storage/posix.hpp"
+#include "tftp/storage/storage.hpp"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <string_view>
+
+#include <sys/stat.h>
+#include <sys/xattr.h>
+
+using namespace tftp;
+
+class TestPosixStorage : public ::testing::Test {
+protected:
+  auto SetUp() -> void override
+  {
+    path = filesystem::tmpname();
+    std::filesystem::remove(path);
+  }
+
+  auto TearDown() -> void override { std::filesystem::remove(path); }
+
+  storage::posix backend;
+  std::filesystem::path path;
+};
+
+TEST(TestStorage, DefaultsToPosixBackend)
+{
+  auto backend = storage::current();
+  ASSERT_TRUE(backend);
+  EXPECT_NE(dynamic_cast<storage::posix *>(backend.get()), nullptr);
+}
+
+TEST(TestStorage, InstallReplacesCurrentBackend)
+{
+  auto next = std::make_shared<storage::posix>();
+  auto prev = storage::install(next);
+
+  EXPECT_EQ(storage::current(), next);
+  EXPECT_EQ(storage::install(prev), next);
+  EXPECT_EQ(storage::current(), prev);
+}
+
+TEST_F(TestPosixStorage, ReadsAtOffsets)
+{
+  std::ofstream(path) << "0123456789";
+
+  auto err = std::error_code();
+  auto file = backend.open_read(path, err);
+  ASSERT_FALSE(err);
+  EXPECT_EQ(file->size(), 10);
+
+  auto buf = std::array<char, 4>();
+  EXPECT_EQ(file->read_at(6, buf, err), 4);
+  EXPECT_EQ(std::string_view(buf.data(), 4), "6789");
+
+  EXPECT_EQ(file->read(buf, err), 4);
+  EXPECT_EQ(std::string_view(buf.data(), 4), "0123");
+  EXPECT_EQ(file->offset(), 4);
+
+  file->seek(8);
+  EXPECT_EQ(file->read(buf, err), 2);
+  EXPECT_EQ(file->read(buf, err), 0);
+}
+
+TEST_F(TestPosixStorage, OpenReadReportsMissingFiles)
+{
+  auto err = std::error_code();
+  auto file = backend.open_read(path, err);
+
+  EXPECT_FALSE(file);
+  EXPECT_EQ(err, std::errc::no_such_file_or_directory);
+}
+
+TEST_F(TestPosixStorage, CommitPublishesWrites)
+{
+  auto err = std::error_code();
+  auto file = backend.open_write(path, err);
+  ASSERT_FALSE(err);
+
+  file->append(std::string_view("hello"), err);
+  ASSERT_FALSE(err);
+  EXPECT_EQ(file->size(), 5);
+
+  // Nothing is visible at the target before the commit.
+  EXPECT_EQ(std::filesystem::file_size(path), 0);
+
+  file->commit(err);
+  ASSERT_FALSE(err);
+  EXPECT_FALSE(file->is_open());
+  EXPECT_EQ(std::filesystem::file_size(path), 5);
+
+  auto status = backend.stat(path, err);
+  ASSERT_FALSE(err);
+  EXPECT_EQ(status.size, 5);
+}
+
+TEST_F(TestPosixStorage, UnchangedUploadsAreNotWritten)
+{
+  std::ofstream(path) << "unchanged";
+  auto inode = [&] {
+    struct stat status{};
+    ::stat(path.c_str(), &status);
+    return status.st_ino;
+  };
+  auto before = inode();
+  auto &stats = storage::posix::stats();
+  auto avoided = stats.avoided.load();
+  auto written = stats.written.load();
+
+  // The first comparison digests the target, the second may use the cache.
+  for (int i = 0; i < 2; ++i)
+  {
+    auto err = std::error_code();
+    auto file = backend.open_write(path, err);
+    file->append(std::string_view("unchanged"), err);
+    file->commit(err);
+    ASSERT_FALSE(err);
+    EXPECT_FALSE(file->is_open());
+  }
+
+  EXPECT_EQ(inode(), before);
+  EXPECT_EQ(stats.avoided, avoided + 2);
+  EXPECT_EQ(stats.written, written);
+
+  auto err = std::error_code();
+  auto file = backend.open_write(path, err);
+  file->append(std::string_view("different"), err);
+  file->commit(err);
+  ASSERT_FALSE(err);
+
+  EXPECT_NE(inode(), before);
+  EXPECT_EQ(stats.written, written + 1);
+
+  auto buf = std::array<char, 16>();
+  auto reader = backend.open_read(path, err);
+  EXPECT_EQ(reader->read(buf, err), 9);
+  EXPECT_EQ(std::string_view(buf.data(), 9), "different");
+}
+
+TEST_F(TestPosixStorage, CachedDigestsAreTrusted)
+{
+  auto err = std::error_code();
+  auto file = backend.open_write(path, err);
+  file->append(std::string_view("collision"), err);
+  file->commit(err);
+  ASSERT_FALSE(err);
+  if (::getxattr(path.c_str(), "user.tftp.sha256", nullptr, 0) <= 0)
+    GTEST_SKIP() << "The filesystem does not support user xattrs.";
+
+  // Overwrite the target in place, keeping its cached digest and mtime. The
+  // cached digest still matches the upload, so the target is not read.
+  auto mtime = std::filesystem::last_write_time(path);
+  {
+    auto stream = std::fstream(path, std::ios::in | std::ios::out);
+    stream << "different";
+  }
+  std::filesystem::last_write_time(path, mtime);
+
+  auto &stats = storage::posix::stats();
+  auto avoided = stats.avoided.load();
+  file = backend.open_write(path, err);
+  file->append(std::string_view("collision"), err);
+  file->commit(err);
+  ASSERT_FALSE(err);
+  EXPECT_EQ(stats.avoided, avoided + 1);
+
+  auto buf = std::array<char, 16>();
+  auto reader = backend.open_read(path, err);
+  EXPECT_EQ(reader->read(buf, err), 9);
+  EXPECT_EQ(std::string_view(buf.data(), 9), "different");
+}
+
+TEST_F(TestPosixStorage, CloseDiscardsUncommittedWrites)
+{
+  auto err = std::error_code();
+  const auto initial_count = filesystem::count().load();
+  auto file = backend.open_write(path, err);
+  ASSERT_FALSE(err);
+
+  // open_write draws exactly one temporary filename.
+  ASSERT_EQ(filesystem::count().load(), initial_count + 1);
+  auto tmp = (filesystem::temp_directory(err) / filesystem::prefix)
+                 .concat(std::format("{:05d}", initial_count));
+  EXPECT_TRUE(std::filesystem::exists(tmp));
+
+  file->append(std::string_view("discarded"), err);
+  file->close();
+
+  EXPECT_FALSE(file->is_open());
+  EXPECT_FALSE(std::filesystem::exists(tmp));
+  EXPECT_EQ(std::filesystem::file_size(path), 0);
+}
+
+TEST_F(TestPosixStorage, StatReportsMissingFiles)
+{
+  auto err = std::error_code();
+  backend.stat(path, err);
+
+  EXPECT_EQ(err, std::errc::no_such_file_or_directory);
+}
+// NOLINTEND
@@ -0,0 +1,234 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+// NOLINTBEGIN
+#include "tftp/filesystem.hpp"
+#include "tftp/storage/archive.hpp"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <string>
+#include <string_view>
+
+#ifdef TFTP_ENABLE_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace tftp;
+
+// Appends a ustar member to a tar archive.
+static auto add_member(std::string &tar, std::string_view name,
+                       std::string_view data, char type = '0',
+                       std::string_view link = {}) -> void
+{
+  auto header = std::array<char, 512>();
+  std::memcpy(header.data(), name.data(),
+              std::min<std::size_t>(name.size(), 100));
+  std::memcpy(header.data() + 100, "0000644", 7);
+  std::memcpy(header.data() + 124, std::format("{:011o}", data.size()).data(),
+              11);
+  std::memcpy(header.data() + 136, "14000000000", 11);
+  std::memset(header.data() + 148, ' ', 8);
+  header[156] = type;
+  std::memcpy(header.data() + 157, link.data(), link.size());
+  std::memcpy(header.data() + 257, "ustar\0" "00", 8);
+
+  unsigned sum = 0;
+  for (auto chr : header)
+    sum += static_cast<unsigned char>(chr);
+  std::memcpy(header.data() + 148, std::format("{:06o}", sum).data(), 6);
+  header[154] = '\0';
+
+  tar.append(header.data(), header.size());
+  tar.append(data);
+  tar.append((512 - (data.size() % 512)) % 512, '\0');
+}
+
+static auto finish(std::string &tar) -> void { tar.append(1024, '\0'); }
+
+class TestArchiveStorage : public ::testing::Test {
+protected:
+  auto SetUp() -> void override { path = filesystem::tmpname(); }
+
+  auto TearDown() -> void override { std::filesystem::remove(path); }
+
+  auto write(std::string_view bytes) -> void
+  {
+    std::ofstream(path, std::ios::binary) << bytes;
+  }
+
+  std::filesystem::path path;
+};
+
+TEST_F(TestArchiveStorage, ServesMembers)
+{
+  auto tar = std::string();
+  add_member(tar, "./boot/", "", '5');
+  add_member(tar, "./boot/pxelinux.0", std::string(700, 'x') + "tail");
+  add_member(tar, "./boot/config", "config");
+  finish(tar);
+  write(tar);
+
+  auto err = std::error_code();
+  auto backend = storage::archive::open(path, err);
+  ASSERT_FALSE(err) << err.message();
+  EXPECT_EQ(backend->size(), 2);
+
+  auto file = backend->open_read("/boot/pxelinux.0", err);
+  ASSERT_FALSE(err);
+  EXPECT_EQ(file->size(), 704);
+
+  auto buf = std::array<char, 8>();
+  EXPECT_EQ(file->read_at(700, buf, err), 4);
+  EXPECT_EQ(std::string_view(buf.data(), 4), "tail");
+
+  file = backend->open_read("boot/config", err);
+  EXPECT_EQ(file->read(buf, err), 6);
+  EXPECT_EQ(std::string_view(buf.data(), 6), "config");
+  EXPECT_EQ(file->read(buf, err), 0);
+
+  auto status = backend->stat("boot/config", err);
+  EXPECT_FALSE(err);
+  EXPECT_EQ(status.size, 6);
+}
+
+TEST_F(TestArchiveStorage, ResolvesLongNamesAndLinks)
+{
+  auto long_name = std::string(120, 'n');
+  auto tar = std::string();
+  add_member(tar, "././@LongLink", long_name + '\0', 'L');
+  add_member(tar, long_name.substr(0, 100), "long");
+  add_member(tar, "PaxHeaders/x", "17 path=pax-name\n", 'x');
+  add_member(tar, "truncated", "pax");
+  add_member(tar, "link", "", '1', "pax-name");
+  finish(tar);
+  write(tar);
+
+  auto err = std::error_code();
+  auto backend = storage::archive::open(path, err);
+  ASSERT_FALSE(err) << err.message();
+
+  EXPECT_EQ(backend->find(long_name)->size, 4);
+  EXPECT_EQ(backend->find("pax-name")->size, 3);
+  EXPECT_FALSE(backend->find("truncated"));
+  EXPECT_EQ(backend->find("link")->offset, backend->find("pax-name")->offset);
+}
+
+TEST_F(TestArchiveStorage, IsReadOnly)
+{
+  auto tar = std::string();
+  add_member(tar, "file", "data");
+  finish(tar);
+  write(tar);
+
+  auto err = std::error_code();
+  auto backend = storage::archive::open(path, err);
+  ASSERT_TRUE(backend);
+
+  EXPECT_FALSE(backend->open_write("file", err));
+  EXPECT_EQ(err, std::errc::permission_denied);
+
+  EXPECT_FALSE(backend->open_read("missing", err));
+  EXPECT_EQ(err, std::errc::no_such_file_or_directory);
+}
+
+TEST_F(TestArchiveStorage, RejectsCorruptArchives)
+{
+  auto tar = std::string();
+  add_member(tar, "file", "data");
+  finish(tar);
+  tar[0] = 'F';
+  write(tar);
+
+  auto err = std::error_code();
+  EXPECT_FALSE(storage::archive::open(path, err));
+  EXPECT_EQ(err, std::errc::invalid_argument);
+}
+
+#ifdef TFTP_ENABLE_ZSTD
+// Compresses an archive in the zstd seekable format.
+static auto compress_seekable(std::string_view tar,
+                              std::size_t frame_size) -> std::string
+{
+  auto out = std::string();
+  auto table = std::string();
+  auto put_le32 = [](std::string &str, std::uint32_t value) {
+    for (int i = 0; i < 4; ++i)
+      str.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+  };
+
+  std::uint32_t frames = 0;
+  for (std::size_t pos = 0; pos < tar.size(); pos += frame_size, ++frames)
+  {
+    auto chunk = tar.substr(pos, frame_size);
+    auto frame = std::string(ZSTD_compressBound(chunk.size()), '\0');
+    frame.resize(ZSTD_compress(frame.data(), frame.size(), chunk.data(),
+                               chunk.size(), 1));
+    out += frame;
+    put_le32(table, frame.size());
+    put_le32(table, chunk.size());
+  }
+
+  put_le32(out, 0x184D2A5E);
+  put_le32(out, table.size() + 9);
+  out += table;
+  put_le32(out, frames);
+  out.push_back('\0');
+  put_le32(out, 0x8F92EAB1);
+  return out;
+}
+
+TEST_F(TestArchiveStorage, ServesSeekableZstdArchives)
+{
+  auto data = std::string();
+  for (int i = 0; i < 1000; ++i)
+    data += std::format("{:04}", i);
+
+  auto tar = std::string();
+  add_member(tar, "first", "first");
+  add_member(tar, "data", data);
+  finish(tar);
+  write(compress_seekable(tar, 1000));
+
+  auto err = std::error_code();
+  auto backend = storage::archive::open(path, err, 2);
+  ASSERT_FALSE(err) << err.message();
+
+  auto file = backend->open_read("data", err);
+  auto buf = std::string(data.size(), '\0');
+  EXPECT_EQ(file->read_at(0, buf, err), data.size());
+  EXPECT_FALSE(err);
+  EXPECT_EQ(buf, data);
+
+  auto small = std::array<char, 8>();
+  EXPECT_EQ(file->read_at(3996, small, err), 4);
+  EXPECT_EQ(std::string_view(small.data(), 4), "0999");
+}
+#else
+TEST_F(TestArchiveStorage, RejectsCompressedArchives)
+{
+  write("\x28\xB5\x2F\xFD" "compressed");
+
+  auto err = std::error_code();
+  EXPECT_FALSE(storage::archive::open(path, err));
+  EXPECT_EQ(err, std::errc::not_supported);
+}
+#endif
+// NOLINTEND
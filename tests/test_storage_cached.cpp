@@ -0,0 +1,311 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// NOLINTBEGIN
+#include "tftp/storage/cached.hpp"
+#include "tftp/filesystem.hpp"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string_view>
+#include <thread>
+
+using namespace tftp;
+using contents = storage::memory::contents;
+
+static auto to_contents(std::string_view str) -> contents
+{
+  return {str.begin(), str.end()};
+}
+
+static auto read_all(storage::backend &backend,
+                     const std::filesystem::path &path) -> std::string
+{
+  auto err = std::error_code();
+  auto file = backend.open_read(path, err);
+  if (err)
+    return {};
+
+  auto buf = std::string(file->size(), '\0');
+  buf.resize(file->read_at(0, buf, err));
+  return buf;
+}
+
+class TestCachedStorage : public ::testing::Test {
+protected:
+  void SetUp() override
+  {
+    inner = std::make_shared<storage::memory>();
+    inner->insert("boot/pxelinux.0", to_contents("0123456789"));
+    inner->insert("boot/ldlinux.c32", to_contents("abcdef"));
+  }
+
+  std::shared_ptr<storage::memory> inner;
+};
+
+TEST_F(TestCachedStorage, ServesRepeatedOpensFromMemory)
+{
+  auto cache = storage::cached(inner);
+
+  EXPECT_EQ(read_all(cache, "boot/pxelinux.0"), "0123456789");
+  EXPECT_EQ(read_all(cache, "boot/../boot/pxelinux.0"), "0123456789");
+  EXPECT_EQ(cache.stats().misses, 1);
+  EXPECT_EQ(cache.stats().hits, 1);
+  EXPECT_EQ(cache.bytes(), 10);
+
+  auto err = std::error_code();
+  EXPECT_FALSE(cache.open_read("missing", err));
+  EXPECT_EQ(err, std::errc::no_such_file_or_directory);
+}
+
+TEST_F(TestCachedStorage, RevalidatesChangedFiles)
+{
+  auto cache = storage::cached(inner);
+  EXPECT_EQ(read_all(cache, "boot/pxelinux.0"), "0123456789");
+
+  inner->insert("boot/pxelinux.0", to_contents("changed"));
+  EXPECT_EQ(read_all(cache, "boot/pxelinux.0"), "changed");
+  EXPECT_EQ(cache.stats().invalidations, 1);
+}
+
+TEST_F(TestCachedStorage, CommitInvalidatesUploads)
+{
+  auto cache = storage::cached(inner);
+  EXPECT_EQ(read_all(cache, "boot/pxelinux.0"), "0123456789");
+
+  auto err = std::error_code();
+  auto writer = cache.open_write("boot/pxelinux.0", err);
+  ASSERT_FALSE(err);
+  writer->append(std::string_view("new"), err);
+  writer->commit(err);
+  ASSERT_FALSE(err);
+
+  EXPECT_EQ(cache.bytes(), 0);
+  EXPECT_EQ(read_all(cache, "boot/pxelinux.0"), "new");
+}
+
+TEST_F(TestCachedStorage, WritesThroughCommittedUploads)
+{
+  auto cache = storage::cached(inner, 64, 32);
+  cache.write_through(true);
+
+  auto err = std::error_code();
+  auto writer = cache.open_write("images/node.img", err);
+  ASSERT_FALSE(err);
+  writer->append(std::string_view("generated"), err);
+  writer->append(std::string_view(" image"), err);
+  writer->commit(err);
+  ASSERT_FALSE(err);
+  EXPECT_EQ(cache.stats().written, 1);
+  EXPECT_EQ(cache.bytes(), 15);
+
+  // The first reader is served from memory.
+  EXPECT_EQ(read_all(cache, "images/node.img"), "generated image");
+  EXPECT_EQ(cache.stats().hits, 1);
+  EXPECT_EQ(cache.stats().misses, 0);
+
+  // A change report for the upload keeps the entry if it is unchanged.
+  cache.invalidate("images");
+  EXPECT_EQ(read_all(cache, "images/node.img"), "generated image");
+  EXPECT_EQ(cache.stats().hits, 2);
+
+  inner->insert("images/node.img", to_contents("replaced"));
+  cache.invalidate("images/node.img");
+  EXPECT_EQ(read_all(cache, "images/node.img"), "replaced");
+
+  // Uploads larger than the largest cached file are not retained.
+  writer = cache.open_write("images/large.img", err);
+  writer->append(std::string(40, 'x'), err);
+  writer->commit(err);
+  ASSERT_FALSE(err);
+  EXPECT_EQ(cache.stats().written, 1);
+
+  // Uploads that are not committed are never installed.
+  writer = cache.open_write("images/aborted.img", err);
+  writer->append(std::string_view("partial"), err);
+  writer->close();
+  EXPECT_EQ(read_all(cache, "images/aborted.img"), "");
+}
+
+TEST_F(TestCachedStorage, InvalidateDropsEverythingBelowAPath)
+{
+  auto cache = storage::cached(inner);
+  read_all(cache, "boot/pxelinux.0");
+  read_all(cache, "boot/ldlinux.c32");
+
+  EXPECT_EQ(cache.invalidate("boot/pxelinux.0.bak"), 0);
+  EXPECT_EQ(cache.invalidate("boot"), 2);
+  EXPECT_EQ(cache.bytes(), 0);
+
+  // Changes are matched against the absolute path of each file.
+  read_all(cache, "boot/pxelinux.0");
+  read_all(cache, "./boot/../boot/ldlinux.c32");
+  EXPECT_EQ(cache.invalidate(std::filesystem::current_path() / "boot/"), 2);
+  EXPECT_EQ(cache.bytes(), 0);
+}
+
+TEST_F(TestCachedStorage, EvictsLeastRecentlyUsedFiles)
+{
+  auto cache = storage::cached(inner, 16);
+  read_all(cache, "boot/pxelinux.0");
+  read_all(cache, "boot/ldlinux.c32");
+  EXPECT_EQ(cache.bytes(), 16);
+
+  inner->insert("grub.cfg", to_contents("menu"));
+  read_all(cache, "grub.cfg");
+  EXPECT_EQ(cache.stats().evictions, 1);
+  EXPECT_EQ(cache.bytes(), 10);
+
+  // Files larger than the cache are served uncached.
+  inner->insert("kernel", contents(32, 'k'));
+  EXPECT_EQ(read_all(cache, "kernel").size(), 32);
+  EXPECT_EQ(cache.bytes(), 10);
+}
+
+TEST_F(TestCachedStorage, ShrinksLeastRecentlyUsedFiles)
+{
+  auto cache = storage::cached(inner);
+  read_all(cache, "boot/pxelinux.0");
+  read_all(cache, "boot/ldlinux.c32");
+  EXPECT_EQ(cache.bytes(), 16);
+
+  EXPECT_EQ(cache.shrink(1), 10);
+  EXPECT_EQ(cache.bytes(), 6);
+  EXPECT_EQ(cache.stats().evictions, 1);
+
+  EXPECT_EQ(cache.shrink(100), 6);
+  EXPECT_EQ(cache.bytes(), 0);
+  EXPECT_EQ(cache.shrink(1), 0);
+  EXPECT_EQ(read_all(cache, "boot/ldlinux.c32"), "abcdef");
+}
+
+TEST_F(TestCachedStorage, SharesIdenticalBlocks)
+{
+  constexpr auto BLOCK = storage::cached::BLOCK_SIZE;
+  auto a = std::string(BLOCK, 'a');
+  auto b = std::string(BLOCK, 'b');
+  auto v1 = a + b + a + "tail";
+  auto v2 = a + std::string(BLOCK, 'c') + a + "tail";
+  inner->insert("firmware-1.0.bin", to_contents(v1));
+  inner->insert("firmware-1.1.bin", to_contents(v2));
+
+  auto cache = storage::cached(inner);
+  EXPECT_EQ(read_all(cache, "firmware-1.0.bin"), v1);
+  EXPECT_EQ(read_all(cache, "firmware-1.1.bin"), v2);
+
+  // a, b, c and the tail are each stored once.
+  auto usage = cache.memory_usage();
+  EXPECT_EQ(usage.files, 2);
+  EXPECT_EQ(usage.blocks, 4);
+  EXPECT_EQ(usage.logical, v1.size() + v2.size());
+  EXPECT_EQ(usage.physical, 3 * BLOCK + 4);
+  EXPECT_EQ(cache.bytes(), usage.physical);
+
+  // Reads that straddle blocks are served from the shared blocks.
+  auto err = std::error_code();
+  auto file = cache.open_read("firmware-1.1.bin", err);
+  auto buf = std::string(8, '\0');
+  EXPECT_EQ(file->read_at(2 * BLOCK - 4, buf, err), 8);
+  EXPECT_EQ(buf, "ccccaaaa");
+
+  // Dropping a file only frees the blocks that nothing else uses.
+  cache.invalidate("firmware-1.0.bin");
+  usage = cache.memory_usage();
+  EXPECT_EQ(usage.blocks, 3);
+  EXPECT_EQ(usage.logical, v2.size());
+  EXPECT_EQ(usage.physical, 2 * BLOCK + 4);
+  EXPECT_EQ(read_all(cache, "firmware-1.1.bin"), v2);
+}
+
+TEST_F(TestCachedStorage, PreloadsAManifest)
+{
+  auto manifest =
+      std::filesystem::temp_directory_path() / "tftp_cache_manifest";
+  {
+    auto stream = std::ofstream(manifest);
+    stream << "# boot chain\n"
+           << "boot/pxelinux.0\n"
+           << "\n"
+           << "  boot/ldlinux.c32  \n"
+           << "missing\n";
+  }
+
+  auto cache = storage::cached(inner);
+  auto err = std::error_code();
+  EXPECT_EQ(cache.preload(manifest, err), 2);
+  EXPECT_FALSE(err);
+  EXPECT_EQ(cache.bytes(), 16);
+
+  read_all(cache, "boot/ldlinux.c32");
+  EXPECT_EQ(cache.stats().hits, 1);
+  EXPECT_EQ(cache.stats().misses, 0);
+
+  std::filesystem::remove(manifest);
+  cache.preload(manifest, err);
+  EXPECT_EQ(err, std::errc::no_such_file_or_directory);
+}
+
+TEST_F(TestCachedStorage, HotSetOnlyCountsFilesThatOpen)
+{
+  auto cache = storage::cached(inner);
+  read_all(cache, "boot/missing");
+  read_all(cache, "boot/missing");
+  read_all(cache, "boot/pxelinux.0");
+
+  auto hot = cache.hot_set();
+  ASSERT_EQ(hot.size(), 1);
+  EXPECT_EQ(hot[0].first, "boot/pxelinux.0");
+}
+
+TEST_F(TestCachedStorage, SnapshotRestoresTheHotSet)
+{
+  auto snapshot =
+      std::filesystem::temp_directory_path() / "tftp_cache_snapshot";
+  {
+    auto cache = storage::cached(inner);
+    read_all(cache, "boot/ldlinux.c32");
+    read_all(cache, "boot/pxelinux.0");
+    read_all(cache, "boot/pxelinux.0");
+
+    auto hot = cache.hot_set(1);
+    ASSERT_EQ(hot.size(), 1);
+    EXPECT_EQ(hot[0].first, "boot/pxelinux.0");
+    EXPECT_EQ(hot[0].second, 2);
+
+    auto err = std::error_code();
+    cache.save_snapshot(snapshot, err);
+    ASSERT_FALSE(err);
+  }
+
+  auto cache = storage::cached(inner);
+  auto err = std::error_code();
+  EXPECT_EQ(cache.load_snapshot(snapshot, err), 2);
+  ASSERT_FALSE(err);
+
+  for (int i = 0; i < 200 && cache.stats().prefetched < 2; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  EXPECT_EQ(cache.stats().prefetched, 2);
+  EXPECT_EQ(cache.hot_set()[0].second, 2);
+
+  read_all(cache, "boot/pxelinux.0");
+  EXPECT_EQ(cache.stats().hits, 1);
+  std::filesystem::remove(snapshot);
+}
+// NOLINTEND
@@ -0,0 +1,95 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+// NOLINTBEGIN
+#include "tftp/storage/embedded.hpp"
+#include "tftp/storage/memory.hpp"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <string_view>
+
+using namespace tftp;
+using namespace std::string_view_literals;
+
+static constexpr auto files = std::array<storage::embedded::entry, 2>{{
+    {"pxelinux.0", "loader\0binary"sv},
+    {"pxelinux.cfg/default", "config"sv},
+}};
+
+class TestEmbeddedStorage : public ::testing::Test {
+protected:
+  auto SetUp() -> void override
+  {
+    fallback = std::make_shared<storage::memory>();
+    fallback->insert("pxelinux.0", {'d', 'i', 's', 'k'});
+    fallback->insert("other", {'d', 'i', 's', 'k'});
+  }
+
+  std::shared_ptr<storage::memory> fallback;
+};
+
+TEST_F(TestEmbeddedStorage, ServesEmbeddedFilesFirst)
+{
+  auto backend = storage::embedded(fallback, files);
+  EXPECT_EQ(backend.size(), 2);
+
+  auto err = std::error_code();
+  auto file = backend.open_read("/pxelinux.0", err);
+  ASSERT_FALSE(err);
+  EXPECT_EQ(file->size(), 13);
+
+  auto buf = std::array<char, 16>();
+  EXPECT_EQ(file->read(buf, err), 13);
+  EXPECT_EQ(std::string_view(buf.data(), 13), "loader\0binary"sv);
+  EXPECT_EQ(file->read(buf, err), 0);
+
+  EXPECT_EQ(backend.stat("pxelinux.cfg/default", err).size, 6);
+  EXPECT_FALSE(err);
+
+  file->close();
+  file->read_at(0, buf, err);
+  EXPECT_EQ(err, std::errc::bad_file_descriptor);
+}
+
+TEST_F(TestEmbeddedStorage, FallsBackForOtherFiles)
+{
+  auto backend = storage::embedded(fallback, files);
+
+  auto err = std::error_code();
+  auto file = backend.open_read("other", err);
+  ASSERT_FALSE(err);
+  EXPECT_EQ(file->size(), 4);
+
+  backend.open_read("missing", err);
+  EXPECT_EQ(err, std::errc::no_such_file_or_directory);
+
+  auto writer = backend.open_write("upload", err);
+  ASSERT_FALSE(err);
+  writer->append(std::string_view("data"), err);
+  writer->commit(err);
+  EXPECT_TRUE(fallback->find("upload"));
+}
+
+TEST_F(TestEmbeddedStorage, RefusesWritesToEmbeddedFiles)
+{
+  auto backend = storage::embedded(fallback, files);
+
+  auto err = std::error_code();
+  EXPECT_FALSE(backend.open_write("pxelinux.0", err));
+  EXPECT_EQ(err, std::errc::permission_denied);
+}
+// NOLINTEND
@@ -0,0 +1,159 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// NOLINTBEGIN
+#include "tftp/filesystem.hpp"
+#include "tftp/storage/memory.hpp"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <string_view>
+
+using namespace tftp;
+using contents = storage::memory::contents;
+
+static auto to_contents(std::string_view str) -> contents
+{
+  return {str.begin(), str.end()};
+}
+
+TEST(TestMemoryStorage, ReadsInsertedFiles)
+{
+  auto backend = storage::memory();
+  backend.insert("/boot/pxelinux.0", to_contents("0123456789"));
+
+  auto err = std::error_code();
+  auto file = backend.open_read("boot/pxelinux.0", err);
+  ASSERT_FALSE(err);
+  EXPECT_EQ(file->size(), 10);
+
+  auto buf = std::array<char, 4>();
+  EXPECT_EQ(file->read_at(8, buf, err), 2);
+  EXPECT_EQ(std::string_view(buf.data(), 2), "89");
+  EXPECT_EQ(file->read_at(10, buf, err), 0);
+
+  EXPECT_EQ(file->read(buf, err), 4);
+  EXPECT_EQ(std::string_view(buf.data(), 4), "0123");
+
+  file->close();
+  EXPECT_FALSE(file->is_open());
+  file->read(buf, err);
+  EXPECT_TRUE(err);
+}
+
+TEST(TestMemoryStorage, ReportsMissingFiles)
+{
+  auto backend = storage::memory();
+
+  auto err = std::error_code();
+  EXPECT_FALSE(backend.open_read("missing", err));
+  EXPECT_EQ(err, std::errc::no_such_file_or_directory);
+
+  backend.stat("missing", err);
+  EXPECT_EQ(err, std::errc::no_such_file_or_directory);
+}
+
+TEST(TestMemoryStorage, CommitPublishesUploads)
+{
+  auto backend = storage::memory();
+  backend.insert("config", to_contents("old"));
+
+  auto err = std::error_code();
+  auto reader = backend.open_read("config", err);
+  auto writer = backend.open_write("/config", err);
+  ASSERT_FALSE(err);
+
+  writer->append(to_contents("new!"), err);
+  ASSERT_FALSE(err);
+  EXPECT_EQ(*backend.find("config"), to_contents("old"));
+
+  writer->commit(err);
+  ASSERT_FALSE(err);
+  EXPECT_FALSE(writer->is_open());
+  EXPECT_EQ(*backend.find("config"), to_contents("new!"));
+  EXPECT_EQ(backend.bytes(), 4);
+  EXPECT_EQ(backend.stat("config", err).size, 4);
+
+  // Readers that were already open keep the old contents.
+  EXPECT_EQ(reader->size(), 3);
+}
+
+TEST(TestMemoryStorage, CloseDiscardsUploads)
+{
+  auto backend = storage::memory();
+
+  auto err = std::error_code();
+  auto writer = backend.open_write("upload", err);
+  writer->append(to_contents("discarded"), err);
+  writer->close();
+
+  EXPECT_FALSE(backend.find("upload"));
+  EXPECT_EQ(backend.bytes(), 0);
+}
+
+TEST(TestMemoryStorage, UploadsAreCapped)
+{
+  auto backend = storage::memory(8);
+
+  auto err = std::error_code();
+  auto first = backend.open_write("first", err);
+  first->append(to_contents("12345"), err);
+  ASSERT_FALSE(err);
+
+  auto second = backend.open_write("second", err);
+  second->append(to_contents("12345"), err);
+  EXPECT_EQ(err, std::errc::no_space_on_device);
+
+  // Space is returned once the first upload is discarded.
+  first->close();
+  second->append(to_contents("12345"), err);
+  EXPECT_FALSE(err);
+  second->commit(err);
+  EXPECT_FALSE(err);
+  EXPECT_EQ(backend.bytes(), 5);
+}
+
+TEST(TestMemoryStorage, LoadsDirectories)
+{
+  auto root = filesystem::tmpname();
+  std::filesystem::create_directories(root / "pxelinux.cfg");
+  std::ofstream(root / "pxelinux.0") << "loader";
+  std::ofstream(root / "pxelinux.cfg" / "default") << "config";
+
+  auto backend = storage::memory();
+  auto err = std::error_code();
+  EXPECT_EQ(backend.load(root, err), 2);
+  EXPECT_FALSE(err);
+
+  EXPECT_EQ(*backend.find("pxelinux.0"), to_contents("loader"));
+  EXPECT_EQ(*backend.find("/pxelinux.cfg/default"), to_contents("config"));
+
+  std::filesystem::remove_all(root);
+}
+
+TEST(TestMemoryStorage, EraseRemovesFiles)
+{
+  auto backend = storage::memory();
+  backend.insert("file", to_contents("data"));
+
+  EXPECT_TRUE(backend.erase("file"));
+  EXPECT_FALSE(backend.erase("file"));
+  EXPECT_EQ(backend.bytes(), 0);
+}
+// NOLINTEND
@@ -0,0 +1,350 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+// NOLINTBEGIN
+#include "tftp/protocol/tftp_protocol.hpp"
+#include "tftp/storage/relay.hpp"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace tftp;
+using namespace std::chrono_literals;
+
+/** @brief A stand-in origin on the loopback interface. */
+class origin_server {
+public:
+  explicit origin_server(int type) : type_(type)
+  {
+    fd_ = ::socket(AF_INET, type, 0);
+    auto addr = sockaddr_in{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ::bind(fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+    auto len = socklen_t{sizeof(addr)};
+    ::getsockname(fd_, reinterpret_cast<sockaddr *>(&addr), &len);
+    port_ = ntohs(addr.sin_port);
+
+    auto poll = timeval{.tv_sec = 0, .tv_usec = 50000};
+    ::setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &poll, sizeof(poll));
+    if (type == SOCK_STREAM)
+      ::listen(fd_, 8);
+
+    thread_ = std::jthread([this](const std::stop_token &token) {
+      while (!token.stop_requested())
+        type_ == SOCK_STREAM ? serve_http() : serve_tftp();
+    });
+  }
+
+  ~origin_server()
+  {
+    thread_.request_stop();
+    thread_.join();
+    ::close(fd_);
+  }
+
+  auto url(std::string_view prefix = "") const -> std::string
+  {
+    return std::string(type_ == SOCK_STREAM ? "http" : "tftp") +
+           "://127.0.0.1:" + std::to_string(port_) + std::string(prefix);
+  }
+
+  std::map<std::string, std::string> files;
+  std::atomic<int> requests{0};
+
+private:
+  auto serve_http() -> void
+  {
+    int conn = ::accept(fd_, nullptr, nullptr);
+    if (conn < 0)
+      return;
+
+    auto buf = std::array<char, 4096>();
+    auto len = ::recv(conn, buf.data(), buf.size(), 0);
+    auto request = std::string(buf.data(), len > 0 ? len : 0);
+    auto path = request.substr(4, request.find(' ', 4) - 4);
+    ++requests;
+
+    auto it = files.find(path);
+    auto response =
+        it == files.end()
+            ? std::string("HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n")
+            : "HTTP/1.0 200 OK\r\nContent-Length: " +
+                  std::to_string(it->second.size()) + "\r\n\r\n" + it->second;
+    ::send(conn, response.data(), response.size(), MSG_NOSIGNAL);
+    ::close(conn);
+  }
+
+  auto serve_tftp() -> void
+  {
+    auto buf = std::array<char, 1024>();
+    auto client = sockaddr_in{};
+    auto len = socklen_t{sizeof(client)};
+    auto n = ::recvfrom(fd_, buf.data(), buf.size(), 0,
+                        reinterpret_cast<sockaddr *>(&client), &len);
+    if (n < 4 || ntohs(*reinterpret_cast<std::uint16_t *>(buf.data())) !=
+                     messages::RRQ)
+      return;
+
+    ++requests;
+    auto path = std::string(buf.data() + 2);
+    auto it = files.find(path);
+    if (it == files.end())
+    {
+      auto error = errors::msg(messages::FILE_NOT_FOUND, "File not found.");
+      ::sendto(fd_, error.data(), error.size(), 0,
+               reinterpret_cast<sockaddr *>(&client), len);
+      return;
+    }
+
+    const auto &contents = it->second;
+    for (std::uint16_t block = 1;; ++block)
+    {
+      auto offset = (block - 1) * messages::DATALEN;
+      auto size = std::min(messages::DATALEN, contents.size() - offset);
+      auto packet = std::string(4, '\0');
+      auto header = messages::data{.opc = htons(messages::DATA),
+                                   .block_num = htons(block)};
+      std::memcpy(packet.data(), &header, sizeof(header));
+      packet += contents.substr(offset, size);
+
+      // Resend until the block is acknowledged.
+      for (auto acked = false; !acked;)
+      {
+        ::sendto(fd_, packet.data(), packet.size(), 0,
+                 reinterpret_cast<sockaddr *>(&client), len);
+        auto ack = messages::ack{};
+        acked = ::recv(fd_, &ack, sizeof(ack), 0) == sizeof(ack) &&
+                ntohs(ack.block_num) == block;
+      }
+
+      if (size < messages::DATALEN)
+        return;
+    }
+  }
+
+  int type_;
+  int fd_{-1};
+  std::uint16_t port_{0};
+  std::jthread thread_;
+};
+
+static auto wait_for(const std::function<bool()> &done) -> bool
+{
+  for (int i = 0; i < 200 && !done(); ++i)
+    std::this_thread::sleep_for(10ms);
+  return done();
+}
+
+/** @brief Reads a file, polling it while it is busy like a session does. */
+static auto read_all(storage::backend &backend,
+                     const std::filesystem::path &path,
+                     std::error_code &err) -> std::string
+{
+  auto file = backend.open_read(path, err);
+  if (err)
+    return {};
+
+  auto contents = std::string();
+  auto buf = std::array<char, 700>();
+  while (true)
+  {
+    if (!wait_for([&] { return !file->busy(err); }))
+    {
+      err = std::make_error_code(std::errc::timed_out);
+      return {};
+    }
+
+    if (err)
+      return {};
+
+    auto len = file->read(buf, err);
+    if (err || len == 0)
+      break;
+
+    contents.append(buf.data(), len);
+  }
+  return contents;
+}
+
+class TestRelayStorage : public ::testing::Test {
+protected:
+  void SetUp() override
+  {
+    dir = std::filesystem::temp_directory_path() / "tftp_relay_cache";
+    std::filesystem::remove_all(dir);
+  }
+
+  void TearDown() override { std::filesystem::remove_all(dir); }
+
+  static auto origin(const std::string &url) -> storage::relay::origin
+  {
+    auto err = std::error_code();
+    return *storage::relay::origin::parse(url, err);
+  }
+
+  std::filesystem::path dir;
+};
+
+TEST(TestRelayOrigin, ParsesUrls)
+{
+  auto err = std::error_code();
+  auto tftp = storage::relay::origin::parse("tftp://boot.example", err);
+  ASSERT_TRUE(tftp);
+  EXPECT_EQ(tftp->protocol, storage::relay::origin::TFTP);
+  EXPECT_EQ(tftp->host, "boot.example");
+  EXPECT_EQ(tftp->port, 69);
+  EXPECT_EQ(tftp->prefix, "");
+
+  auto http = storage::relay::origin::parse("http://[::1]:8080/images/", err);
+  ASSERT_TRUE(http);
+  EXPECT_EQ(http->protocol, storage::relay::origin::HTTP);
+  EXPECT_EQ(http->host, "::1");
+  EXPECT_EQ(http->port, 8080);
+  EXPECT_EQ(http->prefix, "/images");
+
+  EXPECT_FALSE(storage::relay::origin::parse("ftp://host", err));
+  EXPECT_EQ(err, std::errc::invalid_argument);
+  EXPECT_FALSE(storage::relay::origin::parse("http://host:port", err));
+  EXPECT_FALSE(storage::relay::origin::parse("http://", err));
+}
+
+TEST_F(TestRelayStorage, FetchesFromAnHttpOrigin)
+{
+  auto upstream = origin_server(SOCK_STREAM);
+  upstream.files["/images/boot/vmlinuz"] = std::string(5000, 'k');
+
+  {
+    auto relay = storage::relay(origin(upstream.url("/images")), dir);
+    auto err = std::error_code();
+    EXPECT_EQ(read_all(relay, "/boot/vmlinuz", err), std::string(5000, 'k'));
+    ASSERT_FALSE(err);
+    EXPECT_TRUE(wait_for([&] { return relay.bytes() == 5000; }));
+    EXPECT_TRUE(std::filesystem::exists(dir / "boot/vmlinuz"));
+
+    EXPECT_EQ(read_all(relay, "boot/vmlinuz", err).size(), 5000);
+    EXPECT_EQ(relay.stats().hits, 1);
+    EXPECT_EQ(upstream.requests, 1);
+
+    read_all(relay, "missing", err);
+    EXPECT_EQ(err, std::errc::no_such_file_or_directory);
+    EXPECT_EQ(relay.stats().failures, 1);
+
+    read_all(relay, "../etc/passwd", err);
+    EXPECT_EQ(err, std::errc::no_such_file_or_directory);
+  }
+
+  // Files cached by an earlier run are served without the origin.
+  auto relay = storage::relay(origin("http://127.0.0.1:1"), dir);
+  auto err = std::error_code();
+  EXPECT_EQ(read_all(relay, "boot/vmlinuz", err).size(), 5000);
+  EXPECT_EQ(relay.stats().fetches, 0);
+}
+
+TEST_F(TestRelayStorage, FetchesFromATftpOrigin)
+{
+  auto upstream = origin_server(SOCK_DGRAM);
+  auto contents = std::string();
+  for (int i = 0; i < 1200; ++i)
+    contents.push_back(static_cast<char>('a' + i % 26));
+  upstream.files["pxelinux.0"] = contents;
+
+  auto relay = storage::relay(origin(upstream.url()), dir);
+  auto err = std::error_code();
+  EXPECT_EQ(read_all(relay, "pxelinux.0", err), contents);
+  ASSERT_FALSE(err);
+
+  read_all(relay, "missing", err);
+  EXPECT_EQ(err, std::errc::no_such_file_or_directory);
+
+  EXPECT_FALSE(relay.open_write("pxelinux.0", err));
+  EXPECT_EQ(err, std::errc::permission_denied);
+}
+
+TEST_F(TestRelayStorage, NeverWaitsForTheOrigin)
+{
+  // An origin that accepts connections but never answers them.
+  int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+  auto addr = sockaddr_in{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ::bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+  auto len = socklen_t{sizeof(addr)};
+  ::getsockname(listener, reinterpret_cast<sockaddr *>(&addr), &len);
+  ::listen(listener, 8);
+
+  auto url = "http://127.0.0.1:" + std::to_string(ntohs(addr.sin_port));
+  auto relay = storage::relay(origin(url), dir,
+                              storage::relay::DEFAULT_CAPACITY, 200ms);
+  auto err = std::error_code();
+  auto start = std::chrono::steady_clock::now();
+  auto file = relay.open_read("vmlinuz", err);
+  ASSERT_FALSE(err);
+  ASSERT_TRUE(file);
+
+  auto buf = std::array<char, 16>();
+  EXPECT_TRUE(file->busy(err));
+  EXPECT_FALSE(err);
+  EXPECT_EQ(file->read(buf, err), 0);
+  EXPECT_EQ(err, std::errc::operation_would_block);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, 100ms);
+
+  // The stalled download times out and is reported through busy().
+  EXPECT_TRUE(wait_for([&] { return !file->busy(err); }));
+  EXPECT_EQ(err, std::errc::timed_out);
+  ::close(listener);
+}
+
+TEST_F(TestRelayStorage, EvictsLeastRecentlyUsedFiles)
+{
+  auto upstream = origin_server(SOCK_STREAM);
+  for (auto name : {"/a", "/b", "/c"})
+    upstream.files[name] = std::string(1000, name[1]);
+
+  auto relay = storage::relay(origin(upstream.url()), dir, 2500);
+  auto err = std::error_code();
+  for (auto name : {"a", "b", "c"})
+  {
+    read_all(relay, name, err);
+    ASSERT_FALSE(err);
+    ASSERT_TRUE(wait_for([&] {
+      return std::filesystem::exists(dir / name);
+    }));
+  }
+
+  EXPECT_TRUE(wait_for([&] { return relay.stats().evictions == 1; }));
+  EXPECT_FALSE(std::filesystem::exists(dir / "a"));
+  EXPECT_EQ(relay.bytes(), 2000);
+
+  relay.stat("b", err);
+  EXPECT_FALSE(err);
+  relay.stat("a", err);
+  EXPECT_EQ(err, std::errc::no_such_file_or_directory);
+}
+// NOLINTEND
@@ -0,0 +1,194 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+// NOLINTBEGIN
+#include "tftp/memory.hpp"
+#include "tftp/templates.hpp"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+using namespace tftp;
+
+static auto read_all(storage::file &file) -> std::string
+{
+  auto err = std::error_code();
+  auto contents = std::string();
+  auto buf = std::array<char, 7>();
+  while (auto len = file.read(buf, err))
+    contents.append(buf.data(), len);
+  EXPECT_FALSE(err);
+  return contents;
+}
+
+TEST(TestTemplates, RendersTemplates)
+{
+  auto files = templates::registry();
+  auto err = std::error_code();
+  files.add_template(R"(pxelinux\.cfg/01-([0-9a-f-]+))",
+                     "DEFAULT linux\n"
+                     "APPEND initrd=initrd.img ip={ip} BOOTIF=01-$1\n",
+                     err);
+  ASSERT_FALSE(err);
+
+  auto who = rewrite::client{.ip = "192.0.2.10"};
+  auto file = files.open("pxelinux.cfg/01-aa-bb-cc-dd-ee-ff", who);
+  ASSERT_TRUE(file);
+  EXPECT_EQ(read_all(*file), "DEFAULT linux\n"
+                             "APPEND initrd=initrd.img ip=192.0.2.10 "
+                             "BOOTIF=01-aa-bb-cc-dd-ee-ff\n");
+
+  EXPECT_FALSE(files.open("pxelinux.cfg/default", who));
+}
+
+TEST(TestTemplates, MemoizesRenderedFiles)
+{
+  auto files = templates::registry();
+  auto err = std::error_code();
+  files.add_template("hosts/(.*)", "host $1\n", err);
+  files.add_template("ip", "{ip}\n", err);
+
+  auto alice = rewrite::client{.ip = "192.0.2.10"};
+  auto bob = rewrite::client{.ip = "192.0.2.11"};
+  read_all(*files.open("hosts/a", alice));
+  read_all(*files.open("hosts/a", bob));
+  EXPECT_EQ(files.stats().renders, 1);
+  EXPECT_EQ(files.stats().hits, 1);
+
+  // Templates that use the client address are memoized per client.
+  EXPECT_EQ(read_all(*files.open("ip", alice)), "192.0.2.10\n");
+  EXPECT_EQ(read_all(*files.open("ip", bob)), "192.0.2.11\n");
+  EXPECT_EQ(files.stats().renders, 3);
+
+  files.clear();
+  read_all(*files.open("hosts/a", alice));
+  EXPECT_EQ(files.stats().renders, 4);
+}
+
+TEST(TestTemplates, ShrinksTheMemo)
+{
+  auto files = templates::registry();
+  auto err = std::error_code();
+  files.add_template("hosts/(.*)", "host $1\n", err);
+
+  auto who = rewrite::client{};
+  read_all(*files.open("hosts/a", who));
+  read_all(*files.open("hosts/bb", who));
+  EXPECT_EQ(files.bytes(), 15);
+
+  // The least recently used file goes first.
+  EXPECT_EQ(files.shrink(1), 7);
+  EXPECT_EQ(files.bytes(), 8);
+  read_all(*files.open("hosts/bb", who));
+  EXPECT_EQ(files.stats().hits, 1);
+
+  // Nothing is memoized without room for it.
+  auto governor = std::make_shared<memory::governor>(0);
+  auto previous = memory::install(governor);
+  read_all(*files.open("hosts/a", who));
+  memory::install(std::move(previous));
+  EXPECT_EQ(files.bytes(), 8);
+  EXPECT_EQ(governor->stats().declined, 1);
+}
+
+TEST(TestTemplates, RendersLazily)
+{
+  auto files = templates::registry();
+  auto err = std::error_code();
+  auto pulled = std::make_shared<int>(0);
+  files.add(
+      "big",
+      [pulled](templates::context) -> detail::generator<std::string_view> {
+        static const auto block = std::string(512, 'x');
+        for (int i = 0; i < 100; ++i)
+        {
+          ++*pulled;
+          co_yield std::string_view(block);
+        }
+      },
+      err);
+  ASSERT_FALSE(err);
+
+  auto file = files.open("big", {});
+  auto buf = std::array<char, 512>();
+  EXPECT_EQ(file->read(buf, err), 512);
+  EXPECT_EQ(*pulled, 1);
+  EXPECT_EQ(file->size(), 512);
+
+  // Abandoned renders are not memoized.
+  file.reset();
+  file = files.open("big", {});
+  EXPECT_EQ(read_all(*file).size(), 51200);
+  EXPECT_EQ(files.stats().renders, 2);
+  EXPECT_EQ(file->size(), 51200);
+}
+
+TEST(TestTemplates, OpensTheFirstMatchAmongThousands)
+{
+  auto dir = std::filesystem::temp_directory_path() / "tftp_templates_many";
+  std::filesystem::create_directories(dir);
+  std::ofstream(dir / "host.tmpl") << "host $1\n";
+  std::ofstream(dir / "node.tmpl") << "node $1\n";
+  std::ofstream(dir / "fallback.tmpl") << "fallback $1\n";
+  {
+    auto list = std::ofstream(dir / "templates");
+    list << "hosts/(.*) host.tmpl\n";
+    for (int i = 0; i < 3000; ++i)
+      list << ".*/node-(" << i << ")\\.cfg node.tmpl\n";
+    list << "(.*) fallback.tmpl\n";
+  }
+
+  auto err = std::error_code();
+  auto files = templates::registry::load(dir / "templates", err);
+  ASSERT_TRUE(files);
+  EXPECT_EQ(read_all(*files->open("hosts/node-7.cfg", {})),
+            "host node-7.cfg\n");
+  EXPECT_EQ(read_all(*files->open("menus/node-2999.cfg", {})),
+            "node 2999\n");
+  EXPECT_EQ(read_all(*files->open("menus/node-3000.cfg", {})),
+            "fallback menus/node-3000.cfg\n");
+  std::filesystem::remove_all(dir);
+}
+
+TEST(TestTemplates, LoadsTemplateFiles)
+{
+  auto dir = std::filesystem::temp_directory_path() / "tftp_templates";
+  std::filesystem::create_directories(dir);
+  std::ofstream(dir / "menu.tmpl") << "menu for $1\n";
+  std::ofstream(dir / "templates") << "# virtual files\n"
+                                   << R"(menus/(\w+)\.cfg menu.tmpl)" << "\n";
+
+  auto err = std::error_code();
+  auto files = templates::registry::load(dir / "templates", err);
+  ASSERT_TRUE(files);
+  EXPECT_EQ(files->size(), 1);
+  EXPECT_EQ(read_all(*files->open("menus/rescue.cfg", {})),
+            "menu for rescue\n");
+
+  std::ofstream(dir / "templates") << "pattern-only\n";
+  auto line = std::size_t{0};
+  EXPECT_FALSE(templates::registry::load(dir / "templates", err, &line));
+  EXPECT_EQ(line, 1);
+
+  std::ofstream(dir / "templates") << "x missing.tmpl\n";
+  EXPECT_FALSE(templates::registry::load(dir / "templates", err));
+  EXPECT_EQ(err, std::errc::no_such_file_or_directory);
+  std::filesystem::remove_all(dir);
+}
+// NOLINTEND
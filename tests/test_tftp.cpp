@@ -18,15 +18,71 @@
 #include "tftp/filesystem.hpp"
 #include "tftp/protocol/tftp_protocol.hpp"
 #include "tftp/protocol/tftp_session.hpp"
+#include "tftp/sink.hpp"
+#include "tftp/storage/storage.hpp"
+#include "tftp/templates.hpp"
 #include "tftp/tftp.hpp"
 
+#include <atomic>
 #include <cstdlib>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <gtest/gtest.h>
+#include <thread>
+
+#ifdef TFTP_ENABLE_ZSTD
+#include <chrono>
+#include <iostream>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <zstd.h>
+#endif
 
 using namespace tftp;
 
+// Counts global allocations while counting is enabled.
+static std::atomic<bool> counting_allocations{false};
+static std::atomic<std::size_t> allocations{0};
+
+auto operator new(std::size_t size) -> void *
+{
+  if (counting_allocations.load(std::memory_order_relaxed))
+    allocations.fetch_add(1, std::memory_order_relaxed);
+
+  if (auto *ptr = std::malloc(size ? size : 1))
+    return ptr;
+
+  throw std::bad_alloc();
+}
+
+auto operator delete(void *ptr) noexcept -> void { std::free(ptr); }
+
+auto operator delete(void *ptr, std::size_t) noexcept -> void
+{
+  std::free(ptr);
+}
+
+/** @brief Counts the allocations made while it is alive. */
+class allocation_counter {
+public:
+  allocation_counter() noexcept
+  {
+    allocations = 0;
+    counting_allocations = true;
+  }
+  allocation_counter(const allocation_counter &) = delete;
+  auto operator=(const allocation_counter &) -> allocation_counter & = delete;
+  ~allocation_counter() { counting_allocations = false; }
+
+  [[nodiscard]] auto count() const noexcept -> std::size_t
+  {
+    return allocations;
+  }
+};
+
 class TestTftp : public ::testing::Test {
 protected:
   sessions_t sessions;
@@ -49,19 +105,14 @@ protected:
     // Clean up any files created during tests
     for (auto &[addr, sess] : sessions)
     {
-      if (sess.state.file)
-      {
-        sess.state.file->close();
-      }
-      if (!sess.state.tmp.empty() && std::filesystem::exists(sess.state.tmp))
-      {
-        std::filesystem::remove(sess.state.tmp);
-      }
-      if (!sess.state.target.empty() &&
-          std::filesystem::exists(sess.state.target))
+      if (sess.state.transfer->file)
       {
-        std::filesystem::remove(sess.state.target);
+        // Closing discards any uncommitted temporary file.
+        sess.state.transfer->file->close();
       }
+      const auto &target = sess.state.transfer->target;
+      if (target && std::filesystem::exists(*target))
+        std::filesystem::remove(*target);
     }
     sessions.clear();
   }
@@ -159,15 +210,34 @@ TEST_F(TestTftp, HandleRequest_RrqSuccessWithOctetMode)
   EXPECT_EQ(result, 0);
   EXPECT_EQ(siter->second.state.opc, RRQ);
   EXPECT_EQ(siter->second.state.mode, OCTET);
-  EXPECT_EQ(siter->second.state.target, test_file);
-  EXPECT_TRUE(siter->second.state.file);
-  EXPECT_TRUE(siter->second.state.file->is_open());
-  EXPECT_GT(siter->second.state.buffer.size(), sizeof(messages::data));
+  EXPECT_EQ(*siter->second.state.transfer->target, test_file);
+  EXPECT_TRUE(siter->second.state.transfer->file);
+  EXPECT_TRUE(siter->second.state.transfer->file->is_open());
+  EXPECT_GT(siter->second.state.transfer->buffer.size(),
+            sizeof(messages::data));
   EXPECT_EQ(siter->second.state.block_num, 1);
 
   std::filesystem::remove(test_file);
 }
 
+TEST_F(TestTftp, HandleRequest_SharesTargetPath)
+{
+  const auto test_file = create_test_file("hello world");
+  auto first = create_session();
+  auto second = create_session();
+
+  request req{.opc = RRQ, .mode = OCTET, .filename = test_file.c_str()};
+
+  EXPECT_EQ(handle_request(req, first), 0);
+  EXPECT_EQ(handle_request(req, second), 0);
+  EXPECT_EQ(first->second.state.transfer->target.get(),
+            second->second.state.transfer->target.get());
+  EXPECT_EQ(alignof(session::state_t), session::CACHE_LINE_SIZE);
+  EXPECT_EQ(sizeof(session::state_t), session::CACHE_LINE_SIZE);
+
+  std::filesystem::remove(test_file);
+}
+
 TEST_F(TestTftp, HandleRequest_RrqSuccessWithNetasciiMode)
 {
   const auto test_file = create_test_file("test\ndata");
@@ -180,7 +250,7 @@ TEST_F(TestTftp, HandleRequest_RrqSuccessWithNetasciiMode)
   EXPECT_EQ(result, 0);
   EXPECT_EQ(siter->second.state.opc, RRQ);
   EXPECT_EQ(siter->second.state.mode, NETASCII);
-  EXPECT_TRUE(siter->second.state.file);
+  EXPECT_TRUE(siter->second.state.transfer->file);
 
   std::filesystem::remove(test_file);
 }
@@ -198,9 +268,9 @@ TEST_F(TestTftp, HandleRequest_WrqSuccessWithOctetMode)
   EXPECT_EQ(result, 0);
   EXPECT_EQ(siter->second.state.opc, WRQ);
   EXPECT_EQ(siter->second.state.mode, OCTET);
-  EXPECT_EQ(siter->second.state.target, target_file);
-  EXPECT_TRUE(siter->second.state.file);
-  EXPECT_TRUE(siter->second.state.file->is_open());
+  EXPECT_EQ(*siter->second.state.transfer->target, target_file);
+  EXPECT_TRUE(siter->second.state.transfer->file);
+  EXPECT_TRUE(siter->second.state.transfer->file->is_open());
   EXPECT_EQ(siter->second.state.block_num, 0);
 
   std::filesystem::remove(target_file);
@@ -224,9 +294,9 @@ TEST_F(TestTftp, HandleRequest_WrqWithMailMode)
   {
     EXPECT_EQ(siter->second.state.opc, WRQ);
     EXPECT_EQ(siter->second.state.mode, MAIL);
-    EXPECT_TRUE(siter->second.state.target.string().find(username) !=
-                std::string::npos);
-    EXPECT_TRUE(siter->second.state.file);
+    EXPECT_TRUE(siter->second.state.transfer->target->string().find(
+                    username) != std::string::npos);
+    EXPECT_TRUE(siter->second.state.transfer->file);
   }
 }
 
@@ -272,7 +342,7 @@ TEST_F(TestTftp, HandleAck_SendsNextBlockWhenBufferFull)
   handle_request(req, siter);
 
   // Buffer should be full after first request
-  ASSERT_GE(siter->second.state.buffer.size(), DATAMSG_MAXLEN);
+  ASSERT_GE(siter->second.state.transfer->buffer.size(), DATAMSG_MAXLEN);
   const auto initial_block = siter->second.state.block_num;
 
   ack ack_msg{.opc = htons(ACK), .block_num = htons(initial_block)};
@@ -295,7 +365,7 @@ TEST_F(TestTftp, HandleAck_ClosesFileWhenTransferComplete)
   handle_request(req, siter);
 
   // Buffer should be less than full for short file
-  ASSERT_LT(siter->second.state.buffer.size(), DATAMSG_MAXLEN);
+  ASSERT_LT(siter->second.state.transfer->buffer.size(), DATAMSG_MAXLEN);
   const auto final_block = siter->second.state.block_num;
 
   ack ack_msg{.opc = htons(ACK), .block_num = htons(final_block)};
@@ -303,7 +373,7 @@ TEST_F(TestTftp, HandleAck_ClosesFileWhenTransferComplete)
   const auto result = handle_ack(ack_msg, siter);
 
   EXPECT_EQ(result, 0);
-  EXPECT_FALSE(siter->second.state.file->is_open());
+  EXPECT_FALSE(siter->second.state.transfer->file->is_open());
 
   std::filesystem::remove(test_file);
 }
@@ -341,7 +411,7 @@ TEST_F(TestTftp, HandleAck_HandlesBlockNumberWrapAround)
 
   // Simulate wraparound by setting block_num to max value
   siter->second.state.block_num = 0xFFFF;
-  siter->second.state.buffer.resize(DATAMSG_MAXLEN);
+  siter->second.state.transfer->buffer.resize(DATAMSG_MAXLEN);
 
   ack ack_msg{.opc = htons(ACK), .block_num = htons(0xFFFF)};
 
@@ -353,6 +423,594 @@ TEST_F(TestTftp, HandleAck_HandlesBlockNumberWrapAround)
   std::filesystem::remove(test_file);
 }
 
+// Acks DATA blocks until the transfer completes or stop blocks are received.
+static auto receive(iterator_t siter, std::size_t stop = SIZE_MAX)
+    -> std::string
+{
+  auto &state = siter->second.state;
+  auto received = std::string();
+  for (std::size_t count = 0; count < stop; ++count)
+  {
+    const auto &buffer = state.transfer->buffer;
+    received.append(buffer.begin() + sizeof(data), buffer.end());
+    if (buffer.size() < DATAMSG_MAXLEN)
+      break;
+
+    ack ack_msg{.opc = htons(ACK), .block_num = htons(state.block_num)};
+    EXPECT_EQ(handle_ack(ack_msg, siter), 0);
+  }
+  return received;
+}
+
+/** @brief Serves files that arrive only when the test says so. */
+struct arriving_backend : storage::backend {
+  struct arriving_file : storage::file {
+    explicit arriving_file(arriving_backend &owner) : owner(owner) {}
+
+    auto read_at(std::uint64_t offset, std::span<char> buf,
+                 std::error_code &err) -> std::size_t override
+    {
+      err.clear();
+      if (!owner.arrived)
+      {
+        err = std::make_error_code(std::errc::operation_would_block);
+        return 0;
+      }
+
+      auto rest = std::string_view(owner.contents).substr(
+          std::min<std::size_t>(offset, owner.contents.size()));
+      auto len = std::min(buf.size(), rest.size());
+      std::memcpy(buf.data(), rest.data(), len);
+      return len;
+    }
+    auto append(std::span<const char>, std::error_code &) -> void override {}
+    auto commit(std::error_code &) -> void override {}
+    auto close() noexcept -> void override { open = false; }
+    auto is_open() const noexcept -> bool override { return open; }
+    auto size() const noexcept -> std::uint64_t override
+    {
+      return owner.contents.size();
+    }
+    auto busy(std::error_code &err) -> bool override
+    {
+      err = owner.failure;
+      return !owner.arrived && !err;
+    }
+    auto complete() const noexcept -> bool override { return owner.arrived; }
+
+    arriving_backend &owner;
+    bool open{true};
+  };
+
+  auto open_read(const std::filesystem::path &, std::error_code &err)
+      -> std::shared_ptr<storage::file> override
+  {
+    err.clear();
+    return std::make_shared<arriving_file>(*this);
+  }
+  auto open_write(const std::filesystem::path &, std::error_code &err)
+      -> std::shared_ptr<storage::file> override
+  {
+    err = std::make_error_code(std::errc::permission_denied);
+    return {};
+  }
+  auto stat(const std::filesystem::path &, std::error_code &err)
+      -> storage::file_status override
+  {
+    err = std::make_error_code(std::errc::no_such_file_or_directory);
+    return {};
+  }
+
+  std::string contents;
+  bool arrived{false};
+  std::error_code failure;
+};
+
+TEST_F(TestTftp, HandleRequest_WaitsForArrivingFiles)
+{
+  auto backend = std::make_shared<arriving_backend>();
+  backend->contents = std::string(600, 'r');
+  auto previous = storage::install(backend);
+  auto siter = create_session();
+  auto &state = siter->second.state;
+
+  request req{.opc = RRQ, .mode = OCTET, .filename = "relayed"};
+  ASSERT_EQ(handle_request(req, siter), 0);
+  EXPECT_TRUE(state.transfer->buffer.empty());
+
+  auto error = std::uint16_t{0};
+  EXPECT_TRUE(read_pending(siter, error));
+  EXPECT_EQ(error, 0);
+
+  // The first block is sent on an ACK of block 0 once the file is there.
+  backend->arrived = true;
+  EXPECT_FALSE(read_pending(siter, error));
+  EXPECT_EQ(error, 0);
+  EXPECT_EQ(handle_ack(ack{.opc = htons(ACK), .block_num = htons(1)}, siter),
+            0);
+  EXPECT_TRUE(state.transfer->buffer.empty());
+  EXPECT_EQ(handle_ack(ack{.opc = htons(ACK), .block_num = 0}, siter), 0);
+  EXPECT_EQ(state.block_num, 1);
+  EXPECT_EQ(state.transfer->buffer.size(), DATAMSG_MAXLEN);
+
+  // A file that never arrives reports why.
+  backend->arrived = false;
+  backend->failure = std::make_error_code(std::errc::no_such_file_or_directory);
+  EXPECT_EQ(handle_request(req, create_session()), FILE_NOT_FOUND);
+
+  storage::install(previous);
+}
+
+TEST_F(TestTftp, HandleAck_ResumesInterruptedTransfer)
+{
+  auto content = std::string();
+  for (std::size_t i = 0; content.size() < 3000 * DATALEN + 100; ++i)
+    content += std::to_string(i * 7919) + ',';
+  const auto test_file = create_test_file(content);
+
+  // The first transfer dies after 1200 blocks.
+  auto siter = create_session();
+  request req{.opc = RRQ, .mode = OCTET, .filename = test_file.c_str()};
+  ASSERT_EQ(handle_request(req, siter), 0);
+  auto received = receive(siter, 1200);
+  ASSERT_EQ(received.size(), 1200 * DATALEN);
+  sessions.erase(siter);
+
+  // The client resumes after the blocks it has.
+  siter = create_session();
+  req.offset = 1200;
+  ASSERT_EQ(handle_request(req, siter), 0);
+
+  const auto &buffer = siter->second.state.transfer->buffer;
+  auto oack = std::string(buffer.begin(), buffer.end());
+  EXPECT_EQ(oack, std::string("\0\6offset\0001200\0", 14));
+  EXPECT_EQ(siter->second.state.block_num, 0);
+
+  // Stray ACKs do not start the transfer.
+  ack stray{.opc = htons(ACK), .block_num = htons(1)};
+  EXPECT_EQ(handle_ack(stray, siter), 0);
+  EXPECT_EQ(siter->second.state.block_num, 0);
+
+  ack accept{.opc = htons(ACK), .block_num = htons(0)};
+  ASSERT_EQ(handle_ack(accept, siter), 0);
+  EXPECT_EQ(siter->second.state.block_num, 1);
+
+  received += receive(siter);
+  EXPECT_EQ(received, content);
+
+  std::filesystem::remove(test_file);
+}
+
+TEST_F(TestTftp, HandleAck_ResumesNetasciiTransfer)
+{
+  auto content = std::string();
+  for (int i = 0; i < 2000; ++i)
+    content += (i % 2) ? "line\n" : "cr\rx";
+  const auto test_file = create_test_file(content);
+
+  auto siter = create_session();
+  request req{.opc = RRQ, .mode = NETASCII, .filename = test_file.c_str()};
+  ASSERT_EQ(handle_request(req, siter), 0);
+  const auto expected = receive(siter);
+  sessions.erase(siter);
+
+  siter = create_session();
+  req.offset = 17;
+  ASSERT_EQ(handle_request(req, siter), 0);
+  ack accept{.opc = htons(ACK), .block_num = htons(0)};
+  ASSERT_EQ(handle_ack(accept, siter), 0);
+  EXPECT_EQ(receive(siter), expected.substr(17 * DATALEN));
+
+  std::filesystem::remove(test_file);
+}
+
+TEST_F(TestTftp, HandleAck_DoesNotIndexVirtualFiles)
+{
+  auto content = std::string();
+  for (int i = 0; i < 2000; ++i)
+    content += (i % 2) ? "line\n" : "cr\rx";
+  const auto test_file = create_test_file(content);
+
+  // A virtual file with the same name is transcoded first.
+  auto files = std::make_shared<templates::registry>();
+  auto err = std::error_code();
+  files->add_template(".*", std::string(content.size(), '\n'), err);
+  ASSERT_FALSE(err);
+  auto previous = templates::install(files);
+  auto siter = create_session();
+  request req{.opc = RRQ, .mode = NETASCII, .filename = test_file.c_str()};
+  ASSERT_EQ(handle_request(req, siter), 0);
+  EXPECT_EQ(receive(siter).size(), 2 * content.size());
+  sessions.erase(siter);
+  templates::install(previous);
+
+  // Its checkpoints do not leak into resumes of the file on disk.
+  siter = create_session();
+  ASSERT_EQ(handle_request(req, siter), 0);
+  const auto expected = receive(siter);
+  sessions.erase(siter);
+
+  siter = create_session();
+  req.offset = 17;
+  ASSERT_EQ(handle_request(req, siter), 0);
+  ack accept{.opc = htons(ACK), .block_num = htons(0)};
+  ASSERT_EQ(handle_ack(accept, siter), 0);
+  EXPECT_EQ(receive(siter), expected.substr(17 * DATALEN));
+
+  std::filesystem::remove(test_file);
+}
+
+TEST_F(TestTftp, HandleAck_ResumesVirtualFiles)
+{
+  auto content = std::string();
+  for (std::size_t i = 0; content.size() < 3 * DATALEN + 10; ++i)
+    content += std::to_string(i) + ',';
+
+  auto files = std::make_shared<templates::registry>();
+  auto err = std::error_code();
+  files->add_template("virtual", content, err);
+  ASSERT_FALSE(err);
+  auto previous = templates::install(files);
+
+  // The file is rendered up to the offset before the transfer resumes.
+  auto siter = create_session();
+  request req{.opc = RRQ, .mode = OCTET, .filename = "virtual", .offset = 2};
+  ASSERT_EQ(handle_request(req, siter), 0);
+  ack accept{.opc = htons(ACK), .block_num = htons(0)};
+  ASSERT_EQ(handle_ack(accept, siter), 0);
+  EXPECT_EQ(receive(siter), content.substr(2 * DATALEN));
+  sessions.erase(siter);
+
+  siter = create_session();
+  req.offset = 5;
+  EXPECT_EQ(handle_request(req, siter), ILLEGAL_OPERATION);
+
+  templates::install(previous);
+}
+
+TEST_F(TestTftp, HandleRequest_RejectsOffsetPastEnd)
+{
+  const auto test_file = create_test_file(std::string(DATALEN * 2, 'X'));
+  auto siter = create_session();
+
+  // Resuming at the end sends the final empty block.
+  request req{.opc = RRQ, .mode = OCTET, .filename = test_file.c_str(),
+              .offset = 2};
+  ASSERT_EQ(handle_request(req, siter), 0);
+  ack accept{.opc = htons(ACK), .block_num = htons(0)};
+  ASSERT_EQ(handle_ack(accept, siter), 0);
+  EXPECT_EQ(siter->second.state.transfer->buffer.size(), sizeof(data));
+  sessions.erase(siter);
+
+  siter = create_session();
+  req.offset = 3;
+  EXPECT_EQ(handle_request(req, siter), ILLEGAL_OPERATION);
+  sessions.erase(siter);
+
+  siter = create_session();
+  req.offset = std::numeric_limits<std::uint64_t>::max();
+  EXPECT_EQ(handle_request(req, siter), ILLEGAL_OPERATION);
+
+  std::filesystem::remove(test_file);
+}
+
+#ifndef TFTP_ENABLE_ZSTD
+TEST_F(TestTftp, HandleRequest_IgnoresCompressWithoutZstd)
+{
+  const auto test_file = create_test_file("hello world");
+  auto siter = create_session();
+
+  // Legacy transfers are unchanged: the option is not acknowledged.
+  request req{.opc = RRQ, .mode = OCTET, .filename = test_file.c_str(),
+              .compress = true};
+  ASSERT_EQ(handle_request(req, siter), 0);
+  EXPECT_EQ(siter->second.state.block_num, 1);
+  EXPECT_EQ(receive(siter), "hello world");
+
+  std::filesystem::remove(test_file);
+}
+#else
+static auto decompress(const std::string &frame) -> std::string
+{
+  // Frames of files without a known length carry no content size, so they
+  // are decompressed as a stream.
+  auto *ctx = ZSTD_createDCtx();
+  auto text = std::string();
+  auto chunk = std::string(ZSTD_DStreamOutSize(), '\0');
+  auto in = ZSTD_inBuffer{frame.data(), frame.size(), 0};
+  while (true)
+  {
+    auto out = ZSTD_outBuffer{chunk.data(), chunk.size(), 0};
+    auto ret = ZSTD_decompressStream(ctx, &out, &in);
+    EXPECT_FALSE(ZSTD_isError(ret));
+    text.append(chunk.data(), out.pos);
+    if (ZSTD_isError(ret) || ret == 0 ||
+        (in.pos == in.size && out.pos < out.size))
+      break;
+  }
+  ZSTD_freeDCtx(ctx);
+  return text;
+}
+
+// A text artifact along the lines of a kickstart or config file.
+static auto make_config(std::size_t size) -> std::string
+{
+  auto text = std::string();
+  for (std::size_t i = 0; text.size() < size; ++i)
+  {
+    text += "host" + std::to_string(i) + " address 10.0." +
+            std::to_string(i / 256 % 256) + "." + std::to_string(i % 256) +
+            " netmask 255.255.255.0 gateway 10.0.0.1\n";
+  }
+  return text;
+}
+
+TEST_F(TestTftp, HandleAck_SendsCompressedTransfer)
+{
+  const auto content = make_config(200 * DATALEN);
+  const auto test_file = create_test_file(content);
+  auto siter = create_session();
+
+  request req{.opc = RRQ, .mode = OCTET, .filename = test_file.c_str(),
+              .compress = true};
+  ASSERT_EQ(handle_request(req, siter), 0);
+  const auto &buffer = siter->second.state.transfer->buffer;
+  EXPECT_EQ(std::string(buffer.begin(), buffer.end()),
+            std::string("\0\6compress\0zstd\0", 16));
+
+  ack accept{.opc = htons(ACK), .block_num = htons(0)};
+  ASSERT_EQ(handle_ack(accept, siter), 0);
+  auto frame = receive(siter);
+  EXPECT_LT(frame.size(), content.size() / 3);
+  EXPECT_EQ(decompress(frame), content);
+  sessions.erase(siter);
+
+  // Compressed transfers resume at an offset into the compressed stream.
+  siter = create_session();
+  req.offset = 2;
+  ASSERT_EQ(handle_request(req, siter), 0);
+  EXPECT_EQ(std::string(siter->second.state.transfer->buffer.begin(),
+                        siter->second.state.transfer->buffer.end()),
+            std::string("\0\6compress\0zstd\0offset\0002\0", 25));
+  ASSERT_EQ(handle_ack(accept, siter), 0);
+  EXPECT_EQ(receive(siter), frame.substr(2 * DATALEN));
+
+  std::filesystem::remove(test_file);
+}
+
+TEST_F(TestTftp, HandleAck_DoesNotCacheVirtualFiles)
+{
+  const auto content = make_config(20 * DATALEN);
+  const auto test_file = create_test_file(content);
+
+  // A virtual file with the same name is compressed first.
+  auto files = std::make_shared<templates::registry>();
+  auto err = std::error_code();
+  files->add_template(".*", make_config(30 * DATALEN), err);
+  ASSERT_FALSE(err);
+  auto previous = templates::install(files);
+  auto siter = create_session();
+  request req{.opc = RRQ, .mode = OCTET, .filename = test_file.c_str(),
+              .compress = true};
+  ASSERT_EQ(handle_request(req, siter), 0);
+  ack accept{.opc = htons(ACK), .block_num = htons(0)};
+  ASSERT_EQ(handle_ack(accept, siter), 0);
+  EXPECT_EQ(decompress(receive(siter)), make_config(30 * DATALEN));
+  sessions.erase(siter);
+  templates::install(previous);
+
+  // Its frame is not served for the file on disk.
+  siter = create_session();
+  ASSERT_EQ(handle_request(req, siter), 0);
+  ASSERT_EQ(handle_ack(accept, siter), 0);
+  EXPECT_EQ(decompress(receive(siter)), content);
+
+  std::filesystem::remove(test_file);
+}
+
+// Counts the bytes a transfer puts on the wire, including the IP, UDP and
+// TFTP headers of every DATA packet.
+static auto wire_bytes(std::size_t payload) -> std::size_t
+{
+  constexpr auto HEADERS = std::size_t{28} + sizeof(data);
+  return payload + (payload / DATALEN + 1) * HEADERS;
+}
+
+TEST_F(TestTftp, HandleAck_CompressedTransferSendsFewerBytes)
+{
+  const auto content = make_config(1024 * 1024);
+  const auto test_file = create_test_file(content);
+
+  request req{.opc = RRQ, .mode = OCTET, .filename = test_file.c_str()};
+  auto siter = create_session();
+  ASSERT_EQ(handle_request(req, siter), 0);
+  const auto plain = wire_bytes(receive(siter).size());
+  sessions.erase(siter);
+
+  req.compress = true;
+  siter = create_session();
+  ASSERT_EQ(handle_request(req, siter), 0);
+  ack accept{.opc = htons(ACK), .block_num = htons(0)};
+  ASSERT_EQ(handle_ack(accept, siter), 0);
+  EXPECT_LT(wire_bytes(receive(siter).size()), plain / 3);
+
+  std::filesystem::remove(test_file);
+}
+
+/** @brief The result of a transfer over a throttled link. */
+struct wire_result {
+  std::size_t bytes{0};
+  std::chrono::duration<double> elapsed{};
+  std::string received;
+};
+
+// Runs a lock-step transfer over a UDP loopback link paced at rate bytes
+// per second, counting the IP and UDP headers of every packet.
+static auto throttled_transfer(iterator_t siter, double rate) -> wire_result
+{
+  constexpr auto HEADERS = std::size_t{28};
+  using clock = std::chrono::steady_clock;
+
+  auto open_socket = [] {
+    auto fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    auto addr = sockaddr_in{.sin_family = AF_INET,
+                            .sin_addr = {.s_addr = htonl(INADDR_LOOPBACK)}};
+    ::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+    auto len = socklen_t{sizeof(addr)};
+    ::getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len);
+    ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+    return std::make_pair(fd, addr);
+  };
+  auto [server_fd, server_addr] = open_socket();
+  auto [client_fd, client_addr] = open_socket();
+  ::connect(server_fd, reinterpret_cast<sockaddr *>(&client_addr),
+            sizeof(client_addr));
+  ::connect(client_fd, reinterpret_cast<sockaddr *>(&server_addr),
+            sizeof(server_addr));
+
+  auto result = wire_result{};
+  auto start = clock::now();
+  auto next = start;
+  auto pace = [&](std::size_t len) {
+    result.bytes += len + HEADERS;
+    next += std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>((len + HEADERS) / rate));
+    std::this_thread::sleep_until(next);
+  };
+
+  auto client = std::thread([&, fd = client_fd] {
+    auto packet = std::array<char, DATAMSG_MAXLEN>();
+    while (true)
+    {
+      auto len = ::recv(fd, packet.data(), packet.size(), 0);
+      auto msg = data{};
+      std::memcpy(&msg, packet.data(), sizeof(msg));
+      auto reply = ack{.opc = htons(ACK), .block_num = 0};
+      if (ntohs(msg.opc) == DATA)
+      {
+        result.received.append(packet.data() + sizeof(msg),
+                               len - sizeof(msg));
+        reply.block_num = msg.block_num;
+      }
+      ::send(fd, &reply, sizeof(reply), 0);
+      if (ntohs(msg.opc) == DATA &&
+          static_cast<std::size_t>(len) < DATAMSG_MAXLEN)
+        break;
+    }
+  });
+
+  auto &state = siter->second.state;
+  while (true)
+  {
+    const auto &buffer = state.transfer->buffer;
+    pace(buffer.size());
+    ::send(server_fd, buffer.data(), buffer.size(), 0);
+    auto reply = ack{};
+    ::recv(server_fd, &reply, sizeof(reply), 0);
+    pace(sizeof(reply));
+
+    const auto last = ntohs(reinterpret_cast<const data *>(
+                                state.transfer->buffer.data())->opc) == DATA &&
+                      state.transfer->buffer.size() < DATAMSG_MAXLEN;
+    if (last)
+      break;
+
+    EXPECT_EQ(handle_ack(reply, siter), 0);
+  }
+
+  client.join();
+  result.elapsed = clock::now() - start;
+  ::close(server_fd);
+  ::close(client_fd);
+  return result;
+}
+
+TEST_F(TestTftp, HandleRequest_DoesNotCompressArrivingFiles)
+{
+  auto backend = std::make_shared<arriving_backend>();
+  backend->contents = make_config(40 * DATALEN);
+  auto previous = storage::install(backend);
+  auto siter = create_session();
+
+  // The compressor would read past what has arrived, so the option is not
+  // acknowledged and the file is sent as it arrives.
+  request req{.opc = RRQ, .mode = OCTET, .filename = "relayed",
+              .compress = true};
+  ASSERT_EQ(handle_request(req, siter), 0);
+  EXPECT_TRUE(siter->second.state.transfer->buffer.empty());
+
+  backend->arrived = true;
+  ASSERT_EQ(handle_ack(ack{.opc = htons(ACK), .block_num = 0}, siter), 0);
+  EXPECT_EQ(receive(siter), backend->contents);
+
+  storage::install(previous);
+}
+
+// Timed, so it only runs with --gtest_also_run_disabled_tests.
+TEST_F(TestTftp, DISABLED_Benchmark_CompressedTransferOnThrottledLink)
+{
+  // 1 MiB of text over a 4 MiB/s link.
+  constexpr auto RATE = 4.0 * 1024 * 1024;
+  const auto content = make_config(1024 * 1024);
+  const auto test_file = create_test_file(content);
+
+  request req{.opc = RRQ, .mode = OCTET, .filename = test_file.c_str()};
+  auto siter = create_session();
+  ASSERT_EQ(handle_request(req, siter), 0);
+  auto plain = throttled_transfer(siter, RATE);
+  EXPECT_EQ(plain.received, content);
+  sessions.erase(siter);
+
+  req.compress = true;
+  siter = create_session();
+  auto start = std::chrono::steady_clock::now();
+  ASSERT_EQ(handle_request(req, siter), 0);
+  auto zstd = throttled_transfer(siter, RATE);
+  auto text = decompress(zstd.received);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  EXPECT_EQ(text, content);
+  EXPECT_LT(zstd.bytes, plain.bytes / 3);
+
+  std::cout << "plain: " << plain.bytes << " bytes on the wire, "
+            << plain.elapsed.count() << " s\n"
+            << "zstd:  " << zstd.bytes << " bytes on the wire, "
+            << elapsed.count() << " s (including compression)\n";
+
+  std::filesystem::remove(test_file);
+}
+#endif // TFTP_ENABLE_ZSTD
+
+TEST(TestTftpResend, SpacesResendsByTheTimeout)
+{
+  using namespace std::chrono_literals;
+  auto state = session::state_t();
+  auto start = session::clock::now();
+  state.statistics.start_time = start;
+  state.timeout = 8ms;
+
+  // The retransmit timer ticks far more often than the timeout.
+  auto resent = session::timestamp();
+  auto resends = std::vector<session::timestamp>();
+  for (auto now = start; now < start + 50ms; now += 1ms)
+  {
+    if (resend_due(state, now, resent))
+      resends.push_back(now);
+  }
+
+  ASSERT_EQ(resends.size(), 6);
+  EXPECT_EQ(resends.front(), start + 8ms);
+  for (std::size_t i = 1; i < resends.size(); ++i)
+    EXPECT_EQ(resends[i] - resends[i - 1], 8ms);
+
+  // A new block restarts the interval.
+  state.statistics.start_time = start + 50ms;
+  EXPECT_FALSE(resend_due(state, start + 51ms, resent));
+  EXPECT_FALSE(resend_due(state, start + 57ms, resent));
+  EXPECT_TRUE(resend_due(state, start + 58ms, resent));
+  EXPECT_EQ(resent, start + 58ms);
+}
+
 // =============================================================================
 // handle_data Tests
 // =============================================================================
@@ -449,7 +1107,7 @@ TEST_F(TestTftp, HandleData_CompletesTransferOnShortPacket)
   const auto result = handle_data(data_msg, buffer.size(), siter);
 
   EXPECT_EQ(result, 0);
-  EXPECT_FALSE(siter->second.state.file->is_open());
+  EXPECT_FALSE(siter->second.state.transfer->file->is_open());
   EXPECT_TRUE(std::filesystem::exists(target_file));
 
   // Verify file content
@@ -461,6 +1119,55 @@ TEST_F(TestTftp, HandleData_CompletesTransferOnShortPacket)
   std::filesystem::remove(target_file);
 }
 
+TEST_F(TestTftp, HandleData_StreamsUploadsToSinks)
+{
+  struct collector : sink::consumer {
+    std::shared_ptr<std::string> contents;
+    std::shared_ptr<std::atomic<bool>> committed;
+    auto write(std::span<const char> buf, std::error_code &err) -> void override
+    {
+      contents->append(buf.data(), buf.size());
+    }
+    auto commit(std::error_code &err) -> void override { *committed = true; }
+  };
+
+  auto contents = std::make_shared<std::string>();
+  auto committed = std::make_shared<std::atomic<bool>>(false);
+  auto sinks = std::make_shared<sink::registry>();
+  sinks->add("/crash", [&](const auto &) {
+    auto consumer = std::make_unique<collector>();
+    consumer->contents = contents;
+    consumer->committed = committed;
+    return consumer;
+  });
+  auto previous = sink::install(sinks);
+
+  auto siter = create_session();
+  request req{.opc = WRQ, .mode = OCTET, .filename = "/crash/node1"};
+  ASSERT_EQ(handle_request(req, siter), 0);
+
+  const std::string test_data = "stack trace";
+  std::vector<char> buffer(sizeof(messages::data) + test_data.size());
+  auto *data_msg = reinterpret_cast<messages::data *>(buffer.data());
+  data_msg->opc = htons(DATA);
+  data_msg->block_num = htons(1);
+  std::memcpy(buffer.data() + sizeof(messages::data), test_data.data(),
+              test_data.size());
+
+  EXPECT_EQ(handle_data(data_msg, buffer.size(), siter), 0);
+  auto err = std::error_code();
+  auto &file = *siter->second.state.transfer->file;
+  for (int i = 0; i < 1000 && file.busy(err); ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  EXPECT_FALSE(err);
+  EXPECT_TRUE(*committed);
+  EXPECT_EQ(*contents, test_data);
+  EXPECT_FALSE(std::filesystem::exists("/crash/node1"));
+
+  sink::install(previous);
+}
+
 TEST_F(TestTftp, HandleData_HandlesFullBlockSize)
 {
   const auto target_file = filesystem::tmpname();
@@ -482,7 +1189,8 @@ TEST_F(TestTftp, HandleData_HandlesFullBlockSize)
 
   EXPECT_EQ(result, 0);
   EXPECT_EQ(siter->second.state.block_num, 1);
-  EXPECT_TRUE(siter->second.state.file->is_open()); // Should remain open
+  // Should remain open
+  EXPECT_TRUE(siter->second.state.transfer->file->is_open());
 
   std::filesystem::remove(target_file);
 }
@@ -528,7 +1236,7 @@ TEST_F(TestTftp, HandleData_HandlesMultipleBlocks)
 
   result = handle_data(data_msg3, buffer3.size(), siter);
   EXPECT_EQ(result, 0);
-  EXPECT_FALSE(siter->second.state.file->is_open());
+  EXPECT_FALSE(siter->second.state.transfer->file->is_open());
 
   // Verify file size
   EXPECT_EQ(std::filesystem::file_size(target_file), DATALEN * 2 + 10);
@@ -574,4 +1282,63 @@ TEST_F(TestTftp, HandleData_HandlesBlockNumberWrapAround)
   std::filesystem::remove(target_file);
 }
 
+// =============================================================================
+// Allocation Tests
+// =============================================================================
+TEST_F(TestTftp, SteadyStateRrqDoesNotAllocate)
+{
+  for (auto mode : {OCTET, NETASCII})
+  {
+    const auto test_file =
+        create_test_file(std::string(300 * DATALEN, 'x') + "\nend\n");
+    auto siter = create_session();
+    request req{.opc = RRQ, .mode = mode, .filename = test_file.c_str()};
+    ASSERT_EQ(handle_request(req, siter), 0);
+
+    auto &state = siter->second.state;
+    ack ack_msg{.opc = htons(ACK), .block_num = htons(state.block_num)};
+    ASSERT_EQ(handle_ack(ack_msg, siter), 0);
+    {
+      auto counter = allocation_counter();
+      for (int i = 0; i < 200; ++i)
+      {
+        ack_msg.block_num = htons(state.block_num);
+        handle_ack(ack_msg, siter);
+      }
+      EXPECT_EQ(counter.count(), 0) << "mode " << int(mode);
+    }
+    EXPECT_EQ(state.block_num, 202);
+
+    sessions.erase(siter);
+    std::filesystem::remove(test_file);
+  }
+}
+
+TEST_F(TestTftp, SteadyStateWrqDoesNotAllocate)
+{
+  const auto target_file = filesystem::tmpname();
+  std::filesystem::remove(target_file);
+  auto siter = create_session();
+  request req{.opc = WRQ, .mode = OCTET, .filename = target_file.c_str()};
+  ASSERT_EQ(handle_request(req, siter), 0);
+
+  auto buffer = std::vector<char>(sizeof(data) + DATALEN, 'w');
+  auto *msg = reinterpret_cast<data *>(buffer.data());
+  msg->opc = htons(DATA);
+  msg->block_num = htons(1);
+  ASSERT_EQ(handle_data(msg, buffer.size(), siter), 0);
+  {
+    auto counter = allocation_counter();
+    for (std::uint16_t block = 2; block < 202; ++block)
+    {
+      msg->block_num = htons(block);
+      handle_data(msg, buffer.size(), siter);
+    }
+    EXPECT_EQ(counter.count(), 0);
+  }
+  EXPECT_EQ(siter->second.state.block_num, 201);
+
+  std::filesystem::remove(target_file);
+}
+
 // NOLINTEND
@@ -33,6 +33,7 @@ TEST(TFTP_Protocol_Test, ErrStrCoverage)
   EXPECT_STREQ(errors::errstr(UNKNOWN_TID).data(), "Unknown TID.");
   EXPECT_STREQ(errors::errstr(ILLEGAL_OPERATION).data(), "Illegal operation.");
   EXPECT_STREQ(errors::errstr(TIMED_OUT).data(), "Timed out.");
+  EXPECT_STREQ(errors::errstr(BUSY).data(), "Server busy.");
   EXPECT_STREQ(errors::errstr(NOT_DEFINED).data(), "Not defined.");
   EXPECT_STREQ(errors::errstr(FILE_ALREADY_EXISTS).data(),
                "File already exists.");
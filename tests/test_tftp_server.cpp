@@ -16,10 +16,61 @@
 
 // NOLINTBEGIN
 #include "test_server_fixture.hpp"
+#include "tftp/sink.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <new>
+#include <thread>
 
 using namespace io::socket;
 using namespace net::service;
 
+// Counts the allocations of every thread but the test's own, which leaves
+// the server's.
+static std::atomic<bool> counting_allocations{false};
+static std::atomic<std::size_t> allocations{0};
+static thread_local bool test_thread = false;
+
+auto operator new(std::size_t size) -> void *
+{
+  if (!test_thread && counting_allocations.load(std::memory_order_relaxed))
+    allocations.fetch_add(1, std::memory_order_relaxed);
+
+  if (auto *ptr = std::malloc(size ? size : 1))
+    return ptr;
+
+  throw std::bad_alloc();
+}
+
+auto operator delete(void *ptr) noexcept -> void { std::free(ptr); }
+
+auto operator delete(void *ptr, std::size_t) noexcept -> void
+{
+  std::free(ptr);
+}
+
+/** @brief Counts the server's allocations while it is alive. */
+class allocation_counter {
+public:
+  allocation_counter() noexcept
+  {
+    allocations = 0;
+    counting_allocations = true;
+  }
+  allocation_counter(const allocation_counter &) = delete;
+  auto operator=(const allocation_counter &) -> allocation_counter & = delete;
+  ~allocation_counter() { counting_allocations = false; }
+
+  [[nodiscard]] auto count() const noexcept -> std::size_t
+  {
+    return allocations;
+  }
+};
+
 TEST_F(TftpdTests, TestFileNotFound)
 {
   using namespace io::socket;
@@ -63,6 +114,9 @@ TEST_F(TftpdTests, TestRRQNotPermitted)
   using namespace io::socket;
   using namespace std::filesystem;
 
+  if (memory)
+    GTEST_SKIP() << "The memory backend has no file permissions.";
+
   auto f = std::ofstream(test_file);
   f.close();
   permissions(test_file,
@@ -94,9 +148,8 @@ TEST_F(TftpdTests, TestInvalidAck)
 
   {
     auto inf = std::ifstream("/dev/random");
-    auto outf = std::ofstream(test_file);
     inf.read(test_data.data(), test_data.size());
-    outf.write(test_data.data(), test_data.size());
+    write_test_file(test_data);
   }
 
   auto sock = socket_handle(addr_v4->sin_family, SOCK_DGRAM, 0);
@@ -139,9 +192,8 @@ TEST_F(TftpdTests, TestRRQTimeout)
 
   {
     auto inf = std::ifstream("/dev/random");
-    auto outf = std::ofstream(test_file);
     inf.read(test_data.data(), test_data.size());
-    outf.write(test_data.data(), test_data.size());
+    write_test_file(test_data);
   }
 
   auto sock = socket_handle(addr_v4->sin_family, SOCK_DGRAM, 0);
@@ -205,6 +257,52 @@ TEST_F(TftpdTests, TestRRQTimeout)
   remove(test_file);
 }
 
+TEST_F(TftpdTests, TestRRQRetransmitSpacing)
+{
+  using namespace io::socket;
+  using namespace io;
+  using namespace std::chrono;
+  using clock_type = steady_clock;
+
+  write_test_file(std::vector<char>(5 * 512, 'r'));
+
+  auto sock = socket_handle(addr_v4->sin_family, SOCK_DGRAM, 0);
+  addr_v4->sin_addr.s_addr = inet_addr("127.0.0.1");
+  auto len = io::sendmsg(
+      sock, socket_message{.address = {addr_v4}, .buffers = rrq_octet}, 0);
+  ASSERT_EQ(len, rrq_octet.size());
+
+  auto recvbuf = std::vector<char>(516);
+  auto sockmsg = socket_message<sockaddr_in>{
+      .address = {socket_address<sockaddr_in>()}, .buffers = recvbuf};
+
+  // Block 1 is never acked: it is sent once and resent five times.
+  auto arrivals = std::vector<clock_type::time_point>();
+  for (int i = 0; i < 6; ++i)
+  {
+    len = recvmsg(sock, sockmsg, 0);
+    arrivals.push_back(clock_type::now());
+    auto *datamsg = reinterpret_cast<messages::data *>(recvbuf.data());
+    ASSERT_EQ(ntohs(datamsg->opc), messages::DATA);
+    ASSERT_EQ(ntohs(datamsg->block_num), 1);
+  }
+
+  len = recvmsg(sock, sockmsg, 0);
+  ASSERT_EQ(std::memcmp(recvbuf.data(), errors::timed_out().data(), len), 0);
+
+  // The timer ticks faster than the timeout, but every resend waits out a
+  // whole timeout after the one before it.
+  auto gaps = std::vector<milliseconds>();
+  for (std::size_t i = 1; i < arrivals.size(); ++i)
+    gaps.push_back(duration_cast<milliseconds>(arrivals[i] - arrivals[i - 1]));
+
+  auto longest = std::ranges::max(gaps);
+  for (auto gap : gaps)
+    EXPECT_GE(gap * 4, longest * 3) << gap.count() << " of " << longest.count();
+
+  remove(test_file);
+}
+
 TEST_F(TftpdTests, TestIllegalOp)
 {
   using namespace io::socket;
@@ -269,9 +367,8 @@ TEST_F(TftpdTests, TestDuplicateRRQ)
 
   {
     auto inf = std::ifstream("/dev/random");
-    auto outf = std::ofstream(test_file);
     inf.read(test_data.data(), test_data.size());
-    outf.write(test_data.data(), test_data.size());
+    write_test_file(test_data);
   }
 
   auto sock = socket_handle(addr_v4->sin_family, SOCK_DGRAM, 0);
@@ -316,9 +413,8 @@ TEST_P(TftpdRRQOctetTests, TestRRQ)
 
   {
     auto inf = std::ifstream("/dev/random");
-    auto outf = std::ofstream(test_file);
     inf.read(test_data.data(), test_data.size());
-    outf.write(test_data.data(), test_data.size());
+    write_test_file(test_data);
   }
 
   auto sock = socket_handle(addr_v4->sin_family, SOCK_DGRAM, 0);
@@ -356,16 +452,13 @@ TEST_P(TftpdRRQNetAsciiTests, TestNetAsciiRRQ)
 
   auto [netascii_str, linux_str] = GetParam();
 
+  for (auto it = linux_str.begin(); it != linux_str.end(); ++it)
   {
-    auto outf = std::ofstream(test_file);
-    for (auto it = linux_str.begin(); it != linux_str.end(); ++it)
-    {
-      // Randomly insert null bytes.
-      if (std::rand() < RAND_MAX / 4)
-        it = linux_str.insert(it, '\0');
-    }
-    outf.write(linux_str.data(), linux_str.size());
+    // Randomly insert null bytes.
+    if (std::rand() < RAND_MAX / 4)
+      it = linux_str.insert(it, '\0');
   }
+  write_test_file(linux_str);
 
   auto sock = socket_handle(addr_v4->sin_family, SOCK_DGRAM, 0);
   addr_v4->sin_addr.s_addr = inet_addr("127.0.0.1");
@@ -410,9 +503,8 @@ TEST_F(TftpdTests, TestWRQ)
 
   {
     auto inf = std::ifstream("/dev/random");
-    auto outf = std::ofstream(test_file);
     inf.read(test_data.data(), test_data.size());
-    outf.write(test_data.data(), test_data.size());
+    write_test_file(test_data);
   }
 
   auto sock = socket_handle(addr_v4->sin_family, SOCK_DGRAM, 0);
@@ -461,17 +553,106 @@ TEST_F(TftpdTests, TestWRQ)
   ackmsg = reinterpret_cast<messages::ack *>(ack.data());
   ASSERT_EQ(ntohs(ackmsg->block_num), 2);
 
-  auto compare_data = std::vector<char>(test_data.size());
+  auto compare_data = read_test_file();
+  ASSERT_EQ(compare_data.size(), test_data.size());
+  ASSERT_EQ(
+      std::memcmp(test_data.data(), compare_data.data(), test_data.size()), 0);
+
+  remove(test_file);
+}
+
+/** @brief A consumer that waits for a gate before taking any bytes. */
+class gated_consumer : public sink::consumer {
+public:
+  gated_consumer(std::shared_future<void> gate, std::string &received,
+                 std::mutex &mtx)
+      : gate_{std::move(gate)}, received_{received}, mtx_{mtx}
+  {}
+
+  auto write(std::span<const char> buf, std::error_code &err) -> void override
   {
-    auto inf = std::ifstream(test_file);
-    auto len = inf.readsome(compare_data.data(), compare_data.size());
-    ASSERT_EQ(len, test_data.size());
-    ASSERT_EQ(
-        std::memcmp(test_data.data(), compare_data.data(), test_data.size()),
-        0);
+    gate_.wait();
+    auto lock = std::lock_guard{mtx_};
+    received_.append(buf.data(), buf.size());
   }
 
-  remove(test_file);
+  auto commit(std::error_code &err) -> void override {}
+
+private:
+  std::shared_future<void> gate_;
+  std::string &received_;
+  std::mutex &mtx_;
+};
+
+TEST_F(TftpdTests, TestWRQSinkDelaysAcks)
+{
+  using namespace io::socket;
+  using namespace io;
+  using socket_message = socket_message<sockaddr_in6>;
+
+  auto release = std::promise<void>();
+  auto gate = release.get_future().share();
+  auto mtx = std::mutex();
+  auto received = std::string();
+  auto sinks = std::make_shared<sink::registry>();
+  sinks->add(
+      test_file,
+      [&](const auto &) {
+        return std::make_unique<gated_consumer>(gate, received, mtx);
+      },
+      0);
+  auto previous = sink::install(sinks);
+
+  auto sock = socket_handle(addr_v4->sin_family, SOCK_DGRAM, 0);
+  addr_v4->sin_addr.s_addr = inet_addr("127.0.0.1");
+  auto len = io::sendmsg(
+      sock, socket_message{.address = {addr_v4}, .buffers = wrq_octet}, 0);
+  ASSERT_EQ(len, wrq_octet.size());
+
+  auto buf = std::vector<char>(516);
+  auto sockmsg = socket_message{.address = {socket_address<sockaddr_in6>()},
+                                .buffers = buf};
+  len = recvmsg(sock, sockmsg, 0);
+  ASSERT_EQ(len, sizeof(messages::ack));
+
+  auto msg = std::vector<char>(sizeof(messages::data) + messages::DATALEN);
+  auto *data = reinterpret_cast<messages::data *>(msg.data());
+  data->opc = htons(messages::DATA);
+  data->block_num = htons(1);
+  std::fill(msg.begin() + sizeof(messages::data), msg.end(), 'S');
+  len = sendmsg(sock,
+                socket_message{.address = sockmsg.address, .buffers = msg}, 0);
+  ASSERT_EQ(len, msg.size());
+
+  // The consumer has not taken block 1, so its ACK is held back.
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  len = recvmsg(sock, sockmsg, MSG_DONTWAIT);
+  EXPECT_LT(len, 0);
+
+  // Once it catches up the ACK is sent.
+  release.set_value();
+  len = recvmsg(sock, sockmsg, 0);
+  ASSERT_EQ(len, sizeof(messages::ack));
+  auto *ackmsg = reinterpret_cast<messages::ack *>(buf.data());
+  EXPECT_EQ(ntohs(ackmsg->opc), messages::ACK);
+  EXPECT_EQ(ntohs(ackmsg->block_num), 1);
+
+  msg.resize(sizeof(messages::data) + 10);
+  data = reinterpret_cast<messages::data *>(msg.data());
+  data->block_num = htons(2);
+  len = sendmsg(sock,
+                socket_message{.address = sockmsg.address, .buffers = msg}, 0);
+  ASSERT_EQ(len, msg.size());
+  len = recvmsg(sock, sockmsg, 0);
+  ASSERT_EQ(len, sizeof(messages::ack));
+  EXPECT_EQ(ntohs(ackmsg->block_num), 2);
+
+  {
+    auto lock = std::lock_guard{mtx};
+    EXPECT_EQ(received, std::string(messages::DATALEN + 10, 'S'));
+  }
+  EXPECT_FALSE(std::filesystem::exists(test_file));
+  sink::install(previous);
 }
 
 TEST_F(TftpdTests, TestWRQDuplicateData)
@@ -485,9 +666,8 @@ TEST_F(TftpdTests, TestWRQDuplicateData)
 
   {
     auto inf = std::ifstream("/dev/random");
-    auto outf = std::ofstream(test_file);
     inf.read(test_data.data(), test_data.size());
-    outf.write(test_data.data(), test_data.size());
+    write_test_file(test_data);
   }
 
   auto sock = socket_handle(addr_v4->sin_family, SOCK_DGRAM, 0);
@@ -533,15 +713,10 @@ TEST_F(TftpdTests, TestWRQDuplicateData)
   ackmsg = reinterpret_cast<messages::ack *>(ack.data());
   ASSERT_EQ(ntohs(ackmsg->block_num), 1);
 
-  auto compare_data = std::vector<char>(test_data.size());
-  {
-    auto inf = std::ifstream(test_file);
-    auto len = inf.readsome(compare_data.data(), compare_data.size());
-    ASSERT_EQ(len, test_data.size());
-    ASSERT_EQ(
-        std::memcmp(test_data.data(), compare_data.data(), test_data.size()),
-        0);
-  }
+  auto compare_data = read_test_file();
+  ASSERT_EQ(compare_data.size(), test_data.size());
+  ASSERT_EQ(
+      std::memcmp(test_data.data(), compare_data.data(), test_data.size()), 0);
 
   remove(test_file);
 }
@@ -641,6 +816,9 @@ TEST_F(TftpdTests, TestInvalidWRQ)
 
 TEST_F(TftpdTests, TestWRQNotPermitted)
 {
+  if (memory)
+    GTEST_SKIP() << "The memory backend has no file permissions.";
+
   using namespace io::socket;
   using namespace std::filesystem;
   using namespace io;
@@ -663,6 +841,9 @@ TEST_F(TftpdTests, TestWRQNotPermitted)
 
 TEST_F(TftpdTests, TestWRQMail)
 {
+  if (memory)
+    GTEST_SKIP() << "The memory backend has no mail directories.";
+
   using namespace io::socket;
   using namespace std::filesystem;
   using namespace io;
@@ -695,10 +876,7 @@ TEST_F(TftpdTests, TestWRQUnknownTID)
   }
 
   // First, establish an RRQ session to get a valid TID
-  {
-    auto outf = std::ofstream(test_file);
-    outf.write(test_data.data(), test_data.size());
-  }
+  write_test_file(test_data);
 
   auto sock = socket_handle(addr_v4->sin_family, SOCK_DGRAM, 0);
   addr_v4->sin_addr.s_addr = inet_addr("127.0.0.1");
@@ -732,6 +910,111 @@ TEST_F(TftpdTests, TestWRQUnknownTID)
   remove(test_file);
 }
 
+TEST_F(TftpdTests, SteadyStateTransfersAllocateNoMoreThanTheReceiveLoop)
+{
+  using namespace io;
+  using namespace std::chrono_literals;
+  using enum messages::opcode_t;
+  constexpr auto PACKETS = 60;
+  test_thread = true;
+
+  // The client answers after alternating delays, so the server's RTT
+  // estimate moves by a few milliseconds on every packet.
+  auto pause = [](int i) { std::this_thread::sleep_for(i % 2 ? 20ms : 28ms); };
+
+  write_test_file(std::vector<char>(200 * messages::DATALEN, 'x'));
+  auto sock = socket_handle(addr_v4->sin_family, SOCK_DGRAM, 0);
+  addr_v4->sin_addr.s_addr = inet_addr("127.0.0.1");
+  auto len = sendmsg(
+      sock, socket_message{.address = {addr_v4}, .buffers = rrq_octet}, 0);
+  ASSERT_EQ(len, rrq_octet.size());
+
+  auto recvbuf = std::vector<char>(messages::DATAMSG_MAXLEN);
+  auto sockmsg = socket_message{.address = {socket_address<sockaddr_in6>()},
+                                .buffers = recvbuf};
+  auto *datamsg = reinterpret_cast<messages::data *>(recvbuf.data());
+  auto *ackmsg = reinterpret_cast<messages::ack *>(ack.data());
+  auto send_ack = [&] {
+    ackmsg->block_num = datamsg->block_num;
+    sendmsg(sock, socket_message{.address = sockmsg.address, .buffers = ack},
+            0);
+  };
+  auto acknowledge = [&](int i) {
+    pause(i);
+    send_ack();
+    return recvmsg(sock, sockmsg, 0);
+  };
+
+  ASSERT_EQ(recvmsg(sock, sockmsg, 0), messages::DATAMSG_MAXLEN);
+  for (int i = 0; i < PACKETS / 2; ++i)
+    ASSERT_EQ(acknowledge(i), messages::DATAMSG_MAXLEN);
+
+  // Stale ACKs are received and dropped without sending anything or
+  // touching a timer, which is what the receive loop itself costs. The
+  // ACK after them makes sure the server has read them all.
+  auto baseline = std::size_t{0};
+  {
+    auto counter = allocation_counter();
+    ackmsg->block_num = htons(ntohs(datamsg->block_num) - 1);
+    for (int i = 0; i < PACKETS; ++i)
+    {
+      sendmsg(sock,
+              socket_message{.address = sockmsg.address, .buffers = ack}, 0);
+    }
+    ASSERT_EQ(acknowledge(0), messages::DATAMSG_MAXLEN);
+    baseline = counter.count();
+  }
+
+  {
+    auto counter = allocation_counter();
+    for (int i = 0; i < PACKETS; ++i)
+      ASSERT_EQ(acknowledge(i), messages::DATAMSG_MAXLEN);
+    EXPECT_LE(counter.count(), baseline) << "RRQ";
+  }
+
+  // Finish the download, so it does not time out while the upload runs.
+  do
+  {
+    send_ack();
+  } while (recvmsg(sock, sockmsg, 0) == messages::DATAMSG_MAXLEN);
+  send_ack();
+
+  // Uploads are held to the same baseline.
+  auto upload = socket_handle(addr_v4->sin_family, SOCK_DGRAM, 0);
+  len = sendmsg(
+      upload, socket_message{.address = {addr_v4}, .buffers = wrq_octet}, 0);
+  ASSERT_EQ(len, wrq_octet.size());
+
+  auto acked = socket_message{.address = {socket_address<sockaddr_in6>()},
+                              .buffers = ack};
+  ASSERT_EQ(recvmsg(upload, acked, 0), ack.size());
+
+  auto msg = std::vector<char>(messages::DATAMSG_MAXLEN, 'w');
+  auto *data = reinterpret_cast<messages::data *>(msg.data());
+  data->opc = htons(DATA);
+  auto send_block = [&](int i) {
+    pause(i);
+    data->block_num = htons(ntohs(ackmsg->block_num) + 1);
+    sendmsg(upload, socket_message{.address = acked.address, .buffers = msg},
+            0);
+    return recvmsg(upload, acked, 0);
+  };
+
+  for (int i = 0; i < PACKETS / 2; ++i)
+    ASSERT_EQ(send_block(i), ack.size());
+
+  {
+    auto counter = allocation_counter();
+    for (int i = 0; i < PACKETS; ++i)
+      ASSERT_EQ(send_block(i), ack.size());
+    EXPECT_LE(counter.count(), baseline) << "WRQ";
+  }
+  EXPECT_EQ(ntohs(ackmsg->block_num), PACKETS / 2 + PACKETS);
+
+  test_thread = false;
+  remove(test_file);
+}
+
 INSTANTIATE_TEST_SUITE_P(TftpRRQTests, TftpdRRQOctetTests,
                          ::testing::Values(511, 512, 513, 1023, 1024, 1025));
 
@@ -112,6 +112,42 @@ TEST(TftpdStaticTests, TestParseRRQ)
   ASSERT_NE(req.mode, 0);
 }
 
+TEST(TftpdStaticTests, TestParseOptions)
+{
+  auto parse = [](std::string_view msg) {
+    auto request = std::string("\0\1file\0octet\0", 13);
+    request.append(msg);
+    return parse_request(std::span{
+        reinterpret_cast<const std::byte *>(request.data()), request.size()});
+  };
+
+  auto req = parse("");
+  EXPECT_EQ(req.mode, OCTET);
+  EXPECT_FALSE(req.offset);
+
+  req = parse(std::string_view("OFFSET\0001200\0", 12));
+  ASSERT_TRUE(req.offset);
+  EXPECT_EQ(*req.offset, 1200);
+
+  // Unknown options are skipped.
+  req = parse(std::string_view("blksize\0001428\0offset\0007\0", 23));
+  ASSERT_TRUE(req.offset);
+  EXPECT_EQ(*req.offset, 7);
+
+  req = parse(std::string_view("Compress\0ZSTD\0", 14));
+  EXPECT_TRUE(req.compress);
+  EXPECT_FALSE(parse(std::string_view("compress\0gzip\0", 14)).compress);
+
+  req = parse(std::string_view("fec\0008\0", 6));
+  EXPECT_EQ(req.fec, 8);
+  EXPECT_EQ(parse(std::string_view("fec\00070000\0", 10)).fec, 0);
+
+  // Malformed values are ignored.
+  EXPECT_FALSE(parse(std::string_view("offset\0-1\0", 10)).offset);
+  EXPECT_FALSE(parse(std::string_view("offset\0x\0", 9)).offset);
+  EXPECT_FALSE(parse(std::string_view("offset\0007", 8)).offset);
+}
+
 #undef TFTP_SERVER_STATIC_TEST
 #endif
 // NOLINTEND
@@ -0,0 +1,378 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+// NOLINTBEGIN
+#include "tftp/transform.hpp"
+#include "tftp/protocol/tftp_protocol.hpp"
+#include "tftp/storage/memory.hpp"
+
+#include <gtest/gtest.h>
+
+#ifdef TFTP_ENABLE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <cctype>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace tftp;
+
+static auto open(std::string_view text) -> std::shared_ptr<storage::file>
+{
+  return storage::memory::reader(
+      std::make_shared<const storage::memory::contents>(text.begin(),
+                                                        text.end()));
+}
+
+static auto drain(transform::pipeline &chain,
+                  std::size_t block) -> std::vector<std::string>
+{
+  auto blocks = std::vector<std::string>();
+  auto err = std::error_code();
+  auto buf = std::string(block, '\0');
+  while (true)
+  {
+    auto len = chain.fill(buf, err);
+    EXPECT_FALSE(err);
+    blocks.emplace_back(buf.data(), len);
+    if (len < block)
+      break;
+  }
+  return blocks;
+}
+
+static auto join(const std::vector<std::string> &blocks) -> std::string
+{
+  auto text = std::string();
+  for (const auto &block : blocks)
+    text += block;
+  return text;
+}
+
+TEST(TestTransform, PassesOctetThrough)
+{
+  auto text = std::string(1000, 'x');
+  auto chain = transform::make_pipeline(open(text), messages::OCTET);
+  auto blocks = drain(*chain, messages::DATALEN);
+  ASSERT_EQ(blocks.size(), 2);
+  EXPECT_EQ(blocks[0].size(), messages::DATALEN);
+  EXPECT_EQ(join(blocks), text);
+}
+
+TEST(TestTransform, EncodesNetascii)
+{
+  auto text = std::string_view("a\nb\r\nc\rd\0e\r", 12);
+  auto chain = transform::make_pipeline(open(text), messages::NETASCII);
+  EXPECT_EQ(join(drain(*chain, messages::DATALEN)),
+            std::string("a\r\nb\r\nc\r\0de\r\0", 13));
+}
+
+TEST(TestTransform, EncodesAcrossBlockBoundaries)
+{
+  // Every line ending straddles a block boundary for some block size.
+  auto text = std::string();
+  for (int i = 0; i < 200; ++i)
+    text += (i % 3 == 0) ? "line\r\n" : (i % 3 == 1) ? "bare\n" : "cr\rx";
+
+  auto expected = std::string();
+  {
+    auto chain = transform::make_pipeline(open(text), messages::NETASCII);
+    expected = join(drain(*chain, 1 << 16));
+  }
+
+  for (std::size_t block = 1; block <= 9; ++block)
+  {
+    auto chain = transform::make_pipeline(open(text), messages::NETASCII);
+    auto blocks = drain(*chain, block);
+    for (std::size_t i = 0; i + 1 < blocks.size(); ++i)
+      ASSERT_EQ(blocks[i].size(), block);
+    EXPECT_EQ(join(blocks), expected) << "block size " << block;
+  }
+
+  // A \r\n split between DATA blocks is not expanded to \r\0\r\n.
+  auto split = std::string(messages::DATALEN - 1, 'x') + "\r\n";
+  auto chain = transform::make_pipeline(open(split), messages::NETASCII);
+  auto blocks = drain(*chain, messages::DATALEN);
+  ASSERT_EQ(blocks.size(), 2);
+  EXPECT_EQ(blocks[0].back(), '\r');
+  EXPECT_EQ(blocks[1], "\n");
+}
+
+/** @brief An example stage that upper-cases its input. */
+class upper final : public transform::stage {
+public:
+  explicit upper(std::unique_ptr<transform::stage> upstream)
+      : upstream_{std::move(upstream)}
+  {}
+
+  auto pull(std::span<char> buf, std::error_code &err) -> std::size_t override
+  {
+    auto len = upstream_->pull(buf.first(std::min<std::size_t>(buf.size(), 3)),
+                               err);
+    for (auto &chr : buf.first(len))
+      chr = static_cast<char>(std::toupper(static_cast<unsigned char>(chr)));
+    return len;
+  }
+
+private:
+  std::unique_ptr<transform::stage> upstream_;
+};
+
+TEST(TestTransform, ChainsStages)
+{
+  auto chain = transform::make_pipeline(open("ab\ncd\n"), messages::NETASCII);
+  chain->push([](std::unique_ptr<transform::stage> upstream) {
+    return std::make_unique<upper>(std::move(upstream));
+  });
+
+  // Short pulls from a stage are combined into full blocks.
+  auto blocks = drain(*chain, 4);
+  ASSERT_EQ(blocks.size(), 3);
+  EXPECT_EQ(blocks[0], "AB\r\n");
+  EXPECT_EQ(join(blocks), "AB\r\nCD\r\n");
+}
+
+static auto lines(std::size_t count) -> std::string
+{
+  auto text = std::string();
+  for (std::size_t i = 0; i < count; ++i)
+    text += (i % 3 == 0) ? "line\r\n" : (i % 3 == 1) ? "bare\n" : "cr\rx";
+  return text;
+}
+
+TEST(TestTransform, IndexesNetasciiCheckpoints)
+{
+  auto text = lines(3000);
+  auto index = std::make_shared<transform::netascii_index>();
+  auto chain = transform::make_pipeline(open(text), messages::NETASCII, index);
+  auto expected = join(drain(*chain, messages::DATALEN));
+  auto stride = transform::netascii_index::STRIDE;
+  EXPECT_EQ(index->size(), (expected.size() + stride - 1) / stride);
+
+  // Draining again records nothing new.
+  auto again = transform::make_pipeline(open(text), messages::NETASCII, index);
+  EXPECT_EQ(join(drain(*again, messages::DATALEN)), expected);
+  EXPECT_EQ(index->size(), (expected.size() + stride - 1) / stride);
+}
+
+TEST(TestTransform, SeeksNetasciiBlocks)
+{
+  auto text = lines(3000);
+  auto index = std::make_shared<transform::netascii_index>();
+  auto expected = std::string();
+  {
+    auto chain =
+        transform::make_pipeline(open(text), messages::NETASCII, index);
+    expected = join(drain(*chain, messages::DATALEN));
+  }
+
+  auto blocks = expected.size() / messages::DATALEN;
+  for (auto block : {std::size_t{0}, std::size_t{1}, std::size_t{7},
+                     std::size_t{8}, std::size_t{9}, blocks / 2, blocks})
+  {
+    auto offset = block * messages::DATALEN;
+    for (auto shared : {index, std::shared_ptr<transform::netascii_index>()})
+    {
+      auto chain =
+          transform::make_pipeline(open(text), messages::NETASCII, shared);
+      auto err = std::error_code();
+      ASSERT_TRUE(chain->seek(offset, err));
+      EXPECT_FALSE(err);
+      EXPECT_EQ(join(drain(*chain, messages::DATALEN)),
+                expected.substr(offset))
+          << "block " << block;
+    }
+  }
+}
+
+TEST(TestTransform, SeeksOctet)
+{
+  auto text = lines(300);
+  auto chain = transform::make_pipeline(open(text), messages::OCTET);
+  auto err = std::error_code();
+  ASSERT_TRUE(chain->seek(messages::DATALEN, err));
+  EXPECT_EQ(join(drain(*chain, messages::DATALEN)),
+            text.substr(messages::DATALEN));
+}
+
+TEST(TestTransform, SharesIndexesByVersion)
+{
+  auto status = storage::file_status{.size = 10};
+  auto first = transform::netascii_index::shared("/shared/a", status);
+  EXPECT_EQ(transform::netascii_index::shared("/shared/a", status), first);
+  EXPECT_NE(transform::netascii_index::shared("/shared/b", status), first);
+
+  status.size = 11;
+  EXPECT_NE(transform::netascii_index::shared("/shared/a", status), first);
+}
+
+#ifdef TFTP_ENABLE_ZSTD
+// Frames of streams of unknown length do not record their content size.
+static auto decompress(const std::string &frame) -> std::string
+{
+  auto ctx = std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)>(
+      ZSTD_createDCtx(), ZSTD_freeDCtx);
+  auto in = ZSTD_inBuffer{.src = frame.data(), .size = frame.size(), .pos = 0};
+  auto chunk = std::string(ZSTD_DStreamOutSize(), '\0');
+  auto text = std::string();
+  while (true)
+  {
+    auto out = ZSTD_outBuffer{.dst = chunk.data(), .size = chunk.size(),
+                              .pos = 0};
+    auto remaining = ZSTD_decompressStream(ctx.get(), &out, &in);
+    EXPECT_FALSE(ZSTD_isError(remaining));
+    text.append(chunk.data(), out.pos);
+    if (ZSTD_isError(remaining) || remaining == 0)
+      break;
+
+    if (in.pos == in.size && out.pos == 0)
+    {
+      ADD_FAILURE() << "truncated frame";
+      break;
+    }
+  }
+  return text;
+}
+
+static auto compressed(std::string_view text, std::uint8_t mode,
+                       std::string key = {},
+                       storage::file_status status = {},
+                       std::optional<std::uint64_t> length = std::nullopt)
+    -> std::unique_ptr<transform::pipeline>
+{
+  auto chain = transform::make_pipeline(open(text), mode);
+  chain->push([&](std::unique_ptr<transform::stage> upstream) {
+    return std::make_unique<transform::compressor>(
+        std::move(upstream), std::move(key), status, length);
+  });
+  return chain;
+}
+
+/** @brief A stage that counts the bytes pulled through it. */
+class counted final : public transform::stage {
+public:
+  counted(std::unique_ptr<transform::stage> upstream, std::uint64_t &bytes)
+      : upstream_{std::move(upstream)}, bytes_{bytes}
+  {}
+
+  auto pull(std::span<char> buf, std::error_code &err) -> std::size_t override
+  {
+    auto len = upstream_->pull(buf, err);
+    bytes_ += len;
+    return len;
+  }
+
+private:
+  std::unique_ptr<transform::stage> upstream_;
+  std::uint64_t &bytes_;
+};
+
+TEST(TestTransform, CompressesStreams)
+{
+  auto text = lines(3000);
+  for (std::size_t i = 0; i < 3000; ++i)
+    text += std::to_string(i * 7919) + '\n';
+
+  auto chain = compressed(text, messages::OCTET);
+  auto frame = join(drain(*chain, messages::DATALEN));
+  EXPECT_LT(frame.size(), text.size() / 4);
+  EXPECT_EQ(decompress(frame), text);
+
+  // Compression applies to the encoded stream.
+  auto netascii = transform::make_pipeline(open(text), messages::NETASCII);
+  chain = compressed(text, messages::NETASCII);
+  EXPECT_EQ(decompress(join(drain(*chain, messages::DATALEN))),
+            join(drain(*netascii, messages::DATALEN)));
+
+  // The compressed stream can be resumed at any block.
+  chain = compressed(text, messages::OCTET);
+  auto err = std::error_code();
+  ASSERT_TRUE(chain->seek(messages::DATALEN, err));
+  EXPECT_EQ(join(drain(*chain, messages::DATALEN)),
+            frame.substr(messages::DATALEN));
+  EXPECT_FALSE(chain->seek(frame.size() + 1, err));
+  EXPECT_EQ(err, std::errc::invalid_argument);
+}
+
+TEST(TestTransform, CompressesIncrementally)
+{
+  auto text = std::string();
+  for (std::size_t i = 0; text.size() < transform::compressor::MAX_FILE_SIZE;
+       ++i)
+  {
+    text += std::to_string(i * 7919) + '\n';
+  }
+
+  auto pulled = std::uint64_t{0};
+  auto chain = transform::make_pipeline(open(text), messages::OCTET);
+  chain->push([&](std::unique_ptr<transform::stage> upstream) {
+    return std::make_unique<counted>(std::move(upstream), pulled);
+  });
+  chain->push([&](std::unique_ptr<transform::stage> upstream) {
+    return std::make_unique<transform::compressor>(
+        std::move(upstream), std::string(), storage::file_status{},
+        text.size());
+  });
+
+  // The first block only needs about a zstd block of input.
+  auto buf = std::string(messages::DATALEN, '\0');
+  auto err = std::error_code();
+  ASSERT_EQ(chain->fill(buf, err), messages::DATALEN);
+  EXPECT_LE(pulled, 2 * ZSTD_CStreamInSize());
+
+  // Blocks that were already produced are served again after a seek.
+  auto first = buf;
+  ASSERT_TRUE(chain->seek(0, err));
+  ASSERT_EQ(chain->fill(buf, err), messages::DATALEN);
+  EXPECT_EQ(buf, first);
+  EXPECT_LE(pulled, 2 * ZSTD_CStreamInSize());
+
+  auto frame = first + join(drain(*chain, messages::DATALEN));
+  EXPECT_EQ(pulled, text.size());
+  EXPECT_EQ(ZSTD_getFrameContentSize(frame.data(), frame.size()),
+            text.size());
+  EXPECT_EQ(decompress(frame), text);
+}
+
+TEST(TestTransform, CachesCompressedFrames)
+{
+  auto &stats = transform::compressor::stats();
+  auto text = lines(300);
+  auto status = storage::file_status{.size = text.size()};
+
+  auto misses = stats.misses.load();
+  auto hits = stats.hits.load();
+  auto frame = join(drain(*compressed(text, messages::OCTET, "/cached", status),
+                          messages::DATALEN));
+  EXPECT_EQ(stats.misses, misses + 1);
+
+  // The cached frame is served without reading the file.
+  auto again = join(drain(*compressed("", messages::OCTET, "/cached", status),
+                          messages::DATALEN));
+  EXPECT_EQ(again, frame);
+  EXPECT_EQ(stats.hits, hits + 1);
+
+  // A changed file is compressed again.
+  status.size += 1;
+  auto changed = join(drain(
+      *compressed(text + "x", messages::OCTET, "/cached", status),
+      messages::DATALEN));
+  EXPECT_EQ(decompress(changed), text + "x");
+  EXPECT_EQ(stats.misses, misses + 2);
+}
+#endif // TFTP_ENABLE_ZSTD
+// NOLINTEND
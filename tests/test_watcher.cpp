@@ -0,0 +1,210 @@
+/* Copyright (C) 2025 Kevin Exton (kevin.exton@pm.me)
+ *
+ * tftpd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tftpd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with tftpd.  If not, see <https://www.gnu.org/licenses/>.
+ */
+// NOLINTBEGIN
+#include "tftp/filesystem.hpp"
+#include "tftp/watcher.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+using namespace tftp;
+using namespace std::chrono_literals;
+
+class TestWatcher : public ::testing::Test {
+protected:
+  auto SetUp() -> void override
+  {
+    root = filesystem::tmpname();
+    std::filesystem::create_directories(root / "sub");
+  }
+
+  auto TearDown() -> void override { std::filesystem::remove_all(root); }
+
+  auto record(filesystem::watcher &watcher) -> void
+  {
+    watcher.subscribe([this](const std::filesystem::path &path) {
+      auto lock = std::lock_guard{mtx};
+      changed.push_back(path);
+      cv.notify_all();
+    });
+  }
+
+  auto wait_for(const std::filesystem::path &path) -> bool
+  {
+    auto lock = std::unique_lock{mtx};
+    return cv.wait_for(lock, 2s, [&] {
+      return std::ranges::find(changed, path) != changed.end();
+    });
+  }
+
+  std::filesystem::path root;
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::vector<std::filesystem::path> changed;
+};
+
+TEST_F(TestWatcher, ReportsChangesBelowTheRoot)
+{
+  auto watcher = filesystem::watcher(root);
+  record(watcher);
+  EXPECT_FALSE(watcher.degraded());
+
+  std::ofstream(root / "sub" / "file") << "data";
+  EXPECT_TRUE(wait_for(root / "sub" / "file"));
+
+  // New directories are watched as they appear.
+  std::filesystem::create_directory(root / "new");
+  ASSERT_TRUE(wait_for(root / "new"));
+  std::ofstream(root / "new" / "file") << "data";
+  EXPECT_TRUE(wait_for(root / "new" / "file"));
+
+  std::filesystem::remove(root / "sub" / "file");
+  EXPECT_GE(watcher.stats().events, 3);
+  EXPECT_GE(watcher.stats().measured, 1);
+}
+
+TEST_F(TestWatcher, CoversPathsBelowTheRoot)
+{
+  auto watcher = filesystem::watcher(root);
+  EXPECT_TRUE(watcher.covers(root));
+  EXPECT_TRUE(watcher.covers(root / "sub" / ".." / "file"));
+  EXPECT_FALSE(watcher.covers(root.parent_path()));
+  EXPECT_FALSE(watcher.covers(root.string() + "x"));
+}
+
+TEST_F(TestWatcher, FallsBackToPeriodicValidation)
+{
+  auto watcher = filesystem::watcher(root / "missing", 10ms);
+  record(watcher);
+
+  EXPECT_TRUE(watcher.degraded());
+  EXPECT_FALSE(watcher.covers(root / "missing" / "file"));
+  EXPECT_TRUE(wait_for(root / "missing"));
+}
+
+TEST_F(TestWatcher, InvalidatesSharedDescriptors)
+{
+  auto file = root / "file";
+  std::ofstream(file) << "old";
+
+  auto watcher = std::make_shared<filesystem::watcher>(root);
+  record(*watcher);
+  auto previous = filesystem::watch(watcher);
+
+  auto err = std::error_code();
+  auto handle = filesystem::open_read(file, err);
+  ASSERT_FALSE(err);
+  EXPECT_EQ(handle->size(), 3);
+
+  std::ofstream(file, std::ios::app) << "new";
+  ASSERT_TRUE(wait_for(file));
+
+  EXPECT_EQ(filesystem::open_read(file, err)->size(), 6);
+  filesystem::watch(previous);
+}
+
+TEST_F(TestWatcher, DetectsAliasedPaths)
+{
+  auto outside = filesystem::tmpname();
+  std::ofstream(outside) << "data";
+  std::ofstream(root / "file") << "data";
+  std::filesystem::create_symlink(outside, root / "symlink");
+  std::filesystem::create_hard_link(outside, root / "hardlink");
+  std::filesystem::create_directory_symlink(root / "sub", root / "dirlink");
+  std::ofstream(root / "sub" / "file") << "data";
+
+  EXPECT_FALSE(filesystem::watcher::aliased(root / "file"));
+  EXPECT_FALSE(filesystem::watcher::aliased(root / "sub" / ".." / "file"));
+  EXPECT_TRUE(filesystem::watcher::aliased(root / "symlink"));
+  EXPECT_TRUE(filesystem::watcher::aliased(root / "hardlink"));
+  EXPECT_TRUE(filesystem::watcher::aliased(root / "dirlink" / "file"));
+
+  std::filesystem::remove(outside);
+}
+
+TEST_F(TestWatcher, RevalidatesLinksOutOfTheRoot)
+{
+  auto outside = filesystem::tmpname();
+  std::ofstream(outside) << "old";
+  auto link = root / "link";
+  std::filesystem::create_symlink(outside, link);
+
+  auto watcher = std::make_shared<filesystem::watcher>(root);
+  auto previous = filesystem::watch(watcher);
+  ASSERT_TRUE(watcher->covers(link));
+
+  auto err = std::error_code();
+  auto handle = filesystem::open_read(link, err);
+  ASSERT_FALSE(err);
+  EXPECT_EQ(handle->size(), 3);
+
+  // Changes made outside the root are not reported, so the link is checked
+  // on every open.
+  std::ofstream(outside, std::ios::app) << "new";
+  EXPECT_EQ(filesystem::open_read(link, err)->size(), 6);
+
+  filesystem::watch(previous);
+  std::filesystem::remove(outside);
+}
+
+TEST(TestInvalidate, DropsDescriptorsBelowAPath)
+{
+  auto file = filesystem::tmpname();
+  std::ofstream(file) << "data";
+
+  auto err = std::error_code();
+  auto handle = filesystem::open_read(file, err);
+  ASSERT_FALSE(err);
+
+  EXPECT_EQ(filesystem::invalidate(file.string() + "x"), 0);
+  EXPECT_EQ(filesystem::invalidate(file), 1);
+  EXPECT_EQ(filesystem::invalidate(file), 0);
+
+  std::filesystem::remove(file);
+}
+
+TEST(TestInvalidate, MatchesWholePathComponents)
+{
+  auto dir = filesystem::tmpname();
+  auto sibling = std::filesystem::path(dir.string() + "-x");
+  std::filesystem::create_directories(dir);
+  std::filesystem::create_directories(sibling);
+  std::ofstream(dir / "a") << "a";
+  std::ofstream(dir / "b") << "b";
+  std::ofstream(sibling / "c") << "c";
+
+  auto err = std::error_code();
+  auto relative =
+      std::filesystem::relative(dir / "b", std::filesystem::current_path());
+  auto handles = std::array{filesystem::open_read(dir / "a", err),
+                            filesystem::open_read(relative, err),
+                            filesystem::open_read(sibling / "c", err)};
+  ASSERT_FALSE(err);
+
+  EXPECT_EQ(filesystem::invalidate(dir / ""), 2);
+  EXPECT_EQ(filesystem::invalidate(sibling), 1);
+
+  std::filesystem::remove_all(dir);
+  std::filesystem::remove_all(sibling);
+}
+// NOLINTEND